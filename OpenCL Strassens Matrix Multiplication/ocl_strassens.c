@@ -1,142 +1,743 @@
+#ifdef _MSC_VER
 #include "stdafx.h"		//auto-generated by Visual Studio
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <assert.h>
+#include <ctype.h>
+#include <stdint.h>
 #include <CL/cl.h>
+#ifdef _WIN32
+#include <direct.h>
+#define make_directory(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define make_directory(path) mkdir(path, 0777)
+#endif
+#include "ocl_strassens.h"
 
 #pragma comment(lib, "OpenCL.lib")
 
-#define MEM_SIZE (128)
 #define MAX_SOURCE_SIZE (0x100000)
+//exit status without a device to run on, the one test drivers take as skipped
+#define NO_DEVICE_STATUS 77
 #define CHECK_ERROR(ret) do { if (ret != 0) {fprintf(stderr, "line %d: error return %d\n", __LINE__, ret); exit(1);} } while (0)
+//most device buffers the pool keeps, in use or free
+#define POOL_SLOTS 64
+//subproblems of the first two recursion levels get their own queue
+#define MAX_QUEUES (7 + 7 * 7)
+#define MAX_PLATFORMS 16
+#define MAX_DEVICES 16
+//largest tile mulmat_tiled is built with; the smallest is MIN_TILE_SIZE
+#define MAX_TILE_SIZE 32
+#define MIN_TILE_SIZE 8
+//where compiled programs are kept; STRASSEN_OCL_CACHE overrides it, "off" disables the cache
+#define CACHE_DIR ".ocl_strassens_cache"
 
 /*
-	the kernels needed are stored in a char array since ocl needs to store ".cl" file as string
+	the kernels needed are stored in a char array since ocl needs to store ".cl" file as string.
+	Every kernel takes its matrices as (buffer, offset, ld) so that it can work on quadrants in
+	place; work item (j, i) computes element (i, j).
+
+	mulmat_tiled is the base case multiply: each work group computes a TILE_SIZE x TILE_SIZE block
+	of the result, staging TILE_SIZE x TILE_SIZE blocks of a and b in local memory, and each work
+	item keeps WORK_PER_ITEM results of one column in registers, rows TILE_SIZE / WORK_PER_ITEM
+	apart, so every b value it reads from local memory is used WORK_PER_ITEM times. Both are -D
+	options chosen per device by choose_tiles(). Edges are padded with zeros in the tiles.
 */
 char kernel_sources_array[] =
-"__kernel void submat(__global float *a, __global float *b, __global float *result) "
+"#ifndef TILE_SIZE\n"
+"#define TILE_SIZE 16\n"
+"#endif\n"
+"#ifndef WORK_PER_ITEM\n"
+"#define WORK_PER_ITEM 4\n"
+"#endif\n"
+"#define ROWS_PER_PASS (TILE_SIZE / WORK_PER_ITEM)\n"
+"__kernel void submat(__global const float *a, ulong a_offset, int lda, "
+"	__global const float *b, ulong b_offset, int ldb, "
+"	__global float *result, ulong result_offset, int ldr) "
+"{ "
+"	size_t j = get_global_id(0), i = get_global_id(1); "
+"	result[result_offset + i * ldr + j] = a[a_offset + i * lda + j] - b[b_offset + i * ldb + j]; "
+"} "
+"__kernel void addmat(__global const float *a, ulong a_offset, int lda, "
+"	__global const float *b, ulong b_offset, int ldb, "
+"	__global float *result, ulong result_offset, int ldr) "
+"{ "
+"	size_t j = get_global_id(0), i = get_global_id(1); "
+"	result[result_offset + i * ldr + j] = a[a_offset + i * lda + j] + b[b_offset + i * ldb + j]; "
+"} "
+"__kernel void combinemat(__global const float *a, ulong a_offset, int lda, "
+"	__global const float *b, ulong b_offset, int ldb, "
+"	__global const float *c, ulong c_offset, int ldc, "
+"	__global const float *d, ulong d_offset, int ldd, "
+"	__global float *result, ulong result_offset, int ldr) "
+"{ "
+"	size_t j = get_global_id(0), i = get_global_id(1); "
+"	result[result_offset + i * ldr + j] = a[a_offset + i * lda + j] + b[b_offset + i * ldb + j] "
+"		- c[c_offset + i * ldc + j] + d[d_offset + i * ldd + j]; "
+"} "
+"__kernel void mulmat(int k, __global const float *a, ulong a_offset, int lda, "
+"	__global const float *b, ulong b_offset, int ldb, "
+"	__global float *result, ulong result_offset, int ldr, int accumulate) "
 "{ "
-"	size_t id = get_global_id(0); "
-"	result[id] = a[id] - b[id]; "
+"	size_t j = get_global_id(0), i = get_global_id(1); "
+"	__global const float *a_row = a + a_offset + i * lda; "
+"	__global const float *b_column = b + b_offset + j; "
+"	__global float *r = result + result_offset + i * ldr + j; "
+"	float sum = accumulate ? *r : 0.0f; "
+"	for (int p = 0; p < k; p++) "
+"		sum += a_row[p] * b_column[(size_t)p * ldb]; "
+"	*r = sum; "
 "} "
-"__kernel void addmat(__global float *a, __global float *b, __global float *result) "
+"__kernel void mulmat_tiled(int m, int n, int k, __global const float *a, ulong a_offset, int lda, "
+"	__global const float *b, ulong b_offset, int ldb, "
+"	__global float *result, ulong result_offset, int ldr, int accumulate) "
 "{ "
-"	size_t id = get_global_id(0); "
-"	result[id] = a[id] + b[id]; "
+"	__local float a_tile[TILE_SIZE][TILE_SIZE]; "
+"	__local float b_tile[TILE_SIZE][TILE_SIZE]; "
+"	int col = get_local_id(0), row = get_local_id(1); "
+"	int j = get_group_id(0) * TILE_SIZE + col; "
+"	int i0 = get_group_id(1) * TILE_SIZE + row; "
+"	float sum[WORK_PER_ITEM]; "
+"	for (int w = 0; w < WORK_PER_ITEM; w++) "
+"		sum[w] = 0.0f; "
+"	for (int p0 = 0; p0 < k; p0 += TILE_SIZE) { "
+"		for (int w = 0; w < WORK_PER_ITEM; w++) { "
+"			int r = row + w * ROWS_PER_PASS; "
+"			int i = i0 + w * ROWS_PER_PASS; "
+"			a_tile[r][col] = i < m && p0 + col < k ? a[a_offset + (size_t)i * lda + p0 + col] : 0.0f; "
+"			b_tile[r][col] = p0 + r < k && j < n ? b[b_offset + (size_t)(p0 + r) * ldb + j] : 0.0f; "
+"		} "
+"		barrier(CLK_LOCAL_MEM_FENCE); "
+"		for (int p = 0; p < TILE_SIZE; p++) { "
+"			float b_value = b_tile[p][col]; "
+"			for (int w = 0; w < WORK_PER_ITEM; w++) "
+"				sum[w] += a_tile[row + w * ROWS_PER_PASS][p] * b_value; "
+"		} "
+"		barrier(CLK_LOCAL_MEM_FENCE); "
+"	} "
+"	for (int w = 0; w < WORK_PER_ITEM; w++) { "
+"		int i = i0 + w * ROWS_PER_PASS; "
+"		if (i < m && j < n) { "
+"			__global float *r = result + result_offset + (size_t)i * ldr + j; "
+"			*r = accumulate ? *r + sum[w] : sum[w]; "
+"		} "
+"	} "
 "}";
 
 //global initialization
-extern int strassen(int size);
+extern int strassen(int m, int k, int n, int verify);
+extern int benchmark(const char *shapes, int verify);
+extern int take_flag(int *argc, char **argv, const char *flag);
+extern const char * take_option(int *argc, char **argv, const char *name);
+extern void parse_shape(const char *arg, int *m, int *k, int *n);
+extern void configure_cutoff(const char *arg);
+extern void configure_parallel_depth(void);
+extern void tune_cutoff(int m, int k, int n);
 cl_kernel kernel_add=NULL; 
 cl_kernel kernel_sub=NULL;
+cl_kernel kernel_combine=NULL;
+cl_kernel kernel_multiply=NULL;
+cl_kernel kernel_multiply_tiled=NULL;
+//the -D options mulmat_tiled is built with
+int tile_size = 16;
+int work_per_item = 4;
+cl_device_id device_id = NULL;
 cl_context context = NULL;
+cl_program program = NULL;
 cl_command_queue command_queue = NULL;
-cl_mem membuf_a = NULL;
-cl_mem membuf_b = NULL;
-cl_mem membuf_result = NULL;
+cl_command_queue subproblem_queues[MAX_QUEUES];
 
-//OpenCL version of adding matrices
-void ocl_add_matrices(int size, float **ap, float **bp, float **resultp)
+/*
+	the device buffer pool. Buffers are created in size classes of 1, 1.25, 1.5 and 1.75 times
+	a power of two bytes (so at most a quarter is wasted) and go back to the pool when released,
+	for the next request of the same class to pick up without a clCreateBuffer().
+*/
+typedef struct {
+	cl_mem buffer;
+	size_t bytes;
+	int in_use;
+} pool_entry;
+pool_entry pool[POOL_SLOTS];
+
+//the smallest size class holding bytes
+static size_t size_class(size_t bytes)
 {
-	float *a = ap[0];
-	float *b = bp[0];
-	float *result = resultp[0];
-	cl_uint ret;
+	size_t power = MATRIX_ALIGNMENT;
+	while (power * 2 <= bytes)
+		power *= 2;
+	for (size_t quarter = 4; quarter <= 8; quarter++)
+		if (power / 4 * quarter >= bytes)
+			return power / 4 * quarter;
+	return power * 2;
+}
 
+//releases every free buffer in the pool back to the device
+void pool_drain(void)
+{
+	for (int i = 0; i < POOL_SLOTS; i++) {
+		if (pool[i].buffer != NULL && !pool[i].in_use) {
+			clReleaseMemObject(pool[i].buffer);
+			pool[i].buffer = NULL;
+		}
+	}
+}
 
-	size_t gws[] = { size };
-	cl_event event;
-	cl_event events[2];
-	ret = clEnqueueWriteBuffer(command_queue, membuf_a, CL_FALSE, 0,
-		size * sizeof(float), a, 0, NULL, &events[0]);
+/*
+	returns a device buffer of at least bytes, a free one of the same size class if the pool has
+	one. When the device is out of memory, the free buffers of other classes are given back and
+	the allocation is retried once. When every slot holds a buffer in use, the new one is left
+	out of the pool and pool_release() gives it back to the device.
+*/
+cl_mem pool_acquire(size_t bytes)
+{
+	size_t class_bytes = size_class(bytes > 0 ? bytes : 1);
+	int empty = -1;
+	for (int i = 0; i < POOL_SLOTS; i++) {
+		if (pool[i].buffer != NULL && !pool[i].in_use && pool[i].bytes == class_bytes) {
+			pool[i].in_use = 1;
+			return pool[i].buffer;
+		}
+		if (pool[i].buffer == NULL && empty < 0)
+			empty = i;
+	}
+	if (empty < 0) {
+		pool_drain();
+		for (int i = 0; i < POOL_SLOTS && empty < 0; i++)
+			if (pool[i].buffer == NULL)
+				empty = i;
+	}
+	cl_int ret;
+	cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, class_bytes, NULL, &ret);
+	if (ret != CL_SUCCESS) {
+		pool_drain();
+		buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, class_bytes, NULL, &ret);
+	}
 	CHECK_ERROR(ret);
-	ret = clEnqueueWriteBuffer(command_queue, membuf_b, CL_FALSE, 0,
-		size * sizeof(float), b, 0, NULL, &events[1]);
+	if (empty < 0)
+		return buffer;
+	pool[empty].buffer = buffer;
+	pool[empty].bytes = class_bytes;
+	pool[empty].in_use = 1;
+	return buffer;
+}
+
+//hands a buffer from pool_acquire() back; the device must be done with it
+void pool_release(cl_mem buffer)
+{
+	for (int i = 0; i < POOL_SLOTS; i++) {
+		if (pool[i].buffer == buffer) {
+			pool[i].in_use = 0;
+			return;
+		}
+	}
+	//acquired while the pool was full
+	clReleaseMemObject(buffer);
+}
+
+/*
+	takes the device buffers for m x k by k x n products from the pool. a, b and result are laid
+	out like the host matrices (rows matrix_stride(cols) floats apart) so each moves with a
+	single copy.
+*/
+device_product * create_device_product(int m, int k, int n, size_t workspace_elements)
+{
+	device_product *product = (device_product *)malloc(sizeof(device_product));
+	assert(product != NULL);
+	product->m = m;
+	product->k = k;
+	product->n = n;
+	product->a = pool_acquire(sizeof(float) * m * (size_t)matrix_stride(k));
+	product->b = pool_acquire(sizeof(float) * k * (size_t)matrix_stride(n));
+	product->result = pool_acquire(sizeof(float) * m * (size_t)matrix_stride(n));
+	product->workspace = pool_acquire(sizeof(float) * workspace_elements);
+	return product;
+}
+
+//returns the buffers of a product to the pool once the queue is idle
+void release_device_product(device_product *product)
+{
+	cl_int ret = clFinish(command_queue);
 	CHECK_ERROR(ret);
-	ret = clEnqueueNDRangeKernel(command_queue, kernel_add, 1, NULL, gws, NULL, 2, &events, &event);
+	pool_release(product->a);
+	pool_release(product->b);
+	pool_release(product->result);
+	pool_release(product->workspace);
+	free(product);
+}
+
+/*
+	the queue of recursion node node, numbered like a heap: the whole product is node 0 and
+	runs on command_queue, the subproblems of node x are 7x + 1 .. 7x + 7. Queues are created
+	the first time they are asked for.
+*/
+cl_command_queue subproblem_queue(int node)
+{
+	if (node == 0)
+		return command_queue;
+	assert(node <= MAX_QUEUES);
+	if (subproblem_queues[node - 1] == NULL) {
+		cl_int ret;
+		subproblem_queues[node - 1] = clCreateCommandQueue(context, device_id, 0, &ret);
+		CHECK_ERROR(ret);
+	}
+	return subproblem_queues[node - 1];
+}
+
+/*
+	makes everything enqueued from now on in each of the count queues to wait for what is
+	already enqueued in from
+*/
+void fork_queues(cl_command_queue from, cl_command_queue *to, int count)
+{
+	cl_event ready;
+	cl_int ret = clEnqueueMarkerWithWaitList(from, 0, NULL, &ready);
 	CHECK_ERROR(ret);
-	ret = clWaitForEvents(1, &event);
+	ret = clFlush(from);
 	CHECK_ERROR(ret);
-	ret = clEnqueueReadBuffer(command_queue, membuf_result, CL_TRUE, 0,
-		size * sizeof(float), result, 0, NULL, NULL);
+	for (int i = 0; i < count; i++) {
+		ret = clEnqueueBarrierWithWaitList(to[i], 1, &ready, NULL);
+		CHECK_ERROR(ret);
+	}
+	clReleaseEvent(ready);
+}
+
+/*
+	makes everything enqueued from now on in to wait for what is already enqueued in each of
+	the count queues. Those are flushed, as waiting on events of another queue requires.
+*/
+void join_queues(cl_command_queue to, cl_command_queue *from, int count)
+{
+	cl_event done[7] = { NULL };
+	assert(count <= 7);
+	for (int i = 0; i < count; i++) {
+		cl_int ret = clEnqueueMarkerWithWaitList(from[i], 0, NULL, &done[i]);
+		CHECK_ERROR(ret);
+		ret = clFlush(from[i]);
+		CHECK_ERROR(ret);
+	}
+	cl_int ret = clEnqueueBarrierWithWaitList(to, count, done, NULL);
 	CHECK_ERROR(ret);
+	for (int i = 0; i < count; i++)
+		clReleaseEvent(done[i]);
+}
 
+/*
+	enqueues the copy of a rows x cols host matrix into buffer. The host matrix is one
+	contiguous block, so this is one transfer; it does not wait, the in-order queue makes the
+	kernels that read the buffer run after it.
+*/
+void upload_matrix(cl_mem buffer, int rows, int cols, matrix_view matrix)
+{
+	size_t bytes = sizeof(float) * ((size_t)(rows - 1) * matrix.ld + cols);
+	cl_int ret = clEnqueueWriteBuffer(command_queue, buffer, CL_FALSE, 0, bytes, matrix.base, 0, NULL, NULL);
+	CHECK_ERROR(ret);
 }
-//OpenCL version of subtracting matrices
-void ocl_sub_matrices(int size, float **ap, float **bp, float **resultp)
+
+/*
+	copies buffer back into a rows x cols host matrix, waiting for everything enqueued before.
+	Only the rows are written: the elements between them may be someone else's, as in the
+	padded matrices of the library, so a matrix with gaps is read as a rectangle.
+*/
+void download_matrix(cl_mem buffer, int rows, int cols, matrix_view matrix)
 {
-	float *a = ap[0];
-	float *b = bp[0];
-	float *result = resultp[0];
-	cl_uint ret;
+	cl_int ret;
+	if (matrix.ld == cols || rows == 1) {
+		size_t bytes = sizeof(float) * ((size_t)(rows - 1) * matrix.ld + cols);
+		ret = clEnqueueReadBuffer(command_queue, buffer, CL_TRUE, 0, bytes, matrix.base, 0, NULL, NULL);
+	} else {
+		size_t origin[3] = { 0, 0, 0 };
+		size_t region[3] = { sizeof(float) * cols, rows, 1 };
+		size_t pitch = sizeof(float) * matrix.ld;
+		ret = clEnqueueReadBufferRect(command_queue, buffer, CL_TRUE, origin, origin, region, pitch, 0,
+			pitch, 0, matrix.base, 0, NULL, NULL);
+	}
+	CHECK_ERROR(ret);
+}
 
-	size_t gws[] = { size };
-	cl_event event;
-	cl_event events[2];
-	ret = clEnqueueWriteBuffer(command_queue, membuf_a, CL_FALSE, 0,
-		size * sizeof(float), a, 0, NULL, &events[0]);
+/*
+	sets kernel arguments index, index + 1 and index + 2 to the buffer, offset and leading
+	dimension of a view
+*/
+static void set_view_args(cl_kernel kernel, cl_uint index, device_view v)
+{
+	cl_ulong offset = v.offset;
+	cl_int ld = v.ld;
+	cl_int ret = clSetKernelArg(kernel, index, sizeof(cl_mem), (void *)&v.buffer);
 	CHECK_ERROR(ret);
-	ret = clEnqueueWriteBuffer(command_queue, membuf_b, CL_FALSE, 0,
-		size * sizeof(float), b, 0, NULL, &events[1]);
+	ret = clSetKernelArg(kernel, index + 1, sizeof(cl_ulong), (void *)&offset);
 	CHECK_ERROR(ret);
-	ret = clEnqueueNDRangeKernel(command_queue, kernel_sub, 1, NULL, gws, NULL, 2, &events, &event);
+	ret = clSetKernelArg(kernel, index + 2, sizeof(cl_int), (void *)&ld);
 	CHECK_ERROR(ret);
-	ret = clWaitForEvents(1, &event);
+}
+
+/*
+	enqueues kernel over a rows x cols block, one work item per element
+*/
+static void enqueue_block(cl_command_queue queue, cl_kernel kernel, int rows, int cols)
+{
+	size_t gws[] = { (size_t)cols, (size_t)rows };
+	cl_int ret = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, gws, NULL, 0, NULL, NULL);
 	CHECK_ERROR(ret);
-	ret = clEnqueueReadBuffer(command_queue, membuf_result, CL_TRUE, 0,
-		size * sizeof(float), result, 0, NULL, NULL);
+}
+
+//OpenCL version of adding matrices
+void ocl_add_matrices(cl_command_queue queue, int rows, int cols, device_view a, device_view b, device_view result)
+{
+	set_view_args(kernel_add, 0, a);
+	set_view_args(kernel_add, 3, b);
+	set_view_args(kernel_add, 6, result);
+	enqueue_block(queue, kernel_add, rows, cols);
+}
+//OpenCL version of subtracting matrices
+void ocl_sub_matrices(cl_command_queue queue, int rows, int cols, device_view a, device_view b, device_view result)
+{
+	set_view_args(kernel_sub, 0, a);
+	set_view_args(kernel_sub, 3, b);
+	set_view_args(kernel_sub, 6, result);
+	enqueue_block(queue, kernel_sub, rows, cols);
+}
+//OpenCL version of combine_matrices(): result = a + b - c + d
+void ocl_combine_matrices(cl_command_queue queue, int rows, int cols, device_view a, device_view b, device_view c,
+	device_view d, device_view result)
+{
+	set_view_args(kernel_combine, 0, a);
+	set_view_args(kernel_combine, 3, b);
+	set_view_args(kernel_combine, 6, c);
+	set_view_args(kernel_combine, 9, d);
+	set_view_args(kernel_combine, 12, result);
+	enqueue_block(queue, kernel_combine, rows, cols);
+}
+//OpenCL base case: result (+)= a * b for an m x k by k x n product
+/*
+	m x k by k x n product into result, or added to it with accumulate set. Blocks of at least a
+	tile in both m and n go to mulmat_tiled; the thin products peeling leaves would be mostly
+	padding there and take the one work item per element mulmat.
+*/
+void ocl_multiply(cl_command_queue queue, int m, int k, int n, device_view a, device_view b, device_view result,
+	int accumulate)
+{
+	if (m >= tile_size && n >= tile_size) {
+		cl_int dims[] = { m, n, k };
+		cl_int add = accumulate;
+		for (cl_uint i = 0; i < 3; i++) {
+			cl_int ret = clSetKernelArg(kernel_multiply_tiled, i, sizeof(cl_int), (void *)&dims[i]);
+			CHECK_ERROR(ret);
+		}
+		set_view_args(kernel_multiply_tiled, 3, a);
+		set_view_args(kernel_multiply_tiled, 6, b);
+		set_view_args(kernel_multiply_tiled, 9, result);
+		cl_int ret = clSetKernelArg(kernel_multiply_tiled, 12, sizeof(cl_int), (void *)&add);
+		CHECK_ERROR(ret);
+		size_t tiles_n = (n + tile_size - 1) / tile_size, tiles_m = (m + tile_size - 1) / tile_size;
+		size_t gws[] = { tiles_n * tile_size, tiles_m * (tile_size / work_per_item) };
+		size_t lws[] = { (size_t)tile_size, (size_t)(tile_size / work_per_item) };
+		ret = clEnqueueNDRangeKernel(queue, kernel_multiply_tiled, 2, NULL, gws, lws, 0, NULL, NULL);
+		CHECK_ERROR(ret);
+		return;
+	}
+	cl_int inner = k;
+	cl_int add = accumulate;
+	cl_int ret = clSetKernelArg(kernel_multiply, 0, sizeof(cl_int), (void *)&inner);
 	CHECK_ERROR(ret);
+	set_view_args(kernel_multiply, 1, a);
+	set_view_args(kernel_multiply, 4, b);
+	set_view_args(kernel_multiply, 7, result);
+	ret = clSetKernelArg(kernel_multiply, 10, sizeof(cl_int), (void *)&add);
+	CHECK_ERROR(ret);
+	enqueue_block(queue, kernel_multiply, m, n);
 }
 
-int main(int argc, char *argv[])
+/*
+	picks the mulmat_tiled tile size and work per item for device_id: 32 x 32 tiles with 8 rows per
+	work item (128 item groups) on GPUs, 16 x 16 with 4 (64 item groups) elsewhere, where groups
+	run as loops over the items and smaller tiles stay in cache. Tiles are halved until a group
+	and its two tiles fit the device. STRASSEN_OCL_TILE and STRASSEN_OCL_WORK_PER_ITEM override
+	the choice.
+*/
+static void choose_tiles(void)
 {
-	int probsize = argc > 1 ? atoi(argv[1]) : 128;
-	cl_device_id device_id = NULL;
-	cl_mem memobj = NULL;
-	cl_program program = NULL;
-	cl_kernel kernel = NULL;
-	cl_platform_id platform_id = NULL;
-	cl_uint ret_num_devices;
-	cl_uint ret_num_platforms;
-	cl_int ret;
+	cl_device_type type = 0;
+	size_t max_group = 0;
+	cl_ulong local_memory = 0;
+	clGetDeviceInfo(device_id, CL_DEVICE_TYPE, sizeof type, &type, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof max_group, &max_group, NULL);
+	clGetDeviceInfo(device_id, CL_DEVICE_LOCAL_MEM_SIZE, sizeof local_memory, &local_memory, NULL);
+	int gpu = (type & CL_DEVICE_TYPE_GPU) != 0;
+	tile_size = gpu ? 32 : 16;
+	work_per_item = gpu ? 8 : 4;
 
-	char string[MEM_SIZE];
+	const char *env = getenv("STRASSEN_OCL_TILE");
+	if (env != NULL)
+		tile_size = atoi(env);
+	env = getenv("STRASSEN_OCL_WORK_PER_ITEM");
+	if (env != NULL)
+		work_per_item = atoi(env);
+	//a power of two in range, with work_per_item dividing it
+	int size = MIN_TILE_SIZE;
+	while (size * 2 <= tile_size && size < MAX_TILE_SIZE)
+		size *= 2;
+	tile_size = size;
+	if (work_per_item < 1)
+		work_per_item = 1;
+	while (work_per_item > tile_size || tile_size % work_per_item != 0)
+		work_per_item--;
 
-	size_t num_platforms = 0;
-	/* Get Platform and Device Info */
-	ret = clGetPlatformIDs(100, NULL, &num_platforms);
-	cl_platform_id * platids = malloc(num_platforms * sizeof(cl_platform_id));
-	ret = clGetPlatformIDs(num_platforms, platids, NULL);
-	for (cl_uint i = 0; i < num_platforms; ++i)
-	{
-		char st[10240];
-		size_t sz;
-		ret = clGetPlatformInfo(platids[i], CL_PLATFORM_VENDOR, 10240, st, &sz);
-		if (strcmp(st, "NVIDIA Corporation") == 0)
-			platform_id = platids[i];
+	while (tile_size > MIN_TILE_SIZE
+		&& ((size_t)tile_size * (tile_size / work_per_item) > max_group
+		|| 2 * sizeof(float) * tile_size * tile_size > local_memory)) {
+		tile_size /= 2;
+		if (work_per_item > tile_size)
+			work_per_item = tile_size;
 	}
-	free(platids);
-	if (platform_id == NULL) abort();
+}
 
-	ret = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_DEFAULT, 1, &device_id, &ret_num_devices);
-	CHECK_ERROR(ret);
+//whether text contains part, ignoring case
+static int contains_ignoring_case(const char *text, const char *part)
+{
+	size_t length = strlen(part);
+	for (; *text != '\0'; text++) {
+		size_t i = 0;
+		while (i < length && tolower((unsigned char)text[i]) == tolower((unsigned char)part[i]))
+			i++;
+		if (i == length)
+			return 1;
+	}
+	return length == 0;
+}
 
-	/* Create OpenCL context */
-	context = clCreateContext(NULL, 1, &device_id, NULL, NULL, &ret);
-	CHECK_ERROR(ret);
+static void platform_string(cl_platform_id platform, cl_platform_info what, char *value, size_t size)
+{
+	if (clGetPlatformInfo(platform, what, size, value, NULL) != CL_SUCCESS)
+		value[0] = '\0';
+}
 
-	/* Create Command Queue */
-	command_queue = clCreateCommandQueue(context, device_id, 0, &ret);
-	CHECK_ERROR(ret);
+static void device_string(cl_device_id device, cl_device_info what, char *value, size_t size)
+{
+	if (clGetDeviceInfo(device, what, size, value, NULL) != CL_SUCCESS)
+		value[0] = '\0';
+}
 
-	char * src = malloc(10240);
-	strcpy(src, kernel_sources_array);
-	size_t szsrc = strlen(src);
-	program = clCreateProgramWithSource(context, 1, (const char **)&src, &szsrc, &ret);
-	CHECK_ERROR(ret);
+//the device type --device-type names: cpu, gpu, accelerator, all or default
+static cl_device_type parse_device_type(const char *name)
+{
+	if (name == NULL || strcmp(name, "default") == 0)
+		return CL_DEVICE_TYPE_DEFAULT;
+	if (strcmp(name, "cpu") == 0)
+		return CL_DEVICE_TYPE_CPU;
+	if (strcmp(name, "gpu") == 0)
+		return CL_DEVICE_TYPE_GPU;
+	if (strcmp(name, "accelerator") == 0)
+		return CL_DEVICE_TYPE_ACCELERATOR;
+	if (strcmp(name, "all") == 0)
+		return CL_DEVICE_TYPE_ALL;
+	fprintf(stderr, "unknown device type %s (cpu, gpu, accelerator, all or default)\n", name);
+	exit(1);
+}
 
-	/* Build Kernel Program */
-	ret = clBuildProgram(program, 1, &device_id, NULL, NULL, NULL);
+static const char * device_type_name(cl_device_type type)
+{
+	if (type & CL_DEVICE_TYPE_GPU)
+		return "GPU";
+	if (type & CL_DEVICE_TYPE_CPU)
+		return "CPU";
+	if (type & CL_DEVICE_TYPE_ACCELERATOR)
+		return "accelerator";
+	return "other";
+}
+
+/*
+	picks the device to run on. Candidates are the devices of the given type (parse_device_type())
+	on the platforms matching platform_selector, either a platform index or part of the vendor or
+	platform name, or all platforms if it is NULL. Without a selector NVIDIA platforms come first,
+	as they always have. device_selector indexes the candidates in that order, 0 by default.
+	Returns NULL if there is no such device. With list set every candidate is printed instead
+	and NULL returned.
+*/
+static cl_device_id select_device(const char *platform_selector, const char *type_name,
+	const char *device_selector, int list)
+{
+	cl_platform_id platforms[MAX_PLATFORMS];
+	cl_uint num_platforms = 0;
+	//without any platform the ICD loader fails with CL_PLATFORM_NOT_FOUND_KHR, which is no device too
+	if (clGetPlatformIDs(MAX_PLATFORMS, platforms, &num_platforms) != CL_SUCCESS)
+		num_platforms = 0;
+	if (num_platforms > MAX_PLATFORMS)
+		num_platforms = MAX_PLATFORMS;
+
+	cl_device_type type = parse_device_type(type_name);
+	int wanted = device_selector != NULL ? atoi(device_selector) : 0;
+	int candidate = 0;
+	char vendor[256], name[256], device_name[256];
+	//pass 0 takes the NVIDIA platforms, pass 1 the rest
+	for (int pass = 0; pass < 2; pass++) {
+		for (cl_uint p = 0; p < num_platforms; p++) {
+			platform_string(platforms[p], CL_PLATFORM_VENDOR, vendor, sizeof vendor);
+			platform_string(platforms[p], CL_PLATFORM_NAME, name, sizeof name);
+			int nvidia = strcmp(vendor, "NVIDIA Corporation") == 0;
+			if (platform_selector == NULL ? nvidia != (pass == 0) : pass == 1)
+				continue;
+			if (platform_selector != NULL) {
+				char *end;
+				long index = strtol(platform_selector, &end, 10);
+				if (*end == '\0' ? index != (long)p : !contains_ignoring_case(vendor, platform_selector)
+					&& !contains_ignoring_case(name, platform_selector))
+					continue;
+			}
+			cl_device_id devices[MAX_DEVICES];
+			cl_uint num_devices = 0;
+			if (clGetDeviceIDs(platforms[p], type, MAX_DEVICES, devices, &num_devices) != CL_SUCCESS)
+				continue;
+			if (num_devices > MAX_DEVICES)
+				num_devices = MAX_DEVICES;
+			for (cl_uint d = 0; d < num_devices; d++, candidate++) {
+				cl_device_type device_type = 0;
+				clGetDeviceInfo(devices[d], CL_DEVICE_TYPE, sizeof device_type, &device_type, NULL);
+				device_string(devices[d], CL_DEVICE_NAME, device_name, sizeof device_name);
+				if (list) {
+					printf("device %d: %s [%s] on platform %u: %s (%s)\n", candidate, device_name,
+						device_type_name(device_type), p, name, vendor);
+				} else if (candidate == wanted) {
+					fprintf(stderr, "using %s [%s] on %s (%s)\n", device_name,
+						device_type_name(device_type), name, vendor);
+					return devices[d];
+				}
+			}
+		}
+	}
+	if (list && candidate == 0)
+		printf("no OpenCL devices\n");
+	if (!list)
+		fprintf(stderr, "no OpenCL device %d of type %s on platform %s\n", wanted,
+			type_name != NULL ? type_name : "default", platform_selector != NULL ? platform_selector : "any");
+	return NULL;
+}
+
+//FNV-1a, continuing from hash
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t length)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+/*
+	writes the cache file name of a program built from source with options for device_id into
+	path. The name hashes the source and options with the device, its OpenCL and driver versions
+	and the platform, so a driver update or another device never picks up a stale binary.
+	Returns 0 if the cache is turned off.
+*/
+static int cache_path(char *path, size_t size, const char *source, const char *options)
+{
+	const char *dir = getenv("STRASSEN_OCL_CACHE");
+	if (dir == NULL)
+		dir = CACHE_DIR;
+	if (*dir == '\0' || strcmp(dir, "off") == 0)
+		return 0;
+
+	char info[1024];
+	cl_platform_id platform = NULL;
+	uint64_t hash = 14695981039346656037ull;
+	hash = hash_bytes(hash, source, strlen(source) + 1);
+	hash = hash_bytes(hash, options, strlen(options) + 1);
+	static const cl_device_info device_keys[] = { CL_DEVICE_NAME, CL_DEVICE_VENDOR, CL_DEVICE_VERSION,
+		CL_DRIVER_VERSION };
+	for (size_t i = 0; i < sizeof device_keys / sizeof device_keys[0]; i++) {
+		device_string(device_id, device_keys[i], info, sizeof info);
+		hash = hash_bytes(hash, info, strlen(info) + 1);
+	}
+	clGetDeviceInfo(device_id, CL_DEVICE_PLATFORM, sizeof platform, &platform, NULL);
+	platform_string(platform, CL_PLATFORM_NAME, info, sizeof info);
+	hash = hash_bytes(hash, info, strlen(info) + 1);
+	platform_string(platform, CL_PLATFORM_VERSION, info, sizeof info);
+	hash = hash_bytes(hash, info, strlen(info) + 1);
+
+	make_directory(dir);
+	snprintf(path, size, "%s/%016llx.bin", dir, (unsigned long long)hash);
+	return 1;
+}
+
+//the program in a cache file, built, or NULL if there is none or the device rejects it
+static cl_program load_cached_program(const char *path, const char *options)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	long length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	unsigned char *binary = length > 0 ? (unsigned char *)malloc(length) : NULL;
+	size_t binary_size = binary != NULL ? fread(binary, 1, length, f) : 0;
+	fclose(f);
+	if (binary_size == 0 || binary_size != (size_t)length) {
+		free(binary);
+		return NULL;
+	}
+
+	cl_int status, ret;
+	const unsigned char *binaries[] = { binary };
+	cl_program program = clCreateProgramWithBinary(context, 1, &device_id, &binary_size, binaries,
+		&status, &ret);
+	free(binary);
+	if (ret != CL_SUCCESS || status != CL_SUCCESS)
+		return NULL;
+	if (clBuildProgram(program, 1, &device_id, options, NULL, NULL) != CL_SUCCESS) {
+		clReleaseProgram(program);
+		return NULL;
+	}
+	return program;
+}
+
+/*
+	stores the device binary of a built program. It goes to a temporary file renamed into
+	place, so a concurrent run never reads half a binary.
+*/
+static void store_program(cl_program program, const char *path)
+{
+	size_t binary_size = 0;
+	cl_int ret = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof binary_size, &binary_size, NULL);
+	if (ret != CL_SUCCESS || binary_size == 0)
+		return;
+	unsigned char *binary = (unsigned char *)malloc(binary_size);
+	unsigned char *binaries[] = { binary };
+	ret = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof binaries, binaries, NULL);
+	char temporary[1100];
+	snprintf(temporary, sizeof temporary, "%s.tmp", path);
+	FILE *f = ret == CL_SUCCESS ? fopen(temporary, "wb") : NULL;
+	if (f != NULL) {
+		int written = fwrite(binary, 1, binary_size, f) == binary_size;
+		if (fclose(f) == 0 && written) {
+			remove(path);
+			rename(temporary, path);
+		}
+		remove(temporary);
+	}
+	free(binary);
+}
+
+/*
+	builds source with options for device_id, or loads it from the binary cache when it was built
+	for this device before, so a cold start skips the compile. Exits with the build log when the
+	source doesn't build.
+*/
+cl_program build_program(const char *source, const char *options)
+{
+	char path[1024];
+	int cached = cache_path(path, sizeof path, source, options);
+	cl_program program = cached ? load_cached_program(path, options) : NULL;
+	if (program != NULL)
+		return program;
+
+	cl_int ret;
+	size_t length = strlen(source);
+	program = clCreateProgramWithSource(context, 1, &source, &length, &ret);
+	CHECK_ERROR(ret);
+	ret = clBuildProgram(program, 1, &device_id, options, NULL, NULL);
 	if (ret != 0)
 	{
 		char log[10240];
@@ -144,59 +745,137 @@ int main(int argc, char *argv[])
 		printf("Log: %s\n", log);
 		exit(1);
 	}
+	if (cached)
+		store_program(program, path);
+	return program;
+}
+
+/*
+	sets up the device the selectors pick (see select_device(); NULL takes the STRASSEN_OCL_PLATFORM,
+	STRASSEN_OCL_DEVICE_TYPE and STRASSEN_OCL_DEVICE environment variables instead) with its
+	context, queue and kernels. Returns 0, or -1 if there is no such device. Does nothing if a
+	device is set up already.
+*/
+int ocl_initialize(const char *platform_selector, const char *device_type, const char *device_selector)
+{
+	cl_int ret;
+	if (device_id != NULL)
+		return 0;
+	if (platform_selector == NULL)
+		platform_selector = getenv("STRASSEN_OCL_PLATFORM");
+	if (device_type == NULL)
+		device_type = getenv("STRASSEN_OCL_DEVICE_TYPE");
+	if (device_selector == NULL)
+		device_selector = getenv("STRASSEN_OCL_DEVICE");
+	device_id = select_device(platform_selector, device_type, device_selector, 0);
+	if (device_id == NULL)
+		return -1;
+
+	/* Create OpenCL context */
+	context = clCreateContext(NULL, 1, &device_id, NULL, NULL, &ret);
+	CHECK_ERROR(ret);
 
+	/* Create Command Queue */
+	command_queue = clCreateCommandQueue(context, device_id, 0, &ret);
 	CHECK_ERROR(ret);
 
+	/* Build Kernel Program */
+	choose_tiles();
+	char options[128];
+	snprintf(options, sizeof options, "-DTILE_SIZE=%d -DWORK_PER_ITEM=%d", tile_size, work_per_item);
+	program = build_program(kernel_sources_array, options);
+
 	/* Create OpenCL Kernel */
 	kernel_add = clCreateKernel(program, "addmat", &ret);
 	CHECK_ERROR(ret);
 	kernel_sub = clCreateKernel(program, "submat", &ret);
 	CHECK_ERROR(ret);
-	
-	/* Create OpenCL Buffers */
-	membuf_a = clCreateBuffer(context, CL_MEM_READ_WRITE, 1024 * sizeof(float), NULL, &ret);
+	kernel_combine = clCreateKernel(program, "combinemat", &ret);
 	CHECK_ERROR(ret);
-	membuf_b = clCreateBuffer(context, CL_MEM_READ_WRITE, 1024 * sizeof(float), NULL, &ret);
+	kernel_multiply = clCreateKernel(program, "mulmat", &ret);
 	CHECK_ERROR(ret);
-	membuf_result = clCreateBuffer(context, CL_MEM_READ_WRITE, 1024 * sizeof(float), NULL, &ret);
+	kernel_multiply_tiled = clCreateKernel(program, "mulmat_tiled", &ret);
 	CHECK_ERROR(ret);
+	return 0;
+}
 
-	ret = clSetKernelArg(kernel_add, 0, sizeof(cl_mem), (void *)&membuf_a);
-	CHECK_ERROR(ret);
-	ret = clSetKernelArg(kernel_add, 1, sizeof(cl_mem), (void *)&membuf_b);
-	CHECK_ERROR(ret);
-	ret = clSetKernelArg(kernel_add, 2, sizeof(cl_mem), (void *)&membuf_result);
-	CHECK_ERROR(ret);
-	ret = clSetKernelArg(kernel_sub, 0, sizeof(cl_mem), (void *)&membuf_a);
-	CHECK_ERROR(ret);
-	ret = clSetKernelArg(kernel_sub, 1, sizeof(cl_mem), (void *)&membuf_b);
-	CHECK_ERROR(ret);
-	ret = clSetKernelArg(kernel_sub, 2, sizeof(cl_mem), (void *)&membuf_result);
-	CHECK_ERROR(ret);
-
-	strassen(probsize);
-
+//waits for the device and releases everything ocl_initialize() and the buffer pool hold
+void ocl_release(void)
+{
+	if (device_id == NULL)
+		return;
 	/* Final clearing and flushing */
-	ret = clFlush(command_queue);
+	cl_int ret = clFlush(command_queue);
 	CHECK_ERROR(ret);
 	ret = clFinish(command_queue);
 	CHECK_ERROR(ret);
+	for (int i = 0; i < MAX_QUEUES; i++) {
+		if (subproblem_queues[i] != NULL) {
+			clReleaseCommandQueue(subproblem_queues[i]);
+			subproblem_queues[i] = NULL;
+		}
+	}
+	pool_drain();
 	ret = clReleaseKernel(kernel_add);
 	CHECK_ERROR(ret);
 	ret = clReleaseKernel(kernel_sub);
 	CHECK_ERROR(ret);
-	ret = clReleaseProgram(program);
+	ret = clReleaseKernel(kernel_combine);
 	CHECK_ERROR(ret);
-	ret = clReleaseMemObject(membuf_a);
+	ret = clReleaseKernel(kernel_multiply);
 	CHECK_ERROR(ret);
-	ret = clReleaseMemObject(membuf_b);
+	ret = clReleaseKernel(kernel_multiply_tiled);
 	CHECK_ERROR(ret);
-	ret = clReleaseMemObject(membuf_result);
+	ret = clReleaseProgram(program);
 	CHECK_ERROR(ret);
 	ret = clReleaseCommandQueue(command_queue);
 	CHECK_ERROR(ret);
 	ret = clReleaseContext(context);
 	CHECK_ERROR(ret);
-	
-	return 0;
+	command_queue = NULL;
+	context = NULL;
+	device_id = NULL;
+}
+
+//the library takes the engine without the program around it
+#ifndef STRASSEN_LIBRARY
+int main(int argc, char *argv[])
+{
+	int verify = take_flag(&argc, argv, "--verify");
+	int m = 128, k = 128, n = 128;
+	int failed = 0;
+	const char *platform_selector = take_option(&argc, argv, "--platform");
+	const char *device_type = take_option(&argc, argv, "--device-type");
+	const char *device_selector = take_option(&argc, argv, "--device");
+	int list = take_flag(&argc, argv, "--list-devices");
+	if (argc > 1)
+		parse_shape(argv[1], &m, &k, &n);
+
+	/* Get Platform and Device Info; the environment stands in for missing flags */
+	if (list) {
+		select_device(platform_selector != NULL ? platform_selector : getenv("STRASSEN_OCL_PLATFORM"),
+			device_type != NULL ? device_type : getenv("STRASSEN_OCL_DEVICE_TYPE"),
+			device_selector != NULL ? device_selector : getenv("STRASSEN_OCL_DEVICE"), 1);
+		return 0;
+	}
+	if (ocl_initialize(platform_selector, device_type, device_selector) != 0)
+		return NO_DEVICE_STATUS;
+
+	configure_parallel_depth();
+	//usage: ocl_strassens [--verify] [size | MxKxN] [cutoff | tune]
+	//       ocl_strassens [--verify] size[,size...] bench
+	if (argc > 2 && strcmp(argv[2], "tune") == 0) {
+		tune_cutoff(m, k, n);
+		failed = strassen(m, k, n, verify);
+	} else if (argc > 2 && strcmp(argv[2], "bench") == 0) {
+		configure_cutoff(NULL);
+		failed = benchmark(argv[1], verify);
+	} else {
+		configure_cutoff(argc > 2 ? argv[2] : NULL);
+		failed = strassen(m, k, n, verify);
+	}
+
+	ocl_release();
+	return failed;
 }
+#endif
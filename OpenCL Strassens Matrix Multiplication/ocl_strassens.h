@@ -0,0 +1,64 @@
+/* ocl_strassens.h
+	Device side of the OpenCL Strassen program. The operands, the result
+	and the recursion workspace stay in device buffers for a whole product;
+	blocks of them are addressed by offset and leading dimension, and every
+	add, subtract, combine and base case multiply is a kernel on an in-order
+	queue, so nothing waits on the host until the result is read back. The
+	subproblems of the top recursion levels get queues of their own, ordered
+	against their parent's by fork_queues() and join_queues(), so the device
+	can run them concurrently. Buffers come from a pool of size classes and
+	are reused across products.
+*/
+#ifndef OCL_STRASSENS_H
+#define OCL_STRASSENS_H
+
+#include <CL/cl.h>
+#include "../common/matrix.h"
+
+// the kernels and buffer sizes are written for float
+#if STRASSEN_ELEMENT != ELEMENT_FLOAT
+#error "the OpenCL program is built for float elements only"
+#endif
+
+/* A block of a row-major matrix in a device buffer: element (i, j) is
+* element offset + i * ld + j of buffer. The device counterpart of
+* matrix_view.
+*/
+typedef struct {
+	cl_mem buffer;
+	size_t offset;
+	int ld;
+} device_view;
+
+/* Device buffers for m x k by k x n products: a, b and result with the
+* same row strides as the host matrices, and the recursion workspace.
+*/
+typedef struct {
+	int m, k, n;
+	cl_mem a, b, result, workspace;
+} device_product;
+
+int ocl_initialize(const char *platform_selector, const char *device_type, const char *device_selector);
+void ocl_release(void);
+
+cl_mem pool_acquire(size_t bytes);
+void pool_release(cl_mem buffer);
+void pool_drain(void);
+
+device_product * create_device_product(int m, int k, int n, size_t workspace_elements);
+void release_device_product(device_product *product);
+void upload_matrix(cl_mem buffer, int rows, int cols, matrix_view matrix);
+void download_matrix(cl_mem buffer, int rows, int cols, matrix_view matrix);
+
+cl_command_queue subproblem_queue(int node);
+void fork_queues(cl_command_queue from, cl_command_queue *to, int count);
+void join_queues(cl_command_queue to, cl_command_queue *from, int count);
+
+void ocl_add_matrices(cl_command_queue queue, int rows, int cols, device_view a, device_view b, device_view result);
+void ocl_sub_matrices(cl_command_queue queue, int rows, int cols, device_view a, device_view b, device_view result);
+void ocl_combine_matrices(cl_command_queue queue, int rows, int cols, device_view a, device_view b, device_view c,
+	device_view d, device_view result);
+void ocl_multiply(cl_command_queue queue, int m, int k, int n, device_view a, device_view b, device_view result,
+	int accumulate);
+
+#endif
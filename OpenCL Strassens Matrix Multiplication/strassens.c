@@ -4,217 +4,536 @@
 	of the strassen's algorithm
 */
 
+#ifdef _MSC_VER
 #include "stdafx.h"
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
-#include <time.h>
-#include <windows.h>
+#include "../common/matrix.h"
+#include "../common/bench.h"
+#include "../common/verify.h"
+#include "ocl_strassens.h"
 #define ONESHOT 1
 
-typedef float matrix_type;
-#define FORMAT "%f\t"
+/* Recursion cutoff used unless the command line, STRASSEN_CUTOFF or a
+* stored tuning result says otherwise.
+*/
+#define DEFAULT_CUTOFF 64
+/* Where "tune" stores the measured cutoff; STRASSEN_TUNE_FILE overrides it.
+*/
+#define TUNE_FILE ".ocl_strassens_cutoff"
+#define TUNE_REPEATS 3
+/* Recursion levels whose seven subproblems run on queues of their own,
+* unless STRASSEN_PARALLEL_DEPTH says otherwise. subproblem_queue() has
+* queues for two levels.
+*/
+#define DEFAULT_PARALLEL_DEPTH 1
+#define MAX_PARALLEL_DEPTH 2
 
-void ocl_add_matrices(int size, float **ap, float **bp, float **resultp);
-void ocl_sub_matrices(int size, float **ap, float **bp, float **resultp);
-#if 1
-	#define add_matrices ocl_add_matrices
-	#define subtract_matrices ocl_sub_matrices
-#endif
+/* Blocks with any dimension of this size or smaller are multiplied by
+* the mulmat kernel instead of being split further.
+*/
+int strassen_cutoff = DEFAULT_CUTOFF;
+int parallel_depth = DEFAULT_PARALLEL_DEPTH;
 
-/*
-allocate_matrix() is a function to allocate the matrix onto heap storage
-the matrix is an array of pointers that each have an array of pointers
+/* Number of elements of device workspace strassens_multiplication() needs for an
+* m x k by k x n product starting at recursion level depth. Each level takes
+* m1..m7 (m/2 x n/2). A parallel level also takes five temporaries each for
+* sums of a blocks (m/2 x k/2) and of b blocks (k/2 x n/2), so subproblems on
+* different queues never share one, and gives each of its seven subproblems
+* its own region; a sequential level needs one temporary of each shape and
+* its subproblems reuse one region. Blocks are rounded up to whole cache
+* lines; odd sizes are peeled, so the halves round down.
 */
-matrix_type ** allocate_matrix(int size)
+size_t strassen_workspace_size(int m, int k, int n, int depth)
 {
-	matrix_type **matrix_rows = (matrix_type**)malloc(sizeof(matrix_type *) * size);
-	matrix_type * full_data = (matrix_type *)malloc(sizeof(matrix_type) * size * size);
-	assert(full_data != NULL);
-	for (int i = 0; i < size; ++i)
-	{
-		matrix_rows[i] = full_data + i * size;
-	}
-	return matrix_rows;
+	if (m <= strassen_cutoff || k <= strassen_cutoff || n <= strassen_cutoff)
+		return 0;
+	m /= 2;
+	k /= 2;
+	n /= 2;
+	int parallel = depth < parallel_depth;
+	return 7 * aligned_elements((size_t)m * n)
+		+ (parallel ? 5 : 1) * (aligned_elements((size_t)m * k) + aligned_elements((size_t)k * n))
+		+ (parallel ? 7 : 1) * strassen_workspace_size(m, k, n, depth + 1);
 }
 
-/*
-deallocate_matrix() is a function which deallocates a matrix once it's use is over
+/* Peak workspace, in bytes, of an m x k by k x n product. This is all the
+* memory the recursion uses besides a, b and result.
 */
+size_t strassen_workspace_bytes(int m, int k, int n)
+{
+	return sizeof(matrix_type) * strassen_workspace_size(m, k, n, 0);
+}
 
-void deallocate_matrix(matrix_type ** m, int size)
+/* The block of v starting at row, col; the device counterpart of sub_view().
+*/
+device_view device_sub_view(device_view v, int row, int col)
 {
-		free(m[0]);
-		free(m);
+	device_view block = { v.buffer, v.offset + (size_t)row * v.ld + col, v.ld };
+	return block;
 }
 
-/* Takes a pointer to a 2-dimensional array matrix_type matrix and
-* fills it with random numbers.
+/* Quadrant (row, col) of v, with block_rows x block_cols blocks.
 */
-void fill_matrix(int size, matrix_type **matrix)
+device_view device_quadrant(device_view v, int block_rows, int block_cols, int row, int col)
 {
-	for (int i = 0; i < size; i++) {
-		for (int j = 0; j < size; j++) {
-			matrix[i][j] = rand() % 100;
-		}
-	}
+	return device_sub_view(v, row * block_rows, col * block_cols);
 }
 
-/* Iterative matrix multiplication. The naive implementation.
+/* Takes the next rows x cols block off the front of a device workspace,
+* packed and rounded up to whole cache lines like take_block().
 */
-void naive_matrix_multiplication(int size, matrix_type **a, matrix_type **b, matrix_type **result)
+device_view take_device_block(device_view *workspace, int rows, int cols)
 {
-	for (int i = 0; i < size; i++) {
-		for (int j = 0; j < size; j++) {
-			result[i][j] = 0;
-			for (int k = 0; k < size; k++) {
-				result[i][j] += a[i][k] * b[k][j];
-			}
-		}
+	device_view block = { workspace->buffer, workspace->offset, cols };
+	workspace->offset += aligned_elements((size_t)rows * cols);
+	return block;
+}
+
+/* Everything the seven products and four result quadrants of one level of
+* the recursion work on. node numbers the level for subproblem_queue().
+*/
+typedef struct {
+	int m2, k2, n2;
+	int depth, node, parallel;
+	device_view a11, a12, a21, a22;
+	device_view b11, b12, b21, b22;
+	device_view c11, c12, c21, c22;
+	//m1..m7
+	device_view products[7];
+	//operand temporaries; all five of a shape are the same block on a
+	//sequential level
+	device_view sum_a[5];
+	device_view sum_b[5];
+	//product i recurses into child_workspace + i * child_size
+	device_view child_workspace;
+	size_t child_size;
+} strassen_level;
+
+void strassens_multiplication(int m, int k, int n, device_view a, device_view b,
+	device_view result, device_view workspace, int depth, int node);
+
+/* Recursion node of product i of a level: a node of its own below a parallel
+* level, the level's node otherwise.
+*/
+int product_node(const strassen_level *l, int i)
+{
+	return l->parallel ? 7 * l->node + 1 + i : l->node;
+}
+
+/* Enqueues Strassen's product m(i+1) of a level on the queue of its node: forms
+* its operand sums in the level's temporaries and multiplies them recursively.
+*/
+void compute_product(const strassen_level *l, int i)
+{
+	int m2 = l->m2, k2 = l->k2, n2 = l->n2;
+	int node = product_node(l, i);
+	cl_command_queue queue = subproblem_queue(node);
+	device_view workspace = l->child_workspace;
+	workspace.offset += i * l->child_size;
+	switch (i) {
+	// m1 = (a11 + a22)(b11 + b22)
+	case 0:
+		ocl_add_matrices(queue, m2, k2, l->a11, l->a22, l->sum_a[0]);
+		ocl_add_matrices(queue, k2, n2, l->b11, l->b22, l->sum_b[0]);
+		strassens_multiplication(m2, k2, n2, l->sum_a[0], l->sum_b[0], l->products[0],
+			workspace, l->depth + 1, node);
+		break;
+	// m2 = (a21 + a22) b11
+	case 1:
+		ocl_add_matrices(queue, m2, k2, l->a21, l->a22, l->sum_a[1]);
+		strassens_multiplication(m2, k2, n2, l->sum_a[1], l->b11, l->products[1],
+			workspace, l->depth + 1, node);
+		break;
+	// m3 = a11 (b12 - b22)
+	case 2:
+		ocl_sub_matrices(queue, k2, n2, l->b12, l->b22, l->sum_b[1]);
+		strassens_multiplication(m2, k2, n2, l->a11, l->sum_b[1], l->products[2],
+			workspace, l->depth + 1, node);
+		break;
+	// m4 = a22 (b21 - b11)
+	case 3:
+		ocl_sub_matrices(queue, k2, n2, l->b21, l->b11, l->sum_b[2]);
+		strassens_multiplication(m2, k2, n2, l->a22, l->sum_b[2], l->products[3],
+			workspace, l->depth + 1, node);
+		break;
+	// m5 = (a11 + a12) b22
+	case 4:
+		ocl_add_matrices(queue, m2, k2, l->a11, l->a12, l->sum_a[2]);
+		strassens_multiplication(m2, k2, n2, l->sum_a[2], l->b22, l->products[4],
+			workspace, l->depth + 1, node);
+		break;
+	// m6 = (a21 - a11)(b11 + b12)
+	case 5:
+		ocl_sub_matrices(queue, m2, k2, l->a21, l->a11, l->sum_a[3]);
+		ocl_add_matrices(queue, k2, n2, l->b11, l->b12, l->sum_b[3]);
+		strassens_multiplication(m2, k2, n2, l->sum_a[3], l->sum_b[3], l->products[5],
+			workspace, l->depth + 1, node);
+		break;
+	// m7 = (a12 - a22)(b21 + b22)
+	case 6:
+		ocl_sub_matrices(queue, m2, k2, l->a12, l->a22, l->sum_a[4]);
+		ocl_add_matrices(queue, k2, n2, l->b21, l->b22, l->sum_b[4]);
+		strassens_multiplication(m2, k2, n2, l->sum_a[4], l->sum_b[4], l->products[6],
+			workspace, l->depth + 1, node);
+		break;
 	}
 }
 
 /* Implementation of Strassen's recursive matrix multiplication
-* algorithm.
+* algorithm for an m x k matrix a and a k x n matrix b, all in device
+* memory. The quadrants of a, b and result are addressed in place; result
+* must not overlap a or b. workspace must hold at least
+* strassen_workspace_size(m, k, n, depth) elements. Everything is enqueued
+* on the queue of recursion node node; nothing is read back and the host
+* never waits.
+*
+* On the first parallel_depth levels the seven products are forked onto
+* queues of their own, which wait for what node's queue has enqueued so far,
+* and joined back before the result quadrants are combined, so the device
+* may run independent subproblems at the same time.
+*
+* Odd dimensions are handled by dynamic peeling: Strassen runs on the
+* even-sized leading part and the last row, column and inner index are
+* fixed up with the mulmat kernel, which costs O(mk + kn +
+* mn) rather than padding to the next power of two.
 */
-void strassens_multiplication(int size, matrix_type **a, matrix_type **b, matrix_type **result)
+void strassens_multiplication(int m, int k, int n, device_view a, device_view b,
+	device_view result, device_view workspace, int depth, int node)
 {
-	if (size <= 2)
+	cl_command_queue queue = subproblem_queue(node);
+	if (m <= strassen_cutoff || k <= strassen_cutoff || n <= strassen_cutoff) 
 	{
-		naive_matrix_multiplication(size, a, b, result);
+		ocl_multiply(queue, m, k, n, a, b, result, 0);
+		return;
 	}
-	else
-	{
-		int block_size = size / 2;
-
-		//allocate memory to all matrices
-		matrix_type ** m1 = allocate_matrix(block_size);
-		matrix_type ** m2 = allocate_matrix(block_size);
-		matrix_type ** m3 = allocate_matrix(block_size);
-		matrix_type ** m4 = allocate_matrix(block_size);
-		matrix_type ** m5 = allocate_matrix(block_size);
-		matrix_type ** m6 = allocate_matrix(block_size);
-		matrix_type ** m7 = allocate_matrix(block_size);
-		matrix_type ** a11 = allocate_matrix(block_size);
-		matrix_type ** a12 = allocate_matrix(block_size);
-		matrix_type ** a21 = allocate_matrix(block_size);
-		matrix_type ** a22 = allocate_matrix(block_size);
-		matrix_type ** b11 = allocate_matrix(block_size);
-		matrix_type ** b12 = allocate_matrix(block_size);
-		matrix_type ** b21 = allocate_matrix(block_size);
-		matrix_type ** b22 = allocate_matrix(block_size);
-		matrix_type ** add_result1 = allocate_matrix(size);
-		matrix_type ** add_result2 = allocate_matrix(size);
-		matrix_type ** subtract_result = allocate_matrix(size);
-
-		for (int i = 0; i < block_size; i++) {
-			for (int j = 0; j < block_size; j++) {
-				a11[i][j] = a[i][j];
-				a12[i][j] = a[i][j + block_size];
-				a21[i][j] = a[i + block_size][j];
-				a22[i][j] = a[i + block_size][j + block_size];
-				b11[i][j] = b[i][j];
-				b12[i][j] = b[i][j + block_size];
-				b21[i][j] = b[i + block_size][j];
-				b22[i][j] = b[i + block_size][j + block_size];
+
+	strassen_level level;
+	strassen_level *l = &level;
+	l->m2 = m / 2;
+	l->k2 = k / 2;
+	l->n2 = n / 2;
+	l->depth = depth;
+	l->node = node;
+	l->parallel = depth < parallel_depth;
+
+	l->a11 = device_quadrant(a, l->m2, l->k2, 0, 0);
+	l->a12 = device_quadrant(a, l->m2, l->k2, 0, 1);
+	l->a21 = device_quadrant(a, l->m2, l->k2, 1, 0);
+	l->a22 = device_quadrant(a, l->m2, l->k2, 1, 1);
+	l->b11 = device_quadrant(b, l->k2, l->n2, 0, 0);
+	l->b12 = device_quadrant(b, l->k2, l->n2, 0, 1);
+	l->b21 = device_quadrant(b, l->k2, l->n2, 1, 0);
+	l->b22 = device_quadrant(b, l->k2, l->n2, 1, 1);
+	l->c11 = device_quadrant(result, l->m2, l->n2, 0, 0);
+	l->c12 = device_quadrant(result, l->m2, l->n2, 0, 1);
+	l->c21 = device_quadrant(result, l->m2, l->n2, 1, 0);
+	l->c22 = device_quadrant(result, l->m2, l->n2, 1, 1);
+
+	//the products and the operand temporaries of this level are carved
+	//off the front of the workspace, the rest goes to the recursive calls
+	for (int i = 0; i < 7; i++)
+		l->products[i] = take_device_block(&workspace, l->m2, l->n2);
+	for (int i = 0; i < 5; i++) {
+		if (i == 0 || l->parallel) {
+			l->sum_a[i] = take_device_block(&workspace, l->m2, l->k2);
+			l->sum_b[i] = take_device_block(&workspace, l->k2, l->n2);
+		} else {
+			l->sum_a[i] = l->sum_a[0];
+			l->sum_b[i] = l->sum_b[0];
+		}
+	}
+	l->child_workspace = workspace;
+	l->child_size = l->parallel ? strassen_workspace_size(l->m2, l->k2, l->n2, depth + 1) : 0;
+
+	cl_command_queue queues[7];
+	if (l->parallel) {
+		for (int i = 0; i < 7; i++)
+			queues[i] = subproblem_queue(product_node(l, i));
+		fork_queues(queue, queues, 7);
+	}
+	for (int i = 0; i < 7; i++)
+		compute_product(l, i);
+	if (l->parallel)
+		join_queues(queue, queues, 7);
+
+	device_view *p = l->products;
+	// the C blocks are written straight into the quadrants of result
+	// c11
+	ocl_combine_matrices(queue, l->m2, l->n2, p[0], p[3], p[4], p[6], l->c11);
+	// c12
+	ocl_add_matrices(queue, l->m2, l->n2, p[2], p[4], l->c12);
+	// c21
+	ocl_add_matrices(queue, l->m2, l->n2, p[1], p[3], l->c21);
+	// c22
+	ocl_combine_matrices(queue, l->m2, l->n2, p[0], p[2], p[1], p[5], l->c22);
+
+	// peel the odd edges: the last inner index is a rank-1 update of
+	// the even part, the last column and row are thin products
+	if (k % 2) {
+		ocl_multiply(queue, 2 * l->m2, 1, 2 * l->n2, device_sub_view(a, 0, k - 1),
+			device_sub_view(b, k - 1, 0), result, 1);
+	}
+	if (n % 2) {
+		ocl_multiply(queue, m, k, 1, a, device_sub_view(b, 0, n - 1),
+			device_sub_view(result, 0, n - 1), 0);
+	}
+	if (m % 2) {
+		ocl_multiply(queue, 1, k, 2 * l->n2, device_sub_view(a, m - 1, 0), b,
+			device_sub_view(result, m - 1, 0), 0);
+	}
+}
+
+/* Runs one m x k by k x n product on the device: one upload each of a and
+* b, the whole recursion on device buffers and one download of the result.
+*/
+void device_strassen(device_product *product, matrix_view a, matrix_view b, matrix_view result)
+{
+	int m = product->m, k = product->k, n = product->n;
+	device_view device_a = { product->a, 0, a.ld };
+	device_view device_b = { product->b, 0, b.ld };
+	device_view device_result = { product->result, 0, result.ld };
+	device_view workspace = { product->workspace, 0, 0 };
+
+	upload_matrix(product->a, m, k, a);
+	upload_matrix(product->b, k, n, b);
+	strassens_multiplication(m, k, n, device_a, device_b, device_result, workspace, 0, 0);
+	download_matrix(product->result, m, n, result);
+}
+
+/* Device buffers for m x k by k x n products at the current cutoff.
+*/
+device_product * allocate_device_product(int m, int k, int n)
+{
+	return create_device_product(m, k, n, strassen_workspace_size(m, k, n, 0));
+}
+
+/* Path of the file the tuned cutoff is stored in.
+*/
+const char * tune_file(void)
+{
+	const char *path = getenv("STRASSEN_TUNE_FILE");
+	return path != NULL ? path : TUNE_FILE;
+}
+
+/* Sets strassen_cutoff from, in order of precedence, the command line
+* argument (may be NULL), the STRASSEN_CUTOFF environment variable and
+* the stored tuning result. Keeps DEFAULT_CUTOFF if none is given.
+*/
+void configure_cutoff(const char *arg)
+{
+	const char *env = getenv("STRASSEN_CUTOFF");
+	if (arg != NULL) {
+		strassen_cutoff = atoi(arg);
+	} else if (env != NULL) {
+		strassen_cutoff = atoi(env);
+	} else {
+		FILE *f = fopen(tune_file(), "r");
+		if (f != NULL) {
+			if (fscanf(f, "%d", &strassen_cutoff) != 1) {
+				strassen_cutoff = DEFAULT_CUTOFF;
 			}
+			fclose(f);
 		}
+	}
+	if (strassen_cutoff < 1) {
+		strassen_cutoff = 1;
+	}
+}
+
+/* Sets parallel_depth from STRASSEN_PARALLEL_DEPTH, clamped to the levels
+* there are queues for.
+*/
+void configure_parallel_depth(void)
+{
+	const char *env = getenv("STRASSEN_PARALLEL_DEPTH");
+	if (env != NULL)
+		parallel_depth = atoi(env);
+	if (parallel_depth < 0)
+		parallel_depth = 0;
+	if (parallel_depth > MAX_PARALLEL_DEPTH)
+		parallel_depth = MAX_PARALLEL_DEPTH;
+}
 
-		// m1
-		add_matrices(block_size, a11, a22, add_result1);
-		add_matrices(block_size, b11, b22, add_result2);
-		strassens_multiplication(block_size, add_result1, add_result2, m1);
-		// m2   
-		add_matrices(block_size, a21, a22, add_result1);
-		strassens_multiplication(block_size, add_result1, b11, m2);
-		// m3
-		subtract_matrices(block_size, b12, b22, subtract_result);
-		strassens_multiplication(block_size, a11, subtract_result, m3);
-		// m4
-		subtract_matrices(block_size, b21, b11, subtract_result);
-		strassens_multiplication(block_size, a22, subtract_result, m4);
-		// m5
-		add_matrices(block_size, a11, a12, add_result1);
-		strassens_multiplication(block_size, add_result1, b22, m5);
-		// m6
-		subtract_matrices(block_size, a21, a11, subtract_result);
-		add_matrices(block_size, b11, b12, add_result1);
-		strassens_multiplication(block_size, subtract_result,
-			add_result1, m6);
-		// m7
-		subtract_matrices(block_size, a12, a22, subtract_result);
-		add_matrices(block_size, b21, b22, add_result1);
-		strassens_multiplication(block_size, subtract_result,
-			add_result1, m7);
-
-		//deallocate memory for a and b blocks
-		deallocate_matrix(a11, block_size);
-		deallocate_matrix(a12, block_size);
-		deallocate_matrix(a21, block_size);
-		deallocate_matrix(a22, block_size);
-		deallocate_matrix(b11, block_size);
-		deallocate_matrix(b12, block_size);
-		deallocate_matrix(b21, block_size);
-		deallocate_matrix(b22, block_size);
-
-
-		matrix_type ** c11 = allocate_matrix(block_size);
-		matrix_type ** c12 = allocate_matrix(block_size);
-		matrix_type ** c21 = allocate_matrix(block_size);
-		matrix_type ** c22 = allocate_matrix(block_size);
-
-		// c11
-		add_matrices(block_size, m1, m4, add_result1);
-		add_matrices(block_size, add_result1, m7, add_result2);
-		subtract_matrices(block_size, add_result2, m5, c11);
-		// c12
-		add_matrices(block_size, m3, m5, c12);
-		// c21
-		add_matrices(block_size, m2, m4, c21);
-		// c22
-		add_matrices(block_size, m1, m3, add_result1);
-		add_matrices(block_size, add_result1, m6, add_result2);
-		subtract_matrices(block_size, add_result2, m2, c22);
-
-		for (int k = 0; k < block_size; k++) {
-			for (int j = 0; j < block_size; j++) {
-				result[k][j] = c11[k][j];
-				result[k][j + block_size] = c12[k][j];
-				result[k + block_size][j] = c21[k][j];
-				result[k + block_size][j + block_size] = c22[k][j];
+/* Times m x k by k x n products for every power of two cutoff up to the
+* smallest dimension (best of TUNE_REPEATS runs each), keeps the fastest
+* in strassen_cutoff and stores it in the tuning file for later runs.
+*/
+void tune_cutoff(int m, int k, int n)
+{
+	matrix_type **matrix_a = allocate_matrix(m, k);
+	matrix_type **matrix_b = allocate_matrix(k, n);
+	matrix_type **matrix_result = allocate_matrix(m, n);
+	fill_matrix(m, k, matrix_a);
+	fill_matrix(k, n, matrix_b);
+
+	int smallest = m < k ? (m < n ? m : n) : (k < n ? k : n);
+	int best_cutoff = strassen_cutoff;
+	double best_time = -1;
+	for (int candidate = 16; ; candidate *= 2) {
+		strassen_cutoff = candidate < smallest ? candidate : smallest;
+		device_product *product = allocate_device_product(m, k, n);
+		double time = -1;
+		for (int r = 0; r < TUNE_REPEATS; r++) {
+			double begin = wall_time();
+			device_strassen(product, view_of(k, matrix_a), view_of(n, matrix_b),
+				view_of(n, matrix_result));
+			double elapsed = wall_time() - begin;
+			if (time < 0 || elapsed < time) {
+				time = elapsed;
 			}
 		}
+		release_device_product(product);
+		printf("cutoff %d: %f s\n", strassen_cutoff, time);
+		if (best_time < 0 || time < best_time) {
+			best_time = time;
+			best_cutoff = strassen_cutoff;
+		}
+		if (strassen_cutoff == smallest) {
+			break;
+		}
+	}
+	strassen_cutoff = best_cutoff;
+	printf("best cutoff for %dx%dx%d: %d\n", m, k, n, strassen_cutoff);
 
-		//deallocate all left over matrices
-		deallocate_matrix(c11, block_size);
-		deallocate_matrix(c12, block_size);
-		deallocate_matrix(c21, block_size);
-		deallocate_matrix(c22, block_size);
-		deallocate_matrix(m1, block_size);
-		deallocate_matrix(m2, block_size);
-		deallocate_matrix(m3, block_size);
-		deallocate_matrix(m4, block_size);
-		deallocate_matrix(m5, block_size);
-		deallocate_matrix(m6, block_size);
-		deallocate_matrix(m7, block_size);
-		deallocate_matrix(add_result1, size);
-		deallocate_matrix(add_result2, size);
+	FILE *f = fopen(tune_file(), "w");
+	if (f != NULL) {
+		fprintf(f, "%d\n", strassen_cutoff);
+		fclose(f);
+	} else {
+		fprintf(stderr, "could not store cutoff in %s\n", tune_file());
 	}
+	deallocate_matrix(matrix_a, m);
+	deallocate_matrix(matrix_b, k);
+	deallocate_matrix(matrix_result, m);
 }
 
-int strassen(int size)
+/* Reads a problem shape: either a single size for a square product or
+* MxKxN for an M x K by K x N product.
+*/
+void parse_shape(const char *arg, int *m, int *k, int *n)
 {
-	matrix_type **matrix_a = allocate_matrix(size);
-	matrix_type **matrix_b = allocate_matrix(size);
-	matrix_type **matrix_result = allocate_matrix(size);
+	if (sscanf(arg, "%dx%dx%d", m, k, n) != 3) {
+		*m = *k = *n = atoi(arg);
+	}
+	assert(*m > 0 && *k > 0 && *n > 0);
+}
 
-	fill_matrix(size, matrix_a);
-	fill_matrix(size, matrix_b);
+/* device_strassen() with the device buffers passed as context, for
+* bench_measure(). The timing includes the upload and the download.
+*/
+void bench_strassen(int m, int k, int n, matrix_view a, matrix_view b, matrix_view result,
+	void *product)
+{
+	device_strassen((device_product *)product, a, b, result);
+}
 
-	DWORD begin = GetTickCount(); //start timer
-	strassens_multiplication(size, matrix_a, matrix_b, matrix_result);
-	DWORD end = GetTickCount(); //start timer
+/* "bench" mode: for every shape of a comma separated list, times the naive
+* baseline and this program and prints them in the format
+* STRASSEN_BENCH_FORMAT asks for. With verify set every product is checked
+* too; returns 1 if one fails.
+*/
+int benchmark(const char *shapes, int verify)
+{
+	int failed = 0;
+	bench_options options;
+	bench_configure(&options);
+	bench_begin(&options);
+	int m, k, n;
+	while (next_shape(&shapes, &m, &k, &n)) {
+		matrix_type **matrix_a = allocate_matrix(m, k);
+		matrix_type **matrix_b = allocate_matrix(k, n);
+		matrix_type **matrix_result = allocate_matrix(m, n);
+		fill_matrix(m, k, matrix_a);
+		fill_matrix(k, n, matrix_b);
+
+		double baseline = bench_baseline(&options, m, k, n, view_of(k, matrix_a),
+			view_of(n, matrix_b), view_of(n, matrix_result));
 
-	printf("total time %d milliseconds for problem size %d\n", end - begin, size);
+		device_product *product = allocate_device_product(m, k, n);
+		bench_record record = { "ocl_strassens", "strassen" };
+		record.threads = 1;
+		record.cutoff = strassen_cutoff;
+		bench_measure(&options, bench_strassen, product, m, k, n, view_of(k, matrix_a),
+			view_of(n, matrix_b), view_of(n, matrix_result), &record);
+		record.speedup = baseline > 0 ? baseline / record.median : -1;
+		bench_print(&options, &record);
+		release_device_product(product);
+		if (verify && !verify_product(m, k, n, view_of(k, matrix_a), view_of(n, matrix_b),
+			view_of(n, matrix_result), strassen_cutoff, 0))
+			failed = 1;
+
+		deallocate_matrix(matrix_a, m);
+		deallocate_matrix(matrix_b, k);
+		deallocate_matrix(matrix_result, m);
+	}
+	bench_end(&options);
+	return failed;
+}
+
+/* Library entry point: sets up the device the STRASSEN_OCL_* environment
+* variables select, unless that is done, the parallel depth and the cutoff
+* to cutoff, or as configure_cutoff() does if that is 0. threads has no
+* meaning on the device. Returns 0, or -1 if there is no such device.
+*/
+int strassen_configure(int threads, int cutoff)
+{
+	if (ocl_initialize(NULL, NULL, NULL) != 0)
+		return -1;
+	configure_parallel_depth();
+	if (cutoff > 0)
+		strassen_cutoff = cutoff;
+	else
+		configure_cutoff(NULL);
 	return 0;
 }
+
+/* Multiplies an m x k matrix a by a k x n matrix b into result on the
+* device, through buffers from the pool. The rows of a, b and result must
+* be matrix_stride() apart, like the device copies.
+*/
+void strassen_product(int m, int k, int n, matrix_view a, matrix_view b, matrix_view result)
+{
+	assert(a.ld == matrix_stride(k) && b.ld == matrix_stride(n) && result.ld == matrix_stride(n));
+	device_product *product = allocate_device_product(m, k, n);
+	device_strassen(product, a, b, result);
+	release_device_product(product);
+}
+
+//releases the device strassen_configure() set up
+void strassen_release(void)
+{
+	ocl_release();
+}
+
+/* Multiplies random m x k and k x n matrices and prints the time taken.
+* With verify set the product is checked; returns 1 if that fails.
+*/
+int strassen(int m, int k, int n, int verify)
+{
+	matrix_type **matrix_a = allocate_matrix(m, k);
+	matrix_type **matrix_b = allocate_matrix(k, n);
+	matrix_type **matrix_result = allocate_matrix(m, n);
+
+	fill_matrix(m, k, matrix_a);
+	fill_matrix(k, n, matrix_b);
+
+	device_product *product = allocate_device_product(m, k, n);
+
+	double begin = wall_time(); //start timer
+	device_strassen(product, view_of(k, matrix_a), view_of(n, matrix_b),
+		view_of(n, matrix_result));
+	double end = wall_time(); //stop timer
+	release_device_product(product);
+
+	printf("total time %.0f milliseconds for problem size %dx%dx%d\n", (end - begin) * 1000, m, k, n);
+
+	int failed = verify && !verify_product(m, k, n, view_of(k, matrix_a), view_of(n, matrix_b),
+		view_of(n, matrix_result), strassen_cutoff, 0);
+	deallocate_matrix(matrix_a, m);
+	deallocate_matrix(matrix_b, k);
+	deallocate_matrix(matrix_result, m);
+	return failed;
+}
@@ -1,362 +1,1259 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
+#include "../common/matrix.h"
+#include "../common/bench.h"
+#include "../common/verify.h"
+#include "../common/out_of_core.h"
+#include "../common/placement.h"
+#include "../common/stealing.h"
+#include "../common/profile.h"
+#include "../common/trace.h"
+
+/* The threads engine of libstrassen is this file with the OpenMP
+ * schedules left out (STRASSEN_WITHOUT_OPENMP): it only has the stealing
+ * schedule, so it never starts an OpenMP team, even in a library built
+ * with OpenMP.
+ */
+#if defined(_OPENMP) && !defined(STRASSEN_WITHOUT_OPENMP)
+#define OPENMP_SCHEDULES 1
 #include <omp.h>
+#else
+#define OPENMP_SCHEDULES 0
+#endif
 
 #define ONESHOT 1
 
+/* Levels deeper than this never run their products in parallel: 7^3 =
+ * 343 concurrent subproblems already exceed any core count we run on, and
+ * each parallel level multiplies the workspace its subtree needs by seven.
+ */
+#define MAX_PARALLEL_DEPTH 3
+
+/* Recursion cutoff used unless the command line, STRASSEN_CUTOFF or a
+ * stored tuning result says otherwise.
+ */
+#define DEFAULT_CUTOFF 64
+/* Where "tune" stores the measured cutoff; STRASSEN_TUNE_FILE overrides it.
+ */
+#define TUNE_FILE ".parallel_strassens_cutoff"
+#define TUNE_REPEATS 3
+#define SCALING_REPEATS 3
 
-typedef float matrix_type;
-#define FORMAT "%f\t"
 
 /*
-allocate_matrix() is a function to allocate the matrix onto heap storage
-the matrix is an array of pointers that each have an array of pointers
+Parallelizing the elementwise add/subtract loops is ocunter-productive as all
+threads are already occupied, and while trying to parllelize for loop, we make
+it wait longer
 */
-matrix_type ** allocate_matrix(int size) 
+
+/* How the seven products of a parallel level are run. SCHEDULE_TASKS
+ * creates OpenMP tasks inside one team of team_size threads and joins
+ * them with taskwait. SCHEDULE_SECTIONS is the original scheme: every
+ * parallel level opens a nested team of its own for parallel sections of
+ * its products; it is kept so that "scaling" can compare the two.
+ * SCHEDULE_STEALING spawns them on the work-stealing scheduler of
+ * common/stealing.h instead of OpenMP, on team_size workers of its own or
+ * of the application's pool, and the joining worker helps until they are
+ * done.
+ */
+enum { SCHEDULE_TASKS, SCHEDULE_SECTIONS, SCHEDULE_STEALING };
+int strassen_schedule = OPENMP_SCHEDULES ? SCHEDULE_TASKS : SCHEDULE_STEALING;
+
+/* The application's thread pool the stealing schedule borrows its workers
+ * from, with room for application_workers of them, given to libstrassen
+ * with strassen_set_executor(). Without one it starts threads.
+ */
+void *application_pool = NULL;
+stealing_submit application_submit = NULL;
+int application_workers = 0;
+
+/* Which recursion strassens_multiplication() runs, picked with
+ * STRASSEN_VARIANT=strassen|winograd. VARIANT_WINOGRAD is the
+ * Strassen-Winograd form (7 multiplies, 15 additions); its sequential
+ * levels need only two temporaries and build the products in the
+ * quadrants of the result.
+ */
+enum { VARIANT_STRASSEN, VARIANT_WINOGRAD };
+int strassen_variant = VARIANT_STRASSEN;
+
+/* Size of the thread team. Set once in main().
+ */
+int team_size = 1;
+
+/* Number of recursion levels that run their products in parallel. Set
+ * once in main(), before the workspace is sized.
+ */
+int parallel_depth = 1;
+
+/* NUMA nodes the top level is spread over with the task schedule: product
+ * i of the top level, its temporaries and the workspace it recurses into
+ * are placed on node i % node_count, and it runs on a nested team of that
+ * node's share of the threads, bound to the node. 1 turns all of that
+ * off. Set once in configure_parallelism().
+ */
+int node_count = 1;
+
+/* Node each product of the last top level started on, for
+ * locality_report().
+ */
+int product_nodes[7];
+
+/* Blocks with any dimension of this size or smaller are multiplied by
+ * blocked_matrix_multiplication() instead of being split further.
+ */
+int strassen_cutoff = DEFAULT_CUTOFF;
+
+/* Number of elements of workspace strassens_multiplication() needs for an
+ * m x k by k x n product starting at recursion level depth. Every
+ * Strassen level takes m1..m7 (m/2 x n/2). A parallel level also takes
+ * five temporaries each for sums of a blocks (m/2 x k/2) and of b blocks
+ * (k/2 x n/2), so concurrent products never share one, and gives each of
+ * its seven subproblems its own region. A sequential level needs one
+ * temporary of each shape and its subproblems reuse one region.
+ *
+ * A parallel Winograd level keeps four products in the result and takes
+ * three m/2 x n/2 blocks for the others, plus s1..s4 and t1..t4; a
+ * sequential one takes just two temporaries, the first large enough to
+ * also hold an m/2 x n/2 product. Blocks are rounded up to whole cache
+ * lines; odd sizes are peeled, so the halves round down.
+ *
+ * A leaf takes the scratch of blocked_matrix_multiplication(), and the
+ * peels of a level use the front of its region once its products are
+ * combined.
+ */
+size_t strassen_workspace_size(int m, int k, int n, int depth)
 {
-    matrix_type **matrix_rows = (matrix_type**) malloc(sizeof (matrix_type *) * size);
-    assert (matrix_rows != NULL); 
-    matrix_type * full_data = (matrix_type *) malloc(sizeof(matrix_type) * size * size);
-    assert (full_data != NULL);
-    for (int i = 0; i < size; ++i)
-    {        
-        matrix_rows[i] = full_data + i * size;
+    size_t peel = blocked_scratch_size(m, k, n);
+    if(m <= strassen_cutoff || k <= strassen_cutoff || n <= strassen_cutoff) {
+        return peel;
+    }
+    m /= 2;
+    k /= 2;
+    n /= 2;
+    int parallel = depth < parallel_depth;
+    size_t child = strassen_workspace_size(m, k, n, depth + 1);
+    size_t total;
+    if(strassen_variant == VARIANT_WINOGRAD && parallel) {
+        total = 3 * aligned_elements((size_t)m * n)
+            + 4 * (aligned_elements((size_t)m * k) + aligned_elements((size_t)k * n)) + 7 * child;
+    } else if(strassen_variant == VARIANT_WINOGRAD) {
+        total = aligned_elements((size_t)m * (k > n ? k : n)) + aligned_elements((size_t)k * n) + child;
+    } else {
+        total = 7 * aligned_elements((size_t)m * n)
+            + (parallel ? 5 : 1) * (aligned_elements((size_t)m * k) + aligned_elements((size_t)k * n))
+            + (parallel ? 7 : 1) * child;
     }
-    return matrix_rows;
+    return total > peel ? total : peel;
 }
 
-/*
-deallocate_matrix() is a function which deallocates a matrix once it's use is over
-*/
-
-void deallocate_matrix(matrix_type ** m, int size)
+/* Peak workspace, in bytes, of an m x k by k x n product. This is all the
+ * memory the recursion uses besides a, b and result.
+ */
+size_t strassen_workspace_bytes(int m, int k, int n)
 {
-    free(m[0]);
-    free (m);
+    return sizeof(matrix_type) * strassen_workspace_size(m, k, n, 0);
 }
 
+/* Everything the seven products and four result quadrants of one level
+ * of the recursion work on. The Winograd variant keeps s1..s4 in sum_a
+ * and t1..t4 in sum_b.
+ */
+typedef struct {
+    int m2, k2, n2;
+    int depth;
+    matrix_view a11, a12, a21, a22;
+    matrix_view b11, b12, b21, b22;
+    matrix_view c11, c12, c21, c22;
+    // m1..m7, or p1..p7
+    matrix_view products[7];
+    // Operand temporaries; all five of a shape are the same block on a
+    // sequential level
+    matrix_view sum_a[5];
+    matrix_view sum_b[5];
+    // Product i recurses into child_workspace + i * child_size
+    matrix_type *child_workspace;
+    size_t child_size;
+} strassen_level;
 
-
-/* Takes a pointer to a 2-dimensional array matrix_type matrix of int size and
- * prints it to stdout, preceeded by a char label.
+/* Carves the temporaries of level l off the front of workspace: the
+ * products that aren't built in the result, the operand temporaries and,
+ * after them, what the subproblems recurse into. Sequential Winograd
+ * levels carve their own in winograd_step().
  */
-void print_matrix(char *label, int size, matrix_type **matrix)
+void carve_level(strassen_level *l, matrix_type *workspace, int parallel)
 {
-    int i = 0;
-    int j = 0;
-
-    printf("\n\n%s\n", label);
-    printf("{\n");
-    for(i = 0; i < size; i++) {
-        printf("\t[");
-        for(j = 0; j < size; j++) {
-            printf(FORMAT, matrix[i][j]);
+    if(strassen_variant == VARIANT_WINOGRAD) {
+        // p2, p5, p6 and p7 are built in the result, the other three and
+        // the operands are carved off the front of the workspace
+        l->products[0] = take_block(&workspace, l->m2, l->n2);
+        l->products[1] = l->c11;
+        l->products[2] = take_block(&workspace, l->m2, l->n2);
+        l->products[3] = take_block(&workspace, l->m2, l->n2);
+        l->products[4] = l->c22;
+        l->products[5] = l->c12;
+        l->products[6] = l->c21;
+        for(int i = 0; i < 4; i++) {
+            l->sum_a[i] = take_block(&workspace, l->m2, l->k2);
+            l->sum_b[i] = take_block(&workspace, l->k2, l->n2);
+        }
+        l->child_workspace = workspace;
+        l->child_size = strassen_workspace_size(l->m2, l->k2, l->n2, l->depth + 1);
+    } else {
+        // The 7 blocks defined by Strassen and the operand temporaries
+        for(int i = 0; i < 7; i++) {
+            l->products[i] = take_block(&workspace, l->m2, l->n2);
+        }
+        for(int i = 0; i < 5; i++) {
+            l->sum_a[i] = i == 0 || parallel ? take_block(&workspace, l->m2, l->k2) : l->sum_a[0];
+            l->sum_b[i] = i == 0 || parallel ? take_block(&workspace, l->k2, l->n2) : l->sum_b[0];
         }
-        printf("]\n");
+
+        // What is left is split between the subproblems: disjoint regions
+        // when they run in parallel, one shared region when they don't
+        l->child_workspace = workspace;
+        l->child_size = parallel ? strassen_workspace_size(l->m2, l->k2, l->n2, l->depth + 1) : 0;
     }
-    printf("}\n");
 }
 
-/* Takes a pointer to a 2-dimensional array matrix_type matrix of int size and
- * fills it with random numbers.
+/* Calls visit(memory, bytes, i, context) for every block of workspace
+ * that only product i of the top level of an m x k by k x n product works
+ * in: its product, the operand temporaries it multiplies and the region
+ * it recurses into. Does nothing unless the top level is a parallel one.
  */
-void fill_matrix(int size, matrix_type **matrix)
+void visit_product_regions(matrix_type *workspace, int m, int k, int n,
+    void (*visit)(void *memory, size_t bytes, int i, void *context), void *context)
 {
-    int i = 0;
-    int j = 0;
-
-    for(i = 0; i < size; i++) {
-        for(j = 0; j < size; j++) {
-            matrix[i][j] = rand() % 100;
+    // which product multiplies sum_a[i] and sum_b[i], by variant
+    static const int sum_a_user[2][5] = { { 0, 1, 4, 5, 6 }, { 4, 5, 6, 2, -1 } };
+    static const int sum_b_user[2][5] = { { 0, 2, 3, 5, 6 }, { 4, 5, 6, 3, -1 } };
+    if(parallel_depth < 1 || m <= strassen_cutoff || k <= strassen_cutoff || n <= strassen_cutoff) {
+        return;
+    }
+    int winograd = strassen_variant == VARIANT_WINOGRAD;
+    // the result quadrants stay null, so products built in them are skipped
+    strassen_level level = { m / 2, k / 2, n / 2, 0 };
+    carve_level(&level, workspace, 1);
+    for(int i = 0; i < 7; i++) {
+        if(level.products[i].base != NULL) {
+            visit(level.products[i].base, sizeof(matrix_type) * level.m2 * level.n2, i, context);
         }
+        visit(level.child_workspace + i * level.child_size, sizeof(matrix_type) * level.child_size,
+            i, context);
+    }
+    for(int i = 0; i < 5 && sum_a_user[winograd][i] >= 0; i++) {
+        visit(level.sum_a[i].base, sizeof(matrix_type) * level.m2 * level.k2,
+            sum_a_user[winograd][i], context);
+        visit(level.sum_b[i].base, sizeof(matrix_type) * level.k2 * level.n2,
+            sum_b_user[winograd][i], context);
     }
 }
 
-/* Iterative matrix multiplication. The naive implementation.
+/* Puts the blocks of product i on its node, for visit_product_regions().
  */
-void naive_matrix_multiplication(
-    int size,
-    matrix_type **a ,
-    matrix_type **b ,
-    matrix_type **result)
+void place_region(void *memory, size_t bytes, int i, void *context)
 {
-    int i = 0;
-    int j = 0;
-    int k = 0;
+    (void) context;
+    place_on_node(memory, bytes, i % node_count);
+}
 
-    for(i = 0; i < size; i++) {
-        for(j = 0; j < size; j++) {
-            result[i][j] = 0;
-            for(k = 0; k < size; k++) {
-                result[i][j] += a[i][k] * b[k][j];
-            }
-        }
+/*
+allocate_workspace() allocates the arena for an m x k by k x n product once, up front,
+and with node_count > 1 places what each top level product works in on its node
+before anything touches it
+*/
+matrix_type * allocate_workspace(int m, int k, int n)
+{
+    matrix_type *workspace = (matrix_type *) allocate_aligned(strassen_workspace_bytes(m, k, n));
+    if(node_count > 1) {
+        visit_product_regions(workspace, m, k, n, place_region, NULL);
     }
+    return workspace;
 }
 
-/* Subtract two matrices
+void strassens_multiplication(int m, int k, int n, matrix_view a, matrix_view b,
+    matrix_view result, matrix_type *workspace, int depth);
+
+/* Computes Strassen's product m(i+1) of a level: forms its operand sums
+ * in the level's temporaries and multiplies them recursively.
  */
-void subtract_matrices(
-int size,
-    matrix_type **a ,
-    matrix_type **b ,
-    matrix_type **result
-)
+void compute_product(const strassen_level *l, int i)
 {
-    int i = 0;
-    int j = 0;
-    for(i = 0; i < size; i++) {
-        for(j = 0; j < size; j++) {
-            result[i][j] = a[i][j] - b[i][j];
-        }
+    int m2 = l->m2, k2 = l->k2, n2 = l->n2;
+    matrix_type *workspace = l->child_workspace + i * l->child_size;
+    if(l->depth == 0) {
+        product_nodes[i] = current_node();
+    }
+    switch(i) {
+    // m1 = (a11 + a22)(b11 + b22)
+    case 0:
+        add_matrices(m2, k2, l->a11, l->a22, l->sum_a[0]);
+        add_matrices(k2, n2, l->b11, l->b22, l->sum_b[0]);
+        strassens_multiplication(m2, k2, n2, l->sum_a[0], l->sum_b[0], l->products[0],
+            workspace, l->depth + 1);
+        break;
+    // m2 = (a21 + a22) b11
+    case 1:
+        add_matrices(m2, k2, l->a21, l->a22, l->sum_a[1]);
+        strassens_multiplication(m2, k2, n2, l->sum_a[1], l->b11, l->products[1],
+            workspace, l->depth + 1);
+        break;
+    // m3 = a11 (b12 - b22)
+    case 2:
+        subtract_matrices(k2, n2, l->b12, l->b22, l->sum_b[1]);
+        strassens_multiplication(m2, k2, n2, l->a11, l->sum_b[1], l->products[2],
+            workspace, l->depth + 1);
+        break;
+    // m4 = a22 (b21 - b11)
+    case 3:
+        subtract_matrices(k2, n2, l->b21, l->b11, l->sum_b[2]);
+        strassens_multiplication(m2, k2, n2, l->a22, l->sum_b[2], l->products[3],
+            workspace, l->depth + 1);
+        break;
+    // m5 = (a11 + a12) b22
+    case 4:
+        add_matrices(m2, k2, l->a11, l->a12, l->sum_a[2]);
+        strassens_multiplication(m2, k2, n2, l->sum_a[2], l->b22, l->products[4],
+            workspace, l->depth + 1);
+        break;
+    // m6 = (a21 - a11)(b11 + b12)
+    case 5:
+        subtract_matrices(m2, k2, l->a21, l->a11, l->sum_a[3]);
+        add_matrices(k2, n2, l->b11, l->b12, l->sum_b[3]);
+        strassens_multiplication(m2, k2, n2, l->sum_a[3], l->sum_b[3], l->products[5],
+            workspace, l->depth + 1);
+        break;
+    // m7 = (a12 - a22)(b21 + b22)
+    case 6:
+        subtract_matrices(m2, k2, l->a12, l->a22, l->sum_a[4]);
+        add_matrices(k2, n2, l->b21, l->b22, l->sum_b[4]);
+        strassens_multiplication(m2, k2, n2, l->sum_a[4], l->sum_b[4], l->products[6],
+            workspace, l->depth + 1);
+        break;
     }
 }
-/*
-Parallelizing for loop is ocunter-productive as all threads are already occupied,
-and while trying to parllelize for loop, we make it wait longer
-*/
 
+/* Computes result quadrant i (c11, c12, c21, c22) of a level from its
+ * products, straight into result.
+ */
+void compute_quadrant(const strassen_level *l, int i)
+{
+    const matrix_view *p = l->products;
+    switch(i) {
+    case 0:
+        combine_matrices(l->m2, l->n2, p[0], p[3], p[4], p[6], l->c11);
+        break;
+    case 1:
+        add_matrices(l->m2, l->n2, p[2], p[4], l->c12);
+        break;
+    case 2:
+        add_matrices(l->m2, l->n2, p[1], p[3], l->c21);
+        break;
+    case 3:
+        combine_matrices(l->m2, l->n2, p[0], p[2], p[1], p[5], l->c22);
+        break;
+    }
+}
 
-/* Add two matrices
+/* Forms the Winograd operands of a parallel level: s1..s4 (i == 0) or
+ * t1..t4 (i == 1).
+ *
+ *   s1 = a21 + a22   s2 = s1 - a11   s3 = a11 - a21   s4 = a12 - s2
+ *   t1 = b12 - b11   t2 = b22 - t1   t3 = b22 - b12   t4 = t2 - b21
  */
-void add_matrices(
-    int size,
-    matrix_type **a ,
-    matrix_type **b ,
-    matrix_type **result
-)
+void winograd_operands(const strassen_level *l, int i)
 {
-    int i = 0;
-    int j = 0;
+    int m2 = l->m2, k2 = l->k2, n2 = l->n2;
+    const matrix_view *s = l->sum_a, *t = l->sum_b;
+    if(i == 0) {
+        add_matrices(m2, k2, l->a21, l->a22, s[0]);
+        subtract_matrices(m2, k2, s[0], l->a11, s[1]);
+        subtract_matrices(m2, k2, l->a11, l->a21, s[2]);
+        subtract_matrices(m2, k2, l->a12, s[1], s[3]);
+    } else {
+        subtract_matrices(k2, n2, l->b12, l->b11, t[0]);
+        subtract_matrices(k2, n2, l->b22, t[0], t[1]);
+        subtract_matrices(k2, n2, l->b22, l->b12, t[2]);
+        subtract_matrices(k2, n2, t[1], l->b21, t[3]);
+    }
+}
 
-    for(i = 0; i < size; i++) {
-        for(j = 0; j < size; j++) {
-            result[i][j] = a[i][j] + b[i][j];
-        }
+/* Computes Winograd's product p(i+1) of a parallel level:
+ *
+ *   p1 = a11 b11   p2 = a12 b21   p3 = s4 b22   p4 = a22 t4
+ *   p5 = s1 t1     p6 = s2 t2     p7 = s3 t3
+ */
+void winograd_product(const strassen_level *l, int i)
+{
+    static const int a_operand[7] = { -1, -1, 3, -1, 0, 1, 2 };
+    static const int b_operand[7] = { -1, -1, -1, 3, 0, 1, 2 };
+    matrix_view a = i == 0 ? l->a11 : i == 1 ? l->a12 : l->a22;
+    matrix_view b = i == 0 ? l->b11 : i == 1 ? l->b21 : l->b22;
+    if(a_operand[i] >= 0) {
+        a = l->sum_a[a_operand[i]];
+    }
+    if(b_operand[i] >= 0) {
+        b = l->sum_b[b_operand[i]];
     }
+    if(l->depth == 0) {
+        product_nodes[i] = current_node();
+    }
+    strassens_multiplication(l->m2, l->k2, l->n2, a, b, l->products[i],
+        l->child_workspace + i * l->child_size, l->depth + 1);
 }
 
-/* Implementation of Strassen's recursive matrix multiplication
- * algorithm.
+/* Combines the Winograd products of a parallel level, in place in the
+ * result, where p2, p5, p6 and p7 already are: c11 = p1 + p2 (i == 0),
+ * or c12 = u2 + p5 + p3, c21 = u3 - p4 and c22 = u3 + p5, with u2 = p1 +
+ * p6 and u3 = u2 + p7 (i == 1).
  */
-void strassens_multiplication(
-    int size,
-    matrix_type **a ,
-    matrix_type **b ,
-    matrix_type **result
-)
+void winograd_combine(const strassen_level *l, int i)
 {
-    if(size <= 2) {
-        naive_matrix_multiplication(size, a, b, result);
+    int m2 = l->m2, n2 = l->n2;
+    const matrix_view *p = l->products;
+    if(i == 0) {
+        add_matrices(m2, n2, p[0], l->c11, l->c11);
     } else {
-        int block_size = size / 2;
-
-        // The four quadrants (blocks) of the resulting matrix
-        // The 7 blocks defined by Strassen
-        matrix_type ** a11=allocate_matrix(block_size);
-        matrix_type ** a12=allocate_matrix(block_size);
-        matrix_type ** a21=allocate_matrix(block_size);
-        matrix_type ** a22=allocate_matrix(block_size);
-        matrix_type ** b11=allocate_matrix(block_size);
-        matrix_type ** b12=allocate_matrix(block_size);
-        matrix_type ** b21=allocate_matrix(block_size);
-        matrix_type ** b22=allocate_matrix(block_size);
-
-
-        matrix_type ** m1;
-        matrix_type ** m2;
-        matrix_type ** m3;
-        matrix_type ** m4;
-        matrix_type ** m5;
-        matrix_type ** m6;
-        matrix_type ** m7;
-        matrix_type ** add_result1;
-        matrix_type ** add_result2;
-        matrix_type ** add_result3;
-        matrix_type ** add_result4;
-        matrix_type ** add_result5;
-        matrix_type ** add_result6;
-        
-        matrix_type ** subtract_result1;
-        matrix_type ** subtract_result2;
-        matrix_type ** subtract_result3;
-        matrix_type ** subtract_result4;
+        add_matrices(m2, n2, p[0], l->c12, l->c12);
+        add_matrices(m2, n2, l->c12, l->c21, l->c21);
+        add_matrices(m2, n2, l->c12, l->c22, l->c12);
+        add_matrices(m2, n2, l->c21, l->c22, l->c22);
+        add_matrices(m2, n2, l->c12, p[2], l->c12);
+        subtract_matrices(m2, n2, l->c21, p[3], l->c21);
+    }
+}
 
+/* One sequential level of the Winograd variant in the two-temporary
+ * schedule of Boyer, Dumas, Pernet and Zhou (operands and products as in
+ * winograd_operands() and winograd_product()). Products go straight into
+ * the quadrants of result and are combined there in place; x holds the
+ * a operands and later p1, y the b operands.
+ */
+void winograd_step(const strassen_level *l, matrix_type *workspace)
+{
+    int m2 = l->m2, k2 = l->k2, n2 = l->n2;
+    int depth = l->depth + 1;
 
-        #pragma omp parallel sections
+    // x is sized for the larger of an m2 x k2 sum and the m2 x n2 p1
+    matrix_view x = take_block(&workspace, m2, k2 > n2 ? k2 : n2);
+    matrix_view p1 = { x.base, n2 };
+    x.ld = k2;
+    matrix_view y = take_block(&workspace, k2, n2);
+
+    // c21 = p7
+    subtract_matrices(m2, k2, l->a11, l->a21, x);
+    subtract_matrices(k2, n2, l->b22, l->b12, y);
+    strassens_multiplication(m2, k2, n2, x, y, l->c21, workspace, depth);
+    // c22 = p5
+    add_matrices(m2, k2, l->a21, l->a22, x);
+    subtract_matrices(k2, n2, l->b12, l->b11, y);
+    strassens_multiplication(m2, k2, n2, x, y, l->c22, workspace, depth);
+    // c12 = p6
+    subtract_matrices(m2, k2, x, l->a11, x);
+    subtract_matrices(k2, n2, l->b22, y, y);
+    strassens_multiplication(m2, k2, n2, x, y, l->c12, workspace, depth);
+    // c11 = p3
+    subtract_matrices(m2, k2, l->a12, x, x);
+    strassens_multiplication(m2, k2, n2, x, l->b22, l->c11, workspace, depth);
+    // p1, which replaces s4 in x
+    strassens_multiplication(m2, k2, n2, l->a11, l->b11, p1, workspace, depth);
+
+    // c12 = u2, c21 = u3, c12 = u4, c22 = u7, c12 = u5
+    add_matrices(m2, n2, p1, l->c12, l->c12);
+    add_matrices(m2, n2, l->c12, l->c21, l->c21);
+    add_matrices(m2, n2, l->c12, l->c22, l->c12);
+    add_matrices(m2, n2, l->c21, l->c22, l->c22);
+    add_matrices(m2, n2, l->c12, l->c11, l->c12);
+    // c11 = p4, c21 = u6
+    subtract_matrices(k2, n2, y, l->b21, y);
+    strassens_multiplication(m2, k2, n2, l->a22, y, l->c11, workspace, depth);
+    subtract_matrices(m2, n2, l->c21, l->c11, l->c21);
+    // c11 = p2, c11 = u1
+    strassens_multiplication(m2, k2, n2, l->a12, l->b21, l->c11, workspace, depth);
+    add_matrices(m2, n2, p1, l->c11, l->c11);
+}
+
+/* Names of the items of each phase in the trace. */
+static const char *const product_names[7] = { "m1", "m2", "m3", "m4", "m5", "m6", "m7" };
+static const char *const quadrant_names[4] = { "c11", "c12", "c21", "c22" };
+static const char *const winograd_operand_names[2] = { "s1..s4", "t1..t4" };
+static const char *const winograd_product_names[7] = { "p1", "p2", "p3", "p4", "p5", "p6", "p7" };
+static const char *const winograd_combine_names[2] = { "c11", "c12 c21 c22" };
+
+/* Runs work(l, i) on whichever thread it landed on, with what it does
+ * counted at the level's depth, and traced as names[i] if the level is
+ * parallel.
+ */
+void run_item(void (*work)(const strassen_level *, int), const char *const *names,
+    const strassen_level *l, int i)
+{
+    double begin = l->depth < parallel_depth ? trace_begin() : -1;
+    PROFILE_ENTER(l->depth);
+    work(l, i);
+    PROFILE_LEAVE();
+    trace_end(begin, names[i], l->depth);
+}
+
+#if OPENMP_SCHEDULES
+/* Runs work(l, i) for every i < count with i % node_count == node on
+ * the thread's node, for each node: a team with one thread per node
+ * starts a nested team of the node's share of team_size, bound to the
+ * node, which runs them as tasks.
+ */
+void run_on_nodes(void (*work)(const strassen_level *, int), const char *const *names,
+    const strassen_level *l, int count)
+{
+    #pragma omp parallel num_threads(node_count) proc_bind(spread)
+    for(int node = omp_get_thread_num(); node < node_count; node += omp_get_num_threads()) {
+        int threads = team_size / node_count + (node < team_size % node_count);
+        #pragma omp parallel num_threads(threads) proc_bind(close)
         {
-            #pragma omp section
-            {
-                m1=allocate_matrix(block_size);
-                m2=allocate_matrix(block_size);
-                m3=allocate_matrix(block_size);
-                m4=allocate_matrix(block_size);
-                m5=allocate_matrix(block_size);
-                m6=allocate_matrix(block_size);
-                m7=allocate_matrix(block_size);
-                add_result1 = allocate_matrix(size);
-                add_result2 = allocate_matrix(size);
-                add_result3 = allocate_matrix(size);
-                add_result4 = allocate_matrix(size);
-                add_result5 = allocate_matrix(size);
-                add_result6 = allocate_matrix(size);
-                
-                subtract_result1 = allocate_matrix(size);
-                subtract_result2 = allocate_matrix(size);
-                subtract_result3= allocate_matrix(size);
-                subtract_result4 = allocate_matrix(size);   
+            node_binding saved;
+            bind_to_node(node, &saved);
+            #pragma omp single
+            for(int i = node; i < count; i += node_count) {
+                #pragma omp task firstprivate(i)
+                run_item(work, names, l, i);
             }
-            #pragma omp section
-            {
-                for(int i = 0; i < block_size; i++) {
-                    for(int j = 0; j < block_size; j++) {
-                        // Assign correct values to the different blocks
-                        a11[i][j] = a[i][j];
-                        a12[i][j] = a[i][j + block_size];
-                        a21[i][j] = a[i + block_size][j];
-                        a22[i][j] = a[i + block_size][j + block_size];
-                        b11[i][j] = b[i][j];
-                        b12[i][j] = b[i][j + block_size];
-                        b21[i][j] = b[i + block_size][j];
-                        b22[i][j] = b[i + block_size][j + block_size];
-                    }
-                }
+            restore_binding(&saved);
+        }
+    }
+}
+#endif
+
+/* A phase of a level as the stealing scheduler's work. */
+typedef struct {
+    void (*work)(const strassen_level *, int);
+    const char *const *names;
+    const strassen_level *l;
+} level_phase;
+
+void run_phase_item(const void *context, int i)
+{
+    const level_phase *phase = (const level_phase *) context;
+    run_item(phase->work, phase->names, phase->l, i);
+}
+
+/* Runs work(l, 0) .. work(l, count - 1), traced as names[0] ..
+ * names[count - 1], and returns when all are done: as tasks or nested
+ * parallel sections when parallel is set, one after the other otherwise.
+ * The top level runs on the nodes with run_on_nodes() when node_count >
+ * 1.
+ */
+void run_phase(void (*work)(const strassen_level *, int), const char *const *names,
+    const strassen_level *l, int count, int parallel)
+{
+    if(strassen_schedule == SCHEDULE_STEALING || !parallel) {
+        level_phase phase = { work, names, l };
+        if(parallel) {
+            stealing_for(run_phase_item, &phase, count);
+        } else {
+            for(int i = 0; i < count; i++) {
+                run_item(work, names, l, i);
             }
         }
-        // Calculate the values of Strassens blocks
+        return;
+    }
+#if OPENMP_SCHEDULES
+    if(l->depth == 0 && node_count > 1) {
+        run_on_nodes(work, names, l, count);
+    } else if(strassen_schedule == SCHEDULE_TASKS) {
+        for(int i = 0; i < count; i++) {
+            #pragma omp task firstprivate(i)
+            run_item(work, names, l, i);
+        }
+        #pragma omp taskwait
+    } else {
+        // a section per item of the largest phase, the seven products;
+        // smaller phases leave the last ones empty
+        assert (count <= 7);
         #pragma omp parallel sections
         {
-            // m1
             #pragma omp section
-            {
-                add_matrices(block_size, a11, a22, add_result1);
-                add_matrices(block_size, b11, b22, add_result2);
-                strassens_multiplication(block_size, add_result1, add_result2,m1);
-            }
-            // m2   
+            run_item(work, names, l, 0);
             #pragma omp section
-            {
-                add_matrices(block_size, a21, a22, add_result3);
-                strassens_multiplication(block_size, add_result3, b11, m2);
+            if(count > 1) {
+                run_item(work, names, l, 1);
             }
-            // m3
             #pragma omp section
-            {
-                subtract_matrices(block_size, b12, b22, subtract_result1);
-                strassens_multiplication(block_size, a11, subtract_result1, m3);
+            if(count > 2) {
+                run_item(work, names, l, 2);
             }
-            // m4
             #pragma omp section
-            {
-                subtract_matrices(block_size, b21, b11, subtract_result2);
-                strassens_multiplication(block_size, a22, subtract_result2, m4);
+            if(count > 3) {
+                run_item(work, names, l, 3);
             }
-            // m5
             #pragma omp section
-            {
-                add_matrices(block_size, a11, a12, add_result4);
-                strassens_multiplication(block_size, add_result4, b22, m5);
+            if(count > 4) {
+                run_item(work, names, l, 4);
             }
-            // m6
             #pragma omp section
-            {
-                subtract_matrices(block_size, a21, a11, subtract_result3);
-                add_matrices(block_size, b11, b12, add_result5);
-                strassens_multiplication(block_size, subtract_result3,add_result5, m6);
+            if(count > 5) {
+                run_item(work, names, l, 5);
             }
-            // m7
             #pragma omp section
-            {
-                subtract_matrices(block_size, a12, a22, subtract_result4);
-                add_matrices(block_size, b21, b22, add_result6);
-                strassens_multiplication(block_size, subtract_result4,add_result6, m7);
+            if(count > 6) {
+                run_item(work, names, l, 6);
             }
         }
-        deallocate_matrix(a11, block_size);
-        deallocate_matrix(a12, block_size);
-        deallocate_matrix(a21, block_size);
-        deallocate_matrix(a22, block_size);
-        deallocate_matrix(b11, block_size);
-        deallocate_matrix(b12, block_size);
-        deallocate_matrix(b21, block_size);
-        deallocate_matrix(b22, block_size);
-        deallocate_matrix(add_result5, size);
-        deallocate_matrix(add_result6, size);
-        deallocate_matrix(subtract_result1, size);
-        deallocate_matrix(subtract_result2, size);
-        deallocate_matrix(subtract_result3, size);
-        deallocate_matrix(subtract_result4, size);
-        
-        
-
-        matrix_type ** c11=allocate_matrix(block_size);
-        matrix_type ** c12=allocate_matrix(block_size);
-        matrix_type ** c21=allocate_matrix(block_size);
-        matrix_type ** c22=allocate_matrix(block_size);
-        // Calculate the resulting product matrix
-        // c11
-        #pragma omp parallel sections
-        {
-            #pragma omp section
-            {
-                add_matrices(block_size, m1, m4, add_result1);
-                add_matrices(block_size, add_result1, m7, add_result2);
-                subtract_matrices(block_size, add_result2, m5, c11);
+    }
+#endif
+}
+
+/* Implementation of Strassen's recursive matrix multiplication
+ * algorithm for an m x k matrix a and a k x n matrix b. The quadrants of
+ * a, b and result are addressed in place; result must not overlap a or b.
+ * workspace must hold at least strassen_workspace_size(m, k, n, depth)
+ * elements; no heap calls are made.
+ *
+ * With SCHEDULE_TASKS this must run inside a parallel region (see
+ * parallel_strassen()); the first parallel_depth levels spawn their seven
+ * products and then their four quadrants as tasks and wait for them,
+ * deeper levels run everything in the encountering task. With
+ * VARIANT_WINOGRAD, parallel levels run the Winograd operands, products
+ * and combination as three phases and sequential levels run
+ * winograd_step().
+ *
+ * Odd dimensions are handled by dynamic peeling: Strassen runs on the
+ * even-sized leading part and the last row, column and inner index are
+ * fixed up with blocked_matrix_multiplication(), which costs O(mk + kn +
+ * mn) rather than padding to the next power of two.
+ */
+void strassens_multiplication(
+    int m ,
+    int k ,
+    int n ,
+    matrix_view a ,
+    matrix_view b ,
+    matrix_view result ,
+    matrix_type *workspace ,
+    int depth
+)
+{
+    PROFILE_ENTER(depth);
+    if(m <= strassen_cutoff || k <= strassen_cutoff || n <= strassen_cutoff) {
+        blocked_matrix_multiplication(m, k, n, a, b, result, 0, workspace);
+        PROFILE_LEAVE();
+        return;
+    }
+    // the parallel levels and the sequential subtrees below them are traced
+    double begin = depth <= parallel_depth ? trace_begin() : -1;
+
+    strassen_level level;
+    strassen_level *l = &level;
+    int parallel = depth < parallel_depth;
+    l->m2 = m / 2;
+    l->k2 = k / 2;
+    l->n2 = n / 2;
+    l->depth = depth;
+
+    // The four quadrants (blocks) of the operands and of the result
+    l->a11 = quadrant(a, l->m2, l->k2, 0, 0);
+    l->a12 = quadrant(a, l->m2, l->k2, 0, 1);
+    l->a21 = quadrant(a, l->m2, l->k2, 1, 0);
+    l->a22 = quadrant(a, l->m2, l->k2, 1, 1);
+    l->b11 = quadrant(b, l->k2, l->n2, 0, 0);
+    l->b12 = quadrant(b, l->k2, l->n2, 0, 1);
+    l->b21 = quadrant(b, l->k2, l->n2, 1, 0);
+    l->b22 = quadrant(b, l->k2, l->n2, 1, 1);
+    l->c11 = quadrant(result, l->m2, l->n2, 0, 0);
+    l->c12 = quadrant(result, l->m2, l->n2, 0, 1);
+    l->c21 = quadrant(result, l->m2, l->n2, 1, 0);
+    l->c22 = quadrant(result, l->m2, l->n2, 1, 1);
+
+    if(strassen_variant == VARIANT_WINOGRAD && !parallel) {
+        winograd_step(l, workspace);
+    } else if(strassen_variant == VARIANT_WINOGRAD) {
+        carve_level(l, workspace, parallel);
+        run_phase(winograd_operands, winograd_operand_names, l, 2, parallel);
+        run_phase(winograd_product, winograd_product_names, l, 7, parallel);
+        run_phase(winograd_combine, winograd_combine_names, l, 2, parallel);
+    } else {
+        carve_level(l, workspace, parallel);
+        run_phase(compute_product, product_names, l, 7, parallel);
+        run_phase(compute_quadrant, quadrant_names, l, 4, parallel);
+    }
+
+    // Peel the odd edges: the last inner index is a rank-1 update of
+    // the even part, the last column and row are thin products
+    if(k % 2) {
+        blocked_matrix_multiplication(2 * l->m2, 1, 2 * l->n2, sub_view(a, 0, k - 1),
+            sub_view(b, k - 1, 0), result, 1, workspace);
+    }
+    if(n % 2) {
+        blocked_matrix_multiplication(m, k, 1, a, sub_view(b, 0, n - 1),
+            sub_view(result, 0, n - 1), 0, workspace);
+    }
+    if(m % 2) {
+        blocked_matrix_multiplication(1, k, 2 * l->n2, sub_view(a, m - 1, 0), b,
+            sub_view(result, m - 1, 0), 0, workspace);
+    }
+    trace_end(begin, depth < parallel_depth ? "level" : "subtree", depth);
+    PROFILE_LEAVE();
+}
+
+/* The arguments of parallel_strassen(), for stealing_run(). */
+typedef struct {
+    int m, k, n;
+    matrix_view a, b, result;
+    matrix_type *workspace;
+} product_arguments;
+
+void run_product(void *argument)
+{
+    product_arguments *p = (product_arguments *) argument;
+    strassens_multiplication(p->m, p->k, p->n, p->a, p->b, p->result, p->workspace, 0);
+}
+
+/* Runs a whole product with the current schedule: with tasks, one team of
+ * team_size threads is started here and a single thread seeds the
+ * recursion, unless the top level starts a team per node itself; with
+ * sections every parallel level starts its own team; with stealing the
+ * calling thread seeds it as worker 0 of the scheduler.
+ */
+void parallel_strassen(int m, int k, int n, matrix_view a, matrix_view b,
+    matrix_view result, matrix_type *workspace)
+{
+    if(strassen_schedule == SCHEDULE_STEALING) {
+        product_arguments p = { m, k, n, a, b, result, workspace };
+        stealing_run(run_product, &p);
+        return;
+    }
+#if OPENMP_SCHEDULES
+    if(strassen_schedule == SCHEDULE_TASKS && node_count == 1) {
+        #pragma omp parallel num_threads(team_size)
+        #pragma omp single
+        strassens_multiplication(m, k, n, a, b, result, workspace, 0);
+        return;
+    }
+#endif
+    strassens_multiplication(m, k, n, a, b, result, workspace, 0);
+}
+
+/* Sets the team size (unless threads is positive: OMP_NUM_THREADS or all
+ * processors, or with the stealing schedule all processors or the
+ * application's pool and the calling thread), the parallel depth: STRASSEN_PARALLEL_DEPTH if set,
+ * otherwise the fewest levels that give every thread at least four
+ * subproblems to balance over, capped at MAX_PARALLEL_DEPTH, and the
+ * nodes to spread over: STRASSEN_NUMA if set (0 or 1 for none), otherwise
+ * all of them, but no more than there are threads, and none with the
+ * sections or stealing schedules or without a parallel level.
+ */
+void configure_parallelism(int threads)
+{
+    int processors = application_submit != NULL ? application_workers + 1 : stealing_processors();
+#if OPENMP_SCHEDULES
+    if(strassen_schedule != SCHEDULE_STEALING) {
+        processors = omp_get_max_threads();
+    }
+#endif
+    team_size = threads > 0 ? threads : processors;
+
+    const char *env = getenv("STRASSEN_PARALLEL_DEPTH");
+    if(env != NULL) {
+        parallel_depth = atoi(env);
+    } else {
+        long subproblems = 7;
+        parallel_depth = 1;
+        while(subproblems < 4L * team_size) {
+            subproblems *= 7;
+            parallel_depth++;
+        }
+    }
+    if(parallel_depth < 0) {
+        parallel_depth = 0;
+    }
+    if(parallel_depth > MAX_PARALLEL_DEPTH) {
+        parallel_depth = MAX_PARALLEL_DEPTH;
+    }
+
+    const char *numa = getenv("STRASSEN_NUMA");
+    node_count = numa != NULL ? atoi(numa) : memory_nodes();
+    if(node_count > team_size) {
+        node_count = team_size;
+    }
+    if(node_count < 1 || strassen_schedule != SCHEDULE_TASKS || parallel_depth == 0) {
+        node_count = 1;
+    }
+}
+
+/* Uses schedule s with team size threads for the following products (the
+ * stealing schedule, without the OpenMP ones). The sections schedule
+ * needs one active nesting level per parallel level, the tasks two when
+ * they are spread over nodes.
+ */
+void use_schedule(int s, int threads)
+{
+    strassen_schedule = OPENMP_SCHEDULES ? s : SCHEDULE_STEALING;
+    configure_parallelism(threads);
+    if(strassen_schedule == SCHEDULE_STEALING) {
+        stealing_configure(team_size, application_pool, application_submit);
+        return;
+    }
+#if OPENMP_SCHEDULES
+    omp_set_num_threads(team_size);
+    omp_set_max_active_levels(strassen_schedule == SCHEDULE_SECTIONS ? parallel_depth
+        : node_count > 1 ? 2 : 1);
+#endif
+}
+
+/* Path of the file the tuned cutoff is stored in.
+ */
+const char * tune_file(void)
+{
+    const char *path = getenv("STRASSEN_TUNE_FILE");
+    return path != NULL ? path : TUNE_FILE;
+}
+
+/* Sets strassen_cutoff from, in order of precedence, the command line
+ * argument (may be NULL), the STRASSEN_CUTOFF environment variable and
+ * the stored tuning result. Keeps DEFAULT_CUTOFF if none is given.
+ */
+void configure_cutoff(const char *arg)
+{
+    const char *env = getenv("STRASSEN_CUTOFF");
+    if(arg != NULL) {
+        strassen_cutoff = atoi(arg);
+    } else if(env != NULL) {
+        strassen_cutoff = atoi(env);
+    } else {
+        FILE *f = fopen(tune_file(), "r");
+        if(f != NULL) {
+            if(fscanf(f, "%d", &strassen_cutoff) != 1) {
+                strassen_cutoff = DEFAULT_CUTOFF;
             }
-            // c12
-            #pragma omp section
-                add_matrices(block_size, m3, m5, c12);
-            // c21
-            #pragma omp section
-                add_matrices(block_size, m2, m4, c21);
-            // c22
-            #pragma omp section
-            {
-                add_matrices(block_size, m1, m3, add_result3);
-                add_matrices(block_size, add_result3, m6, add_result4);
-                subtract_matrices(block_size, add_result4, m2, c22);
+            fclose(f);
+        }
+    }
+    if(strassen_cutoff < 1) {
+        strassen_cutoff = 1;
+    }
+}
+
+/* Times m x k by k x n products for every power of two cutoff up to the
+ * smallest dimension (best of TUNE_REPEATS runs each), keeps the fastest
+ * in strassen_cutoff and stores it in the tuning file for later runs.
+ */
+void tune_cutoff(int m, int k, int n)
+{
+    matrix_type **matrix_a = allocate_matrix(m, k);
+    matrix_type **matrix_b = allocate_matrix(k, n);
+    matrix_type **matrix_result = allocate_matrix(m, n);
+    fill_matrix(m, k, matrix_a);
+    fill_matrix(k, n, matrix_b);
+
+    int smallest = m < k ? (m < n ? m : n) : (k < n ? k : n);
+    int best_cutoff = strassen_cutoff;
+    double best_time = -1;
+    for(int candidate = 16; ; candidate *= 2) {
+        strassen_cutoff = candidate < smallest ? candidate : smallest;
+        matrix_type *workspace = allocate_workspace(m, k, n);
+        double time = -1;
+        for(int r = 0; r < TUNE_REPEATS; r++) {
+            double begin = wall_time();
+            parallel_strassen(m, k, n, view_of(k, matrix_a), view_of(n, matrix_b),
+                view_of(n, matrix_result), workspace);
+            double elapsed = wall_time() - begin;
+            if(time < 0 || elapsed < time) {
+                time = elapsed;
             }
         }
-        
-        // Concatenate the four product blocks in our result matrix
-        for(int k = 0; k < block_size; k++) {
-            for(int j = 0; j < block_size; j++) {
-                result[k][j] = c11[k][j];
-                result[k][j + block_size] = c12[k][j];
-                result[k + block_size][j] = c21[k][j];
-                result[k + block_size][j + block_size] = c22[k][j];
+        deallocate_aligned(workspace);
+        printf("cutoff %d: %f s\n", strassen_cutoff, time);
+        if(best_time < 0 || time < best_time) {
+            best_time = time;
+            best_cutoff = strassen_cutoff;
+        }
+        if(strassen_cutoff == smallest) {
+            break;
+        }
+    }
+    strassen_cutoff = best_cutoff;
+    printf("best cutoff for %dx%dx%d: %d\n", m, k, n, strassen_cutoff);
+
+    FILE *f = fopen(tune_file(), "w");
+    if(f != NULL) {
+        fprintf(f, "%d\n", strassen_cutoff);
+        fclose(f);
+    } else {
+        fprintf(stderr, "could not store cutoff in %s\n", tune_file());
+    }
+    deallocate_matrix(matrix_a, m);
+    deallocate_matrix(matrix_b, k);
+    deallocate_matrix(matrix_result, m);
+}
+
+/* Strong-scaling report: times the same m x k by k x n product with the
+ * sections, task and stealing schedules for 1, 2, 4, ... threads up to
+ * max_threads (best of SCALING_REPEATS runs each) and prints the speedup
+ * of each over the single-threaded task run and the gain of tasks over
+ * sections.
+ */
+void scaling_report(int m, int k, int n, int max_threads)
+{
+    matrix_type **matrix_a = allocate_matrix(m, k);
+    matrix_type **matrix_b = allocate_matrix(k, n);
+    matrix_type **matrix_result = allocate_matrix(m, n);
+    fill_matrix(m, k, matrix_a);
+    fill_matrix(k, n, matrix_b);
+
+    printf("%dx%dx%d, cutoff %d\n", m, k, n, strassen_cutoff);
+    printf("threads\tdepth\tsections s\ttasks s\tstealing s\tsections speedup\ttasks speedup"
+        "\tstealing speedup\ttasks gain\n");
+    double base = -1;
+    for(int threads = 1; ; threads *= 2) {
+        if(threads > max_threads) {
+            threads = max_threads;
+        }
+        double time[3];
+        int schedules[3] = { SCHEDULE_SECTIONS, SCHEDULE_TASKS, SCHEDULE_STEALING };
+        for(int s = 0; s < 3; s++) {
+            use_schedule(schedules[s], threads);
+            matrix_type *workspace = allocate_workspace(m, k, n);
+            time[s] = -1;
+            for(int r = 0; r < SCALING_REPEATS; r++) {
+                double begin = wall_time();
+                parallel_strassen(m, k, n, view_of(k, matrix_a), view_of(n, matrix_b),
+                    view_of(n, matrix_result), workspace);
+                double elapsed = wall_time() - begin;
+                if(time[s] < 0 || elapsed < time[s]) {
+                    time[s] = elapsed;
+                }
             }
+            deallocate_aligned(workspace);
+        }
+        if(base < 0) {
+            base = time[1];
         }
-        deallocate_matrix(c11, block_size);
-        deallocate_matrix(c12, block_size);
-        deallocate_matrix(c21, block_size);
-        deallocate_matrix(c22, block_size);
-        deallocate_matrix(m1, block_size);
-        deallocate_matrix(m2, block_size);
-        deallocate_matrix(m3, block_size);
-        deallocate_matrix(m4, block_size);
-        deallocate_matrix(m5, block_size);
-        deallocate_matrix(m6, block_size);
-        deallocate_matrix(m7, block_size);
-        deallocate_matrix(add_result1, size);
-        deallocate_matrix(add_result2, size);
-        deallocate_matrix(add_result3, size);
-        deallocate_matrix(add_result4, size);
+        printf("%d\t%d\t%f\t%f\t%f\t%.2f\t%.2f\t%.2f\t%.2f\n", threads, parallel_depth, time[0],
+            time[1], time[2], base / time[0], base / time[1], base / time[2], time[0] / time[1]);
+        if(threads == max_threads) {
+            break;
+        }
+    }
+    deallocate_matrix(matrix_a, m);
+    deallocate_matrix(matrix_b, k);
+    deallocate_matrix(matrix_result, m);
+}
+
+/* Bytes of the blocks of each top level product, and how many of them
+ * are on the node the product ran on.
+ */
+typedef struct {
+    size_t bytes[7];
+    size_t local[7];
+} product_locality;
+
+/* Counts the blocks of product i, for visit_product_regions().
+ */
+void count_local(void *memory, size_t bytes, int i, void *context)
+{
+    product_locality *p = (product_locality *) context;
+    p->bytes[i] += bytes;
+    p->local[i] += bytes_on_node(memory, bytes, product_nodes[i]);
+}
+
+/* Prints the nodes of the pages of an operand, in percent of its size.
+ */
+void print_operand_nodes(const char *name, const void *memory, size_t bytes)
+{
+    printf("%s", name);
+    for(int node = 0; node < memory_nodes(); node++) {
+        printf("\tnode %d %.1f%%", node, 100.0 * bytes_on_node(memory, bytes, node) / bytes);
     }
+    printf("\n");
 }
 
+/* NUMA locality report: times the same m x k by k x n product (best of
+ * SCALING_REPEATS runs) with the workspace left to first touch and, when
+ * there are several nodes, placed on node_count of them. For each, it
+ * prints the node each top level product ran on and how much of its
+ * temporaries and workspace is on that node. Every product writes and
+ * reads its blocks several times and touches no other product's, so the
+ * share over all products is the share of workspace traffic that stays
+ * on the node. a and b are read by every product and are shown by where
+ * their pages are, as is the result.
+ */
+void locality_report(int m, int k, int n)
+{
+    matrix_type **matrix_a = allocate_matrix(m, k);
+    matrix_type **matrix_b = allocate_matrix(k, n);
+    matrix_type **matrix_result = allocate_matrix(m, n);
+    fill_matrix(m, k, matrix_a);
+    fill_matrix(k, n, matrix_b);
+
+    int placed = node_count;
+    char name = strassen_variant == VARIANT_WINOGRAD ? 'p' : 'm';
+    printf("%dx%dx%d, cutoff %d, %d threads, %d nodes\n", m, k, n, strassen_cutoff, team_size,
+        memory_nodes());
+    for(int run = 0; run < (placed > 1 ? 2 : 1); run++) {
+        node_count = run == 0 ? 1 : placed;
+#if OPENMP_SCHEDULES
+        omp_set_max_active_levels(node_count > 1 ? 2 : 1);
+#endif
+        matrix_type *workspace = allocate_workspace(m, k, n);
+        double time = -1;
+        for(int r = 0; r < SCALING_REPEATS; r++) {
+            double begin = wall_time();
+            parallel_strassen(m, k, n, view_of(k, matrix_a), view_of(n, matrix_b),
+                view_of(n, matrix_result), workspace);
+            double elapsed = wall_time() - begin;
+            if(time < 0 || elapsed < time) {
+                time = elapsed;
+            }
+        }
+        if(run == 0) {
+            printf("\nfirst touch: %f s\n", time);
+        } else {
+            printf("\nplaced on %d nodes: %f s\n", node_count, time);
+        }
+
+        product_locality p = { { 0 } };
+        visit_product_regions(workspace, m, k, n, count_local, &p);
+        size_t bytes = 0, local = 0;
+        printf("product\tnode\tMiB\tlocal %%\n");
+        for(int i = 0; i < 7; i++) {
+            printf("%c%d\t%d\t%.1f\t%.1f\n", name, i + 1, product_nodes[i],
+                p.bytes[i] / 1048576.0, p.bytes[i] > 0 ? 100.0 * p.local[i] / p.bytes[i] : 0.0);
+            bytes += p.bytes[i];
+            local += p.local[i];
+        }
+        if(bytes == 0) {
+            printf("no parallel level: the workspace is not split between products\n");
+        } else {
+            printf("all\t\t%.1f\t%.1f\n", bytes / 1048576.0, 100.0 * local / bytes);
+        }
+        deallocate_aligned(workspace);
+    }
+    node_count = placed;
+#if OPENMP_SCHEDULES
+    omp_set_max_active_levels(node_count > 1 ? 2 : 1);
+#endif
+
+    printf("\n");
+    print_operand_nodes("a", matrix_a[0], sizeof(matrix_type) * m * (size_t)matrix_stride(k));
+    print_operand_nodes("b", matrix_b[0], sizeof(matrix_type) * k * (size_t)matrix_stride(n));
+    print_operand_nodes("result", matrix_result[0],
+        sizeof(matrix_type) * m * (size_t)matrix_stride(n));
+    deallocate_matrix(matrix_a, m);
+    deallocate_matrix(matrix_b, k);
+    deallocate_matrix(matrix_result, m);
+}
+
+/* Name of the selected variant, for reports.
+ */
+const char * variant_name(void)
+{
+    return strassen_variant == VARIANT_WINOGRAD ? "winograd" : "strassen";
+}
+
+/* parallel_strassen() with the workspace passed as context, for
+ * bench_measure().
+ */
+void bench_strassen(int m, int k, int n, matrix_view a, matrix_view b, matrix_view result,
+    void *workspace)
+{
+    parallel_strassen(m, k, n, a, b, result, (matrix_type *) workspace);
+}
+
+/* "bench" mode: for every shape of a comma separated list, times the naive
+ * baseline and this program with 1, 2, 4, ... max_threads threads and
+ * prints them in the format STRASSEN_BENCH_FORMAT asks for. Speedups are
+ * over the single-threaded naive product.
+ */
+void benchmark(const char *shapes, int max_threads)
+{
+    bench_options options;
+    bench_configure(&options);
+    bench_begin(&options);
+    int m, k, n;
+    while(next_shape(&shapes, &m, &k, &n)) {
+        matrix_type **matrix_a = allocate_matrix(m, k);
+        matrix_type **matrix_b = allocate_matrix(k, n);
+        matrix_type **matrix_result = allocate_matrix(m, n);
+        fill_matrix(m, k, matrix_a);
+        fill_matrix(k, n, matrix_b);
+
+        double baseline = bench_baseline(&options, m, k, n, view_of(k, matrix_a),
+            view_of(n, matrix_b), view_of(n, matrix_result));
+
+        for(int threads = 1; ; threads *= 2) {
+            if(threads > max_threads) {
+                threads = max_threads;
+            }
+            use_schedule(strassen_schedule, threads);
+            matrix_type *workspace = allocate_workspace(m, k, n);
+            bench_record record = { "parallel_strassens", variant_name() };
+            record.threads = threads;
+            record.cutoff = strassen_cutoff;
+            bench_measure(&options, bench_strassen, workspace, m, k, n, view_of(k, matrix_a),
+                view_of(n, matrix_b), view_of(n, matrix_result), &record);
+            record.speedup = baseline > 0 ? baseline / record.median : -1;
+            bench_print(&options, &record);
+            deallocate_aligned(workspace);
+            if(threads == max_threads) {
+                break;
+            }
+        }
+
+        deallocate_matrix(matrix_a, m);
+        deallocate_matrix(matrix_b, k);
+        deallocate_matrix(matrix_result, m);
+    }
+    bench_end(&options);
+}
+
+/* Reads a problem shape: either a single size for a square product or
+ * MxKxN for an M x K by K x N product.
+ */
+void parse_shape(const char *arg, int *m, int *k, int *n)
+{
+    if(sscanf(arg, "%dx%dx%d", m, k, n) != 3) {
+        *m = *k = *n = atoi(arg);
+    }
+    assert (*m > 0 && *k > 0 && *n > 0);
+}
+
+/* Sets strassen_variant from the STRASSEN_VARIANT environment variable.
+ */
+void configure_variant(void)
+{
+    const char *env = getenv("STRASSEN_VARIANT");
+    if(env != NULL && strcmp(env, "winograd") == 0) {
+        strassen_variant = VARIANT_WINOGRAD;
+    } else if(env != NULL && strcmp(env, "strassen") != 0) {
+        fprintf(stderr, "unknown STRASSEN_VARIANT %s, using strassen\n", env);
+    }
+}
+
+/* Schedule from STRASSEN_SCHEDULE: the tasks unless it says "sections"
+ * or "stealing".
+ */
+int configured_schedule(void)
+{
+    const char *s = getenv("STRASSEN_SCHEDULE");
+    if(s != NULL && strcmp(s, "sections") == 0) {
+        return SCHEDULE_SECTIONS;
+    }
+    return s != NULL && strcmp(s, "stealing") == 0 ? SCHEDULE_STEALING : SCHEDULE_TASKS;
+}
+
+/* Library entry point: sets the variant and schedule from the environment,
+ * the team size to threads (all processors if 0) and the cutoff to cutoff,
+ * or as configure_cutoff() does if that is 0. The stealing schedule runs
+ * on the application's pool if strassen_set_executor() gave one. Returns
+ * 0.
+ */
+int strassen_configure(int threads, int cutoff)
+{
+    configure_variant();
+#ifdef STRASSEN_LIBRARY
+    const strassen_executor *executor = configured_executor();
+    application_pool = executor != NULL ? executor->data : NULL;
+    application_submit = executor != NULL ? executor->submit : NULL;
+    application_workers = executor != NULL ? executor->workers : 0;
+#endif
+    use_schedule(configured_schedule(), threads);
+    if(cutoff > 0) {
+        strassen_cutoff = cutoff;
+    } else {
+        configure_cutoff(NULL);
+    }
+    return 0;
+}
+
+/* Multiplies an m x k matrix a by a k x n matrix b into result on the
+ * configured team, with a workspace of its own for the call.
+ */
+void strassen_product(int m, int k, int n, matrix_view a, matrix_view b, matrix_view result)
+{
+    matrix_type *workspace = allocate_workspace(m, k, n);
+    parallel_strassen(m, k, n, a, b, result, workspace);
+    deallocate_aligned(workspace);
+}
+
+/* Library entry point: stops the threads the stealing schedule started.
+ */
+void strassen_release(void)
+{
+    stealing_shutdown();
+}
+
+//the library takes the engine without the program around it
+#ifndef STRASSEN_LIBRARY
+/* strassen_product() as the in-memory product of the file mode. */
+void file_strassen(int m, int k, int n, matrix_view a, matrix_view b, matrix_view result,
+    void *context)
+{
+    (void) context;
+    strassen_product(m, k, n, a, b, result);
+}
+
+/* Usage: parallel_strassens [--verify] [size | MxKxN] [cutoff | tune | scaling | numa] [threads]
+ *        parallel_strassens size[,size...] bench [threads]
+ * "scaling" prints a strong-scaling report for up to threads threads,
+ * "numa" a NUMA locality report, "bench" a benchmark report.
+ * STRASSEN_SCHEDULE=sections selects the original nested parallel
+ * sections, one team per parallel level,
+ * STRASSEN_SCHEDULE=stealing the work-stealing scheduler without OpenMP,
+ * STRASSEN_NUMA=0 keeps the task schedule off the NUMA nodes,
+ * STRASSEN_VARIANT=winograd the Strassen-Winograd recursion. --verify
+ * checks the product and fails if it is off by more than the error bound.
+ * --a=FILE --b=FILE [--generate] [--out=FILE] [--tile=N] [--memory=BYTES]
+ * multiply matrix files, out of core if they don't fit (see
+ * common/out_of_core.h).
+ */
 int main(int argc, char *argv[])
 {
-    int size = argc == 1 ? 128 : atoi(argv[1]);
-    
-    matrix_type **matrix_a = allocate_matrix(size);
-    matrix_type **matrix_b = allocate_matrix(size);
-    matrix_type **matrix_result = allocate_matrix(size);
+    int verify = take_flag(&argc, argv, "--verify");
+    file_options files;
+    int file_mode = take_file_options(&argc, argv, &files);
+    int m = 128, k = 128, n = 128;
+    if(argc > 1) {
+        parse_shape(argv[1], &m, &k, &n);
+    }
+    configure_variant();
+    int threads = argc > 3 ? atoi(argv[3]) : 0;
+    use_schedule(configured_schedule(), threads);
+
+    if(argc > 2 && strcmp(argv[2], "tune") == 0) {
+        tune_cutoff(m, k, n);
+    } else if(argc > 2 && strcmp(argv[2], "scaling") == 0) {
+        configure_cutoff(NULL);
+        scaling_report(m, k, n, team_size);
+        return 0;
+    } else if(argc > 2 && strcmp(argv[2], "numa") == 0) {
+        configure_cutoff(NULL);
+        locality_report(m, k, n);
+        return 0;
+    } else if(argc > 2 && strcmp(argv[2], "bench") == 0) {
+        configure_cutoff(NULL);
+        benchmark(argv[1], team_size);
+        return 0;
+    } else {
+        configure_cutoff(argc > 2 ? argv[2] : NULL);
+    }
+    if(file_mode) {
+        out_of_core_options options = { file_strassen, NULL, strassen_workspace_bytes };
+        return file_product(&files, m, k, n, &options, verify, strassen_cutoff,
+            strassen_variant == VARIANT_WINOGRAD);
+    }
+
+    matrix_type **matrix_a = allocate_matrix(m, k);
+    matrix_type **matrix_b = allocate_matrix(k, n);
+    matrix_type **matrix_result = allocate_matrix(m, n);
 
-    fill_matrix(size, matrix_a);
-    fill_matrix(size, matrix_b);
-    strassens_multiplication(size, matrix_a, matrix_b, matrix_result);
+    fill_matrix(m, k, matrix_a);
+    fill_matrix(k, n, matrix_b);
 
+    strassen_product(m, k, n, view_of(k, matrix_a), view_of(n, matrix_b),
+        view_of(n, matrix_result));
+
+    if(verify && !verify_product(m, k, n, view_of(k, matrix_a), view_of(n, matrix_b),
+        view_of(n, matrix_result), strassen_cutoff, strassen_variant == VARIANT_WINOGRAD)) {
+        return 1;
+    }
     return 0;
 }
+#endif
@@ -0,0 +1,267 @@
+/* bench.c
+   Timing, statistics, memory high water mark and report output for the
+   "bench" mode of all three programs.
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+#include "bench.h"
+
+#define DEFAULT_WARMUP 1
+#define DEFAULT_REPEATS 5
+#define DEFAULT_NAIVE_MAX 1024
+
+/* Records printed since bench_begin(), to separate JSON objects. */
+static int records_printed = 0;
+
+/* Seconds on a monotonic clock.
+ */
+double wall_time(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (double)count.QuadPart / frequency.QuadPart;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+#endif
+}
+
+/* Peak resident set size of the process in bytes since the last
+ * reset_peak_rss(), or since start up where that can't be reset. 0 when
+ * the platform doesn't say.
+ */
+size_t peak_rss_bytes(void)
+{
+#ifdef _WIN32
+    return 0;
+#else
+    // VmHWM is the resettable high water mark on Linux
+    FILE *f = fopen("/proc/self/status", "r");
+    if(f != NULL) {
+        char line[256];
+        size_t kib = 0;
+        while(fgets(line, sizeof line, f) != NULL) {
+            if(sscanf(line, "VmHWM: %zu kB", &kib) == 1) {
+                break;
+            }
+        }
+        fclose(f);
+        if(kib > 0) {
+            return kib * 1024;
+        }
+    }
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    // ru_maxrss is in KiB on Linux and in bytes on macOS
+#ifdef __APPLE__
+    return (size_t)usage.ru_maxrss;
+#else
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+/* Restarts the peak RSS count at the current resident size, so that each
+ * measurement reports its own peak. Linux only; elsewhere a no-op.
+ */
+void reset_peak_rss(void)
+{
+#ifndef _WIN32
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    if(f != NULL) {
+        fputs("5", f);
+        fclose(f);
+    }
+#endif
+}
+
+static int env_int(const char *name, int fallback)
+{
+    const char *env = getenv(name);
+    return env != NULL ? atoi(env) : fallback;
+}
+
+/* Fills options from the STRASSEN_BENCH_* environment variables.
+ */
+void bench_configure(bench_options *options)
+{
+    const char *format = getenv("STRASSEN_BENCH_FORMAT");
+    options->format = BENCH_TABLE;
+    if(format != NULL && strcmp(format, "csv") == 0) {
+        options->format = BENCH_CSV;
+    } else if(format != NULL && strcmp(format, "json") == 0) {
+        options->format = BENCH_JSON;
+    }
+    options->warmup = env_int("STRASSEN_BENCH_WARMUP", DEFAULT_WARMUP);
+    options->repeats = env_int("STRASSEN_BENCH_REPEATS", DEFAULT_REPEATS);
+    options->naive_max = env_int("STRASSEN_BENCH_NAIVE_MAX", DEFAULT_NAIVE_MAX);
+    if(options->warmup < 0) {
+        options->warmup = 0;
+    }
+    if(options->repeats < 1) {
+        options->repeats = 1;
+    }
+}
+
+/* Reads the next shape off a comma separated list of sizes and MxKxN
+ * shapes ("512,1024,256x512x128") and advances *list past it. Returns 0
+ * when the list is exhausted.
+ */
+int next_shape(const char **list, int *m, int *k, int *n)
+{
+    while(**list == ',') {
+        (*list)++;
+    }
+    if(**list == '\0') {
+        return 0;
+    }
+    if(sscanf(*list, "%dx%dx%d", m, k, n) != 3) {
+        *m = *k = *n = atoi(*list);
+    }
+    *list += strcspn(*list, ",");
+    if(*m <= 0 || *k <= 0 || *n <= 0) {
+        fprintf(stderr, "bad shape in benchmark list\n");
+        return next_shape(list, m, k, n);
+    }
+    return 1;
+}
+
+static int compare_doubles(const void *x, const void *y)
+{
+    double a = *(const double *)x, b = *(const double *)y;
+    return (a > b) - (a < b);
+}
+
+/* Runs multiply options->warmup times untimed and options->repeats times
+ * timed, and fills in the shape, median and p95 (nearest rank) wall time,
+ * GFLOP/s at the median (2mkn flops, whatever the algorithm) and the peak
+ * RSS of record. The other fields are left to the caller.
+ */
+void bench_measure(const bench_options *options, bench_function multiply, void *context,
+    int m, int k, int n, matrix_view a, matrix_view b, matrix_view result, bench_record *record)
+{
+    double *times = (double *) malloc(sizeof(double) * options->repeats);
+    reset_peak_rss();
+    for(int r = 0; r < options->warmup; r++) {
+        multiply(m, k, n, a, b, result, context);
+    }
+    for(int r = 0; r < options->repeats; r++) {
+        double begin = wall_time();
+        multiply(m, k, n, a, b, result, context);
+        times[r] = wall_time() - begin;
+    }
+    qsort(times, options->repeats, sizeof(double), compare_doubles);
+
+    int count = options->repeats;
+    record->m = m;
+    record->k = k;
+    record->n = n;
+    record->median = count % 2 ? times[count / 2] : (times[count / 2 - 1] + times[count / 2]) / 2;
+    record->p95 = times[(95 * count + 99) / 100 - 1];
+    record->gflops = 2.0 * m * k * n / record->median * 1e-9;
+    record->peak_rss = peak_rss_bytes();
+    free(times);
+}
+
+static void naive(int m, int k, int n, matrix_view a, matrix_view b, matrix_view result,
+    void *context)
+{
+    (void) context;
+    naive_matrix_multiplication(m, k, n, a, b, result);
+}
+
+/* Measures and prints naive_matrix_multiplication() for an m x k by k x n
+ * product, unless a dimension exceeds options->naive_max. Returns the
+ * median time to compute speedups from, or -1 when it was skipped.
+ */
+double bench_baseline(const bench_options *options, int m, int k, int n, matrix_view a,
+    matrix_view b, matrix_view result)
+{
+    if(m > options->naive_max || k > options->naive_max || n > options->naive_max) {
+        return -1;
+    }
+    bench_record record = { "naive", "naive" };
+    record.threads = 1;
+    bench_measure(options, naive, NULL, m, k, n, a, b, result, &record);
+    record.speedup = 1;
+    bench_print(options, &record);
+    return record.median;
+}
+
+/* Prints the header of the report.
+ */
+void bench_begin(const bench_options *options)
+{
+    records_printed = 0;
+    if(options->format == BENCH_CSV) {
+        printf("program,variant,m,k,n,threads,cutoff,median_s,p95_s,gflops,speedup,peak_rss_mb\n");
+    } else if(options->format == BENCH_JSON) {
+        printf("[");
+    } else {
+        printf("%-20s %-9s %17s %7s %6s %10s %10s %8s %8s %9s\n", "program", "variant", "shape",
+            "threads", "cutoff", "median s", "p95 s", "GFLOP/s", "speedup", "peak MiB");
+    }
+}
+
+/* Prints one record; a negative speedup is printed as empty, null or -.
+ */
+void bench_print(const bench_options *options, const bench_record *record)
+{
+    double rss_mb = record->peak_rss / (1024.0 * 1024.0);
+    if(options->format == BENCH_CSV) {
+        printf("%s,%s,%d,%d,%d,%d,%d,%.6f,%.6f,%.3f,", record->program, record->variant,
+            record->m, record->k, record->n, record->threads, record->cutoff, record->median,
+            record->p95, record->gflops);
+        if(record->speedup >= 0) {
+            printf("%.3f", record->speedup);
+        }
+        printf(",%.1f\n", rss_mb);
+    } else if(options->format == BENCH_JSON) {
+        printf("%s\n  {\"program\": \"%s\", \"variant\": \"%s\", \"m\": %d, \"k\": %d, \"n\": %d, "
+            "\"threads\": %d, \"cutoff\": %d, \"median_s\": %.6f, \"p95_s\": %.6f, "
+            "\"gflops\": %.3f, \"speedup\": ", records_printed > 0 ? "," : "", record->program,
+            record->variant, record->m, record->k, record->n, record->threads, record->cutoff,
+            record->median, record->p95, record->gflops);
+        if(record->speedup >= 0) {
+            printf("%.3f", record->speedup);
+        } else {
+            printf("null");
+        }
+        printf(", \"peak_rss_mb\": %.1f}", rss_mb);
+    } else {
+        char shape[64];
+        snprintf(shape, sizeof shape, "%dx%dx%d", record->m, record->k, record->n);
+        printf("%-20s %-9s %17s %7d %6d %10.6f %10.6f %8.2f ", record->program, record->variant,
+            shape, record->threads, record->cutoff, record->median, record->p95, record->gflops);
+        if(record->speedup >= 0) {
+            printf("%8.2f", record->speedup);
+        } else {
+            printf("%8s", "-");
+        }
+        printf(" %9.1f\n", rss_mb);
+    }
+    records_printed++;
+    fflush(stdout);
+}
+
+/* Closes the report.
+ */
+void bench_end(const bench_options *options)
+{
+    if(options->format == BENCH_JSON) {
+        printf("\n]\n");
+    }
+}
@@ -0,0 +1,65 @@
+/* bench.h
+   Benchmark driver shared by the serial, OpenMP and OpenCL programs: wall
+   clock timing with warm-up runs and repetitions, median and p95 times,
+   GFLOP/s, peak RSS and speedup over naive_matrix_multiplication(),
+   printed as a table, CSV or JSON.
+*/
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include "matrix.h"
+
+enum { BENCH_TABLE, BENCH_CSV, BENCH_JSON };
+
+/* Read from the environment by bench_configure():
+ *   STRASSEN_BENCH_FORMAT     table, csv or json (table)
+ *   STRASSEN_BENCH_WARMUP     untimed runs before measuring (1)
+ *   STRASSEN_BENCH_REPEATS    timed runs (5)
+ *   STRASSEN_BENCH_NAIVE_MAX  largest dimension the naive baseline is run
+ *                             for; above it there is no speedup (1024)
+ */
+typedef struct {
+    int format;
+    int warmup;
+    int repeats;
+    int naive_max;
+} bench_options;
+
+/* One line of the report. speedup is over the naive baseline of the same
+ * shape and negative when that was not run; peak_rss is the high water
+ * mark of the process during the measurement.
+ */
+typedef struct {
+    const char *program;
+    const char *variant;
+    int m, k, n;
+    int threads;
+    int cutoff;
+    double median;
+    double p95;
+    double gflops;
+    double speedup;
+    size_t peak_rss;
+} bench_record;
+
+/* The product being measured; context is passed through unchanged. */
+typedef void (*bench_function)(int m, int k, int n, matrix_view a, matrix_view b,
+    matrix_view result, void *context);
+
+double wall_time(void);
+size_t peak_rss_bytes(void);
+void reset_peak_rss(void);
+
+void bench_configure(bench_options *options);
+int next_shape(const char **list, int *m, int *k, int *n);
+void bench_measure(const bench_options *options, bench_function multiply, void *context,
+    int m, int k, int n, matrix_view a, matrix_view b, matrix_view result, bench_record *record);
+double bench_baseline(const bench_options *options, int m, int k, int n, matrix_view a,
+    matrix_view b, matrix_view result);
+
+void bench_begin(const bench_options *options);
+void bench_print(const bench_options *options, const bench_record *record);
+void bench_end(const bench_options *options);
+
+#endif
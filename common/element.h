@@ -0,0 +1,267 @@
+/* element.h
+   The element type of the matrices, picked at compile time with
+   -DSTRASSEN_ELEMENT=ELEMENT_<type>:
+     ELEMENT_FLOAT   float (the default)
+     ELEMENT_DOUBLE  double
+     ELEMENT_HALF    IEEE binary16 stored in a uint16_t, added and
+                     multiplied in float
+     ELEMENT_INT32   int32_t, exact modulo 2^32
+     ELEMENT_INT64   int64_t, exact modulo 2^64
+   matrix_type is what matrices and workspaces hold and accumulator_type
+   what sums and products are computed in; ELEMENT_GET() and ELEMENT_SET()
+   convert between them. Integers are computed unsigned, so that overflow
+   wraps instead of being undefined.
+
+   Every type but float prefixes the external names of common/ with its
+   name (allocate_matrix becomes double_allocate_matrix), so that
+   instantiations for several types link into one program side by side.
+*/
+#ifndef ELEMENT_H
+#define ELEMENT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+#include <inttypes.h>
+
+#define ELEMENT_FLOAT  1
+#define ELEMENT_DOUBLE 2
+#define ELEMENT_HALF   3
+#define ELEMENT_INT32  4
+#define ELEMENT_INT64  5
+
+#ifndef STRASSEN_ELEMENT
+#define STRASSEN_ELEMENT ELEMENT_FLOAT
+#endif
+
+#define ELEMENT_CONCAT_(prefix, name) prefix##name
+#define ELEMENT_CONCAT(prefix, name) ELEMENT_CONCAT_(prefix, name)
+
+/* binary16 <-> float with round to nearest even, for compilers and CPUs
+ * without a half type; the row kernels use F16C where there is one.
+ */
+static inline float half_to_float(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    uint32_t bits;
+    if(exponent == 0x1f) {
+        bits = sign | 0x7f800000 | mantissa << 13;
+    } else if(exponent != 0) {
+        bits = sign | (exponent + 112) << 23 | mantissa << 13;
+    } else if(mantissa == 0) {
+        bits = sign;
+    } else {
+        // subnormal: normalise into a float exponent
+        int shift = 0;
+        while(!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            shift++;
+        }
+        bits = sign | (uint32_t)(113 - shift) << 23 | (mantissa & 0x3ff) << 13;
+    }
+    float f;
+    memcpy(&f, &bits, sizeof f);
+    return f;
+}
+
+static inline uint16_t float_to_half(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof bits);
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t mantissa = bits & 0x7fffff;
+    int exponent = (int)((bits >> 23) & 0xff) - 112;
+    if(exponent == 0xff - 112) {
+        return (uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    }
+    if(exponent >= 31) {
+        return (uint16_t)(sign | 0x7c00);
+    }
+    if(exponent <= 0) {
+        if(exponent < -10) {
+            return (uint16_t)sign;
+        }
+        // subnormal: shift the full significand down to units of 2^-24
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if(rest > halfway || (rest == halfway && (half & 1))) {
+            half++;
+        }
+        return (uint16_t)(sign | half);
+    }
+    // a carry out of the mantissa rounds up into the exponent, or to infinity
+    uint32_t half = (uint32_t)exponent << 10 | mantissa >> 13;
+    uint32_t rest = mantissa & 0x1fff;
+    if(rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        half++;
+    }
+    return (uint16_t)(sign | half);
+}
+
+#if STRASSEN_ELEMENT == ELEMENT_FLOAT
+typedef float matrix_type;
+typedef float accumulator_type;
+#define ELEMENT_LABEL "float"
+#define ELEMENT_UNIT_ROUNDOFF (FLT_EPSILON / 2)
+#define FORMAT "%f\t"
+#elif STRASSEN_ELEMENT == ELEMENT_DOUBLE
+typedef double matrix_type;
+typedef double accumulator_type;
+#define ELEMENT_LABEL "double"
+#define ELEMENT_PREFIX double_
+#define ELEMENT_UNIT_ROUNDOFF (DBL_EPSILON / 2)
+#define FORMAT "%f\t"
+#elif STRASSEN_ELEMENT == ELEMENT_HALF
+typedef uint16_t matrix_type;
+typedef float accumulator_type;
+#define ELEMENT_LABEL "half"
+#define ELEMENT_PREFIX half_
+// every sum of the recursion is rounded to half when it is stored
+#define ELEMENT_UNIT_ROUNDOFF (1.0 / 2048)
+#define FORMAT "%f\t"
+#define ELEMENT_CONVERTS 1
+#define ELEMENT_GET(x) half_to_float(x)
+#define ELEMENT_SET(x) float_to_half(x)
+// products of the 0..99 of fill_matrix() would overflow half from k = 7
+#define FILL_VALUE(r) float_to_half((r) / 64.0f)
+#elif STRASSEN_ELEMENT == ELEMENT_INT32
+typedef int32_t matrix_type;
+typedef uint32_t accumulator_type;
+#define ELEMENT_LABEL "int32"
+#define ELEMENT_PREFIX int32_
+#define ELEMENT_UNIT_ROUNDOFF 0.0
+#define FORMAT "%" PRId32 "\t"
+#define ELEMENT_INTEGER 1
+#elif STRASSEN_ELEMENT == ELEMENT_INT64
+typedef int64_t matrix_type;
+typedef uint64_t accumulator_type;
+#define ELEMENT_LABEL "int64"
+#define ELEMENT_PREFIX int64_
+#define ELEMENT_UNIT_ROUNDOFF 0.0
+#define FORMAT "%" PRId64 "\t"
+#define ELEMENT_INTEGER 1
+#else
+#error "STRASSEN_ELEMENT must be one of ELEMENT_FLOAT, ELEMENT_DOUBLE, ELEMENT_HALF, ELEMENT_INT32 or ELEMENT_INT64"
+#endif
+
+/* Whether matrix_type has to be converted to be computed with, so that
+ * a matrix_type * can't be used as an accumulator_type *.
+ */
+#ifndef ELEMENT_CONVERTS
+#define ELEMENT_CONVERTS 0
+#define ELEMENT_GET(x) ((accumulator_type)(x))
+#define ELEMENT_SET(x) ((matrix_type)(x))
+#endif
+#ifndef ELEMENT_INTEGER
+#define ELEMENT_INTEGER 0
+#endif
+#ifndef FILL_VALUE
+#define FILL_VALUE(r) ((matrix_type)(r))
+#endif
+
+/* An element as a double, for checking and printing; integers keep
+ * their sign.
+ */
+#if ELEMENT_CONVERTS
+#define ELEMENT_VALUE(x) ((double)ELEMENT_GET(x))
+#else
+#define ELEMENT_VALUE(x) ((double)(x))
+#endif
+#if ELEMENT_INTEGER
+#define PRINT_VALUE(x) (x)
+#else
+#define PRINT_VALUE(x) ELEMENT_VALUE(x)
+#endif
+
+#ifdef ELEMENT_PREFIX
+#define ELEMENT_NAME(name) ELEMENT_CONCAT(ELEMENT_PREFIX, name)
+#define add_matrices                  ELEMENT_NAME(add_matrices)
+#define add_row                       ELEMENT_NAME(add_row)
+#define aligned_elements              ELEMENT_NAME(aligned_elements)
+#define allocate_aligned              ELEMENT_NAME(allocate_aligned)
+#define allocate_matrix               ELEMENT_NAME(allocate_matrix)
+#define bench_baseline                ELEMENT_NAME(bench_baseline)
+#define bench_begin                   ELEMENT_NAME(bench_begin)
+#define bench_configure               ELEMENT_NAME(bench_configure)
+#define bench_end                     ELEMENT_NAME(bench_end)
+#define bench_measure                 ELEMENT_NAME(bench_measure)
+#define bench_print                   ELEMENT_NAME(bench_print)
+#define bind_to_node                  ELEMENT_NAME(bind_to_node)
+#define blocked_matrix_multiplication ELEMENT_NAME(blocked_matrix_multiplication)
+#define blocked_scratch_size          ELEMENT_NAME(blocked_scratch_size)
+#define bytes_on_node                 ELEMENT_NAME(bytes_on_node)
+#define combine_matrices              ELEMENT_NAME(combine_matrices)
+#define combine_row                   ELEMENT_NAME(combine_row)
+#define current_node                  ELEMENT_NAME(current_node)
+#define deallocate_aligned            ELEMENT_NAME(deallocate_aligned)
+#define deallocate_matrix             ELEMENT_NAME(deallocate_matrix)
+#define default_memory_budget         ELEMENT_NAME(default_memory_budget)
+#define file_product                  ELEMENT_NAME(file_product)
+#define fill_key                      ELEMENT_NAME(fill_key)
+#define fill_matrix                   ELEMENT_NAME(fill_matrix)
+#define fill_row                      ELEMENT_NAME(fill_row)
+#define fill_view                     ELEMENT_NAME(fill_view)
+#define from_morton                   ELEMENT_NAME(from_morton)
+#define matrix_file_close             ELEMENT_NAME(matrix_file_close)
+#define matrix_file_create            ELEMENT_NAME(matrix_file_create)
+#define matrix_file_fill              ELEMENT_NAME(matrix_file_fill)
+#define matrix_file_open              ELEMENT_NAME(matrix_file_open)
+#define matrix_file_read              ELEMENT_NAME(matrix_file_read)
+#define matrix_file_temporary         ELEMENT_NAME(matrix_file_temporary)
+#define matrix_file_tile              ELEMENT_NAME(matrix_file_tile)
+#define matrix_file_view              ELEMENT_NAME(matrix_file_view)
+#define matrix_file_write             ELEMENT_NAME(matrix_file_write)
+#define matrix_pad_rows               ELEMENT_NAME(matrix_pad_rows)
+#define matrix_stride                 ELEMENT_NAME(matrix_stride)
+#define memory_nodes                  ELEMENT_NAME(memory_nodes)
+#define morton_add                    ELEMENT_NAME(morton_add)
+#define morton_combine                ELEMENT_NAME(morton_combine)
+#define morton_elements               ELEMENT_NAME(morton_elements)
+#define morton_shape_of               ELEMENT_NAME(morton_shape_of)
+#define morton_subtract               ELEMENT_NAME(morton_subtract)
+#define naive_matrix_multiplication   ELEMENT_NAME(naive_matrix_multiplication)
+#define next_shape                    ELEMENT_NAME(next_shape)
+#define out_of_core_multiply          ELEMENT_NAME(out_of_core_multiply)
+#define parse_bytes                   ELEMENT_NAME(parse_bytes)
+#define peak_rss_bytes                ELEMENT_NAME(peak_rss_bytes)
+#define place_on_node                 ELEMENT_NAME(place_on_node)
+#define print_matrix                  ELEMENT_NAME(print_matrix)
+#define profile_depth                 ELEMENT_NAME(profile_depth)
+#define profile_enter                 ELEMENT_NAME(profile_enter)
+#define profile_start                 ELEMENT_NAME(profile_start)
+#define profile_stop                  ELEMENT_NAME(profile_stop)
+#define quadrant                      ELEMENT_NAME(quadrant)
+#define reference_multiplication      ELEMENT_NAME(reference_multiplication)
+#define reset_peak_rss                ELEMENT_NAME(reset_peak_rss)
+#define restore_binding               ELEMENT_NAME(restore_binding)
+#define simd_isa                      ELEMENT_NAME(simd_isa)
+#define stealing_configure            ELEMENT_NAME(stealing_configure)
+#define stealing_for                  ELEMENT_NAME(stealing_for)
+#define stealing_processors           ELEMENT_NAME(stealing_processors)
+#define stealing_run                  ELEMENT_NAME(stealing_run)
+#define stealing_shutdown             ELEMENT_NAME(stealing_shutdown)
+#define stealing_worker               ELEMENT_NAME(stealing_worker)
+#define stealing_workers              ELEMENT_NAME(stealing_workers)
+#define strassen_error_bound          ELEMENT_NAME(strassen_error_bound)
+#define sub_view                      ELEMENT_NAME(sub_view)
+#define subtract_matrices             ELEMENT_NAME(subtract_matrices)
+#define subtract_row                  ELEMENT_NAME(subtract_row)
+#define take_block                    ELEMENT_NAME(take_block)
+#define take_file_options             ELEMENT_NAME(take_file_options)
+#define take_flag                     ELEMENT_NAME(take_flag)
+#define take_option                   ELEMENT_NAME(take_option)
+#define temporary_directory           ELEMENT_NAME(temporary_directory)
+#define to_morton                     ELEMENT_NAME(to_morton)
+#define verify_product                ELEMENT_NAME(verify_product)
+#define view_of                       ELEMENT_NAME(view_of)
+#define wall_time                     ELEMENT_NAME(wall_time)
+#else
+#define ELEMENT_NAME(name) name
+#endif
+
+#endif
@@ -0,0 +1,404 @@
+/*
+  Original code written by Henrik Almer - https://github.com/henrikalmer
+  ---Added dynamic allocation of memory to matrices---
+  Storage, views and elementwise kernels shared by all three programs.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include "matrix.h"
+#include "simd.h"
+#include "profile.h"
+#include "random.h"
+
+/* Tile sizes of blocked_matrix_multiplication(): TILE_K rows of b by
+ * TILE_J columns (128 x 256 floats = 128 KiB, twice that for the 64-bit
+ * types) stay resident in L2.
+ */
+#define TILE_K 128
+#define TILE_J 256
+
+/* Rows of the result that types which convert (half) work on at a time,
+ * with TILE_J of its columns and TILE_K of the inner dimension.
+ */
+#define TILE_I 256
+
+int matrix_pad_rows = 1;
+
+#ifdef STRASSEN_PROFILE
+/* Bytes an m x k by k x n product moves at the least: a and b read and
+ * result written, and read too when accumulating.
+ */
+static size_t multiply_bytes(int m, int k, int n, int accumulate)
+{
+    return sizeof(matrix_type) * ((size_t)m * k + (size_t)k * n + (size_t)m * n * (1 + accumulate));
+}
+#endif
+
+/* Allocates bytes of MATRIX_ALIGNMENT aligned storage. Never returns NULL
+ * and never asks for 0 bytes.
+ */
+void * allocate_aligned(size_t bytes)
+{
+    PROFILE_START(mark);
+    // round up to whole cache lines, aligned_alloc() requires it
+    bytes = (bytes + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+    if(bytes == 0) {
+        bytes = MATRIX_ALIGNMENT;
+    }
+#ifdef _WIN32
+    void *p = _aligned_malloc(bytes, MATRIX_ALIGNMENT);
+#else
+    void *p = aligned_alloc(MATRIX_ALIGNMENT, bytes);
+#endif
+    assert (p != NULL);
+    PROFILE_STOP(mark, PHASE_ALLOCATE, bytes, 0);
+    return p;
+}
+
+void deallocate_aligned(void *p)
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+/* Number of elements count rounded up to whole cache lines.
+ */
+size_t aligned_elements(size_t count)
+{
+    size_t line = MATRIX_ALIGNMENT / sizeof(matrix_type);
+    return (count + line - 1) / line * line;
+}
+
+/* Row stride, in elements, of a matrix with cols columns: rows start on a
+ * cache line boundary and, with matrix_pad_rows set, strides that are a
+ * multiple of MATRIX_PAD_PERIOD bytes are skewed by one cache line.
+ */
+int matrix_stride(int cols)
+{
+    int stride = (int)aligned_elements(cols);
+    if(matrix_pad_rows && stride * sizeof(matrix_type) % MATRIX_PAD_PERIOD == 0) {
+        stride += MATRIX_ALIGNMENT / sizeof(matrix_type);
+    }
+    return stride;
+}
+
+/*
+allocate_matrix() is a function to allocate the matrix onto heap storage
+the matrix is an array of row pointers into one contiguous, cache line
+aligned block with rows matrix_stride(cols) elements apart, so that views
+with a leading dimension can address any block of it in place
+*/
+matrix_type ** allocate_matrix(int rows, int cols) 
+{
+    int stride = matrix_stride(cols);
+    matrix_type **matrix_rows = (matrix_type**) malloc(sizeof (matrix_type *) * rows);
+    assert (matrix_rows != NULL); 
+    matrix_type * full_data = (matrix_type *) allocate_aligned(sizeof(matrix_type) * rows * (size_t)stride);
+    for (int i = 0; i < rows; ++i)
+    {
+        matrix_rows[i] = full_data + (size_t)i * stride;
+    }
+    return matrix_rows;
+}
+
+/*
+deallocate_matrix() is a function which deallocates a matrix once it's use is over
+*/
+
+void deallocate_matrix(matrix_type ** m, int rows)
+{
+    // the rows share one block
+    (void) rows;
+    deallocate_aligned(m[0]);
+    free (m);
+}
+
+/* View of a whole matrix of cols columns returned by allocate_matrix().
+ */
+matrix_view view_of(int cols, matrix_type **matrix)
+{
+    matrix_view v = { matrix[0], matrix_stride(cols) };
+    return v;
+}
+
+/* View of the block of v starting at element (row, col).
+ */
+matrix_view sub_view(matrix_view v, int row, int col)
+{
+    matrix_view q = { v.base + (size_t)row * v.ld + col, v.ld };
+    return q;
+}
+
+/* View of quadrant (row, col) of v, where row and col are 0 or 1 and a
+ * quadrant is block_rows x block_cols.
+ */
+matrix_view quadrant(matrix_view v, int block_rows, int block_cols, int row, int col)
+{
+    return sub_view(v, row * block_rows, col * block_cols);
+}
+
+/* Takes the next rows x cols block off the front of a workspace. Blocks
+ * are packed (ld == cols) and each one is rounded up to whole cache lines,
+ * so a workspace sized with aligned_elements() keeps them all aligned.
+ */
+matrix_view take_block(matrix_type **workspace, int rows, int cols)
+{
+    matrix_view v = { *workspace, cols };
+    *workspace += aligned_elements((size_t)rows * cols);
+    return v;
+}
+
+/* Takes a pointer to a 2-dimensional array matrix_type matrix of rows x cols
+ * and prints it to stdout, preceeded by a char label.
+ */
+void print_matrix(char *label, int rows, int cols, matrix_type **matrix)
+{
+    printf("\n\n%s\n", label);
+    printf("{\n");
+    for(int i = 0; i < rows; i++) {
+        printf("\t[");
+        for(int j = 0; j < cols; j++) {
+            printf(FORMAT, PRINT_VALUE(matrix[i][j]));
+        }
+        printf("]\n");
+    }
+    printf("}\n");
+}
+
+/* Takes a pointer to a 2-dimensional array matrix_type matrix of rows x cols
+ * and fills it with the next stream of random numbers of random.h, by
+ * default whole numbers 0 to 99 except for half (see FILL_VALUE).
+ */
+void fill_matrix(int rows, int cols, matrix_type **matrix)
+{
+    fill_view(fill_key(), rows, cols, view_of(cols, matrix));
+}
+
+/* Iterative matrix multiplication of an m x k by a k x n matrix. The
+ * naive implementation.
+ */
+void naive_matrix_multiplication(int m, int k, int n, matrix_view a, matrix_view b, matrix_view result)
+{
+    PROFILE_START(mark);
+    for(int i = 0; i < m; i++) {
+        for(int j = 0; j < n; j++) {
+            accumulator_type sum = 0;
+            for(int p = 0; p < k; p++) {
+                sum += ELEMENT_GET(VIEW_AT(a, i, p)) * ELEMENT_GET(VIEW_AT(b, p, j));
+            }
+            VIEW_AT(result, i, j) = ELEMENT_SET(sum);
+        }
+    }
+    PROFILE_STOP(mark, PHASE_MULTIPLY, multiply_bytes(m, k, n, 0), 2.0 * m * k * n);
+}
+
+/* The loops of blocked_matrix_multiplication(), adding the product of an
+ * m x k by a k x n array to c. For each TILE_K x TILE_J tile of b, four
+ * rows of c are updated at a time from contiguous rows of b, so the inner
+ * loop streams along rows and vectorises.
+ */
+static void blocked_accumulate(int m, int k, int n, const accumulator_type *a, size_t lda,
+    const accumulator_type *b, size_t ldb, accumulator_type *c, size_t ldc)
+{
+    for(int jj = 0; jj < n; jj += TILE_J) {
+        int j_end = jj + TILE_J < n ? jj + TILE_J : n;
+        for(int kk = 0; kk < k; kk += TILE_K) {
+            int k_end = kk + TILE_K < k ? kk + TILE_K : k;
+            int i = 0;
+            for(; i + 4 <= m; i += 4) {
+                accumulator_type *restrict c0 = c + i * ldc;
+                accumulator_type *restrict c1 = c + (i + 1) * ldc;
+                accumulator_type *restrict c2 = c + (i + 2) * ldc;
+                accumulator_type *restrict c3 = c + (i + 3) * ldc;
+                for(int p = kk; p < k_end; p++) {
+                    const accumulator_type *restrict bp = b + p * ldb;
+                    accumulator_type a0 = a[i * lda + p];
+                    accumulator_type a1 = a[(i + 1) * lda + p];
+                    accumulator_type a2 = a[(i + 2) * lda + p];
+                    accumulator_type a3 = a[(i + 3) * lda + p];
+                    for(int j = jj; j < j_end; j++) {
+                        c0[j] += a0 * bp[j];
+                        c1[j] += a1 * bp[j];
+                        c2[j] += a2 * bp[j];
+                        c3[j] += a3 * bp[j];
+                    }
+                }
+            }
+            for(; i < m; i++) {
+                accumulator_type *restrict c0 = c + i * ldc;
+                for(int p = kk; p < k_end; p++) {
+                    const accumulator_type *restrict bp = b + p * ldb;
+                    accumulator_type a0 = a[i * lda + p];
+                    for(int j = jj; j < j_end; j++) {
+                        c0[j] += a0 * bp[j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+#if ELEMENT_CONVERTS
+/* Number of elements that hold count accumulator_type ones, rounded up
+ * to whole cache lines like take_block().
+ */
+static size_t wide_elements(size_t count)
+{
+    return aligned_elements((count * sizeof(accumulator_type) + sizeof(matrix_type) - 1)
+        / sizeof(matrix_type));
+}
+
+/* Copies a rows x cols view into the packed accumulator_type array wide. */
+static void widen(int rows, int cols, matrix_view v, accumulator_type *wide)
+{
+    for(int i = 0; i < rows; i++) {
+        for(int j = 0; j < cols; j++) {
+            wide[(size_t)i * cols + j] = ELEMENT_GET(VIEW_AT(v, i, j));
+        }
+    }
+}
+#endif
+
+/* Number of elements of scratch blocked_matrix_multiplication() needs
+ * for an m x k by k x n product: an accumulator_type tile of each
+ * operand and of the result for types that convert, none otherwise. It
+ * is never more than for a TILE_I x TILE_K by TILE_K x TILE_J product.
+ */
+size_t blocked_scratch_size(int m, int k, int n)
+{
+#if ELEMENT_CONVERTS
+    size_t rows = m < TILE_I ? m : TILE_I;
+    size_t inner = k < TILE_K ? k : TILE_K;
+    size_t cols = n < TILE_J ? n : TILE_J;
+    return wide_elements(rows * inner) + wide_elements(inner * cols) + wide_elements(rows * cols);
+#else
+    (void) m;
+    (void) k;
+    (void) n;
+    return 0;
+#endif
+}
+
+/* Cache- and register-blocked i-k-j multiplication of an m x k by a k x n
+ * matrix, used below the recursion cutoff and for the peeled edges of odd
+ * sizes. With accumulate set the product is added to result instead of
+ * overwriting it. Types that convert to be computed with (half) are
+ * widened a tile at a time into accumulator_type copies in scratch, which
+ * must hold blocked_scratch_size(m, k, n) elements (NULL has it
+ * allocated), so the whole dot product is accumulated in float and
+ * rounded once. Products no larger than a tile, like the leaves of the
+ * recursion, convert each element once: O(mk + kn + mn) against the
+ * O(mkn) multiply. Other types ignore scratch.
+ */
+void blocked_matrix_multiplication(int m, int k, int n, matrix_view a, matrix_view b,
+    matrix_view result, int accumulate, matrix_type *scratch)
+{
+    PROFILE_START(mark);
+#if ELEMENT_CONVERTS
+    if(m == 0 || n == 0) {
+        return;
+    }
+    matrix_type *allocated = NULL;
+    if(scratch == NULL) {
+        allocated = scratch = (matrix_type *) allocate_aligned(
+            sizeof(matrix_type) * blocked_scratch_size(m, k, n));
+    }
+    size_t tile_i = m < TILE_I ? m : TILE_I;
+    size_t tile_k = k < TILE_K ? k : TILE_K;
+    size_t tile_j = n < TILE_J ? n : TILE_J;
+    accumulator_type *wide_a = (accumulator_type *) scratch;
+    accumulator_type *wide_b = (accumulator_type *) (scratch + wide_elements(tile_i * tile_k));
+    accumulator_type *wide_result = (accumulator_type *) (scratch + wide_elements(tile_i * tile_k)
+        + wide_elements(tile_k * tile_j));
+    for(int ii = 0; ii < m; ii += TILE_I) {
+        int rows = m - ii < TILE_I ? m - ii : TILE_I;
+        for(int jj = 0; jj < n; jj += TILE_J) {
+            int cols = n - jj < TILE_J ? n - jj : TILE_J;
+            matrix_view c = sub_view(result, ii, jj);
+            if(accumulate) {
+                widen(rows, cols, c, wide_result);
+            } else {
+                memset(wide_result, 0, sizeof(accumulator_type) * rows * (size_t)cols);
+            }
+            for(int kk = 0; kk < k; kk += TILE_K) {
+                int inner = k - kk < TILE_K ? k - kk : TILE_K;
+                widen(rows, inner, sub_view(a, ii, kk), wide_a);
+                widen(inner, cols, sub_view(b, kk, jj), wide_b);
+                blocked_accumulate(rows, inner, cols, wide_a, inner, wide_b, cols, wide_result,
+                    cols);
+            }
+            for(int i = 0; i < rows; i++) {
+                for(int j = 0; j < cols; j++) {
+                    VIEW_AT(c, i, j) = ELEMENT_SET(wide_result[(size_t)i * cols + j]);
+                }
+            }
+        }
+    }
+    if(allocated != NULL) {
+        deallocate_aligned(allocated);
+    }
+#else
+    (void) scratch;
+    if(!accumulate) {
+        for(int i = 0; i < m; i++) {
+            for(int j = 0; j < n; j++) {
+                VIEW_AT(result, i, j) = 0;
+            }
+        }
+    }
+    // matrix_type is accumulator_type or its signed counterpart, which
+    // may alias it
+    blocked_accumulate(m, k, n, (const accumulator_type *) a.base, a.ld,
+        (const accumulator_type *) b.base, b.ld, (accumulator_type *) result.base, result.ld);
+#endif
+    PROFILE_STOP(mark, PHASE_MULTIPLY, multiply_bytes(m, k, n, accumulate), 2.0 * m * k * n);
+}
+
+/* Subtract two rows x cols matrices. result may be the same view as a or b.
+ */
+void subtract_matrices(int rows, int cols, matrix_view a, matrix_view b, matrix_view result)
+{
+    PROFILE_START(mark);
+    for(int i = 0; i < rows; i++) {
+        subtract_row(&VIEW_AT(a, i, 0), &VIEW_AT(b, i, 0), &VIEW_AT(result, i, 0), cols);
+    }
+    PROFILE_STOP(mark, PHASE_ADD, 3 * sizeof(matrix_type) * rows * (size_t)cols,
+        (double) rows * cols);
+}
+
+/* Add two rows x cols matrices. result may be the same view as a or b.
+ */
+void add_matrices(int rows, int cols, matrix_view a, matrix_view b, matrix_view result)
+{
+    PROFILE_START(mark);
+    for(int i = 0; i < rows; i++) {
+        add_row(&VIEW_AT(a, i, 0), &VIEW_AT(b, i, 0), &VIEW_AT(result, i, 0), cols);
+    }
+    PROFILE_STOP(mark, PHASE_ADD, 3 * sizeof(matrix_type) * rows * (size_t)cols,
+        (double) rows * cols);
+}
+
+/* result = a + b - c + d over rows x cols matrices, in a single pass. This
+ * is the shape of both c11 = m1 + m4 - m5 + m7 and c22 = m1 + m3 - m2 + m6,
+ * which otherwise take three passes through a temporary. result may be the
+ * same view as any input.
+ */
+void combine_matrices(int rows, int cols, matrix_view a, matrix_view b, matrix_view c,
+    matrix_view d, matrix_view result)
+{
+    PROFILE_START(mark);
+    for(int i = 0; i < rows; i++) {
+        combine_row(&VIEW_AT(a, i, 0), &VIEW_AT(b, i, 0), &VIEW_AT(c, i, 0),
+            &VIEW_AT(d, i, 0), &VIEW_AT(result, i, 0), cols);
+    }
+    PROFILE_STOP(mark, PHASE_COMBINE, 5 * sizeof(matrix_type) * rows * (size_t)cols,
+        3.0 * rows * cols);
+}
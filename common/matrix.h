@@ -0,0 +1,60 @@
+/* matrix.h
+   Storage, views and elementwise kernels shared by the serial, OpenMP and
+   OpenCL Strassen programs.
+*/
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <stddef.h>
+#include "element.h"
+
+/* Every matrix and workspace block starts on a cache line boundary.
+ */
+#define MATRIX_ALIGNMENT 64
+
+/* When set (the default), row strides that are a multiple of
+ * MATRIX_PAD_PERIOD bytes get one extra cache line so that the rows of a
+ * power of two sized matrix don't all map to the same cache sets. Must
+ * not change while matrices are allocated.
+ */
+#define MATRIX_PAD_PERIOD 512
+extern int matrix_pad_rows;
+
+/* A view of a block of a row-major matrix: element (i, j) of the view is
+ * base[i * ld + j]. Quadrants are views into their parent with the same
+ * leading dimension, so the recursion never copies a11..b22 out.
+ */
+typedef struct {
+    matrix_type *base;
+    int ld;
+} matrix_view;
+
+#define VIEW_AT(v, i, j) ((v).base[(size_t)(i) * (v).ld + (j)])
+
+void * allocate_aligned(size_t bytes);
+void deallocate_aligned(void *p);
+
+int matrix_stride(int cols);
+size_t aligned_elements(size_t count);
+
+matrix_type ** allocate_matrix(int rows, int cols);
+void deallocate_matrix(matrix_type ** m, int rows);
+
+matrix_view view_of(int cols, matrix_type **matrix);
+matrix_view sub_view(matrix_view v, int row, int col);
+matrix_view quadrant(matrix_view v, int block_rows, int block_cols, int row, int col);
+matrix_view take_block(matrix_type **workspace, int rows, int cols);
+
+void print_matrix(char *label, int rows, int cols, matrix_type **matrix);
+void fill_matrix(int rows, int cols, matrix_type **matrix);
+
+void naive_matrix_multiplication(int m, int k, int n, matrix_view a, matrix_view b, matrix_view result);
+size_t blocked_scratch_size(int m, int k, int n);
+void blocked_matrix_multiplication(int m, int k, int n, matrix_view a, matrix_view b,
+    matrix_view result, int accumulate, matrix_type *scratch);
+void subtract_matrices(int rows, int cols, matrix_view a, matrix_view b, matrix_view result);
+void add_matrices(int rows, int cols, matrix_view a, matrix_view b, matrix_view result);
+void combine_matrices(int rows, int cols, matrix_view a, matrix_view b, matrix_view c,
+    matrix_view d, matrix_view result);
+
+#endif
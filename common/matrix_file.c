@@ -0,0 +1,430 @@
+/* matrix_file.c
+   Creating, mapping and filling the tiled matrix files of matrix_file.h,
+   with mmap() or, on Windows, a file mapping object.
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "matrix_file.h"
+#include "profile.h"
+#include "random.h"
+
+static void set_geometry(matrix_file *file, int rows, int cols, int tile_rows, int tile_cols)
+{
+    file->rows = rows;
+    file->cols = cols;
+    file->tile_rows = tile_rows;
+    file->tile_cols = tile_cols;
+    file->tiles_down = (rows + tile_rows - 1) / tile_rows;
+    file->tiles_across = (cols + tile_cols - 1) / tile_cols;
+}
+
+/* Size of the whole file, or 0 if it doesn't fit in a size_t. */
+static size_t file_bytes(const matrix_file *file)
+{
+    uint64_t tile = (uint64_t)file->tile_rows * file->tile_cols * sizeof(matrix_type);
+    uint64_t bytes = MATRIX_FILE_DATA_OFFSET
+        + (uint64_t)file->tiles_down * file->tiles_across * tile;
+    return bytes == (size_t)bytes ? (size_t)bytes : 0;
+}
+
+#ifdef _WIN32
+/* Maps the first bytes of the file open in file->handle, closing it if
+ * that fails.
+ */
+static int map_handle(matrix_file *file, const char *path, size_t bytes, int writable)
+{
+    file->writable = writable;
+    file->mapping = CreateFileMappingA(file->handle, NULL,
+        writable ? PAGE_READWRITE : PAGE_READONLY, (DWORD)((uint64_t)bytes >> 32), (DWORD)bytes,
+        NULL);
+    file->map = file->mapping != NULL ? MapViewOfFile(file->mapping,
+        writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, bytes) : NULL;
+    if(file->map == NULL) {
+        fprintf(stderr, "%s: can't map (error %lu)\n", path, GetLastError());
+        if(file->mapping != NULL) {
+            CloseHandle(file->mapping);
+        }
+        CloseHandle(file->handle);
+        return -1;
+    }
+    file->map_bytes = bytes;
+    return 0;
+}
+
+/* Creates the file at path, or a temporary one in directory if path is
+ * NULL, of bytes zero bytes and maps it for writing.
+ */
+static int create_and_map(matrix_file *file, const char *path, const char *directory,
+    size_t bytes)
+{
+    char name[MAX_PATH];
+    DWORD flags = FILE_ATTRIBUTE_NORMAL;
+    if(path == NULL) {
+        if(GetTempFileNameA(directory, "smt", 0, name) == 0) {
+            fprintf(stderr, "%s: can't create a temporary file (error %lu)\n", directory,
+                GetLastError());
+            return -1;
+        }
+        path = name;
+        flags = FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE;
+    }
+    file->handle = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+        CREATE_ALWAYS, flags, NULL);
+    if(file->handle == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "%s: can't create (error %lu)\n", path, GetLastError());
+        return -1;
+    }
+    LARGE_INTEGER size;
+    size.QuadPart = (LONGLONG)bytes;
+    if(!SetFilePointerEx(file->handle, size, NULL, FILE_BEGIN) || !SetEndOfFile(file->handle)) {
+        fprintf(stderr, "%s: can't grow to %zu bytes (error %lu)\n", path, bytes, GetLastError());
+        CloseHandle(file->handle);
+        return -1;
+    }
+    return map_handle(file, path, bytes, 1);
+}
+
+static int open_existing(matrix_file *file, const char *path)
+{
+    file->handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file->handle == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "%s: can't open (error %lu)\n", path, GetLastError());
+        return -1;
+    }
+    return 0;
+}
+
+/* Size of the file open in file, for checking the header against; 0 if
+ * it can't be found out.
+ */
+static size_t existing_bytes(const matrix_file *file, const char *path)
+{
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file->handle, &size)) {
+        fprintf(stderr, "%s: can't get the size (error %lu)\n", path, GetLastError());
+        return 0;
+    }
+    return (size_t)size.QuadPart;
+}
+
+static int read_header(matrix_file *file, matrix_file_header *header)
+{
+    DWORD got = 0;
+    return ReadFile(file->handle, header, sizeof *header, &got, NULL) && got == sizeof *header;
+}
+
+static void close_existing(matrix_file *file)
+{
+    CloseHandle(file->handle);
+}
+
+static int map_existing(matrix_file *file, const char *path, size_t bytes)
+{
+    return map_handle(file, path, bytes, 0);
+}
+
+void matrix_file_close(matrix_file *file)
+{
+    UnmapViewOfFile(file->map);
+    CloseHandle(file->mapping);
+    CloseHandle(file->handle);
+}
+#else
+/* Maps the first bytes of the file open in file->fd, closing it if that
+ * fails.
+ */
+static int map_descriptor(matrix_file *file, const char *path, size_t bytes, int writable)
+{
+    file->writable = writable;
+    file->map = mmap(NULL, bytes, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+        file->fd, 0);
+    if(file->map == MAP_FAILED) {
+        fprintf(stderr, "%s: can't map: %s\n", path, strerror(errno));
+        close(file->fd);
+        return -1;
+    }
+    file->map_bytes = bytes;
+    return 0;
+}
+
+/* Creates the file at path, or a temporary one in directory if path is
+ * NULL, of bytes zero bytes and maps it for writing.
+ */
+static int create_and_map(matrix_file *file, const char *path, const char *directory,
+    size_t bytes)
+{
+    if(path == NULL) {
+        if(directory == NULL) {
+            fprintf(stderr, "no directory for a temporary matrix file\n");
+            return -1;
+        }
+        // unlinked at once, so the file goes away with the descriptor
+        size_t length = strlen(directory) + sizeof "/strassen-XXXXXX";
+        char *name = (char *) malloc(length);
+        if(name == NULL) {
+            fprintf(stderr, "%s: out of memory\n", directory);
+            return -1;
+        }
+        snprintf(name, length, "%s/strassen-XXXXXX", directory);
+        file->fd = mkstemp(name);
+        if(file->fd >= 0) {
+            unlink(name);
+        }
+        free(name);
+        path = directory;
+    } else {
+        file->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    }
+    if(file->fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    // the file is sparse until tiles are written
+    if(ftruncate(file->fd, (off_t)bytes) != 0) {
+        fprintf(stderr, "%s: can't grow to %zu bytes: %s\n", path, bytes, strerror(errno));
+        close(file->fd);
+        return -1;
+    }
+    return map_descriptor(file, path, bytes, 1);
+}
+
+static int open_existing(matrix_file *file, const char *path)
+{
+    file->fd = open(path, O_RDONLY);
+    if(file->fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static size_t existing_bytes(const matrix_file *file, const char *path)
+{
+    struct stat status;
+    if(fstat(file->fd, &status) != 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    return (size_t)status.st_size;
+}
+
+static int read_header(matrix_file *file, matrix_file_header *header)
+{
+    return pread(file->fd, header, sizeof *header, 0) == (ssize_t) sizeof *header;
+}
+
+static void close_existing(matrix_file *file)
+{
+    close(file->fd);
+}
+
+static int map_existing(matrix_file *file, const char *path, size_t bytes)
+{
+    return map_descriptor(file, path, bytes, 0);
+}
+
+void matrix_file_close(matrix_file *file)
+{
+    munmap(file->map, file->map_bytes);
+    close(file->fd);
+}
+#endif
+
+/* Creates a matrix file, or a temporary one in directory if path is NULL,
+ * and maps it for writing. The tiles start out all zeros.
+ */
+static int create_file(const char *path, const char *directory, int rows, int cols,
+    int tile_rows, int tile_cols, matrix_file *file)
+{
+    if(rows < 1 || cols < 1 || tile_rows < 1 || tile_cols < 1) {
+        fprintf(stderr, "%s: bad matrix file shape %dx%d in %dx%d tiles\n",
+            path != NULL ? path : directory, rows, cols, tile_rows, tile_cols);
+        return -1;
+    }
+    set_geometry(file, rows, cols, tile_rows < rows ? tile_rows : rows,
+        tile_cols < cols ? tile_cols : cols);
+    size_t bytes = file_bytes(file);
+    if(bytes == 0) {
+        fprintf(stderr, "%s: %dx%d matrix too large to map\n", path != NULL ? path : directory,
+            rows, cols);
+        return -1;
+    }
+    if(create_and_map(file, path, directory, bytes) != 0) {
+        return -1;
+    }
+    matrix_file_header header;
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, MATRIX_FILE_MAGIC, sizeof header.magic);
+    header.version = MATRIX_FILE_VERSION;
+    header.element = STRASSEN_ELEMENT;
+    header.element_size = sizeof(matrix_type);
+    header.rows = (uint64_t)rows;
+    header.cols = (uint64_t)cols;
+    header.tile_rows = (uint64_t)file->tile_rows;
+    header.tile_cols = (uint64_t)file->tile_cols;
+    header.data_offset = MATRIX_FILE_DATA_OFFSET;
+    memcpy(file->map, &header, sizeof header);
+    file->data = (matrix_type *)((char *) file->map + MATRIX_FILE_DATA_OFFSET);
+    return 0;
+}
+
+/* Creates (or truncates) the file at path for a rows x cols matrix in
+ * tiles of tile_rows x tile_cols (at most the matrix), all zeros, and maps it for reading and
+ * writing. Returns 0, or -1 after printing why it failed.
+ */
+int matrix_file_create(const char *path, int rows, int cols, int tile_rows, int tile_cols,
+    matrix_file *file)
+{
+    return create_file(path, NULL, rows, cols, tile_rows, tile_cols, file);
+}
+
+/* matrix_file_create() for a file in directory that has no name and is
+ * gone once it is closed, or the process ends.
+ */
+int matrix_file_temporary(const char *directory, int rows, int cols, int tile_rows,
+    int tile_cols, matrix_file *file)
+{
+    return create_file(NULL, directory, rows, cols, tile_rows, tile_cols, file);
+}
+
+/* Maps the matrix file at path read-only, after checking that it is one
+ * of this element type and holds all its tiles. Returns 0, or -1 after
+ * printing why it failed.
+ */
+int matrix_file_open(const char *path, matrix_file *file)
+{
+    if(open_existing(file, path) != 0) {
+        return -1;
+    }
+    matrix_file_header header;
+    size_t size = existing_bytes(file, path);
+    if(size < sizeof header) {
+        fprintf(stderr, "%s: not a matrix file\n", path);
+        close_existing(file);
+        return -1;
+    }
+    const char *problem = NULL;
+    if(!read_header(file, &header) || memcmp(header.magic, MATRIX_FILE_MAGIC, sizeof header.magic) != 0) {
+        problem = "not a matrix file";
+    } else if(header.version != MATRIX_FILE_VERSION) {
+        problem = "unknown version or byte order";
+    } else if(header.element != STRASSEN_ELEMENT || header.element_size != sizeof(matrix_type)) {
+        problem = "elements are not " ELEMENT_LABEL;
+    } else if(header.rows < 1 || header.cols < 1 || header.rows > INT32_MAX
+        || header.cols > INT32_MAX || header.tile_rows < 1 || header.tile_cols < 1
+        || header.tile_rows > header.rows || header.tile_cols > header.cols
+        || header.data_offset != MATRIX_FILE_DATA_OFFSET) {
+        problem = "bad header";
+    }
+    if(problem == NULL) {
+        set_geometry(file, (int) header.rows, (int) header.cols, (int) header.tile_rows,
+            (int) header.tile_cols);
+        if(file_bytes(file) == 0 || size < file_bytes(file)) {
+            problem = "shorter than its header says";
+        }
+    }
+    if(problem != NULL) {
+        fprintf(stderr, "%s: %s\n", path, problem);
+        close_existing(file);
+        return -1;
+    }
+    if(map_existing(file, path, file_bytes(file)) != 0) {
+        return -1;
+    }
+    file->data = (matrix_type *)((char *) file->map + MATRIX_FILE_DATA_OFFSET);
+    return 0;
+}
+
+/* Tile (tile_row, tile_col) of file, or NULL if the grid has no such tile.
+ */
+matrix_type * matrix_file_tile(const matrix_file *file, int tile_row, int tile_col)
+{
+    if(tile_row < 0 || tile_col < 0 || tile_row >= file->tiles_down
+        || tile_col >= file->tiles_across) {
+        return NULL;
+    }
+    size_t tile = (size_t)file->tile_rows * file->tile_cols;
+    return file->data + ((size_t)tile_row * file->tiles_across + tile_col) * tile;
+}
+
+/* The whole matrix as one view of the mapping, when the file is a single
+ * tile. Returns 0, or -1 for a file of several tiles.
+ */
+int matrix_file_view(const matrix_file *file, matrix_view *view)
+{
+    if(file->tiles_down != 1 || file->tiles_across != 1) {
+        return -1;
+    }
+    view->base = file->data;
+    view->ld = file->tile_cols;
+    return 0;
+}
+
+/* Piece p of row i of the matrix: the cols elements from column col on
+ * that lie in tile (i / tile_rows, p).
+ */
+static matrix_type * row_piece(const matrix_file *file, int i, int piece, int *col, int *cols)
+{
+    *col = piece * file->tile_cols;
+    *cols = file->cols - *col < file->tile_cols ? file->cols - *col : file->tile_cols;
+    return matrix_file_tile(file, i / file->tile_rows, piece)
+        + (size_t)(i % file->tile_rows) * file->tile_cols;
+}
+
+/* Fills the matrix with the values fill_matrix() would give a rows x cols
+ * matrix in its place, leaving the padding zero.
+ */
+void matrix_file_fill(matrix_file *file)
+{
+    uint64_t key = fill_key();
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for(int i = 0; i < file->rows; i++) {
+        for(int p = 0; p < file->tiles_across; p++) {
+            int col, cols;
+            matrix_type *piece = row_piece(file, i, p, &col, &cols);
+            fill_row(key, (uint64_t) i * file->cols + col, cols, piece);
+        }
+    }
+}
+
+/* Copies the matrix into the rows x cols block at destination. */
+void matrix_file_read(const matrix_file *file, matrix_view destination)
+{
+    PROFILE_START(mark);
+    for(int i = 0; i < file->rows; i++) {
+        for(int p = 0; p < file->tiles_across; p++) {
+            int col, cols;
+            const matrix_type *piece = row_piece(file, i, p, &col, &cols);
+            memcpy(&VIEW_AT(destination, i, col), piece, sizeof(matrix_type) * cols);
+        }
+    }
+    PROFILE_STOP(mark, PHASE_COPY, 2 * sizeof(matrix_type) * file->rows * (size_t)file->cols, 0);
+}
+
+/* Copies the rows x cols block at source into the matrix. */
+void matrix_file_write(matrix_file *file, matrix_view source)
+{
+    PROFILE_START(mark);
+    for(int i = 0; i < file->rows; i++) {
+        for(int p = 0; p < file->tiles_across; p++) {
+            int col, cols;
+            matrix_type *piece = row_piece(file, i, p, &col, &cols);
+            memcpy(piece, &VIEW_AT(source, i, col), sizeof(matrix_type) * cols);
+        }
+    }
+    PROFILE_STOP(mark, PHASE_COPY, 2 * sizeof(matrix_type) * file->rows * (size_t)file->cols, 0);
+}
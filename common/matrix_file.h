@@ -0,0 +1,73 @@
+/* matrix_file.h
+   A binary file format for matrices too large to fill, print or keep in
+   memory, mapped into the address space instead of being read.
+
+   A file is a header followed, at MATRIX_FILE_DATA_OFFSET, by the matrix
+   in tiles of tile_rows x tile_cols elements. Tiles are stored row by row
+   of tiles, each one row-major with its rows tile_cols elements apart, so
+   that every tile is a matrix_view of the mapping. Tiles on the right and
+   bottom edges are stored whole and padded with zeros. A file with a
+   single tile of exactly rows x cols is a plain row-major matrix, which
+   the engines multiply straight from the mapping.
+
+   Elements and header fields are stored in the byte order of the machine
+   that wrote the file; one of the other order is rejected by its version.
+*/
+#ifndef MATRIX_FILE_H
+#define MATRIX_FILE_H
+
+#include <stdint.h>
+#include "matrix.h"
+
+#define MATRIX_FILE_MAGIC "STRASMAT"
+#define MATRIX_FILE_VERSION 1
+/* Where the tiles start; a page boundary, so that tiles are as aligned in
+ * the mapping as their size allows.
+ */
+#define MATRIX_FILE_DATA_OFFSET 4096
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    // STRASSEN_ELEMENT of the writer, ELEMENT_FLOAT..ELEMENT_INT64
+    uint32_t element;
+    uint32_t element_size;
+    uint32_t reserved;
+    uint64_t rows, cols;
+    uint64_t tile_rows, tile_cols;
+    uint64_t data_offset;
+} matrix_file_header;
+
+/* An open, mapped matrix file. tiles_down x tiles_across is the grid of
+ * tiles; tile (i, j) is tile_rows x tile_cols elements at data +
+ * (i * tiles_across + j) * tile_rows * tile_cols.
+ */
+typedef struct {
+    int rows, cols;
+    int tile_rows, tile_cols;
+    int tiles_down, tiles_across;
+    int writable;
+    matrix_type *data;
+    void *map;
+    size_t map_bytes;
+#ifdef _WIN32
+    void *handle, *mapping;
+#else
+    int fd;
+#endif
+} matrix_file;
+
+int matrix_file_create(const char *path, int rows, int cols, int tile_rows, int tile_cols,
+    matrix_file *file);
+int matrix_file_temporary(const char *directory, int rows, int cols, int tile_rows,
+    int tile_cols, matrix_file *file);
+int matrix_file_open(const char *path, matrix_file *file);
+void matrix_file_close(matrix_file *file);
+
+matrix_type * matrix_file_tile(const matrix_file *file, int tile_row, int tile_col);
+int matrix_file_view(const matrix_file *file, matrix_view *view);
+void matrix_file_fill(matrix_file *file);
+void matrix_file_read(const matrix_file *file, matrix_view destination);
+void matrix_file_write(matrix_file *file, matrix_view source);
+
+#endif
@@ -0,0 +1,129 @@
+/* morton.c
+   Conversions between row-major matrices and the Morton layout of
+   morton.h, and the elementwise kernels over whole quadrants.
+*/
+#include <string.h>
+#include "morton.h"
+#include "simd.h"
+#include "profile.h"
+
+/* Longest run handed to a row kernel at once; they count in int. */
+#define SPAN_CHUNK (1 << 30)
+
+/* Layout of a rows x cols matrix split levels times: leaf blocks are
+ * rows / 2^levels by cols / 2^levels, rounded up.
+ */
+morton_shape morton_shape_of(int rows, int cols, int levels)
+{
+    morton_shape shape = { levels, ((rows - 1) >> levels) + 1, ((cols - 1) >> levels) + 1 };
+    return shape;
+}
+
+/* Elements of a matrix in the layout, padding included. */
+size_t morton_elements(morton_shape shape)
+{
+    return (size_t)shape.leaf_rows * shape.leaf_cols << 2 * shape.levels;
+}
+
+/* Leaf block number index of the layout holds the block at block row
+ * compact_bits(index >> 1) and block column compact_bits(index): the
+ * column is in the even bits of the index and the row in the odd ones,
+ * the quadrant of the top level in the highest two.
+ */
+static int compact_bits(size_t index)
+{
+    int value = 0;
+    for(int bit = 0; index != 0; bit++, index >>= 2) {
+        value |= (int)(index & 1) << bit;
+    }
+    return value;
+}
+
+/* Columns of block column col0 that lie in a matrix of cols columns. */
+static int block_width(int cols, int col0, int leaf_cols)
+{
+    int width = cols - col0;
+    return width < 0 ? 0 : (width < leaf_cols ? width : leaf_cols);
+}
+
+/* Copies the rows x cols matrix at source into destination, which holds
+ * morton_elements(shape), in the order of the layout, so destination is
+ * written front to back. The padding is set to zero.
+ */
+void to_morton(int rows, int cols, matrix_view source, morton_shape shape,
+    matrix_type *destination)
+{
+    PROFILE_START(mark);
+    size_t blocks = (size_t)1 << 2 * shape.levels;
+    for(size_t index = 0; index < blocks; index++) {
+        int row0 = compact_bits(index >> 1) * shape.leaf_rows;
+        int col0 = compact_bits(index) * shape.leaf_cols;
+        int width = block_width(cols, col0, shape.leaf_cols);
+        for(int i = 0; i < shape.leaf_rows; i++, destination += shape.leaf_cols) {
+            int copied = row0 + i < rows ? width : 0;
+            if(copied > 0) {
+                memcpy(destination, &VIEW_AT(source, row0 + i, col0), sizeof(matrix_type) * copied);
+            }
+            if(copied < shape.leaf_cols) {
+                memset(destination + copied, 0, sizeof(matrix_type) * (shape.leaf_cols - copied));
+            }
+        }
+    }
+    PROFILE_STOP(mark, PHASE_COPY, sizeof(matrix_type) * ((size_t)rows * cols
+        + morton_elements(shape)), 0);
+}
+
+/* Copies the rows x cols matrix in the layout at source, read front to
+ * back, into destination, leaving out the padding.
+ */
+void from_morton(int rows, int cols, const matrix_type *source, morton_shape shape,
+    matrix_view destination)
+{
+    PROFILE_START(mark);
+    size_t blocks = (size_t)1 << 2 * shape.levels;
+    for(size_t index = 0; index < blocks; index++) {
+        int row0 = compact_bits(index >> 1) * shape.leaf_rows;
+        int col0 = compact_bits(index) * shape.leaf_cols;
+        int width = block_width(cols, col0, shape.leaf_cols);
+        for(int i = 0; i < shape.leaf_rows; i++, source += shape.leaf_cols) {
+            if(row0 + i < rows && width > 0) {
+                memcpy(&VIEW_AT(destination, row0 + i, col0), source, sizeof(matrix_type) * width);
+            }
+        }
+    }
+    PROFILE_STOP(mark, PHASE_COPY, 2 * sizeof(matrix_type) * rows * (size_t)cols, 0);
+}
+
+/* result = a + b over count contiguous elements, as one long row. */
+void morton_add(size_t count, const matrix_type *a, const matrix_type *b, matrix_type *result)
+{
+    PROFILE_START(mark);
+    for(size_t done = 0; done < count; done += SPAN_CHUNK) {
+        int n = count - done < SPAN_CHUNK ? (int)(count - done) : SPAN_CHUNK;
+        add_row(a + done, b + done, result + done, n);
+    }
+    PROFILE_STOP(mark, PHASE_ADD, 3 * sizeof(matrix_type) * count, (double) count);
+}
+
+void morton_subtract(size_t count, const matrix_type *a, const matrix_type *b,
+    matrix_type *result)
+{
+    PROFILE_START(mark);
+    for(size_t done = 0; done < count; done += SPAN_CHUNK) {
+        int n = count - done < SPAN_CHUNK ? (int)(count - done) : SPAN_CHUNK;
+        subtract_row(a + done, b + done, result + done, n);
+    }
+    PROFILE_STOP(mark, PHASE_ADD, 3 * sizeof(matrix_type) * count, (double) count);
+}
+
+/* result = a + b - c + d over count contiguous elements. */
+void morton_combine(size_t count, const matrix_type *a, const matrix_type *b,
+    const matrix_type *c, const matrix_type *d, matrix_type *result)
+{
+    PROFILE_START(mark);
+    for(size_t done = 0; done < count; done += SPAN_CHUNK) {
+        int n = count - done < SPAN_CHUNK ? (int)(count - done) : SPAN_CHUNK;
+        combine_row(a + done, b + done, c + done, d + done, result + done, n);
+    }
+    PROFILE_STOP(mark, PHASE_COMBINE, 5 * sizeof(matrix_type) * count, 3.0 * count);
+}
@@ -0,0 +1,35 @@
+/* morton.h
+   The recursive block (Morton, or Z-order) layout of the Morton variant.
+   A matrix split levels times is stored as its quadrants a11, a12, a21,
+   a22 one after the other, each of them laid out the same way, down to
+   leaf blocks of leaf_rows x leaf_cols elements stored row-major. Every
+   quadrant at every level is one contiguous run of elements, so the sums
+   of the recursion are flat vector loops and a leaf product touches a
+   few pages instead of a page per row. The matrix is padded with zeros
+   to leaf_rows x leaf_cols times 2^levels.
+*/
+#ifndef MORTON_H
+#define MORTON_H
+
+#include "matrix.h"
+
+typedef struct {
+    int levels;
+    int leaf_rows, leaf_cols;
+} morton_shape;
+
+morton_shape morton_shape_of(int rows, int cols, int levels);
+size_t morton_elements(morton_shape shape);
+
+void to_morton(int rows, int cols, matrix_view source, morton_shape shape,
+    matrix_type *destination);
+void from_morton(int rows, int cols, const matrix_type *source, morton_shape shape,
+    matrix_view destination);
+
+void morton_add(size_t count, const matrix_type *a, const matrix_type *b, matrix_type *result);
+void morton_subtract(size_t count, const matrix_type *a, const matrix_type *b,
+    matrix_type *result);
+void morton_combine(size_t count, const matrix_type *a, const matrix_type *b,
+    const matrix_type *c, const matrix_type *d, matrix_type *result);
+
+#endif
@@ -0,0 +1,631 @@
+/* out_of_core.c
+   The out-of-core recursion of out_of_core.h over blocks of tiles of
+   mapped matrix files, and the file mode of the programs.
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "out_of_core.h"
+#include "verify.h"
+#include "profile.h"
+
+/* What is done with a product to a quadrant of the result. */
+enum { KEEP, SET, ADD, SUBTRACT };
+
+/* Quadrants are numbered row * 2 + col: a11 = 0, a12 = 1, a21 = 2, a22 = 3.
+ * Product i multiplies a[first] + sign a[second] by b[first] + sign
+ * b[second] (a single quadrant when second is -1) and goes into the
+ * quadrants of c as c says:
+ *   m1 = (a11 + a22)(b11 + b22)   c11 = m1, c22 = m1
+ *   m2 = (a21 + a22) b11          c21 = m2, c22 -= m2
+ *   m3 = a11 (b12 - b22)          c12 = m3, c22 += m3
+ *   m4 = a22 (b21 - b11)          c11 += m4, c21 += m4
+ *   m5 = (a11 + a12) b22          c11 -= m5, c12 += m5
+ *   m6 = (a21 - a11)(b11 + b12)   c22 += m6
+ *   m7 = (a12 - a22)(b21 + b22)   c11 += m7
+ * Every quadrant is set by the first product that reaches it, so the
+ * result never has to be cleared first.
+ */
+static const struct {
+    int a_first, a_second, a_sign;
+    int b_first, b_second, b_sign;
+    int c[4];
+} products[7] = {
+    { 0, 3, 1, 0, 3, 1, { SET, KEEP, KEEP, SET } },
+    { 2, 3, 1, 0, -1, 0, { KEEP, KEEP, SET, SUBTRACT } },
+    { 0, -1, 0, 1, 3, -1, { KEEP, SET, KEEP, ADD } },
+    { 3, -1, 0, 2, 0, -1, { ADD, KEEP, ADD, KEEP } },
+    { 0, 1, 1, 3, -1, 0, { SUBTRACT, ADD, KEEP, KEEP } },
+    { 2, 0, -1, 0, 1, 1, { KEEP, KEEP, KEEP, ADD } },
+    { 1, 3, -1, 2, 3, 1, { ADD, KEEP, KEEP, KEEP } },
+};
+
+/* A block of whole tiles of a matrix file: rows x cols tiles from tile
+ * (row, col) on. Only the first valid_rows x valid_cols of them belong to
+ * the block; the others lie past the end of the file, or of the block it
+ * was split from when that had an odd number of tiles, and read as zeros.
+ */
+typedef struct {
+    const matrix_file *file;
+    int row, col;
+    int rows, cols;
+    int valid_rows, valid_cols;
+} tile_block;
+
+typedef struct {
+    out_of_core_options *options;
+    // a tile of zeros as large as any tile, for the missing ones
+    matrix_type *zeros;
+    size_t tile_elements;
+} out_of_core_state;
+
+static tile_block whole_file(const matrix_file *file)
+{
+    tile_block x = { file, 0, 0, file->tiles_down, file->tiles_across, file->tiles_down,
+        file->tiles_across };
+    return x;
+}
+
+static int clamp(int value, int limit)
+{
+    return value < 0 ? 0 : (value < limit ? value : limit);
+}
+
+/* Quadrant (row, col) of x, where the first half of an odd number of tiles
+ * is the larger one.
+ */
+static tile_block block_quadrant(const tile_block *x, int row, int col)
+{
+    int half_rows = (x->rows + 1) / 2, half_cols = (x->cols + 1) / 2;
+    tile_block q = { x->file, x->row + row * half_rows, x->col + col * half_cols, half_rows,
+        half_cols, clamp(x->valid_rows - row * half_rows, half_rows),
+        clamp(x->valid_cols - col * half_cols, half_cols) };
+    return q;
+}
+
+/* Tile (i, j) of x, or NULL if it doesn't belong to the block. */
+static matrix_type * block_tile(const tile_block *x, int i, int j)
+{
+    if(i >= x->valid_rows || j >= x->valid_cols) {
+        return NULL;
+    }
+    return matrix_file_tile(x->file, x->row + i, x->col + j);
+}
+
+/* block_tile() with the zero tile standing in for the missing ones. */
+static matrix_view read_tile(out_of_core_state *s, const tile_block *x, int i, int j)
+{
+    matrix_view v = { block_tile(x, i, j), x->file->tile_cols };
+    if(v.base == NULL) {
+        if(s->zeros == NULL) {
+            s->zeros = (matrix_type *) allocate_aligned(sizeof(matrix_type) * s->tile_elements);
+            memset(s->zeros, 0, sizeof(matrix_type) * s->tile_elements);
+        }
+        v.base = s->zeros;
+    }
+    return v;
+}
+
+/* Rows and columns of the matrix that lie in x; the rest of the block is
+ * zeros.
+ */
+static int block_height(const tile_block *x)
+{
+    int rows = x->file->rows - x->row * x->file->tile_rows;
+    int valid = x->valid_rows * x->file->tile_rows;
+    return x->valid_rows == 0 || x->valid_cols == 0 ? 0 : (rows < valid ? rows : valid);
+}
+
+static int block_width(const tile_block *x)
+{
+    int cols = x->file->cols - x->col * x->file->tile_cols;
+    int valid = x->valid_cols * x->file->tile_cols;
+    return x->valid_rows == 0 || x->valid_cols == 0 ? 0 : (cols < valid ? cols : valid);
+}
+
+/* Copies the rows x cols elements at the top left of x into v, as zeros
+ * where x has no tile.
+ */
+static void gather(const tile_block *x, int rows, int cols, matrix_view v)
+{
+    PROFILE_START(mark);
+    int tile_rows = x->file->tile_rows, tile_cols = x->file->tile_cols;
+    for(int i = 0; i < rows; i++) {
+        for(int j = 0; j < cols; j += tile_cols) {
+            int width = cols - j < tile_cols ? cols - j : tile_cols;
+            const matrix_type *tile = block_tile(x, i / tile_rows, j / tile_cols);
+            if(tile != NULL) {
+                memcpy(&VIEW_AT(v, i, j), tile + (size_t)(i % tile_rows) * tile_cols,
+                    sizeof(matrix_type) * width);
+            } else {
+                memset(&VIEW_AT(v, i, j), 0, sizeof(matrix_type) * width);
+            }
+        }
+    }
+    PROFILE_STOP(mark, PHASE_COPY, 2 * sizeof(matrix_type) * rows * (size_t)cols, 0);
+}
+
+/* Copies v into the rows x cols elements at the top left of x. */
+static void scatter(const tile_block *x, int rows, int cols, matrix_view v)
+{
+    PROFILE_START(mark);
+    int tile_rows = x->file->tile_rows, tile_cols = x->file->tile_cols;
+    for(int i = 0; i < rows; i++) {
+        for(int j = 0; j < cols; j += tile_cols) {
+            int width = cols - j < tile_cols ? cols - j : tile_cols;
+            matrix_type *tile = block_tile(x, i / tile_rows, j / tile_cols);
+            if(tile != NULL) {
+                memcpy(tile + (size_t)(i % tile_rows) * tile_cols, &VIEW_AT(v, i, j),
+                    sizeof(matrix_type) * width);
+            }
+        }
+    }
+    PROFILE_STOP(mark, PHASE_COPY, 2 * sizeof(matrix_type) * rows * (size_t)cols, 0);
+}
+
+static void clear_block(const tile_block *x)
+{
+    size_t tile = (size_t)x->file->tile_rows * x->file->tile_cols;
+    for(int i = 0; i < x->valid_rows; i++) {
+        for(int j = 0; j < x->valid_cols; j++) {
+            memset(block_tile(x, i, j), 0, sizeof(matrix_type) * tile);
+        }
+    }
+}
+
+/* The rows x cols elements at the top left of x as a view of the mapping,
+ * if they lie in its first tile.
+ */
+static int tile_in_place(const tile_block *x, int rows, int cols, matrix_view *v)
+{
+    v->base = block_tile(x, 0, 0);
+    v->ld = x->file->tile_cols;
+    return v->base != NULL && rows <= x->file->tile_rows && cols <= x->file->tile_cols;
+}
+
+/* c = a b for an m x k by k x n block product that fits in memory, by
+ * the program's engine. Operands and result in a single tile are used in
+ * place; the others are copied to and from memory.
+ */
+static void multiply_in_memory(out_of_core_state *s, const tile_block *a, const tile_block *b,
+    const tile_block *c, int m, int k, int n)
+{
+    matrix_type **copy_a = NULL, **copy_b = NULL, **copy_c = NULL;
+    matrix_view va, vb, vc;
+    if(!tile_in_place(a, m, k, &va)) {
+        copy_a = allocate_matrix(m, k);
+        va = view_of(k, copy_a);
+        gather(a, m, k, va);
+    }
+    if(!tile_in_place(b, k, n, &vb)) {
+        copy_b = allocate_matrix(k, n);
+        vb = view_of(n, copy_b);
+        gather(b, k, n, vb);
+    }
+    if(!tile_in_place(c, m, n, &vc)) {
+        copy_c = allocate_matrix(m, n);
+        vc = view_of(n, copy_c);
+    }
+    s->options->multiply(m, k, n, va, vb, vc, s->options->context);
+    if(copy_c != NULL) {
+        scatter(c, m, n, vc);
+        deallocate_matrix(copy_c, m);
+    }
+    if(copy_a != NULL) {
+        deallocate_matrix(copy_a, m);
+    }
+    if(copy_b != NULL) {
+        deallocate_matrix(copy_b, k);
+    }
+}
+
+/* c = a b one tile product at a time, for blocks too large for memory
+ * that are a single tile high, wide or deep and so can't be split.
+ */
+static void multiply_by_tiles(out_of_core_state *s, const tile_block *a, const tile_block *b,
+    const tile_block *c)
+{
+    int tile_m = a->file->tile_rows, tile_k = a->file->tile_cols, tile_n = b->file->tile_cols;
+    matrix_type **product = NULL;
+    for(int i = 0; i < c->valid_rows; i++) {
+        for(int j = 0; j < c->valid_cols; j++) {
+            matrix_view vc = { block_tile(c, i, j), c->file->tile_cols };
+            int first = 1;
+            for(int p = 0; p < a->cols; p++) {
+                if(block_tile(a, i, p) == NULL || block_tile(b, p, j) == NULL) {
+                    continue;
+                }
+                if(first) {
+                    s->options->multiply(tile_m, tile_k, tile_n, read_tile(s, a, i, p),
+                        read_tile(s, b, p, j), vc, s->options->context);
+                    first = 0;
+                    continue;
+                }
+                if(product == NULL) {
+                    product = allocate_matrix(tile_m, tile_n);
+                }
+                s->options->multiply(tile_m, tile_k, tile_n, read_tile(s, a, i, p),
+                    read_tile(s, b, p, j), view_of(tile_n, product), s->options->context);
+                add_matrices(tile_m, tile_n, vc, view_of(tile_n, product), vc);
+            }
+            if(first) {
+                memset(vc.base, 0, sizeof(matrix_type) * tile_m * (size_t)tile_n);
+            }
+        }
+    }
+    if(product != NULL) {
+        deallocate_matrix(product, tile_m);
+    }
+}
+
+/* x = q1 + sign q2 for a temporary block x of whole tiles. */
+static void combine_blocks(out_of_core_state *s, const tile_block *x, const tile_block *q1,
+    const tile_block *q2, int sign)
+{
+    int tile_rows = x->file->tile_rows, tile_cols = x->file->tile_cols;
+    for(int i = 0; i < x->rows; i++) {
+        for(int j = 0; j < x->cols; j++) {
+            matrix_view destination = { block_tile(x, i, j), tile_cols };
+            if(sign > 0) {
+                add_matrices(tile_rows, tile_cols, read_tile(s, q1, i, j), read_tile(s, q2, i, j),
+                    destination);
+            } else {
+                subtract_matrices(tile_rows, tile_cols, read_tile(s, q1, i, j),
+                    read_tile(s, q2, i, j), destination);
+            }
+        }
+    }
+}
+
+/* Sets, adds or subtracts the product block p into the quadrant q of the
+ * result, tile by tile.
+ */
+static void update_block(const tile_block *q, const tile_block *p, int how)
+{
+    int tile_rows = q->file->tile_rows, tile_cols = q->file->tile_cols;
+    for(int i = 0; i < q->valid_rows; i++) {
+        for(int j = 0; j < q->valid_cols; j++) {
+            matrix_view target = { block_tile(q, i, j), tile_cols };
+            matrix_view product = { block_tile(p, i, j), tile_cols };
+            if(how == SET) {
+                PROFILE_START(mark);
+                memcpy(target.base, product.base, sizeof(matrix_type) * tile_rows * (size_t)tile_cols);
+                PROFILE_STOP(mark, PHASE_COPY, 2 * sizeof(matrix_type) * tile_rows * (size_t)tile_cols,
+                    0);
+            } else if(how == ADD) {
+                add_matrices(tile_rows, tile_cols, target, product, target);
+            } else if(how == SUBTRACT) {
+                subtract_matrices(tile_rows, tile_cols, target, product, target);
+            }
+        }
+    }
+}
+
+static int multiply_blocks(out_of_core_state *s, const tile_block *a, const tile_block *b,
+    const tile_block *c, int depth);
+
+/* One level of the recursion on disk. The sums of a and b quadrants go to
+ * temporary files of a quarter of a and b, and the products, one at a
+ * time, to a temporary file of a quarter of c.
+ */
+static int multiply_on_disk(out_of_core_state *s, const tile_block *a, const tile_block *b,
+    const tile_block *c, int depth)
+{
+    const matrix_file *fa = a->file, *fb = b->file, *fc = c->file;
+    int half_m = (a->rows + 1) / 2, half_k = (a->cols + 1) / 2, half_n = (b->cols + 1) / 2;
+    const char *directory = s->options->temporary_directory;
+    matrix_file sum_a, sum_b, product;
+    if(matrix_file_temporary(directory, half_m * fa->tile_rows, half_k * fa->tile_cols,
+        fa->tile_rows, fa->tile_cols, &sum_a) != 0) {
+        return -1;
+    }
+    if(matrix_file_temporary(directory, half_k * fb->tile_rows, half_n * fb->tile_cols,
+        fb->tile_rows, fb->tile_cols, &sum_b) != 0) {
+        matrix_file_close(&sum_a);
+        return -1;
+    }
+    if(matrix_file_temporary(directory, half_m * fc->tile_rows, half_n * fc->tile_cols,
+        fc->tile_rows, fc->tile_cols, &product) != 0) {
+        matrix_file_close(&sum_a);
+        matrix_file_close(&sum_b);
+        return -1;
+    }
+
+    tile_block qa[4], qb[4], qc[4];
+    for(int q = 0; q < 4; q++) {
+        qa[q] = block_quadrant(a, q / 2, q % 2);
+        qb[q] = block_quadrant(b, q / 2, q % 2);
+        qc[q] = block_quadrant(c, q / 2, q % 2);
+    }
+    tile_block sa = whole_file(&sum_a), sb = whole_file(&sum_b), mp = whole_file(&product);
+    int status = 0;
+    for(int i = 0; i < 7 && status == 0; i++) {
+        const tile_block *x = &qa[products[i].a_first], *y = &qb[products[i].b_first];
+        if(products[i].a_second >= 0) {
+            combine_blocks(s, &sa, x, &qa[products[i].a_second], products[i].a_sign);
+            x = &sa;
+        }
+        if(products[i].b_second >= 0) {
+            combine_blocks(s, &sb, y, &qb[products[i].b_second], products[i].b_sign);
+            y = &sb;
+        }
+        status = multiply_blocks(s, x, y, &mp, depth + 1);
+        for(int q = 0; q < 4 && status == 0; q++) {
+            update_block(&qc[q], &mp, products[i].c[q]);
+        }
+    }
+    matrix_file_close(&sum_a);
+    matrix_file_close(&sum_b);
+    matrix_file_close(&product);
+    return status;
+}
+
+/* Whether an m x k by k x n product, its copies and workspace included,
+ * fits in the memory budget.
+ */
+static int fits_in_memory(const out_of_core_options *options, int m, int k, int n)
+{
+    size_t elements = (size_t)m * k + (size_t)k * n + (size_t)m * n;
+    return sizeof(matrix_type) * elements + options->workspace_bytes(m, k, n) <= options->memory;
+}
+
+/* c = a b for blocks of tiles: in memory if it fits, otherwise by a level
+ * of the recursion on disk, or tile by tile if a block can't be split.
+ * Returns 0, or -1 if a temporary file can't be made.
+ */
+static int multiply_blocks(out_of_core_state *s, const tile_block *a, const tile_block *b,
+    const tile_block *c, int depth)
+{
+    // only the part of the result that is in the file is computed;
+    // operands that end sooner are zeros past their end
+    int m = block_height(c), n = block_width(c);
+    int k = block_width(a) < block_height(b) ? block_width(a) : block_height(b);
+    if(m == 0 || n == 0) {
+        return 0;
+    }
+    if(k == 0) {
+        clear_block(c);
+        return 0;
+    }
+    if(fits_in_memory(s->options, m, k, n)) {
+        multiply_in_memory(s, a, b, c, m, k, n);
+        s->options->leaves++;
+        return 0;
+    }
+    if(a->rows < 2 || a->cols < 2 || b->cols < 2) {
+        multiply_by_tiles(s, a, b, c);
+        s->options->leaves++;
+        s->options->tiled_leaves++;
+        return 0;
+    }
+    if(depth + 1 > s->options->disk_levels) {
+        s->options->disk_levels = depth + 1;
+    }
+    return multiply_on_disk(s, a, b, c, depth);
+}
+
+/* result = a b, where result is a writable file of the product's shape.
+ * Unless the whole product fits in options->memory, the tiles of the
+ * three files have to line up: a's columns as wide as b's rows are high,
+ * and result tiled like a's rows and b's columns. Returns 0, or -1 after
+ * printing what went wrong.
+ */
+int out_of_core_multiply(const matrix_file *a, const matrix_file *b, matrix_file *result,
+    out_of_core_options *options)
+{
+    if(a->cols != b->rows || result->rows != a->rows || result->cols != b->cols
+        || !result->writable) {
+        fprintf(stderr, "out of core: can't multiply a %dx%d by a %dx%d matrix into a %dx%d one\n",
+            a->rows, a->cols, b->rows, b->cols, result->rows, result->cols);
+        return -1;
+    }
+    options->disk_levels = 0;
+    options->leaves = 0;
+    options->tiled_leaves = 0;
+    if(!fits_in_memory(options, a->rows, a->cols, b->cols)
+        && (a->tile_cols != b->tile_rows || result->tile_rows != a->tile_rows
+            || result->tile_cols != b->tile_cols)) {
+        fprintf(stderr, "out of core: tiles of %dx%d, %dx%d and %dx%d don't line up\n",
+            a->tile_rows, a->tile_cols, b->tile_rows, b->tile_cols, result->tile_rows,
+            result->tile_cols);
+        return -1;
+    }
+
+    out_of_core_state s = { options, NULL, 0 };
+    const matrix_file *files[3] = { a, b, result };
+    for(int i = 0; i < 3; i++) {
+        size_t tile = (size_t)files[i]->tile_rows * files[i]->tile_cols;
+        s.tile_elements = tile > s.tile_elements ? tile : s.tile_elements;
+    }
+    tile_block ba = whole_file(a), bb = whole_file(b), bc = whole_file(result);
+    int status = multiply_blocks(&s, &ba, &bb, &bc, 0);
+    if(s.zeros != NULL) {
+        deallocate_aligned(s.zeros);
+    }
+    return status;
+}
+
+/* A byte count with an optional K, M or G (binary) suffix; 0 if there is
+ * no number.
+ */
+size_t parse_bytes(const char *text)
+{
+    char *end;
+    double value = strtod(text, &end);
+    switch(toupper((unsigned char) *end)) {
+    case 'G':
+        value *= 1024;
+        // fall through
+    case 'M':
+        value *= 1024;
+        // fall through
+    case 'K':
+        value *= 1024;
+        break;
+    default:
+        break;
+    }
+    return value > 0 ? (size_t)value : 0;
+}
+
+/* STRASSEN_MEMORY, or half the physical memory. */
+size_t default_memory_budget(void)
+{
+    const char *env = getenv("STRASSEN_MEMORY");
+    if(env != NULL && parse_bytes(env) > 0) {
+        return parse_bytes(env);
+    }
+#ifdef _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof status;
+    if(GlobalMemoryStatusEx(&status)) {
+        return (size_t)(status.ullTotalPhys / 2);
+    }
+#else
+    long pages = sysconf(_SC_PHYS_PAGES), page = sysconf(_SC_PAGESIZE);
+    if(pages > 0 && page > 0) {
+        return (size_t)pages * (size_t)page / 2;
+    }
+#endif
+    return (size_t)1 << 30;
+}
+
+const char * temporary_directory(void)
+{
+    const char *names[] = { "STRASSEN_TMPDIR", "TMPDIR", "TEMP" };
+    for(int i = 0; i < 3; i++) {
+        const char *env = getenv(names[i]);
+        if(env != NULL && *env != '\0') {
+            return env;
+        }
+    }
+#ifdef _WIN32
+    return ".";
+#else
+    return "/tmp";
+#endif
+}
+
+/* Takes the options of the file mode (see out_of_core.h) out of argv and
+ * returns whether there were any.
+ */
+int take_file_options(int *argc, char **argv, file_options *files)
+{
+    const char *tile = take_option(argc, argv, "--tile");
+    const char *memory = take_option(argc, argv, "--memory");
+    files->a = take_option(argc, argv, "--a");
+    files->b = take_option(argc, argv, "--b");
+    files->result = take_option(argc, argv, "--out");
+    files->generate = take_flag(argc, argv, "--generate");
+    files->tile = tile != NULL ? atoi(tile) : OUT_OF_CORE_TILE;
+    files->memory = memory != NULL ? parse_bytes(memory) : default_memory_budget();
+    return files->a != NULL || files->b != NULL || files->result != NULL || files->generate;
+}
+
+/* The rows x cols matrix of file as a view: of the mapping for a single
+ * tile, otherwise of a copy in *copy.
+ */
+static matrix_view whole_view(const matrix_file *file, matrix_type ***copy)
+{
+    matrix_view v;
+    *copy = NULL;
+    if(matrix_file_view(file, &v) != 0) {
+        *copy = allocate_matrix(file->rows, file->cols);
+        v = view_of(file->cols, *copy);
+        matrix_file_read(file, v);
+    }
+    return v;
+}
+
+static int verify_files(const matrix_file *a, const matrix_file *b, const matrix_file *result,
+    int cutoff, int winograd)
+{
+    matrix_type **copies[3];
+    matrix_view va = whole_view(a, &copies[0]);
+    matrix_view vb = whole_view(b, &copies[1]);
+    matrix_view vc = whole_view(result, &copies[2]);
+    int passed = verify_product(a->rows, a->cols, b->cols, va, vb, vc, cutoff, winograd);
+    int rows[3] = { a->rows, b->rows, result->rows };
+    for(int i = 0; i < 3; i++) {
+        if(copies[i] != NULL) {
+            deallocate_matrix(copies[i], rows[i]);
+        }
+    }
+    return passed;
+}
+
+/* The file mode: multiplies the files named by files, generating them
+ * first as m x k and k x n matrices if asked to, with the in-memory
+ * product of options, and checks the result when verify is set. Returns
+ * the exit status of the program.
+ */
+int file_product(const file_options *files, int m, int k, int n, out_of_core_options *options,
+    int verify, int cutoff, int winograd)
+{
+    if(files->a == NULL || files->b == NULL) {
+        fprintf(stderr, "the file mode needs --a=FILE and --b=FILE\n");
+        return 1;
+    }
+    matrix_file a, b, result;
+    int tile = files->tile;
+    if(files->generate) {
+        if(matrix_file_create(files->a, m, k, tile > 0 ? tile : m, tile > 0 ? tile : k, &a) != 0) {
+            return 1;
+        }
+        matrix_file_fill(&a);
+        if(matrix_file_create(files->b, k, n, tile > 0 ? tile : k, tile > 0 ? tile : n, &b) != 0) {
+            matrix_file_close(&a);
+            return 1;
+        }
+        matrix_file_fill(&b);
+    } else {
+        if(matrix_file_open(files->a, &a) != 0) {
+            return 1;
+        }
+        if(matrix_file_open(files->b, &b) != 0) {
+            matrix_file_close(&a);
+            return 1;
+        }
+    }
+    int failed = a.cols != b.rows;
+    if(failed) {
+        fprintf(stderr, "%s is %dx%d and %s %dx%d\n", files->a, a.rows, a.cols, files->b, b.rows,
+            b.cols);
+    } else if(files->result != NULL) {
+        failed = matrix_file_create(files->result, a.rows, b.cols, a.tile_rows, b.tile_cols,
+            &result) != 0;
+    } else {
+        failed = matrix_file_temporary(temporary_directory(), a.rows, b.cols, a.tile_rows,
+            b.tile_cols, &result) != 0;
+    }
+    if(failed) {
+        matrix_file_close(&a);
+        matrix_file_close(&b);
+        return 1;
+    }
+
+    options->memory = files->memory;
+    options->temporary_directory = temporary_directory();
+    double begin = wall_time();
+    failed = out_of_core_multiply(&a, &b, &result, options) != 0;
+    double elapsed = wall_time() - begin;
+    if(!failed) {
+        printf("%dx%dx%d from files in %.3f s: %d levels on disk, %d blocks in memory, "
+            "%d tile by tile\n", a.rows, a.cols, b.cols, elapsed, options->disk_levels,
+            options->leaves - options->tiled_leaves, options->tiled_leaves);
+    }
+    if(!failed && verify) {
+        failed = !verify_files(&a, &b, &result, cutoff, winograd);
+    }
+    matrix_file_close(&a);
+    matrix_file_close(&b);
+    matrix_file_close(&result);
+    return failed;
+}
@@ -0,0 +1,67 @@
+/* out_of_core.h
+   Strassen products of matrix files (matrix_file.h) too large for memory.
+   The top levels of the recursion run on blocks of whole tiles of the
+   mapped files: the sums of quadrants go to temporary files, one product
+   at a time is computed into another, and each is added into the
+   quadrants of the result it belongs to, so the page cache streams the
+   tiles from and to disk. Once a block's operands, result and workspace
+   fit in the memory budget, the block is copied into memory (or used in
+   place, when it is a single tile) and multiplied by the program's
+   in-memory engine, recursion levels and all.
+
+   The file mode of the serial and OpenMP programs is built on it:
+     --a=FILE --b=FILE  multiply these matrix files
+     --generate         first create them with the random values
+                        fill_matrix() gives, of the size on the command line
+     --out=FILE         write the product to FILE (to a temporary file
+                        that is deleted if not given)
+     --tile=N           tile side of generated files, 0 for a plain
+                        row-major file of one tile (OUT_OF_CORE_TILE)
+     --memory=BYTES     the memory budget, with an optional K, M or G
+                        suffix; STRASSEN_MEMORY sets it too, and it
+                        defaults to half the physical memory
+   Temporary files go to STRASSEN_TMPDIR, TMPDIR or /tmp.
+*/
+#ifndef OUT_OF_CORE_H
+#define OUT_OF_CORE_H
+
+#include "matrix_file.h"
+#include "bench.h"
+
+#define OUT_OF_CORE_TILE 1024
+
+typedef struct {
+    // the in-memory product of the blocks that fit, and its workspace in
+    // bytes for an m x k by k x n product
+    bench_function multiply;
+    void *context;
+    size_t (*workspace_bytes)(int m, int k, int n);
+    size_t memory;
+    const char *temporary_directory;
+    // counted by out_of_core_multiply(): levels run on disk, blocks
+    // multiplied in memory and blocks too thin to split that were
+    // multiplied a tile product at a time
+    int disk_levels;
+    int leaves;
+    int tiled_leaves;
+} out_of_core_options;
+
+typedef struct {
+    const char *a, *b, *result;
+    int generate;
+    int tile;
+    size_t memory;
+} file_options;
+
+size_t parse_bytes(const char *text);
+size_t default_memory_budget(void);
+const char * temporary_directory(void);
+
+int out_of_core_multiply(const matrix_file *a, const matrix_file *b, matrix_file *result,
+    out_of_core_options *options);
+
+int take_file_options(int *argc, char **argv, file_options *files);
+int file_product(const file_options *files, int m, int k, int n, out_of_core_options *options,
+    int verify, int cutoff, int winograd);
+
+#endif
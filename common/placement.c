@@ -0,0 +1,165 @@
+/* placement.c
+   placement.h on libnuma, or a single node without it.
+*/
+#define _GNU_SOURCE
+#include "placement.h"
+
+#ifdef STRASSEN_HAVE_NUMA
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <numa.h>
+#include <numaif.h>
+
+/* Pages asked about per move_pages() call in bytes_on_node(). */
+#define QUERY_PAGES 1024
+
+/* Number of nodes, numbered 0 to memory_nodes() - 1.
+ */
+int memory_nodes(void)
+{
+    return numa_available() < 0 ? 1 : numa_max_node() + 1;
+}
+
+/* Node of the CPU the calling thread runs on right now. Asks the kernel
+ * rather than numa_node_of_cpu(), whose table is filled in on first use
+ * without a lock, as this runs on all the workers at once.
+ */
+int current_node(void)
+{
+    unsigned int cpu, node;
+    if(numa_available() < 0 || syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+        return 0;
+    }
+    return (int) node;
+}
+
+/* Asks for the whole pages of memory .. memory + bytes to be on node,
+ * moving those already touched. The kernel falls back to other nodes
+ * when node is full; pages shared with neighbouring blocks keep going
+ * wherever they are first touched.
+ */
+void place_on_node(void *memory, size_t bytes, int node)
+{
+    if(numa_available() < 0) {
+        return;
+    }
+    uintptr_t page = (uintptr_t) numa_pagesize();
+    uintptr_t begin = ((uintptr_t) memory + page - 1) / page * page;
+    uintptr_t end = ((uintptr_t) memory + bytes) / page * page;
+    if(end <= begin) {
+        return;
+    }
+    struct bitmask *nodes = numa_allocate_nodemask();
+    numa_bitmask_setbit(nodes, node);
+    mbind((void *) begin, end - begin, MPOL_PREFERRED, nodes->maskp, nodes->size + 1,
+        MPOL_MF_MOVE);
+    numa_bitmask_free(nodes);
+}
+
+/* Bytes of memory .. memory + bytes in pages that are on node. Pages not
+ * touched yet are on no node.
+ */
+size_t bytes_on_node(const void *memory, size_t bytes, int node)
+{
+    if(numa_available() < 0) {
+        return node == 0 ? bytes : 0;
+    }
+    uintptr_t page = (uintptr_t) numa_pagesize();
+    uintptr_t begin = (uintptr_t) memory / page * page;
+    uintptr_t end = (uintptr_t) memory + bytes;
+    void *pages[QUERY_PAGES];
+    int status[QUERY_PAGES];
+    size_t found = 0;
+    while(begin < end) {
+        unsigned long count = 0;
+        for(; count < QUERY_PAGES && begin < end; count++, begin += page) {
+            pages[count] = (void *) begin;
+        }
+        if(numa_move_pages(0, count, pages, NULL, status, 0) < 0) {
+            break;
+        }
+        for(unsigned long i = 0; i < count; i++) {
+            found += status[i] == node ? page : 0;
+        }
+    }
+    return found < bytes ? found : bytes;
+}
+
+/* Restricts the calling thread to the CPUs of node, keeping it on the
+ * CPUs it is already bound to (by OMP_PLACES, say) that are on the node,
+ * and stores the affinity it had in saved for restore_binding().
+ */
+void bind_to_node(int node, node_binding *saved)
+{
+    saved->mask = NULL;
+    if(numa_available() < 0) {
+        return;
+    }
+    struct bitmask *current = numa_allocate_cpumask();
+    struct bitmask *cpus = numa_allocate_cpumask();
+    if(numa_sched_getaffinity(0, current) < 0 || numa_node_to_cpus(node, cpus) < 0) {
+        numa_bitmask_free(current);
+        numa_bitmask_free(cpus);
+        return;
+    }
+    struct bitmask *both = numa_allocate_cpumask();
+    int overlap = 0;
+    for(unsigned int cpu = 0; cpu < cpus->size; cpu++) {
+        if(numa_bitmask_isbitset(cpus, cpu) && numa_bitmask_isbitset(current, cpu)) {
+            numa_bitmask_setbit(both, cpu);
+            overlap = 1;
+        }
+    }
+    numa_sched_setaffinity(0, overlap ? both : cpus);
+    numa_bitmask_free(both);
+    numa_bitmask_free(cpus);
+    saved->mask = current;
+}
+
+void restore_binding(node_binding *saved)
+{
+    if(saved->mask != NULL) {
+        numa_sched_setaffinity(0, (struct bitmask *) saved->mask);
+        numa_bitmask_free((struct bitmask *) saved->mask);
+        saved->mask = NULL;
+    }
+}
+
+#else
+
+int memory_nodes(void)
+{
+    return 1;
+}
+
+int current_node(void)
+{
+    return 0;
+}
+
+void place_on_node(void *memory, size_t bytes, int node)
+{
+    (void) memory;
+    (void) bytes;
+    (void) node;
+}
+
+size_t bytes_on_node(const void *memory, size_t bytes, int node)
+{
+    (void) memory;
+    return node == 0 ? bytes : 0;
+}
+
+void bind_to_node(int node, node_binding *saved)
+{
+    (void) node;
+    saved->mask = NULL;
+}
+
+void restore_binding(node_binding *saved)
+{
+    saved->mask = NULL;
+}
+
+#endif
@@ -0,0 +1,29 @@
+/* placement.h
+   NUMA placement for the OpenMP engine: how many nodes there are, putting
+   memory on one of them, binding the calling thread to one, and finding
+   out where pages ended up. Built on libnuma when compiled with
+   STRASSEN_HAVE_NUMA; without it, or when the kernel has no NUMA support,
+   there is a single node 0, nothing is placed or bound, and all memory
+   counts as being on node 0.
+*/
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stddef.h>
+#include "element.h"
+
+/* The CPU affinity of a thread before bind_to_node(). */
+typedef struct {
+    void *mask;
+} node_binding;
+
+int memory_nodes(void);
+int current_node(void);
+
+void place_on_node(void *memory, size_t bytes, int node);
+size_t bytes_on_node(const void *memory, size_t bytes, int node);
+
+void bind_to_node(int node, node_binding *saved);
+void restore_binding(node_binding *saved);
+
+#endif
@@ -0,0 +1,256 @@
+/* profile.c
+   The tables of profile.h: one per thread, registered on its first record
+   and kept to the end, the perf_event_open() groups, and the summary.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "profile.h"
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/* Rows of a table: outside the recursion, then depths 0 and on; deeper
+ * levels are counted in the last row.
+ */
+#define PROFILE_ROWS 12
+
+typedef struct {
+    uint64_t calls, nanoseconds, bytes;
+    double flops;
+    uint64_t counters[PROFILE_COUNTERS];
+} profile_entry;
+
+typedef struct profile_table {
+    profile_entry entries[PHASE_COUNT][PROFILE_ROWS];
+    // leader of the thread's counter group, -1 without one, and the
+    // place of each counter in the group, -1 for those not opened
+    int group;
+    int slot[PROFILE_COUNTERS];
+    struct profile_table *next;
+} profile_table;
+
+static const char *phase_names[PHASE_COUNT] = {
+    "multiply", "add", "combine", "copy", "allocate"
+};
+static const char *counter_names[PROFILE_COUNTERS] = {
+    "cycles", "cache misses", "LLC read misses"
+};
+
+static _Thread_local profile_table *table;
+static _Thread_local int depth = -1;
+
+static pthread_mutex_t tables_lock = PTHREAD_MUTEX_INITIALIZER;
+static profile_table *tables;
+static int counters_wanted;
+
+static uint64_t now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000u + (uint64_t) t.tv_nsec;
+}
+
+/* Opens the counters of the calling thread as one group, as many of them
+ * as the kernel gives.
+ */
+static void open_counters(profile_table *t)
+{
+#ifdef __linux__
+    static const uint32_t types[PROFILE_COUNTERS] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE
+    };
+    static const uint64_t configs[PROFILE_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_CACHE_LL | PERF_COUNT_HW_CACHE_OP_READ << 8
+            | PERF_COUNT_HW_CACHE_RESULT_MISS << 16
+    };
+    int opened = 0;
+    for(int c = 0; c < PROFILE_COUNTERS; c++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = types[c];
+        attr.config = configs[c];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        int fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, t->group, 0);
+        if(fd < 0) {
+            continue;
+        }
+        if(t->group < 0) {
+            t->group = fd;
+        }
+        t->slot[c] = opened++;
+    }
+#else
+    (void) t;
+#endif
+}
+
+static void read_counters(const profile_table *t, uint64_t *counters)
+{
+    uint64_t values[1 + PROFILE_COUNTERS] = { 0 };
+#ifdef __linux__
+    if(t->group >= 0 && read(t->group, values, sizeof values) < (ssize_t) sizeof(uint64_t)) {
+        values[0] = 0;
+    }
+#endif
+    for(int c = 0; c < PROFILE_COUNTERS; c++) {
+        int slot = t->slot[c];
+        counters[c] = slot >= 0 && (uint64_t) slot < values[0] ? values[1 + slot] : 0;
+    }
+}
+
+static void print_summary(void);
+
+/* The calling thread's table, made on its first record. */
+static profile_table * thread_table(void)
+{
+    if(table != NULL) {
+        return table;
+    }
+    profile_table *t = (profile_table *) calloc(1, sizeof *t);
+    if(t == NULL) {
+        abort();
+    }
+    t->group = -1;
+    for(int c = 0; c < PROFILE_COUNTERS; c++) {
+        t->slot[c] = -1;
+    }
+    pthread_mutex_lock(&tables_lock);
+    if(tables == NULL) {
+        const char *env = getenv("STRASSEN_PROFILE_COUNTERS");
+        counters_wanted = env != NULL && atoi(env) != 0;
+        atexit(print_summary);
+    }
+    t->next = tables;
+    tables = t;
+    pthread_mutex_unlock(&tables_lock);
+    if(counters_wanted) {
+        open_counters(t);
+    }
+    table = t;
+    return t;
+}
+
+void profile_start(profile_mark *mark)
+{
+    profile_table *t = thread_table();
+    if(t->group >= 0) {
+        read_counters(t, mark->counters);
+    }
+    mark->nanoseconds = now();
+}
+
+void profile_stop(const profile_mark *mark, profile_phase phase, size_t bytes, double flops)
+{
+    uint64_t end = now();
+    profile_table *t = table;
+    int row = depth + 1 < PROFILE_ROWS ? depth + 1 : PROFILE_ROWS - 1;
+    profile_entry *e = &t->entries[phase][row];
+    e->calls++;
+    e->nanoseconds += end - mark->nanoseconds;
+    e->bytes += bytes;
+    e->flops += flops;
+    if(t->group >= 0) {
+        uint64_t counters[PROFILE_COUNTERS];
+        read_counters(t, counters);
+        for(int c = 0; c < PROFILE_COUNTERS; c++) {
+            e->counters[c] += counters[c] - mark->counters[c];
+        }
+    }
+}
+
+/* Sets the calling thread's depth, returning the one it was at. */
+int profile_enter(int d)
+{
+    int outer = depth;
+    depth = d;
+    return outer;
+}
+
+int profile_depth(void)
+{
+    return depth;
+}
+
+/* The tables of all threads added up, one line per phase and depth
+ * that ran, with the hardware counters if any thread had them. Runs at
+ * exit, when no product is running any more.
+ */
+static void print_summary(void)
+{
+    static profile_entry total[PHASE_COUNT][PROFILE_ROWS];
+    int threads = 0;
+    int counted[PROFILE_COUNTERS] = { 0 };
+    int any_counted = 0;
+    pthread_mutex_lock(&tables_lock);
+    for(const profile_table *t = tables; t != NULL; t = t->next) {
+        threads++;
+        for(int c = 0; c < PROFILE_COUNTERS; c++) {
+            counted[c] |= t->slot[c] >= 0;
+            any_counted |= t->slot[c] >= 0;
+        }
+        for(int p = 0; p < PHASE_COUNT; p++) {
+            for(int r = 0; r < PROFILE_ROWS; r++) {
+                const profile_entry *e = &t->entries[p][r];
+                profile_entry *sum = &total[p][r];
+                sum->calls += e->calls;
+                sum->nanoseconds += e->nanoseconds;
+                sum->bytes += e->bytes;
+                sum->flops += e->flops;
+                for(int c = 0; c < PROFILE_COUNTERS; c++) {
+                    sum->counters[c] += e->counters[c];
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&tables_lock);
+
+    fprintf(stderr, "profile of the %s kernels, %d thread%s, seconds summed over threads\n",
+        ELEMENT_LABEL, threads, threads == 1 ? "" : "s");
+    fprintf(stderr, "phase\tdepth\tcalls\tseconds\tGB\tGB/s\tGflop\tGflop/s");
+    for(int c = 0; c < PROFILE_COUNTERS && any_counted; c++) {
+        fprintf(stderr, "\t%s", counter_names[c]);
+    }
+    fprintf(stderr, "\n");
+    for(int p = 0; p < PHASE_COUNT; p++) {
+        for(int r = 0; r < PROFILE_ROWS; r++) {
+            const profile_entry *e = &total[p][r];
+            if(e->calls == 0) {
+                continue;
+            }
+            double seconds = e->nanoseconds * 1e-9;
+            double gigabytes = e->bytes * 1e-9, gigaflops = e->flops * 1e-9;
+            char row[16];
+            if(r == 0) {
+                snprintf(row, sizeof row, "-");
+            } else {
+                snprintf(row, sizeof row, "%d%s", r - 1, r == PROFILE_ROWS - 1 ? "+" : "");
+            }
+            fprintf(stderr, "%s\t%s\t%llu\t%f\t%.3f\t%.2f\t%.3f\t%.2f", phase_names[p], row,
+                (unsigned long long) e->calls, seconds, gigabytes,
+                seconds > 0 ? gigabytes / seconds : 0, gigaflops,
+                seconds > 0 ? gigaflops / seconds : 0);
+            for(int c = 0; c < PROFILE_COUNTERS && any_counted; c++) {
+                if(counted[c]) {
+                    fprintf(stderr, "\t%llu", (unsigned long long) e->counters[c]);
+                } else {
+                    fprintf(stderr, "\t-");
+                }
+            }
+            fprintf(stderr, "\n");
+        }
+    }
+    if(counters_wanted && !any_counted) {
+        fprintf(stderr, "hardware counters unavailable\n");
+    }
+}
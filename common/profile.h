@@ -0,0 +1,74 @@
+/* profile.h
+   Instrumentation of the hot paths, compiled in with STRASSEN_PROFILE
+   (cmake -DSTRASSEN_WITH_PROFILE=ON) and to nothing without it. The base
+   case multiplications, the elementwise kernels, the copies into and out
+   of other layouts and allocate_aligned() count their calls, time, bytes
+   moved and flops, per phase and per recursion depth of the engine they
+   run in; a summary table goes to stderr at exit.
+
+   Every thread counts into a table of its own, so a record takes two
+   clock reads and no lock or atomic. The recursion depth is per thread
+   too: the engines set it with PROFILE_ENTER() wherever a thread starts
+   working on a level, and work outside any recursion (packing operands,
+   file I/O) is shown at depth "-". Nested phases are counted in both, so
+   the multiplications of half include the allocations for widening.
+
+   With STRASSEN_PROFILE_COUNTERS=1 in the environment, each thread also
+   opens a perf_event_open() group of CPU cycles, cache misses and
+   last-level cache read misses, counting in user space, and reads it at
+   both ends of every record. That is a system call each, so it is for
+   finding where misses come from rather than timing; when the kernel
+   doesn't give the events (no PMU, perf_event_paranoid) they are shown as
+   unavailable.
+*/
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "element.h"
+
+typedef enum {
+    PHASE_MULTIPLY,
+    PHASE_ADD,
+    PHASE_COMBINE,
+    PHASE_COPY,
+    PHASE_ALLOCATE,
+    PHASE_COUNT
+} profile_phase;
+
+/* CPU cycles, cache misses and LLC read misses. */
+#define PROFILE_COUNTERS 3
+
+/* The start of a record. */
+typedef struct {
+    uint64_t nanoseconds;
+    uint64_t counters[PROFILE_COUNTERS];
+} profile_mark;
+
+#ifdef STRASSEN_PROFILE
+void profile_start(profile_mark *mark);
+void profile_stop(const profile_mark *mark, profile_phase phase, size_t bytes, double flops);
+int profile_enter(int depth);
+int profile_depth(void);
+
+/* Records what runs between the two as a phase that moved bytes and did
+ * flops. mark names the record, so that records can nest.
+ */
+#define PROFILE_START(mark) profile_mark mark; profile_start(&mark)
+#define PROFILE_STOP(mark, phase, bytes, flops) profile_stop(&mark, phase, bytes, flops)
+/* Counts what the calling thread records from here on at recursion depth
+ * depth (0 is the top level), up to PROFILE_LEAVE() in the same block.
+ */
+#define PROFILE_ENTER(depth) int profile_outer = profile_enter(depth)
+#define PROFILE_LEAVE() profile_enter(profile_outer)
+/* The depth below the one the calling thread is at. */
+#define PROFILE_BELOW (profile_depth() + 1)
+#else
+#define PROFILE_START(mark) ((void) 0)
+#define PROFILE_STOP(mark, phase, bytes, flops) ((void) 0)
+#define PROFILE_ENTER(depth) ((void) 0)
+#define PROFILE_LEAVE() ((void) 0)
+#endif
+
+#endif
@@ -0,0 +1,124 @@
+/* random.c
+   The counter-based generator of random.h.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "random.h"
+
+#define DEFAULT_SEED 1
+/* SplitMix64's increment, 2^64 over the golden ratio. */
+#define GOLDEN_GAMMA UINT64_C(0x9e3779b97f4a7c15)
+#define TWO_PI 6.283185307179586
+
+static fill_distribution distribution = FILL_INTEGER;
+static uint64_t seed = DEFAULT_SEED;
+static int configured = 0;
+/* Streams handed out so far. */
+static uint64_t streams = 0;
+
+/* SplitMix64's output function, a bijection that spreads every bit of z
+ * over all of the result.
+ */
+static inline uint64_t mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+}
+
+/* Number n of the stream with key key. */
+static inline uint64_t draw(uint64_t key, uint64_t n)
+{
+    return mix(key + n * GOLDEN_GAMMA);
+}
+
+/* The top 53 bits of x as a double in [0, 1). */
+static inline double unit(uint64_t x)
+{
+    return (x >> 11) * 0x1.0p-53;
+}
+
+/* Sets the distribution and the seed from the environment. */
+static void configure(void)
+{
+    const char *env = getenv("STRASSEN_FILL");
+    if(env != NULL && strcmp(env, "uniform") == 0) {
+        distribution = FILL_UNIFORM;
+    } else if(env != NULL && strcmp(env, "normal") == 0) {
+        distribution = FILL_NORMAL;
+    } else if(env != NULL && strcmp(env, "integer") != 0) {
+        fprintf(stderr, "unknown STRASSEN_FILL %s, using integer\n", env);
+    }
+    if(ELEMENT_INTEGER && distribution != FILL_INTEGER) {
+        fprintf(stderr, "STRASSEN_FILL=%s needs a floating point type, using integer\n", env);
+        distribution = FILL_INTEGER;
+    }
+    env = getenv("STRASSEN_SEED");
+    if(env != NULL) {
+        seed = strtoull(env, NULL, 0);
+    }
+    configured = 1;
+}
+
+/* The key of the next stream: fills made in the same order from the same
+ * seed get the same keys. Not thread-safe.
+ */
+uint64_t fill_key(void)
+{
+    if(!configured) {
+        configure();
+    }
+    return draw(mix(seed), streams++);
+}
+
+/* Sets row[0] .. row[count - 1] to elements index .. index + count - 1
+ * of the stream with key key.
+ */
+void fill_row(uint64_t key, uint64_t index, int count, matrix_type *row)
+{
+    switch(distribution) {
+    case FILL_INTEGER:
+        for(int j = 0; j < count; j++) {
+            // the top 32 bits scaled to 0..99, without a division
+            uint64_t r = ((draw(key, index + j) >> 32) * 100) >> 32;
+            row[j] = FILL_VALUE((int) r);
+        }
+        break;
+    case FILL_UNIFORM:
+        for(int j = 0; j < count; j++) {
+            row[j] = ELEMENT_SET((accumulator_type) (2 * unit(draw(key, index + j)) - 1));
+        }
+        break;
+    case FILL_NORMAL:
+        // Box-Muller on numbers 2 p and 2 p + 1 of the stream gives
+        // elements 2 p and 2 p + 1, so a row may start or end half way
+        // through a pair
+        for(int j = 0; j < count;) {
+            uint64_t pair = (index + j) / 2;
+            double radius = sqrt(-2 * log(1 - unit(draw(key, 2 * pair))));
+            double angle = TWO_PI * unit(draw(key, 2 * pair + 1));
+            if((index + j) % 2 == 0) {
+                row[j++] = ELEMENT_SET((accumulator_type) (radius * cos(angle)));
+            }
+            if(j < count) {
+                row[j++] = ELEMENT_SET((accumulator_type) (radius * sin(angle)));
+            }
+        }
+        break;
+    }
+}
+
+/* Fills the rows x cols view v with the stream with key key, element (i,
+ * j) being number i * cols + j.
+ */
+void fill_view(uint64_t key, int rows, int cols, matrix_view v)
+{
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for(int i = 0; i < rows; i++) {
+        fill_row(key, (uint64_t) i * cols, cols, &VIEW_AT(v, i, 0));
+    }
+}
@@ -0,0 +1,35 @@
+/* random.h
+   Seeded, reproducible random matrices for fill_matrix() and
+   matrix_file_fill(). Each fill draws a stream key from the seed and the
+   number of fills before it, and element number index (row * cols + col)
+   of the stream is SplitMix64's output for that key and index, computed
+   directly from the counter. No element depends on another, so rows are
+   filled in parallel (with OpenMP, where the program has it) and every
+   thread count, schedule and tile layout gives the same matrix. The
+   threads that will work on a part of the matrix also touch its pages
+   first.
+
+   Read from the environment on the first fill:
+     STRASSEN_FILL  integer (whole numbers 0 to 99, or FILL_VALUE() of
+                    them), uniform (on [-1, 1)) or normal (mean 0,
+                    variance 1); the integer types are always filled with
+                    integers
+     STRASSEN_SEED  the seed, a 64-bit number (1)
+*/
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+#include "matrix.h"
+
+typedef enum {
+    FILL_INTEGER,
+    FILL_UNIFORM,
+    FILL_NORMAL
+} fill_distribution;
+
+uint64_t fill_key(void);
+void fill_row(uint64_t key, uint64_t index, int count, matrix_type *row);
+void fill_view(uint64_t key, int rows, int cols, matrix_view v);
+
+#endif
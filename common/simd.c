@@ -0,0 +1,173 @@
+/* simd.c
+   SSE, AVX2 and AVX-512 versions of the elementwise row kernels. Each
+   version is compiled with its own target attribute, so the file builds
+   without -m flags, and the pointers in simd.h are set before main() from
+   CPU detection. STRASSEN_SIMD=scalar|sse|avx2|avx512 caps the choice.
+   The vectors hold 128, 256 or 512 bits of the element type, so as many
+   lanes as fit; half is widened to float with F16C, so its three levels
+   need F16C too.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "simd.h"
+
+static void add_row_scalar(const matrix_type *a, const matrix_type *b, matrix_type *r, int n)
+{
+    for(int j = 0; j < n; j++) {
+        r[j] = ELEMENT_SET(ELEMENT_GET(a[j]) + ELEMENT_GET(b[j]));
+    }
+}
+
+static void subtract_row_scalar(const matrix_type *a, const matrix_type *b, matrix_type *r, int n)
+{
+    for(int j = 0; j < n; j++) {
+        r[j] = ELEMENT_SET(ELEMENT_GET(a[j]) - ELEMENT_GET(b[j]));
+    }
+}
+
+static void combine_row_scalar(const matrix_type *a, const matrix_type *b, const matrix_type *c,
+    const matrix_type *d, matrix_type *r, int n)
+{
+    for(int j = 0; j < n; j++) {
+        r[j] = ELEMENT_SET(ELEMENT_GET(a[j]) + ELEMENT_GET(b[j]) - ELEMENT_GET(c[j]) + ELEMENT_GET(d[j]));
+    }
+}
+
+void (*add_row)(const matrix_type *, const matrix_type *, matrix_type *, int) = add_row_scalar;
+void (*subtract_row)(const matrix_type *, const matrix_type *, matrix_type *, int) = subtract_row_scalar;
+void (*combine_row)(const matrix_type *, const matrix_type *, const matrix_type *,
+    const matrix_type *, matrix_type *, int) = combine_row_scalar;
+
+static const char *isa = "scalar";
+
+const char * simd_isa(void)
+{
+    return isa;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+/* One set of row kernels for a vector type: full vectors of width
+ * elements, then a scalar tail. Loads of an index always precede its
+ * store, so r may alias any input.
+ */
+#define ROW_KERNELS(suffix, isa_name, width, loadu, storeu, vadd, vsub)                 \
+    __attribute__((target(isa_name)))                                                   \
+    static void add_row_##suffix(const matrix_type *a, const matrix_type *b,            \
+        matrix_type *r, int n)                                                          \
+    {                                                                                   \
+        int j = 0;                                                                      \
+        for(; j + width <= n; j += width) {                                             \
+            storeu(r + j, vadd(loadu(a + j), loadu(b + j)));                            \
+        }                                                                               \
+        for(; j < n; j++) {                                                             \
+            r[j] = ELEMENT_SET(ELEMENT_GET(a[j]) + ELEMENT_GET(b[j]));                   \
+        }                                                                               \
+    }                                                                                   \
+    __attribute__((target(isa_name)))                                                   \
+    static void subtract_row_##suffix(const matrix_type *a, const matrix_type *b,       \
+        matrix_type *r, int n)                                                          \
+    {                                                                                   \
+        int j = 0;                                                                      \
+        for(; j + width <= n; j += width) {                                             \
+            storeu(r + j, vsub(loadu(a + j), loadu(b + j)));                            \
+        }                                                                               \
+        for(; j < n; j++) {                                                             \
+            r[j] = ELEMENT_SET(ELEMENT_GET(a[j]) - ELEMENT_GET(b[j]));                   \
+        }                                                                               \
+    }                                                                                   \
+    __attribute__((target(isa_name)))                                                   \
+    static void combine_row_##suffix(const matrix_type *a, const matrix_type *b,        \
+        const matrix_type *c, const matrix_type *d, matrix_type *r, int n)              \
+    {                                                                                   \
+        int j = 0;                                                                      \
+        for(; j + width <= n; j += width) {                                             \
+            storeu(r + j, vadd(vsub(vadd(loadu(a + j), loadu(b + j)), loadu(c + j)),    \
+                loadu(d + j)));                                                         \
+        }                                                                               \
+        for(; j < n; j++) {                                                             \
+            r[j] = ELEMENT_SET(ELEMENT_GET(a[j]) + ELEMENT_GET(b[j]) - ELEMENT_GET(c[j])  \
+                + ELEMENT_GET(d[j]));                                                   \
+        }                                                                               \
+    }
+
+#if STRASSEN_ELEMENT == ELEMENT_FLOAT
+ROW_KERNELS(sse, "sse", 4, _mm_loadu_ps, _mm_storeu_ps, _mm_add_ps, _mm_sub_ps)
+ROW_KERNELS(avx2, "avx2", 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_add_ps, _mm256_sub_ps)
+ROW_KERNELS(avx512, "avx512f", 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_add_ps, _mm512_sub_ps)
+#define SSE_FEATURES "sse"
+#elif STRASSEN_ELEMENT == ELEMENT_DOUBLE
+ROW_KERNELS(sse, "sse2", 2, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd, _mm_sub_pd)
+ROW_KERNELS(avx2, "avx2", 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, _mm256_sub_pd)
+ROW_KERNELS(avx512, "avx512f", 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_add_pd, _mm512_sub_pd)
+#define SSE_FEATURES "sse2"
+#elif STRASSEN_ELEMENT == ELEMENT_HALF
+// half rows are loaded into float vectors and rounded back on the store
+#define LOAD_HALF_128(p) _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(p)))
+#define STORE_HALF_128(p, v) _mm_storel_epi64((__m128i *)(p), _mm_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT))
+#define LOAD_HALF_256(p) _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(p)))
+#define STORE_HALF_256(p, v) _mm_storeu_si128((__m128i *)(p), _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT))
+#define LOAD_HALF_512(p) _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(p)))
+#define STORE_HALF_512(p, v) _mm256_storeu_si256((__m256i *)(p), _mm512_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT))
+ROW_KERNELS(sse, "f16c", 4, LOAD_HALF_128, STORE_HALF_128, _mm_add_ps, _mm_sub_ps)
+ROW_KERNELS(avx2, "avx2,f16c", 8, LOAD_HALF_256, STORE_HALF_256, _mm256_add_ps, _mm256_sub_ps)
+ROW_KERNELS(avx512, "avx512f", 16, LOAD_HALF_512, STORE_HALF_512, _mm512_add_ps, _mm512_sub_ps)
+#define SSE_FEATURES "f16c"
+#define AVX2_FEATURES "f16c"
+#define AVX512_FEATURES "f16c"
+#else
+#define LOADU_128(p) _mm_loadu_si128((const __m128i *)(p))
+#define STOREU_128(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#define LOADU_256(p) _mm256_loadu_si256((const __m256i *)(p))
+#define STOREU_256(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+#if STRASSEN_ELEMENT == ELEMENT_INT32
+ROW_KERNELS(sse, "sse2", 4, LOADU_128, STOREU_128, _mm_add_epi32, _mm_sub_epi32)
+ROW_KERNELS(avx2, "avx2", 8, LOADU_256, STOREU_256, _mm256_add_epi32, _mm256_sub_epi32)
+ROW_KERNELS(avx512, "avx512f", 16, _mm512_loadu_si512, _mm512_storeu_si512, _mm512_add_epi32,
+    _mm512_sub_epi32)
+#else
+ROW_KERNELS(sse, "sse2", 2, LOADU_128, STOREU_128, _mm_add_epi64, _mm_sub_epi64)
+ROW_KERNELS(avx2, "avx2", 4, LOADU_256, STOREU_256, _mm256_add_epi64, _mm256_sub_epi64)
+ROW_KERNELS(avx512, "avx512f", 8, _mm512_loadu_si512, _mm512_storeu_si512, _mm512_add_epi64,
+    _mm512_sub_epi64)
+#endif
+#define SSE_FEATURES "sse2"
+#endif
+
+/* CPU features each level needs besides its instruction set. */
+#ifndef AVX2_FEATURES
+#define AVX2_FEATURES "avx2"
+#define AVX512_FEATURES "avx512f"
+#endif
+
+#define USE_KERNELS(suffix)                     \
+    do {                                        \
+        add_row = add_row_##suffix;                                                     \
+        subtract_row = subtract_row_##suffix;                                           \
+        combine_row = combine_row_##suffix;                                             \
+        isa = #suffix;                                                                  \
+    } while (0)
+
+/* Runs before main(), so the pointers never change while threads use them.
+ */
+__attribute__((constructor))
+static void select_row_kernels(void)
+{
+    const char *cap = getenv("STRASSEN_SIMD");
+    int level = 3;
+    if(cap != NULL) {
+        level = strcmp(cap, "avx512") == 0 ? 3 : strcmp(cap, "avx2") == 0 ? 2
+            : strcmp(cap, "sse") == 0 ? 1 : 0;
+    }
+
+    __builtin_cpu_init();
+    if(level >= 3 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports(AVX512_FEATURES)) {
+        USE_KERNELS(avx512);
+    } else if(level >= 2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports(AVX2_FEATURES)) {
+        USE_KERNELS(avx2);
+    } else if(level >= 1 && __builtin_cpu_supports(SSE_FEATURES)) {
+        USE_KERNELS(sse);
+    }
+}
+#endif
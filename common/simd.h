@@ -0,0 +1,23 @@
+/* simd.h
+   Row kernels for the elementwise matrix operations, picked once at start
+   up for the widest instruction set the CPU supports.
+*/
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "matrix.h"
+
+/* r[j] = a[j] + b[j] for j < n; r may be a or b. */
+extern void (*add_row)(const matrix_type *a, const matrix_type *b, matrix_type *r, int n);
+/* r[j] = a[j] - b[j] for j < n; r may be a or b. */
+extern void (*subtract_row)(const matrix_type *a, const matrix_type *b, matrix_type *r, int n);
+/* r[j] = a[j] + b[j] - c[j] + d[j] for j < n, in one pass; r may be any input. */
+extern void (*combine_row)(const matrix_type *a, const matrix_type *b, const matrix_type *c,
+    const matrix_type *d, matrix_type *r, int n);
+
+/* Name of the instruction set the row kernels use: "avx512", "avx2",
+ * "sse" or "scalar".
+ */
+const char * simd_isa(void);
+
+#endif
@@ -0,0 +1,428 @@
+/* stealing.c
+   The work-stealing scheduler of stealing.h.
+*/
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "stealing.h"
+
+#ifdef _WIN32
+#include <windows.h>
+typedef SRWLOCK lock_type;
+typedef CONDITION_VARIABLE condition_type;
+typedef HANDLE thread_type;
+#define LOCK_INITIALIZER SRWLOCK_INIT
+#define CONDITION_INITIALIZER CONDITION_VARIABLE_INIT
+#define THREAD_LOCAL __declspec(thread)
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+typedef pthread_mutex_t lock_type;
+typedef pthread_cond_t condition_type;
+typedef pthread_t thread_type;
+#define LOCK_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define CONDITION_INITIALIZER PTHREAD_COND_INITIALIZER
+#define THREAD_LOCAL _Thread_local
+#endif
+
+/* Tasks a deque holds. A worker whose deque is full runs the item itself;
+ * a level of the recursion pushes six, so this is never reached there.
+ */
+#define DEQUE_CAPACITY 256
+/* Items stealing_for() spawns at once; more are spawned in rounds.
+ */
+#define FAN_OUT 16
+/* Failed rounds of stealing before an idle worker yields its processor.
+ */
+#define STEAL_ROUNDS 64
+
+typedef struct {
+    void (*work)(const void *context, int i);
+    const void *context;
+    int i;
+    atomic_int *pending;
+} stealing_task;
+
+/* Chase and Lev's deque on a fixed ring. The owner moves bottom, thieves
+ * move top; they are a cache line apart so that stealing doesn't slow
+ * the owner down.
+ */
+typedef struct {
+    atomic_long top;
+    char top_line[MATRIX_ALIGNMENT - sizeof(atomic_long)];
+    atomic_long bottom;
+    char bottom_line[MATRIX_ALIGNMENT - sizeof(atomic_long)];
+    _Atomic(stealing_task *) slots[DEQUE_CAPACITY];
+} stealing_deque;
+
+static int worker_count = 1;
+static stealing_deque *deques;
+static void *executor_pool;
+static stealing_submit executor_submit;
+
+/* The product running, if product_done is 0. Helpers count themselves in
+ * helpers before they look at it, and a product waits for them to leave
+ * before the next one starts.
+ */
+static atomic_uint product_epoch;
+static atomic_int product_done = 1;
+static atomic_int next_worker;
+static atomic_int helpers;
+
+/* Products take turns on session. The threads of the scheduler's own
+ * wait on wake for wake_epoch to change.
+ */
+static lock_type session = LOCK_INITIALIZER;
+static lock_type wake_lock = LOCK_INITIALIZER;
+static condition_type wake = CONDITION_INITIALIZER;
+static unsigned int wake_epoch;
+static int quitting;
+static thread_type *threads;
+static int thread_count;
+
+static THREAD_LOCAL int current_worker = -1;
+
+#ifdef _WIN32
+static void lock(lock_type *l) { AcquireSRWLockExclusive(l); }
+static void unlock(lock_type *l) { ReleaseSRWLockExclusive(l); }
+static void wait_for(condition_type *c, lock_type *l) { SleepConditionVariableSRW(c, l, INFINITE, 0); }
+static void wake_all(condition_type *c) { WakeAllConditionVariable(c); }
+static void yield(void) { SwitchToThread(); }
+#else
+static void lock(lock_type *l) { pthread_mutex_lock(l); }
+static void unlock(lock_type *l) { pthread_mutex_unlock(l); }
+static void wait_for(condition_type *c, lock_type *l) { pthread_cond_wait(c, l); }
+static void wake_all(condition_type *c) { pthread_cond_broadcast(c); }
+static void yield(void) { sched_yield(); }
+#endif
+
+/* Processors online, the default number of workers.
+ */
+int stealing_processors(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int) info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int) count : 1;
+#endif
+}
+
+static int push(stealing_deque *d, stealing_task *task)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    if(b - t >= DEQUE_CAPACITY) {
+        return 0;
+    }
+    atomic_store_explicit(&d->slots[b % DEQUE_CAPACITY], task, memory_order_relaxed);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_release);
+    return 1;
+}
+
+/* The owner's end: the task pushed last, or NULL. */
+static stealing_task * take(stealing_deque *d)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if(t > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+    stealing_task *task = atomic_load_explicit(&d->slots[b % DEQUE_CAPACITY], memory_order_relaxed);
+    if(t == b) {
+        // the last one: a thief may be taking it too
+        if(!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst,
+            memory_order_relaxed)) {
+            task = NULL;
+        }
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+/* The thieves' end: the oldest task, or NULL if there is none or another
+ * thief got it first.
+ */
+static stealing_task * steal(stealing_deque *d)
+{
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if(t >= b) {
+        return NULL;
+    }
+    stealing_task *task = atomic_load_explicit(&d->slots[t % DEQUE_CAPACITY], memory_order_relaxed);
+    if(!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst,
+        memory_order_relaxed)) {
+        return NULL;
+    }
+    return task;
+}
+
+/* Runs task and counts it done. The task lives in the frame of the
+ * stealing_for() waiting for it, so it must not be touched after that.
+ */
+static void run_task(stealing_task *task)
+{
+    atomic_int *pending = task->pending;
+    task->work(task->context, task->i);
+    atomic_fetch_sub_explicit(pending, 1, memory_order_release);
+}
+
+/* A task from worker's own deque or, failing that, one stolen from the
+ * others, starting at a pseudo-random one.
+ */
+static stealing_task * find_task(int worker, unsigned int *seed)
+{
+    stealing_task *task = take(&deques[worker]);
+    if(task != NULL || worker_count == 1) {
+        return task;
+    }
+    *seed = *seed * 1103515245u + 12345u;
+    int victim = (int)((*seed >> 16) % (unsigned int) worker_count);
+    for(int tried = 0; task == NULL && tried < worker_count; tried++) {
+        if(victim != worker) {
+            task = steal(&deques[victim]);
+        }
+        victim = victim + 1 == worker_count ? 0 : victim + 1;
+    }
+    return task;
+}
+
+/* Runs work(context, 0) .. work(context, count - 1) and returns when all
+ * of them are done. The first item of each round runs here and the
+ * others are pushed for the workers to take; meanwhile this worker runs
+ * whatever it finds. Outside stealing_run() the items run one after the
+ * other.
+ */
+void stealing_for(void (*work)(const void *context, int i), const void *context, int count)
+{
+    int worker = current_worker;
+    if(worker < 0) {
+        for(int i = 0; i < count; i++) {
+            work(context, i);
+        }
+        return;
+    }
+    unsigned int seed = (unsigned int) worker * 2654435761u + 1;
+    stealing_task tasks[FAN_OUT];
+    atomic_int pending;
+    for(int first = 0; first < count; first += FAN_OUT) {
+        int round = count - first < FAN_OUT ? count - first : FAN_OUT;
+        atomic_init(&pending, round - 1);
+        for(int j = round - 1; j > 0; j--) {
+            stealing_task task = { work, context, first + j, &pending };
+            tasks[j] = task;
+            if(!push(&deques[worker], &tasks[j])) {
+                run_task(&tasks[j]);
+            }
+        }
+        work(context, first);
+        int idle = 0;
+        while(atomic_load_explicit(&pending, memory_order_acquire) > 0) {
+            stealing_task *task = find_task(worker, &seed);
+            if(task != NULL) {
+                run_task(task);
+                idle = 0;
+            } else if(++idle == STEAL_ROUNDS) {
+                yield();
+                idle = 0;
+            }
+        }
+    }
+}
+
+/* The worker the calling thread is in the running product, or -1.
+ */
+int stealing_worker(void)
+{
+    return current_worker;
+}
+
+int stealing_workers(void)
+{
+    return worker_count;
+}
+
+/* Works on the product as worker until it is done.
+ */
+static void help(int worker)
+{
+    unsigned int seed = (unsigned int) worker * 2654435761u + 1;
+    int idle = 0;
+    current_worker = worker;
+    while(!atomic_load_explicit(&product_done, memory_order_acquire)) {
+        stealing_task *task = find_task(worker, &seed);
+        if(task != NULL) {
+            run_task(task);
+            idle = 0;
+        } else if(++idle == STEAL_ROUNDS) {
+            yield();
+            idle = 0;
+        }
+    }
+    current_worker = -1;
+}
+
+/* Helps with product epoch if it is still running and has a worker left.
+ */
+static void join_product(unsigned int epoch)
+{
+    atomic_fetch_add(&helpers, 1);
+    if(!atomic_load(&product_done) && atomic_load(&product_epoch) == epoch) {
+        int worker = atomic_fetch_add(&next_worker, 1);
+        if(worker < worker_count) {
+            help(worker);
+        }
+    }
+    atomic_fetch_sub(&helpers, 1);
+}
+
+/* The job submitted to the application's pool. */
+static void helper_job(void *argument)
+{
+    join_product((unsigned int)(uintptr_t) argument);
+}
+
+/* The scheduler's own threads: each product wakes them to join it.
+ */
+#ifdef _WIN32
+static DWORD WINAPI helper_thread(void *argument)
+#else
+static void * helper_thread(void *argument)
+#endif
+{
+    (void) argument;
+    unsigned int seen = 0;
+    lock(&wake_lock);
+    for(;;) {
+        while(!quitting && wake_epoch == seen) {
+            wait_for(&wake, &wake_lock);
+        }
+        if(quitting) {
+            break;
+        }
+        seen = wake_epoch;
+        unlock(&wake_lock);
+        join_product(seen);
+        lock(&wake_lock);
+    }
+    unlock(&wake_lock);
+    return 0;
+}
+
+static void start_threads(void)
+{
+    wake_epoch = atomic_load(&product_epoch);
+    threads = (thread_type *) malloc(sizeof(thread_type) * (worker_count - 1));
+    for(thread_count = 0; threads != NULL && thread_count < worker_count - 1; thread_count++) {
+#ifdef _WIN32
+        threads[thread_count] = CreateThread(NULL, 0, helper_thread, NULL, 0, NULL);
+        if(threads[thread_count] == NULL) {
+            break;
+        }
+#else
+        if(pthread_create(&threads[thread_count], NULL, helper_thread, NULL) != 0) {
+            break;
+        }
+#endif
+    }
+}
+
+/* Stops the scheduler's own threads; the next product starts them again.
+ */
+void stealing_shutdown(void)
+{
+    lock(&wake_lock);
+    quitting = 1;
+    wake_all(&wake);
+    unlock(&wake_lock);
+    for(int i = 0; i < thread_count; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
+    free(threads);
+    threads = NULL;
+    thread_count = 0;
+    quitting = 0;
+}
+
+/* Runs the following products on workers workers: the calling thread and
+ * workers - 1 threads of the scheduler's own, or jobs submitted to pool
+ * when submit is given. Must not be called while a product runs.
+ */
+void stealing_configure(int workers, void *pool, stealing_submit submit)
+{
+    stealing_shutdown();
+    if(workers < 1) {
+        workers = 1;
+    }
+    if(deques == NULL || workers > worker_count) {
+        deallocate_aligned(deques);
+        deques = (stealing_deque *) allocate_aligned(sizeof(stealing_deque) * workers);
+    }
+    for(int i = 0; i < workers; i++) {
+        atomic_init(&deques[i].top, 0);
+        atomic_init(&deques[i].bottom, 0);
+        for(int j = 0; j < DEQUE_CAPACITY; j++) {
+            atomic_init(&deques[i].slots[j], NULL);
+        }
+    }
+    worker_count = workers;
+    executor_pool = pool;
+    executor_submit = submit;
+}
+
+/* Runs root(argument) on the calling thread as worker 0, with the others
+ * helping with what it spawns, and returns when it is done. Called from
+ * inside a product, it runs root as part of that one.
+ */
+void stealing_run(void (*root)(void *argument), void *argument)
+{
+    if(current_worker >= 0) {
+        root(argument);
+        return;
+    }
+    if(deques == NULL) {
+        stealing_configure(stealing_processors(), NULL, NULL);
+    }
+    lock(&session);
+    if(worker_count > 1 && executor_submit == NULL && threads == NULL) {
+        start_threads();
+    }
+    // the epoch changes first, so late helpers of the last product that
+    // see product_done cleared know it isn't theirs
+    unsigned int epoch = atomic_fetch_add(&product_epoch, 1) + 1;
+    atomic_store(&next_worker, 1);
+    atomic_store(&product_done, 0);
+    if(executor_submit != NULL) {
+        for(int i = 1; i < worker_count; i++) {
+            executor_submit(executor_pool, helper_job, (void *)(uintptr_t) epoch);
+        }
+    } else if(worker_count > 1) {
+        lock(&wake_lock);
+        wake_epoch = epoch;
+        wake_all(&wake);
+        unlock(&wake_lock);
+    }
+
+    current_worker = 0;
+    root(argument);
+    current_worker = -1;
+
+    atomic_store(&product_done, 1);
+    while(atomic_load(&helpers) > 0) {
+        yield();
+    }
+    unlock(&session);
+}
@@ -0,0 +1,38 @@
+/* stealing.h
+   A work-stealing scheduler for the recursion of the OpenMP engine that
+   doesn't need the OpenMP runtime (STRASSEN_SCHEDULE=stealing, and the
+   threads backend of libstrassen). Every worker has a deque of tasks: it
+   pushes and pops its own at the bottom, and idle workers steal from the
+   top of the others' (Chase and Lev's deque, with the C11 orderings of
+   Le, Pop, Cohen and Zappa Nardelli). stealing_for() spawns a task per
+   item and joins them without blocking: the waiting worker runs its own
+   tasks and steals others' until its items are done.
+
+   The workers are either threads the scheduler starts for the first
+   product and keeps, asleep between products, or borrowed from a pool of
+   the application: submit(pool, run, argument) has to have run(argument)
+   called once on some thread of the pool, without waiting for it. Each
+   product submits a job per helper it wants, and the job works on the
+   product until it is done. Jobs that only start once it is done return
+   at once, so a busy pool gives a product fewer helpers but never
+   deadlocks it. The thread calling stealing_run() is always worker 0.
+   Products from several threads take turns.
+*/
+#ifndef STEALING_H
+#define STEALING_H
+
+#include "matrix.h"
+
+typedef void (*stealing_submit)(void *pool, void (*run)(void *argument), void *argument);
+
+int stealing_processors(void);
+
+void stealing_configure(int workers, void *pool, stealing_submit submit);
+int stealing_workers(void);
+void stealing_shutdown(void);
+
+void stealing_run(void (*root)(void *argument), void *argument);
+void stealing_for(void (*work)(const void *context, int i), const void *context, int count);
+int stealing_worker(void);
+
+#endif
@@ -0,0 +1,152 @@
+/* trace.c
+   The per-thread buffers of trace.h and the JSON they are written as.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "trace.h"
+#include "bench.h"
+
+#ifdef _WIN32
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+/* Events per block of a thread's buffer; full blocks are chained. */
+#define TRACE_BLOCK 1024
+
+typedef struct {
+    const char *name;
+    int depth;
+    double begin, end;
+} trace_event;
+
+typedef struct trace_block {
+    trace_event events[TRACE_BLOCK];
+    int count;
+    struct trace_block *next;
+} trace_block;
+
+typedef struct trace_buffer {
+    int thread;
+    trace_block *first, *last;
+    struct trace_buffer *next;
+} trace_buffer;
+
+enum { TRACE_UNKNOWN, TRACE_STARTING, TRACE_OFF, TRACE_ON };
+
+static atomic_int state = TRACE_UNKNOWN;
+/* Set by the thread that moves state out of TRACE_UNKNOWN. */
+static const char *trace_path;
+static double origin;
+
+static _Atomic(trace_buffer *) buffers;
+static atomic_int thread_count;
+static THREAD_LOCAL trace_buffer *buffer;
+
+static void write_trace(void);
+
+/* Whether STRASSEN_TRACE is set, looked up on the first call. */
+static int tracing(void)
+{
+    int s = atomic_load_explicit(&state, memory_order_acquire);
+    if(s == TRACE_UNKNOWN) {
+        int expected = TRACE_UNKNOWN;
+        if(atomic_compare_exchange_strong(&state, &expected, TRACE_STARTING)) {
+            const char *path = getenv("STRASSEN_TRACE");
+            if(path != NULL && *path != '\0') {
+                trace_path = path;
+                origin = wall_time();
+                atexit(write_trace);
+            }
+            atomic_store_explicit(&state, trace_path != NULL ? TRACE_ON : TRACE_OFF,
+                memory_order_release);
+        }
+    }
+    while((s = atomic_load_explicit(&state, memory_order_acquire)) == TRACE_STARTING) {
+    }
+    return s == TRACE_ON;
+}
+
+/* The calling thread's buffer, hooked into the list on first use. */
+static trace_buffer * thread_buffer(void)
+{
+    if(buffer != NULL) {
+        return buffer;
+    }
+    trace_buffer *b = (trace_buffer *) calloc(1, sizeof *b);
+    trace_block *block = (trace_block *) calloc(1, sizeof *block);
+    if(b == NULL || block == NULL) {
+        abort();
+    }
+    b->thread = atomic_fetch_add(&thread_count, 1);
+    b->first = b->last = block;
+    b->next = atomic_load(&buffers);
+    while(!atomic_compare_exchange_weak(&buffers, &b->next, b)) {
+    }
+    buffer = b;
+    return b;
+}
+
+/* The start of a span, to hand to trace_end(): a time, or -1 when not
+ * tracing.
+ */
+double trace_begin(void)
+{
+    return tracing() ? wall_time() : -1;
+}
+
+/* Records the span from begin to now on the calling thread. name has to
+ * outlive the program, a string literal.
+ */
+void trace_end(double begin, const char *name, int depth)
+{
+    if(begin < 0) {
+        return;
+    }
+    double end = wall_time();
+    trace_buffer *b = thread_buffer();
+    if(b->last->count == TRACE_BLOCK) {
+        trace_block *block = (trace_block *) calloc(1, sizeof *block);
+        if(block == NULL) {
+            abort();
+        }
+        b->last->next = block;
+        b->last = block;
+    }
+    trace_event *e = &b->last->events[b->last->count++];
+    e->name = name;
+    e->depth = depth;
+    e->begin = begin;
+    e->end = end;
+}
+
+/* Writes every thread's events, in microseconds since tracing started.
+ * Runs at exit, when no product is running any more.
+ */
+static void write_trace(void)
+{
+    FILE *out = fopen(trace_path, "w");
+    if(out == NULL) {
+        perror(trace_path);
+        return;
+    }
+    fprintf(out, "{\"traceEvents\":[\n");
+    const char *separator = "";
+    for(trace_buffer *b = atomic_load(&buffers); b != NULL; b = b->next) {
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+            "\"args\":{\"name\":\"thread %d\"}}", separator, b->thread, b->thread);
+        separator = ",\n";
+        for(const trace_block *block = b->first; block != NULL; block = block->next) {
+            for(int i = 0; i < block->count; i++) {
+                const trace_event *e = &block->events[i];
+                fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"strassen\",\"ph\":\"X\",\"pid\":1,"
+                    "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"depth\":%d}}", e->name,
+                    b->thread, (e->begin - origin) * 1e6, (e->end - e->begin) * 1e6, e->depth);
+            }
+        }
+    }
+    fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(out);
+}
@@ -0,0 +1,22 @@
+/* trace.h
+   A timeline of the parallel recursion for chrome://tracing and Perfetto,
+   recorded when STRASSEN_TRACE names a file and written to it as Chrome
+   trace JSON at exit. Each span is a complete event on the thread that ran
+   it, with the recursion depth in its arguments. Spans on one thread nest,
+   so a worker that runs other tasks while it waits for its own shows them
+   inside its wait, and what is left of a span around the spans inside it
+   is the work it did itself.
+
+   Every thread appends to a buffer of its own, which it hooks into the
+   list of buffers once with a compare-and-swap, so recording takes no
+   lock. Unlike the rest of common/, this file is the same for every
+   element type and is built once, so that the products of all types
+   share one timeline.
+*/
+#ifndef TRACE_H
+#define TRACE_H
+
+double trace_begin(void);
+void trace_end(double begin, const char *name, int depth);
+
+#endif
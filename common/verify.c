@@ -0,0 +1,220 @@
+/* verify.c
+   The --verify mode of all three programs. Products up to
+   STRASSEN_VERIFY_REFERENCE_MAX (default 1024) in every dimension are
+   compared element by element with reference_multiplication(); larger
+   ones are checked in O(mk + kn + mn) with Freivalds' test.
+   The worst-case bound is pessimistic by orders of magnitude on random
+   data; STRASSEN_VERIFY_TOLERANCE sets a tighter error limit, relative to
+   max|a| max|b|, to fail against instead.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "verify.h"
+
+#define DEFAULT_REFERENCE_MAX 1024
+#define FREIVALDS_TRIALS 3
+/* Rows of the reference accumulated together, so each row of b is loaded
+ * once per block rather than once per row.
+ */
+#define REFERENCE_ROWS 16
+
+/* Removes every occurrence of flag from argv, shifting the remaining
+ * arguments down, and returns whether there was one.
+ */
+int take_flag(int *argc, char **argv, const char *flag)
+{
+    int found = 0;
+    int kept = 1;
+    for(int i = 1; i < *argc; i++) {
+        if(strcmp(argv[i], flag) == 0) {
+            found = 1;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argv[kept] = NULL;
+    *argc = kept;
+    return found;
+}
+
+/* Removes every --name=value option for name ("--device") from argv like
+ * take_flag() and returns the value of the last one, or NULL if there was
+ * none. The value points into argv.
+ */
+const char * take_option(int *argc, char **argv, const char *name)
+{
+    size_t length = strlen(name);
+    const char *value = NULL;
+    int kept = 1;
+    for(int i = 1; i < *argc; i++) {
+        if(strncmp(argv[i], name, length) == 0 && argv[i][length] == '=') {
+            value = argv[i] + length + 1;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argv[kept] = NULL;
+    *argc = kept;
+    return value;
+}
+
+/* Blocked i-k-j product of an m x k by k x n matrix accumulated in double
+ * precision into the packed m x n array result. Used as the reference the
+ * Strassen result is checked against.
+ */
+void reference_multiplication(int m, int k, int n, matrix_view a, matrix_view b, double *result)
+{
+    for(int i0 = 0; i0 < m; i0 += REFERENCE_ROWS) {
+        int rows = m - i0 < REFERENCE_ROWS ? m - i0 : REFERENCE_ROWS;
+        double *block = result + (size_t)i0 * n;
+        memset(block, 0, sizeof(double) * rows * (size_t)n);
+        for(int p = 0; p < k; p++) {
+            const matrix_type *b_row = &VIEW_AT(b, p, 0);
+            for(int i = 0; i < rows; i++) {
+                double a_ip = ELEMENT_VALUE(VIEW_AT(a, i0 + i, p));
+                double *r = block + (size_t)i * n;
+                for(int j = 0; j < n; j++) {
+                    r[j] += a_ip * ELEMENT_VALUE(b_row[j]);
+                }
+            }
+        }
+    }
+}
+
+/* Worst-case error of an m x k by k x n Strassen product with the given
+ * recursion cutoff, relative to max|a| max|b| (Higham, Accuracy and
+ * Stability of Numerical Algorithms, theorems 23.2 and 23.3): after L
+ * levels down to an inner dimension k0, the error is at most
+ * (12^L (k0^2 + 5 k0) - 5 k) u for Strassen and (18^L (k0^2 + 6 k0) - 6 k)
+ * u for Winograd's variant; L = 0 is the conventional k u. u is the
+ * ELEMENT_UNIT_ROUNDOFF of the element type, 0 for the integer types,
+ * whose products have to come out exact.
+ */
+double strassen_error_bound(int m, int k, int n, int cutoff, int winograd)
+{
+    int levels = 0;
+    while(m > cutoff && k > cutoff && n > cutoff) {
+        m /= 2;
+        k /= 2;
+        n /= 2;
+        levels++;
+    }
+    double k0 = k;
+    double full = ldexp(k0, levels);
+    if(levels == 0) {
+        return full * ELEMENT_UNIT_ROUNDOFF;
+    }
+    double bound = winograd
+        ? pow(18, levels) * (k0 * k0 + 6 * k0) - 6 * full
+        : pow(12, levels) * (k0 * k0 + 5 * k0) - 5 * full;
+    return bound * ELEMENT_UNIT_ROUNDOFF;
+}
+
+static double max_abs(int rows, int cols, matrix_view v)
+{
+    double largest = 0;
+    for(int i = 0; i < rows; i++) {
+        for(int j = 0; j < cols; j++) {
+            double x = fabs(ELEMENT_VALUE(VIEW_AT(v, i, j)));
+            largest = x > largest ? x : largest;
+        }
+    }
+    return largest;
+}
+
+/* Freivalds' test: for random vectors x of +-1 entries, compares result x
+ * with a (b x), all in double. Each entry of the residual is a signed sum
+ * of n entries of the error of result, so a correct product keeps it
+ * within n times the elementwise bound. Returns the largest residual.
+ */
+static double freivalds_residual(int m, int k, int n, matrix_view a, matrix_view b,
+    matrix_view result)
+{
+    double *x = (double *) malloc(sizeof(double) * n);
+    double *bx = (double *) malloc(sizeof(double) * k);
+    double largest = 0;
+    for(int trial = 0; trial < FREIVALDS_TRIALS; trial++) {
+        for(int j = 0; j < n; j++) {
+            x[j] = rand() % 2 ? 1.0 : -1.0;
+        }
+        for(int p = 0; p < k; p++) {
+            double sum = 0;
+            for(int j = 0; j < n; j++) {
+                sum += ELEMENT_VALUE(VIEW_AT(b, p, j)) * x[j];
+            }
+            bx[p] = sum;
+        }
+        for(int i = 0; i < m; i++) {
+            double expected = 0, computed = 0;
+            for(int p = 0; p < k; p++) {
+                expected += ELEMENT_VALUE(VIEW_AT(a, i, p)) * bx[p];
+            }
+            for(int j = 0; j < n; j++) {
+                computed += ELEMENT_VALUE(VIEW_AT(result, i, j)) * x[j];
+            }
+            double residual = fabs(computed - expected);
+            largest = residual > largest ? residual : largest;
+        }
+    }
+    free(x);
+    free(bx);
+    return largest;
+}
+
+/* Checks result against the product of a and b and prints the maximum
+ * absolute and relative error, the error relative to max|a| max|b| and the
+ * bound from strassen_error_bound(). Returns 1 if the error is within the
+ * bound, or within STRASSEN_VERIFY_TOLERANCE if that is set, 0 otherwise.
+ */
+int verify_product(int m, int k, int n, matrix_view a, matrix_view b, matrix_view result,
+    int cutoff, int winograd)
+{
+    const char *env = getenv("STRASSEN_VERIFY_REFERENCE_MAX");
+    int reference_max = env != NULL ? atoi(env) : DEFAULT_REFERENCE_MAX;
+    double scale = max_abs(m, k, a) * max_abs(k, n, b);
+    double bound = strassen_error_bound(m, k, n, cutoff, winograd);
+    const char *tolerance = getenv("STRASSEN_VERIFY_TOLERANCE");
+    double limit = (tolerance != NULL ? atof(tolerance) : bound) * scale;
+    int passed;
+
+    if(m <= reference_max && k <= reference_max && n <= reference_max) {
+        double *reference = (double *) malloc(sizeof(double) * m * (size_t)n);
+        reference_multiplication(m, k, n, a, b, reference);
+        double abs_error = 0, rel_error = 0;
+        for(int i = 0; i < m; i++) {
+            for(int j = 0; j < n; j++) {
+                double expected = reference[(size_t)i * n + j];
+                double error = fabs(ELEMENT_VALUE(VIEW_AT(result, i, j)) - expected);
+                // NaN compares false, so it has to fail explicitly
+                if(error != error) {
+                    error = INFINITY;
+                }
+                abs_error = error > abs_error ? error : abs_error;
+                if(expected != 0 && error / fabs(expected) > rel_error) {
+                    rel_error = error / fabs(expected);
+                }
+            }
+        }
+        free(reference);
+        passed = abs_error <= limit;
+        printf("verify %dx%dx%d against reference: max abs error %.3e, max rel error %.3e, "
+            "normwise %.3e, bound %.3e", m, k, n, abs_error, rel_error,
+            scale > 0 ? abs_error / scale : 0, bound);
+    } else {
+        double residual = freivalds_residual(m, k, n, a, b, result);
+        if(residual != residual) {
+            residual = INFINITY;
+        }
+        passed = residual <= limit * n;
+        printf("verify %dx%dx%d with Freivalds (%d trials): max residual %.3e, "
+            "normwise %.3e, bound %.3e", m, k, n, FREIVALDS_TRIALS, residual,
+            scale > 0 ? residual / (scale * n) : 0, bound);
+    }
+    if(tolerance != NULL) {
+        printf(", tolerance %.3e", atof(tolerance));
+    }
+    printf(": %s\n", passed ? "PASS" : "FAIL");
+    return passed;
+}
@@ -0,0 +1,18 @@
+/* verify.h
+   Checks a computed product against a double precision reference, or
+   with Freivalds' randomized test for large sizes, and compares the error
+   with the worst-case bound for Strassen's algorithm.
+*/
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "matrix.h"
+
+int take_flag(int *argc, char **argv, const char *flag);
+const char * take_option(int *argc, char **argv, const char *name);
+void reference_multiplication(int m, int k, int n, matrix_view a, matrix_view b, double *result);
+double strassen_error_bound(int m, int k, int n, int cutoff, int winograd);
+int verify_product(int m, int k, int n, matrix_view a, matrix_view b, matrix_view result,
+    int cutoff, int winograd);
+
+#endif
@@ -0,0 +1,211 @@
+/* backend.h
+   The interface between the libstrassen front end and its engines. Each
+   engine is one of the three programs compiled without its main() (with
+   STRASSEN_LIBRARY defined) by a *_backend.c file that sets
+   BACKEND_PREFIX first. Every external name an engine defines is then
+   prefixed, like zlib's Z_PREFIX does, so that the engines link into one
+   library side by side: strassen_cutoff of serial_strassens.c becomes
+   serial_strassen_cutoff. A name added to an engine has to be added to
+   the list below too.
+
+   Every engine provides
+     int strassen_configure(int threads, int cutoff): reads its settings
+       from the environment, takes threads (0 for all processors) and the
+       cutoff (0 for STRASSEN_CUTOFF or the tuned one). Returns 0, or -1
+       if the engine can't run here.
+     void strassen_product(int m, int k, int n, matrix_view a,
+       matrix_view b, matrix_view result): multiplies the views. The host
+       engines take any leading dimension; the OpenCL one needs rows
+       matrix_stride() apart, like the device buffers.
+   and the OpenCL one also strassen_release(), which gives up the device.
+   The threads engine is parallel_strassens.c once more, compiled without
+   its OpenMP schedules; its strassen_release() and that of the OpenMP
+   engine stop the threads of the stealing scheduler.
+   Batches run the serial engine on each worker thread with a workspace
+   the worker keeps, through its strassen_workspace_bytes() and
+   strassens_multiplication().
+
+   The serial and OpenMP engines are also compiled for each element type
+   of common/element.h (-DSTRASSEN_ELEMENT=...), and their names then get
+   the element prefix in front of the engine one: strassen_product of the
+   double serial engine is double_serial_strassen_product. libstrassen/
+   gemm.c is compiled once per type as well, and gives strassen.c the
+   element_configure(), element_release() and element_gemm() of its type.
+*/
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include "../common/matrix.h"
+#include "strassen.h"
+
+#define BACKEND_CONCAT_(prefix, name) prefix##name
+#define BACKEND_CONCAT(prefix, name) BACKEND_CONCAT_(prefix, name)
+
+#ifdef BACKEND_PREFIX
+#define BACKEND_NAME(name) ELEMENT_NAME(BACKEND_CONCAT(BACKEND_PREFIX, name))
+#define allocate_device_product  BACKEND_NAME(allocate_device_product)
+#define allocate_workspace       BACKEND_NAME(allocate_workspace)
+#define application_pool         BACKEND_NAME(application_pool)
+#define application_submit       BACKEND_NAME(application_submit)
+#define application_workers      BACKEND_NAME(application_workers)
+#define bench_strassen           BACKEND_NAME(bench_strassen)
+#define benchmark                BACKEND_NAME(benchmark)
+#define build_program            BACKEND_NAME(build_program)
+#define carve_level              BACKEND_NAME(carve_level)
+#define command_queue            BACKEND_NAME(command_queue)
+#define compute_product          BACKEND_NAME(compute_product)
+#define compute_quadrant         BACKEND_NAME(compute_quadrant)
+#define configure_cutoff         BACKEND_NAME(configure_cutoff)
+#define configure_parallel_depth BACKEND_NAME(configure_parallel_depth)
+#define configure_parallelism    BACKEND_NAME(configure_parallelism)
+#define configure_variant        BACKEND_NAME(configure_variant)
+#define configured_schedule      BACKEND_NAME(configured_schedule)
+#define context                  BACKEND_NAME(context)
+#define count_local              BACKEND_NAME(count_local)
+#define create_device_product    BACKEND_NAME(create_device_product)
+#define device_id                BACKEND_NAME(device_id)
+#define device_quadrant          BACKEND_NAME(device_quadrant)
+#define device_strassen          BACKEND_NAME(device_strassen)
+#define device_sub_view          BACKEND_NAME(device_sub_view)
+#define download_matrix          BACKEND_NAME(download_matrix)
+#define fork_queues              BACKEND_NAME(fork_queues)
+#define join_queues              BACKEND_NAME(join_queues)
+#define kernel_add               BACKEND_NAME(kernel_add)
+#define kernel_combine           BACKEND_NAME(kernel_combine)
+#define kernel_multiply          BACKEND_NAME(kernel_multiply)
+#define kernel_multiply_tiled    BACKEND_NAME(kernel_multiply_tiled)
+#define kernel_sources_array     BACKEND_NAME(kernel_sources_array)
+#define kernel_sub               BACKEND_NAME(kernel_sub)
+#define locality_report          BACKEND_NAME(locality_report)
+#define morton_levels            BACKEND_NAME(morton_levels)
+#define morton_multiplication    BACKEND_NAME(morton_multiplication)
+#define morton_strassen          BACKEND_NAME(morton_strassen)
+#define morton_workspace_size    BACKEND_NAME(morton_workspace_size)
+#define node_count               BACKEND_NAME(node_count)
+#define ocl_add_matrices         BACKEND_NAME(ocl_add_matrices)
+#define ocl_combine_matrices     BACKEND_NAME(ocl_combine_matrices)
+#define ocl_initialize           BACKEND_NAME(ocl_initialize)
+#define ocl_multiply             BACKEND_NAME(ocl_multiply)
+#define ocl_release              BACKEND_NAME(ocl_release)
+#define ocl_sub_matrices         BACKEND_NAME(ocl_sub_matrices)
+#define parallel_depth           BACKEND_NAME(parallel_depth)
+#define parallel_strassen        BACKEND_NAME(parallel_strassen)
+#define parse_shape              BACKEND_NAME(parse_shape)
+#define place_region             BACKEND_NAME(place_region)
+#define pool                     BACKEND_NAME(pool)
+#define pool_acquire             BACKEND_NAME(pool_acquire)
+#define pool_drain               BACKEND_NAME(pool_drain)
+#define pool_release             BACKEND_NAME(pool_release)
+#define print_operand_nodes      BACKEND_NAME(print_operand_nodes)
+#define product_node             BACKEND_NAME(product_node)
+#define product_nodes            BACKEND_NAME(product_nodes)
+#define program                  BACKEND_NAME(program)
+#define release_device_product   BACKEND_NAME(release_device_product)
+#define run_item                 BACKEND_NAME(run_item)
+#define run_on_nodes             BACKEND_NAME(run_on_nodes)
+#define run_phase                BACKEND_NAME(run_phase)
+#define run_phase_item           BACKEND_NAME(run_phase_item)
+#define run_product              BACKEND_NAME(run_product)
+#define scaling_report           BACKEND_NAME(scaling_report)
+#define strassen                 BACKEND_NAME(strassen)
+#define strassen_configure       BACKEND_NAME(strassen_configure)
+#define strassen_cutoff          BACKEND_NAME(strassen_cutoff)
+#define strassen_product         BACKEND_NAME(strassen_product)
+#define strassen_release         BACKEND_NAME(strassen_release)
+#define strassen_schedule        BACKEND_NAME(strassen_schedule)
+#define strassen_step            BACKEND_NAME(strassen_step)
+#define strassen_variant         BACKEND_NAME(strassen_variant)
+#define strassen_workspace_bytes BACKEND_NAME(strassen_workspace_bytes)
+#define strassen_workspace_size  BACKEND_NAME(strassen_workspace_size)
+#define strassens_multiplication BACKEND_NAME(strassens_multiplication)
+#define subproblem_queue         BACKEND_NAME(subproblem_queue)
+#define subproblem_queues        BACKEND_NAME(subproblem_queues)
+#define take_device_block        BACKEND_NAME(take_device_block)
+#define team_size                BACKEND_NAME(team_size)
+#define tile_size                BACKEND_NAME(tile_size)
+#define tune_cutoff              BACKEND_NAME(tune_cutoff)
+#define tune_file                BACKEND_NAME(tune_file)
+#define upload_matrix            BACKEND_NAME(upload_matrix)
+#define use_schedule             BACKEND_NAME(use_schedule)
+#define variant_name             BACKEND_NAME(variant_name)
+#define visit_product_regions    BACKEND_NAME(visit_product_regions)
+#define winograd_combine         BACKEND_NAME(winograd_combine)
+#define winograd_operands        BACKEND_NAME(winograd_operands)
+#define winograd_product         BACKEND_NAME(winograd_product)
+#define winograd_step            BACKEND_NAME(winograd_step)
+#define work_per_item            BACKEND_NAME(work_per_item)
+#endif
+
+/* The engines of the element type being compiled. */
+int ELEMENT_NAME(serial_strassen_configure)(int threads, int cutoff);
+void ELEMENT_NAME(serial_strassen_product)(int m, int k, int n, matrix_view a, matrix_view b,
+    matrix_view result);
+
+size_t ELEMENT_NAME(serial_strassen_workspace_bytes)(int m, int k, int n);
+void ELEMENT_NAME(serial_strassens_multiplication)(int m, int k, int n, matrix_view a,
+    matrix_view b, matrix_view result, matrix_type *workspace);
+
+int ELEMENT_NAME(openmp_strassen_configure)(int threads, int cutoff);
+void ELEMENT_NAME(openmp_strassen_product)(int m, int k, int n, matrix_view a, matrix_view b,
+    matrix_view result);
+void ELEMENT_NAME(openmp_strassen_release)(void);
+
+int ELEMENT_NAME(threads_strassen_configure)(int threads, int cutoff);
+void ELEMENT_NAME(threads_strassen_product)(int m, int k, int n, matrix_view a, matrix_view b,
+    matrix_view result);
+void ELEMENT_NAME(threads_strassen_release)(void);
+
+int opencl_strassen_configure(int threads, int cutoff);
+void opencl_strassen_product(int m, int k, int n, matrix_view a, matrix_view b, matrix_view result);
+void opencl_strassen_release(void);
+
+/* hybrid.c, for float with OpenCL: the top level on the host, its seven
+ * products split between the OpenCL and threads engines.
+ */
+int hybrid_strassen_configure(int threads, int cutoff);
+void hybrid_strassen_product(int m, int k, int n, matrix_view a, matrix_view b, matrix_view result);
+void hybrid_strassen_release(void);
+int hybrid_device_products(void);
+
+/* The pool strassen_set_executor() gave, or NULL; strassen.c keeps it. */
+const strassen_executor * configured_executor(void);
+
+/* The members of a batch: a[i] etc. when the pointer arrays are given,
+ * otherwise a_base + i * stride_a elements etc.
+ */
+typedef struct {
+    const void *const *a;
+    const void *const *b;
+    void *const *c;
+    const void *a_base;
+    const void *b_base;
+    void *c_base;
+    long long stride_a, stride_b, stride_c;
+} batch_operands;
+
+/* What gemm.c defines for each element type: element_configure() sets up
+ * a backend for the type and returns 0, or -1 if it isn't built or can't
+ * run; element_gemm() is strassen_gemm() for row-major matrices of the
+ * type on a configured backend, with alpha and beta pointing to
+ * accumulator_type, and element_gemm_batched() the same for count
+ * products on up to threads threads (0 for all). Batches on the OpenMP
+ * backend need the serial one configured too.
+ */
+#define ELEMENT_FUNCTIONS(prefix)                                                           \
+    int prefix##element_configure(strassen_backend backend, int threads, int cutoff);       \
+    void prefix##element_release(strassen_backend backend);                                 \
+    int prefix##element_gemm(strassen_backend backend, strassen_transpose transa,           \
+        strassen_transpose transb, int m, int n, int k, const void *alpha, const void *a,   \
+        int lda, const void *b, int ldb, const void *beta, void *c, int ldc);              \
+    int prefix##element_gemm_batched(strassen_backend backend, int threads,                 \
+        strassen_transpose transa, strassen_transpose transb, int m, int n, int k,          \
+        const void *alpha, const batch_operands *batch, int lda, int ldb, const void *beta, \
+        int ldc, int count);
+
+ELEMENT_FUNCTIONS()
+ELEMENT_FUNCTIONS(double_)
+ELEMENT_FUNCTIONS(half_)
+ELEMENT_FUNCTIONS(int32_)
+ELEMENT_FUNCTIONS(int64_)
+
+#endif
@@ -0,0 +1,344 @@
+/* gemm.c
+   The part of libstrassen that depends on the element type, compiled
+   once for each type of common/element.h: bringing any transpose and
+   leading dimension to the row-major operands the engines multiply,
+   applying alpha and beta, and spreading batches over the threads.
+   strassen.c picks the instantiation at run time.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "backend.h"
+#include "../common/stealing.h"
+#include "../common/profile.h"
+
+/* Transposed operands are copied in square blocks of this many elements a
+ * side, so that the rows read and the rows written both stay in cache.
+ */
+#define TRANSPOSE_BLOCK 32
+
+typedef struct {
+    int (*configure)(int threads, int cutoff);
+    void (*product)(int m, int k, int n, matrix_view a, matrix_view b, matrix_view result);
+    void (*release)(void);
+    // Whether operand and result rows must be matrix_stride() apart, as
+    // for the device copies; the host engines take any leading dimension
+    int packed_rows;
+} backend_ops;
+
+/* Indexed by strassen_backend; a backend that isn't built for this type
+ * has no product.
+ */
+static const backend_ops backends[STRASSEN_BACKEND_HYBRID + 1] = {
+    [STRASSEN_BACKEND_SERIAL] = { ELEMENT_NAME(serial_strassen_configure),
+        ELEMENT_NAME(serial_strassen_product), NULL, 0 },
+#ifdef STRASSEN_HAVE_OPENMP
+    [STRASSEN_BACKEND_OPENMP] = { ELEMENT_NAME(openmp_strassen_configure),
+        ELEMENT_NAME(openmp_strassen_product), ELEMENT_NAME(openmp_strassen_release), 0 },
+#endif
+    [STRASSEN_BACKEND_THREADS] = { ELEMENT_NAME(threads_strassen_configure),
+        ELEMENT_NAME(threads_strassen_product), ELEMENT_NAME(threads_strassen_release), 0 },
+#if defined(STRASSEN_HAVE_OPENCL) && STRASSEN_ELEMENT == ELEMENT_FLOAT
+    [STRASSEN_BACKEND_OPENCL] = { opencl_strassen_configure, opencl_strassen_product,
+        opencl_strassen_release, 1 },
+    [STRASSEN_BACKEND_HYBRID] = { hybrid_strassen_configure, hybrid_strassen_product,
+        hybrid_strassen_release, 0 },
+#endif
+};
+
+static const backend_ops * lookup(strassen_backend backend)
+{
+    if((int)backend <= STRASSEN_BACKEND_AUTO || (int)backend > STRASSEN_BACKEND_HYBRID
+        || backends[backend].product == NULL) {
+        return NULL;
+    }
+    return &backends[backend];
+}
+
+int ELEMENT_NAME(element_configure)(strassen_backend backend, int threads, int cutoff)
+{
+    const backend_ops *ops = lookup(backend);
+    return ops != NULL ? ops->configure(threads, cutoff) : -1;
+}
+
+void ELEMENT_NAME(element_release)(strassen_backend backend)
+{
+    const backend_ops *ops = lookup(backend);
+    if(ops != NULL && ops->release != NULL) {
+        ops->release();
+    }
+}
+
+/* What one worker reuses across the products of a batch: packed copies
+ * of the operands and of the result, allocated for the batch's shape when
+ * first needed, and the recursion workspace when the worker runs the
+ * serial engine itself rather than the backend's product.
+ */
+typedef struct {
+    matrix_type **a, **b, **result;
+    matrix_type *workspace;
+} gemm_buffers;
+
+static void release_buffers(gemm_buffers *buffers, int m, int k)
+{
+    if(buffers->a != NULL) {
+        deallocate_matrix(buffers->a, m);
+    }
+    if(buffers->b != NULL) {
+        deallocate_matrix(buffers->b, k);
+    }
+    if(buffers->result != NULL) {
+        deallocate_matrix(buffers->result, m);
+    }
+    if(buffers->workspace != NULL) {
+        deallocate_aligned(buffers->workspace);
+    }
+}
+
+/* Copies the rows x cols matrix op(x) into packed, where x is stored with
+ * leading dimension ld, transposed (cols x rows) if transpose is set.
+ */
+static void pack_operand(int rows, int cols, int transpose, const matrix_type *x, int ld,
+    matrix_type **packed)
+{
+    PROFILE_START(mark);
+    if(!transpose) {
+        for(int i = 0; i < rows; i++) {
+            memcpy(packed[i], x + (size_t)i * ld, sizeof(matrix_type) * cols);
+        }
+        PROFILE_STOP(mark, PHASE_COPY, 2 * sizeof(matrix_type) * rows * (size_t)cols, 0);
+        return;
+    }
+    for(int i0 = 0; i0 < rows; i0 += TRANSPOSE_BLOCK) {
+        for(int j0 = 0; j0 < cols; j0 += TRANSPOSE_BLOCK) {
+            int i1 = i0 + TRANSPOSE_BLOCK < rows ? i0 + TRANSPOSE_BLOCK : rows;
+            int j1 = j0 + TRANSPOSE_BLOCK < cols ? j0 + TRANSPOSE_BLOCK : cols;
+            for(int i = i0; i < i1; i++) {
+                for(int j = j0; j < j1; j++) {
+                    packed[i][j] = x[(size_t)j * ld + i];
+                }
+            }
+        }
+    }
+    PROFILE_STOP(mark, PHASE_COPY, 2 * sizeof(matrix_type) * rows * (size_t)cols, 0);
+}
+
+/* The rows x cols operand op(x) as the engine takes it: x itself where it
+ * can, otherwise a copy in *packed, which is allocated if it is NULL.
+ * The engines never write their operands, so x can go in as it is.
+ */
+static matrix_view operand_view(int rows, int cols, int transpose, const matrix_type *x, int ld,
+    int packed_rows, matrix_type ***packed)
+{
+    if(!transpose && (!packed_rows || ld == matrix_stride(cols))) {
+        matrix_view v = { (matrix_type *) x, ld };
+        return v;
+    }
+    if(*packed == NULL) {
+        *packed = allocate_matrix(rows, cols);
+    }
+    pack_operand(rows, cols, transpose, x, ld, *packed);
+    return view_of(cols, *packed);
+}
+
+/* c = beta c, without reading c when beta is 0.
+ */
+static void scale_result(int m, int n, accumulator_type beta, matrix_type *c, int ldc)
+{
+    for(int i = 0; i < m; i++) {
+        matrix_type *row = c + (size_t)i * ldc;
+        if(beta == 0) {
+            memset(row, 0, sizeof(matrix_type) * n);
+        } else if(beta != 1) {
+            for(int j = 0; j < n; j++) {
+                row[j] = ELEMENT_SET(beta * ELEMENT_GET(row[j]));
+            }
+        }
+    }
+}
+
+/* c = alpha op(a) op(b) + beta c for one product, in buffers.
+ */
+static void multiply(const backend_ops *ops, gemm_buffers *buffers, strassen_transpose transa,
+    strassen_transpose transb, int m, int n, int k, accumulator_type alpha, const matrix_type *a,
+    int lda, const matrix_type *b, int ldb, accumulator_type beta, matrix_type *c, int ldc)
+{
+    if(k == 0 || alpha == 0) {
+        scale_result(m, n, beta, c, ldc);
+        return;
+    }
+    matrix_view va = operand_view(m, k, transa != STRASSEN_NO_TRANS, a, lda, ops->packed_rows,
+        &buffers->a);
+    matrix_view vb = operand_view(k, n, transb != STRASSEN_NO_TRANS, b, ldb, ops->packed_rows,
+        &buffers->b);
+    matrix_view result = { c, ldc };
+    // the product goes straight into c unless it has to be scaled or
+    // added, or c is laid out differently from what the backend takes
+    int direct = alpha == 1 && beta == 0 && (!ops->packed_rows || ldc == matrix_stride(n));
+    if(!direct) {
+        if(buffers->result == NULL) {
+            buffers->result = allocate_matrix(m, n);
+        }
+        result = view_of(n, buffers->result);
+    }
+
+    if(buffers->workspace != NULL) {
+        ELEMENT_NAME(serial_strassens_multiplication)(m, k, n, va, vb, result, buffers->workspace);
+    } else {
+        ops->product(m, k, n, va, vb, result);
+    }
+
+    if(!direct) {
+        for(int i = 0; i < m; i++) {
+            const matrix_type *t = buffers->result[i];
+            matrix_type *row = c + (size_t)i * ldc;
+            if(beta == 0) {
+                for(int j = 0; j < n; j++) {
+                    row[j] = ELEMENT_SET(alpha * ELEMENT_GET(t[j]));
+                }
+            } else {
+                for(int j = 0; j < n; j++) {
+                    row[j] = ELEMENT_SET(alpha * ELEMENT_GET(t[j]) + beta * ELEMENT_GET(row[j]));
+                }
+            }
+        }
+    }
+}
+
+int ELEMENT_NAME(element_gemm)(strassen_backend backend, strassen_transpose transa,
+    strassen_transpose transb, int m, int n, int k, const void *alpha, const void *a, int lda,
+    const void *b, int ldb, const void *beta, void *c, int ldc)
+{
+    const backend_ops *ops = lookup(backend);
+    if(ops == NULL) {
+        return STRASSEN_UNAVAILABLE;
+    }
+    gemm_buffers buffers = { NULL, NULL, NULL, NULL };
+    // the integer types take int32_t and int64_t, which their unsigned
+    // accumulator_type may alias
+    multiply(ops, &buffers, transa, transb, m, n, k, *(const accumulator_type *) alpha,
+        (const matrix_type *) a, lda, (const matrix_type *) b, ldb,
+        *(const accumulator_type *) beta, (matrix_type *) c, ldc);
+    release_buffers(&buffers, m, k);
+    return STRASSEN_SUCCESS;
+}
+
+/* Product i of a batch in buffers. */
+static void multiply_member(const backend_ops *ops, gemm_buffers *buffers,
+    strassen_transpose transa, strassen_transpose transb, int m, int n, int k,
+    accumulator_type alpha, const batch_operands *batch, int lda, int ldb, accumulator_type beta,
+    int ldc, int i)
+{
+    const matrix_type *a = batch->a != NULL ? (const matrix_type *) batch->a[i]
+        : (const matrix_type *) batch->a_base + i * batch->stride_a;
+    const matrix_type *b = batch->b != NULL ? (const matrix_type *) batch->b[i]
+        : (const matrix_type *) batch->b_base + i * batch->stride_b;
+    matrix_type *c = batch->c != NULL ? (matrix_type *) batch->c[i]
+        : (matrix_type *) batch->c_base + i * batch->stride_c;
+    multiply(ops, buffers, transa, transb, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+}
+
+/* A batch on the threads backend: one task per worker of the stealing
+ * scheduler, each taking the next product until none are left, with the
+ * buffers of the worker it runs on.
+ */
+typedef struct {
+    const backend_ops *ops;
+    gemm_buffers *buffers;
+    strassen_transpose transa, transb;
+    int m, n, k;
+    accumulator_type alpha, beta;
+    const batch_operands *batch;
+    int lda, ldb, ldc;
+    int count;
+    atomic_int next;
+} worker_batch;
+
+static void multiply_members(const void *context, int task)
+{
+    worker_batch *w = (worker_batch *) context;
+    gemm_buffers *buffers = &w->buffers[stealing_worker()];
+    (void) task;
+    if(buffers->workspace == NULL) {
+        buffers->workspace = (matrix_type *) allocate_aligned(
+            ELEMENT_NAME(serial_strassen_workspace_bytes)(w->m, w->k, w->n));
+    }
+    for(int i = atomic_fetch_add(&w->next, 1); i < w->count; i = atomic_fetch_add(&w->next, 1)) {
+        multiply_member(w->ops, buffers, w->transa, w->transb, w->m, w->n, w->k, w->alpha,
+            w->batch, w->lda, w->ldb, w->beta, w->ldc, i);
+    }
+}
+
+static void run_batch(void *argument)
+{
+    stealing_for(multiply_members, argument, stealing_workers());
+}
+
+/* On the OpenMP and threads backends a batch of at least as many products
+ * as there are threads is spread over the threads, one product per
+ * thread at a time, each thread running the serial engine in a workspace
+ * and packing buffers it keeps for the whole batch; that is what keeps
+ * the cores busy on small products, which a parallel recursion can't
+ * split. Smaller batches run one product after the other on all the
+ * threads. The serial, OpenCL and hybrid backends run the products in
+ * turn, the serial one in one workspace.
+ */
+int ELEMENT_NAME(element_gemm_batched)(strassen_backend backend, int threads,
+    strassen_transpose transa, strassen_transpose transb, int m, int n, int k,
+    const void *alpha_value, const batch_operands *batch, int lda, int ldb,
+    const void *beta_value, int ldc, int count)
+{
+    const backend_ops *ops = lookup(backend);
+    accumulator_type alpha = *(const accumulator_type *) alpha_value;
+    accumulator_type beta = *(const accumulator_type *) beta_value;
+    if(ops == NULL) {
+        return STRASSEN_UNAVAILABLE;
+    }
+#if defined(STRASSEN_HAVE_OPENMP) && defined(_OPENMP)
+    int team = threads > 0 ? threads : omp_get_max_threads();
+    if(backend == STRASSEN_BACKEND_OPENMP && count >= team) {
+        #pragma omp parallel num_threads(team)
+        {
+            gemm_buffers buffers = { NULL, NULL, NULL, NULL };
+            buffers.workspace = (matrix_type *) allocate_aligned(
+                ELEMENT_NAME(serial_strassen_workspace_bytes)(m, k, n));
+            #pragma omp for schedule(dynamic)
+            for(int i = 0; i < count; i++) {
+                multiply_member(ops, &buffers, transa, transb, m, n, k, alpha, batch, lda, ldb,
+                    beta, ldc, i);
+            }
+            release_buffers(&buffers, m, k);
+        }
+        return STRASSEN_SUCCESS;
+    }
+#else
+    (void) threads;
+#endif
+    int workers = stealing_workers();
+    worker_batch w = { ops, NULL, transa, transb, m, n, k, alpha, beta, batch, lda, ldb, ldc,
+        count };
+    if(backend == STRASSEN_BACKEND_THREADS && count >= workers
+        && (w.buffers = (gemm_buffers *) calloc(workers, sizeof(gemm_buffers))) != NULL) {
+        atomic_init(&w.next, 0);
+        stealing_run(run_batch, &w);
+        for(int i = 0; i < workers; i++) {
+            release_buffers(&w.buffers[i], m, k);
+        }
+        free(w.buffers);
+        return STRASSEN_SUCCESS;
+    }
+    gemm_buffers buffers = { NULL, NULL, NULL, NULL };
+    if(backend == STRASSEN_BACKEND_SERIAL) {
+        buffers.workspace = (matrix_type *) allocate_aligned(
+            ELEMENT_NAME(serial_strassen_workspace_bytes)(m, k, n));
+    }
+    for(int i = 0; i < count; i++) {
+        multiply_member(ops, &buffers, transa, transb, m, n, k, alpha, batch, lda, ldb, beta,
+            ldc, i);
+    }
+    release_buffers(&buffers, m, k);
+    return STRASSEN_SUCCESS;
+}
@@ -0,0 +1,301 @@
+/* hybrid.c
+   The hybrid backend of libstrassen, for float: the top level of the
+   recursion runs here, and its seven products are split between the
+   OpenCL engine and the threads engine, which work on them at the same
+   time. The calling thread drives the device, one product after the
+   other, while the other workers of the stealing scheduler run the host's
+   products, and helps with those once the device's are done. Every
+   product has the same shape, so the split is a number of products: it
+   starts at INITIAL_DEVICE_PRODUCTS, and after each product the time
+   each side took updates its measured throughput and the split moves to
+   the one that should finish both sides closest together.
+   STRASSEN_HYBRID_SPLIT fixes the number of products on the device.
+
+   The device takes its operands and products as packed matrices, so its
+   quadrants are copied out as well as its sums formed; the host forms
+   only the sums and reads the quadrants in place. Each side forms its own
+   operands, and that is counted in its time.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "backend.h"
+#include "../common/bench.h"
+#include "../common/stealing.h"
+
+/* Products with a dimension smaller than this run on the host alone: the
+ * device wouldn't make up for the copies on halves this small.
+ */
+#define HYBRID_MINIMUM 256
+/* Products on the device before anything is measured. */
+#define INITIAL_DEVICE_PRODUCTS 3
+
+typedef enum {
+    OPERAND_QUADRANT,
+    OPERAND_SUM,
+    OPERAND_DIFFERENCE
+} operand_kind;
+
+/* An operand of one of the seven products: quadrant first (0 to 3 for
+ * x11, x12, x21 and x22), or its sum with or difference from quadrant
+ * second.
+ */
+typedef struct {
+    operand_kind kind;
+    int first, second;
+} operand_recipe;
+
+static const operand_recipe left_operands[7] = {
+    { OPERAND_SUM, 0, 3 },        // m1 = (a11 + a22)(b11 + b22)
+    { OPERAND_SUM, 2, 3 },        // m2 = (a21 + a22) b11
+    { OPERAND_QUADRANT, 0, 0 },   // m3 = a11 (b12 - b22)
+    { OPERAND_QUADRANT, 3, 3 },   // m4 = a22 (b21 - b11)
+    { OPERAND_SUM, 0, 1 },        // m5 = (a11 + a12) b22
+    { OPERAND_DIFFERENCE, 2, 0 }, // m6 = (a21 - a11)(b11 + b12)
+    { OPERAND_DIFFERENCE, 1, 3 }  // m7 = (a12 - a22)(b21 + b22)
+};
+
+static const operand_recipe right_operands[7] = {
+    { OPERAND_SUM, 0, 3 },
+    { OPERAND_QUADRANT, 0, 0 },
+    { OPERAND_DIFFERENCE, 1, 3 },
+    { OPERAND_DIFFERENCE, 2, 0 },
+    { OPERAND_QUADRANT, 3, 3 },
+    { OPERAND_SUM, 0, 1 },
+    { OPERAND_SUM, 2, 3 }
+};
+
+/* The order products go to the device in: first those with two sums,
+ * which the host would have to form as well, then those the host could
+ * read a quadrant of in place.
+ */
+static const int device_order[7] = { 0, 5, 6, 1, 2, 3, 4 };
+
+/* The top level of one product. Side 0 is the device, side 1 the host.
+ */
+typedef struct {
+    int m2, k2, n2;
+    matrix_view a[4], b[4], c[4];
+    // m1..m7, rows matrix_stride(n2) apart
+    matrix_type **products[7];
+    int on_device[7];
+    int device_products;
+    double seconds[2];
+} hybrid_level;
+
+static int device_products = INITIAL_DEVICE_PRODUCTS;
+static int split_fixed;
+/* Measured throughput of each side in multiply-adds of the classical
+ * algorithm per second, 0 until measured.
+ */
+static double device_rate, host_rate;
+
+int hybrid_strassen_configure(int threads, int cutoff)
+{
+    if(opencl_strassen_configure(threads, cutoff) != 0
+        || threads_strassen_configure(threads, cutoff) != 0) {
+        return -1;
+    }
+    const char *env = getenv("STRASSEN_HYBRID_SPLIT");
+    split_fixed = env != NULL;
+    device_products = env != NULL ? atoi(env) : INITIAL_DEVICE_PRODUCTS;
+    if(device_products < 0) {
+        device_products = 0;
+    }
+    if(device_products > 7) {
+        device_products = 7;
+    }
+    device_rate = host_rate = 0;
+    return 0;
+}
+
+void hybrid_strassen_release(void)
+{
+    opencl_strassen_release();
+    threads_strassen_release();
+}
+
+/* Products the device gets of the next product's seven. */
+int hybrid_device_products(void)
+{
+    return device_products;
+}
+
+/* The operand recipe describes, rows x cols. A quadrant the host reads is
+ * returned as it is; everything else goes to a packed matrix allocated in
+ * *packed, which the caller frees.
+ */
+static matrix_view form_operand(operand_recipe recipe, const matrix_view *quadrants, int rows,
+    int cols, int device, matrix_type ***packed)
+{
+    if(recipe.kind == OPERAND_QUADRANT && !device) {
+        return quadrants[recipe.first];
+    }
+    *packed = allocate_matrix(rows, cols);
+    matrix_view v = view_of(cols, *packed);
+    matrix_view first = quadrants[recipe.first], second = quadrants[recipe.second];
+    switch(recipe.kind) {
+    case OPERAND_QUADRANT:
+        for(int i = 0; i < rows; i++) {
+            memcpy(&VIEW_AT(v, i, 0), &VIEW_AT(first, i, 0), sizeof(matrix_type) * cols);
+        }
+        break;
+    case OPERAND_SUM:
+        add_matrices(rows, cols, first, second, v);
+        break;
+    case OPERAND_DIFFERENCE:
+        subtract_matrices(rows, cols, first, second, v);
+        break;
+    }
+    return v;
+}
+
+/* Runs the products of one side, in stealing_for(). */
+static void run_side(const void *context, int side)
+{
+    hybrid_level *l = (hybrid_level *) context;
+    double begin = wall_time();
+    for(int i = 0; i < 7; i++) {
+        if(l->on_device[i] != (side == 0)) {
+            continue;
+        }
+        matrix_type **left = NULL, **right = NULL;
+        matrix_view a = form_operand(left_operands[i], l->a, l->m2, l->k2, side == 0, &left);
+        matrix_view b = form_operand(right_operands[i], l->b, l->k2, l->n2, side == 0, &right);
+        matrix_view product = view_of(l->n2, l->products[i]);
+        if(side == 0) {
+            opencl_strassen_product(l->m2, l->k2, l->n2, a, b, product);
+        } else {
+            threads_strassen_product(l->m2, l->k2, l->n2, a, b, product);
+        }
+        if(left != NULL) {
+            deallocate_matrix(left, l->m2);
+        }
+        if(right != NULL) {
+            deallocate_matrix(right, l->k2);
+        }
+    }
+    l->seconds[side] = wall_time() - begin;
+}
+
+/* Quadrant i of the result from m1..m7, in stealing_for(). */
+static void combine_quadrant(const void *context, int i)
+{
+    const hybrid_level *l = (const hybrid_level *) context;
+    matrix_view p[7];
+    for(int j = 0; j < 7; j++) {
+        p[j] = view_of(l->n2, l->products[j]);
+    }
+    switch(i) {
+    case 0:
+        combine_matrices(l->m2, l->n2, p[0], p[3], p[4], p[6], l->c[0]);
+        break;
+    case 1:
+        add_matrices(l->m2, l->n2, p[2], p[4], l->c[1]);
+        break;
+    case 2:
+        add_matrices(l->m2, l->n2, p[1], p[3], l->c[2]);
+        break;
+    case 3:
+        combine_matrices(l->m2, l->n2, p[0], p[2], p[1], p[5], l->c[3]);
+        break;
+    }
+}
+
+/* The number of products on the device that should have both sides
+ * finish closest together at the measured rates. Each side keeps at least
+ * one product, so that both go on being measured.
+ */
+static int balanced_split(void)
+{
+    int best = device_products;
+    double best_time = -1;
+    for(int d = 1; d < 7; d++) {
+        double device_time = d / device_rate;
+        double host_time = (7 - d) / host_rate;
+        double time = device_time > host_time ? device_time : host_time;
+        if(best_time < 0 || time < best_time) {
+            best = d;
+            best_time = time;
+        }
+    }
+    return best;
+}
+
+/* Folds the times of a level into the rates, each measurement weighing
+ * as much as all before it, and moves the split.
+ */
+static void measure(const hybrid_level *l)
+{
+    double work = (double) l->m2 * l->k2 * l->n2;
+    int counts[2] = { l->device_products, 7 - l->device_products };
+    double *rates[2] = { &device_rate, &host_rate };
+    for(int side = 0; side < 2; side++) {
+        if(counts[side] > 0 && l->seconds[side] > 0) {
+            double rate = counts[side] * work / l->seconds[side];
+            *rates[side] = *rates[side] > 0 ? (*rates[side] + rate) / 2 : rate;
+        }
+    }
+    if(!split_fixed && device_rate > 0 && host_rate > 0) {
+        device_products = balanced_split();
+    }
+}
+
+/* The level as a product of the stealing scheduler: both sides, then the
+ * four quadrants of the result.
+ */
+static void run_level(void *argument)
+{
+    hybrid_level *l = (hybrid_level *) argument;
+    stealing_for(run_side, l, 2);
+    stealing_for(combine_quadrant, l, 4);
+    measure(l);
+}
+
+/* Multiplies an m x k matrix a by a k x n matrix b into result, any
+ * leading dimensions. Odd dimensions are peeled on the host as the
+ * engines do it.
+ */
+void hybrid_strassen_product(int m, int k, int n, matrix_view a, matrix_view b,
+    matrix_view result)
+{
+    if(m < HYBRID_MINIMUM || k < HYBRID_MINIMUM || n < HYBRID_MINIMUM) {
+        threads_strassen_product(m, k, n, a, b, result);
+        return;
+    }
+    hybrid_level level;
+    hybrid_level *l = &level;
+    l->m2 = m / 2;
+    l->k2 = k / 2;
+    l->n2 = n / 2;
+    for(int q = 0; q < 4; q++) {
+        l->a[q] = quadrant(a, l->m2, l->k2, q / 2, q % 2);
+        l->b[q] = quadrant(b, l->k2, l->n2, q / 2, q % 2);
+        l->c[q] = quadrant(result, l->m2, l->n2, q / 2, q % 2);
+    }
+    l->device_products = device_products;
+    for(int i = 0; i < 7; i++) {
+        l->products[i] = allocate_matrix(l->m2, l->n2);
+        l->on_device[device_order[i]] = i < device_products;
+    }
+    l->seconds[0] = l->seconds[1] = 0;
+
+    stealing_run(run_level, l);
+
+    for(int i = 0; i < 7; i++) {
+        deallocate_matrix(l->products[i], l->m2);
+    }
+    // the last inner index is a rank-1 update of the even part, the last
+    // column and row are thin products
+    if(k % 2) {
+        blocked_matrix_multiplication(2 * l->m2, 1, 2 * l->n2, sub_view(a, 0, k - 1),
+            sub_view(b, k - 1, 0), result, 1, NULL);
+    }
+    if(n % 2) {
+        blocked_matrix_multiplication(m, k, 1, a, sub_view(b, 0, n - 1),
+            sub_view(result, 0, n - 1), 0, NULL);
+    }
+    if(m % 2) {
+        blocked_matrix_multiplication(1, k, 2 * l->n2, sub_view(a, m - 1, 0), b,
+            sub_view(result, m - 1, 0), 0, NULL);
+    }
+}
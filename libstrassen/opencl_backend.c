@@ -0,0 +1,8 @@
+/* opencl_backend.c
+   The recursion of the OpenCL program, strassens.c, as the OpenCL engine
+   of libstrassen. opencl_device.c has the device side.
+*/
+#define STRASSEN_LIBRARY
+#define BACKEND_PREFIX opencl_
+#include "backend.h"
+#include "../OpenCL Strassens Matrix Multiplication/strassens.c"
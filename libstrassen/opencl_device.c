@@ -0,0 +1,8 @@
+/* opencl_device.c
+   The device side of the OpenCL program, ocl_strassens.c, for the OpenCL
+   engine of libstrassen: kernels, buffer pool, queues and device set up.
+*/
+#define STRASSEN_LIBRARY
+#define BACKEND_PREFIX opencl_
+#include "backend.h"
+#include "../OpenCL Strassens Matrix Multiplication/ocl_strassens.c"
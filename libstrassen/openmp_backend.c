@@ -0,0 +1,7 @@
+/* openmp_backend.c
+   parallel_strassens.c as the OpenMP engine of libstrassen.
+*/
+#define STRASSEN_LIBRARY
+#define BACKEND_PREFIX openmp_
+#include "backend.h"
+#include "../OpenMP Strassens Matrix Multiplication/parallel_strassens.c"
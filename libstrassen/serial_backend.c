@@ -0,0 +1,7 @@
+/* serial_backend.c
+   serial_strassens.c as the serial engine of libstrassen.
+*/
+#define STRASSEN_LIBRARY
+#define BACKEND_PREFIX serial_
+#include "backend.h"
+#include "../serial_strassens.c"
@@ -0,0 +1,365 @@
+/* strassen.c
+   The libstrassen front end: the backend and its settings, argument
+   checking, and dispatch of strassen_gemm() and the batched products to
+   the gemm.c instantiation of the element type.
+*/
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#include "strassen.h"
+#include "backend.h"
+
+#define BACKEND_COUNT (STRASSEN_BACKEND_HYBRID + 1)
+#define ELEMENT_COUNT (STRASSEN_INT64 + 1)
+
+static const char * const backend_names[BACKEND_COUNT] = { "auto", "serial", "openmp", "opencl",
+    "threads", "hybrid" };
+
+typedef struct {
+    int (*configure)(strassen_backend backend, int threads, int cutoff);
+    void (*release)(strassen_backend backend);
+    int (*gemm)(strassen_backend backend, strassen_transpose transa, strassen_transpose transb,
+        int m, int n, int k, const void *alpha, const void *a, int lda, const void *b, int ldb,
+        const void *beta, void *c, int ldc);
+    int (*gemm_batched)(strassen_backend backend, int threads, strassen_transpose transa,
+        strassen_transpose transb, int m, int n, int k, const void *alpha,
+        const batch_operands *batch, int lda, int ldb, const void *beta, int ldc, int count);
+} element_ops;
+
+/* Indexed by strassen_datatype. */
+static const element_ops elements[ELEMENT_COUNT] = {
+    [STRASSEN_FLOAT32] = { element_configure, element_release, element_gemm,
+        element_gemm_batched },
+    [STRASSEN_FLOAT64] = { double_element_configure, double_element_release, double_element_gemm,
+        double_element_gemm_batched },
+    [STRASSEN_FLOAT16] = { half_element_configure, half_element_release, half_element_gemm,
+        half_element_gemm_batched },
+    [STRASSEN_INT32] = { int32_element_configure, int32_element_release, int32_element_gemm,
+        int32_element_gemm_batched },
+    [STRASSEN_INT64] = { int64_element_configure, int64_element_release, int64_element_gemm,
+        int64_element_gemm_batched },
+};
+
+/* The backend products run on; STRASSEN_BACKEND_AUTO until the first
+ * product or strassen_set_backend() resolves it.
+ */
+static strassen_backend current = STRASSEN_BACKEND_AUTO;
+static int threads_setting = 0;
+static int cutoff_setting = 0;
+static strassen_executor executor_setting;
+static int executor_given = 0;
+/* Whether the engine of each element type and backend is set up with the
+ * current settings; every type has engines of its own.
+ */
+static int configured[ELEMENT_COUNT][BACKEND_COUNT];
+
+/* Held while the settings above change and while a product picks its
+ * backend and sets up its engine, which writes the engine's globals, so
+ * that the first products of several threads don't race.
+ */
+#ifdef _WIN32
+static SRWLOCK setup_lock = SRWLOCK_INIT;
+static void lock_setup(void) { AcquireSRWLockExclusive(&setup_lock); }
+static void unlock_setup(void) { ReleaseSRWLockExclusive(&setup_lock); }
+#else
+static pthread_mutex_t setup_lock = PTHREAD_MUTEX_INITIALIZER;
+static void lock_setup(void) { pthread_mutex_lock(&setup_lock); }
+static void unlock_setup(void) { pthread_mutex_unlock(&setup_lock); }
+#endif
+
+int strassen_backend_built(strassen_backend backend)
+{
+    switch(backend) {
+    case STRASSEN_BACKEND_SERIAL:
+    case STRASSEN_BACKEND_THREADS:
+        return 1;
+#ifdef STRASSEN_HAVE_OPENMP
+    case STRASSEN_BACKEND_OPENMP:
+        return 1;
+#endif
+#ifdef STRASSEN_HAVE_OPENCL
+    case STRASSEN_BACKEND_OPENCL:
+    case STRASSEN_BACKEND_HYBRID:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+const char * strassen_backend_name(strassen_backend backend)
+{
+    return (int)backend >= 0 && (int)backend < BACKEND_COUNT ? backend_names[backend] : "unknown";
+}
+
+/* STRASSEN_BACKEND if it names a backend that is built, otherwise OpenMP
+ * if it is built and serial if not.
+ */
+static strassen_backend automatic_backend(void)
+{
+    const char *env = getenv("STRASSEN_BACKEND");
+    for(int i = STRASSEN_BACKEND_SERIAL; env != NULL && i < BACKEND_COUNT; i++) {
+        if(strcmp(env, backend_names[i]) == 0 && strassen_backend_built((strassen_backend)i)) {
+            return (strassen_backend)i;
+        }
+    }
+    return strassen_backend_built(STRASSEN_BACKEND_OPENMP) ? STRASSEN_BACKEND_OPENMP
+        : STRASSEN_BACKEND_SERIAL;
+}
+
+/* Sets up the engine of type on backend unless it is already. Called
+ * with setup_lock held, like the other functions that touch the
+ * settings.
+ */
+static int configure_backend(strassen_datatype type, strassen_backend backend)
+{
+    if(!strassen_backend_built(backend)) {
+        return STRASSEN_UNAVAILABLE;
+    }
+    if(!configured[type][backend]) {
+        if(elements[type].configure(backend, threads_setting, cutoff_setting) != 0) {
+            return STRASSEN_UNAVAILABLE;
+        }
+        configured[type][backend] = 1;
+    }
+    return STRASSEN_SUCCESS;
+}
+
+static int select_backend(strassen_backend backend)
+{
+    if(backend == STRASSEN_BACKEND_AUTO) {
+        backend = automatic_backend();
+    }
+    // the other element types are set up by their first product
+    int status = configure_backend(STRASSEN_FLOAT32, backend);
+    if(status == STRASSEN_SUCCESS) {
+        current = backend;
+    }
+    return status;
+}
+
+static strassen_backend resolve_backend(void)
+{
+    // an automatic choice that can't run (STRASSEN_BACKEND=opencl without
+    // a device) falls back to the host
+    if(current == STRASSEN_BACKEND_AUTO && select_backend(STRASSEN_BACKEND_AUTO) != STRASSEN_SUCCESS) {
+        select_backend(strassen_backend_built(STRASSEN_BACKEND_OPENMP) ? STRASSEN_BACKEND_OPENMP
+            : STRASSEN_BACKEND_SERIAL);
+    }
+    return current;
+}
+
+int strassen_set_backend(strassen_backend backend)
+{
+    if((int)backend < STRASSEN_BACKEND_AUTO || (int)backend >= BACKEND_COUNT) {
+        return STRASSEN_INVALID_ARGUMENT;
+    }
+    lock_setup();
+    int status = select_backend(backend);
+    unlock_setup();
+    return status;
+}
+
+strassen_backend strassen_get_backend(void)
+{
+    lock_setup();
+    strassen_backend backend = resolve_backend();
+    unlock_setup();
+    return backend;
+}
+
+void strassen_set_threads(int threads)
+{
+    lock_setup();
+    threads_setting = threads > 0 ? threads : 0;
+    memset(configured, 0, sizeof configured);
+    unlock_setup();
+}
+
+void strassen_set_cutoff(int cutoff)
+{
+    lock_setup();
+    cutoff_setting = cutoff > 0 ? cutoff : 0;
+    memset(configured, 0, sizeof configured);
+    unlock_setup();
+}
+
+void strassen_set_executor(const strassen_executor *executor)
+{
+    lock_setup();
+    executor_given = executor != NULL;
+    if(executor != NULL) {
+        executor_setting = *executor;
+    }
+    memset(configured, 0, sizeof configured);
+    unlock_setup();
+}
+
+const strassen_executor * configured_executor(void)
+{
+    return executor_given ? &executor_setting : NULL;
+}
+
+int strassen_hybrid_device_products(void)
+{
+#ifdef STRASSEN_HAVE_OPENCL
+    return hybrid_device_products();
+#else
+    return 0;
+#endif
+}
+
+void strassen_finalize(void)
+{
+    lock_setup();
+    for(int type = 0; type < ELEMENT_COUNT; type++) {
+        for(int backend = 0; backend < BACKEND_COUNT; backend++) {
+            if(configured[type][backend]) {
+                elements[type].release((strassen_backend)backend);
+            }
+            configured[type][backend] = 0;
+        }
+    }
+    unlock_setup();
+}
+
+/* STRASSEN_SUCCESS if the arguments of a row-major product are valid,
+ * STRASSEN_INVALID_ARGUMENT if not.
+ */
+static int check_arguments(strassen_datatype type, strassen_transpose transa,
+    strassen_transpose transb, int m, int n, int k, int lda, int ldb, int ldc)
+{
+    if((int)type < 0 || (int)type >= ELEMENT_COUNT
+        || transa < STRASSEN_NO_TRANS || transa > STRASSEN_CONJ_TRANS
+        || transb < STRASSEN_NO_TRANS || transb > STRASSEN_CONJ_TRANS || m < 0 || n < 0 || k < 0) {
+        return STRASSEN_INVALID_ARGUMENT;
+    }
+    int a_cols = transa != STRASSEN_NO_TRANS ? m : k;
+    int b_cols = transb != STRASSEN_NO_TRANS ? k : n;
+    if(lda < (a_cols > 1 ? a_cols : 1) || ldb < (b_cols > 1 ? b_cols : 1) || ldc < (n > 1 ? n : 1)) {
+        return STRASSEN_INVALID_ARGUMENT;
+    }
+    return STRASSEN_SUCCESS;
+}
+
+int strassen_gemm(strassen_datatype type, strassen_layout layout, strassen_transpose transa,
+    strassen_transpose transb, int m, int n, int k, const void *alpha, const void *a, int lda,
+    const void *b, int ldb, const void *beta, void *c, int ldc)
+{
+    // a column-major matrix is its row-major transpose, and
+    // C^T = op(B)^T op(A)^T
+    if(layout == STRASSEN_COL_MAJOR) {
+        return strassen_gemm(type, STRASSEN_ROW_MAJOR, transb, transa, n, m, k, alpha, b, ldb, a,
+            lda, beta, c, ldc);
+    }
+    if(layout != STRASSEN_ROW_MAJOR) {
+        return STRASSEN_INVALID_ARGUMENT;
+    }
+    int status = check_arguments(type, transa, transb, m, n, k, lda, ldb, ldc);
+    if(status != STRASSEN_SUCCESS || m == 0 || n == 0) {
+        return status;
+    }
+
+    lock_setup();
+    strassen_backend backend = resolve_backend();
+    status = configure_backend(type, backend);
+    unlock_setup();
+    if(status != STRASSEN_SUCCESS) {
+        return STRASSEN_UNAVAILABLE;
+    }
+    return elements[type].gemm(backend, transa, transb, m, n, k, alpha, a, lda, b, ldb, beta, c,
+        ldc);
+}
+
+/* Both batched entry points, once the layout is row-major.
+ */
+static int gemm_batched(strassen_datatype type, strassen_transpose transa,
+    strassen_transpose transb, int m, int n, int k, const void *alpha, const batch_operands *batch,
+    int lda, int ldb, const void *beta, int ldc, int batch_count)
+{
+    int status = check_arguments(type, transa, transb, m, n, k, lda, ldb, ldc);
+    if(status != STRASSEN_SUCCESS || batch_count < 0) {
+        return STRASSEN_INVALID_ARGUMENT;
+    }
+    if(m == 0 || n == 0 || batch_count == 0) {
+        return STRASSEN_SUCCESS;
+    }
+
+    lock_setup();
+    strassen_backend backend = resolve_backend();
+    status = configure_backend(type, backend);
+    if(status == STRASSEN_SUCCESS
+        && (backend == STRASSEN_BACKEND_OPENMP || backend == STRASSEN_BACKEND_THREADS)) {
+        status = configure_backend(type, STRASSEN_BACKEND_SERIAL);
+    }
+    unlock_setup();
+    if(status != STRASSEN_SUCCESS) {
+        return STRASSEN_UNAVAILABLE;
+    }
+    return elements[type].gemm_batched(backend, threads_setting, transa, transb, m, n, k, alpha,
+        batch, lda, ldb, beta, ldc, batch_count);
+}
+
+int strassen_gemm_batched(strassen_datatype type, strassen_layout layout,
+    strassen_transpose transa, strassen_transpose transb, int m, int n, int k,
+    const void *alpha, const void *const *a, int lda, const void *const *b, int ldb,
+    const void *beta, void *const *c, int ldc, int batch_count)
+{
+    batch_operands batch = { a, b, c, NULL, NULL, NULL, 0, 0, 0 };
+    if((layout != STRASSEN_ROW_MAJOR && layout != STRASSEN_COL_MAJOR)
+        || (batch_count > 0 && (a == NULL || b == NULL || c == NULL))) {
+        return STRASSEN_INVALID_ARGUMENT;
+    }
+    if(layout == STRASSEN_COL_MAJOR) {
+        batch.a = b;
+        batch.b = a;
+        return gemm_batched(type, transb, transa, n, m, k, alpha, &batch, ldb, lda, beta, ldc,
+            batch_count);
+    }
+    return gemm_batched(type, transa, transb, m, n, k, alpha, &batch, lda, ldb, beta, ldc,
+        batch_count);
+}
+
+int strassen_gemm_strided_batched(strassen_datatype type, strassen_layout layout,
+    strassen_transpose transa, strassen_transpose transb, int m, int n, int k,
+    const void *alpha, const void *a, int lda, long long stride_a, const void *b, int ldb,
+    long long stride_b, const void *beta, void *c, int ldc, long long stride_c,
+    int batch_count)
+{
+    batch_operands batch = { NULL, NULL, NULL, a, b, c, stride_a, stride_b, stride_c };
+    if((layout != STRASSEN_ROW_MAJOR && layout != STRASSEN_COL_MAJOR)
+        || stride_a < 0 || stride_b < 0 || stride_c < 0
+        || (stride_c == 0 && batch_count > 1)) {
+        return STRASSEN_INVALID_ARGUMENT;
+    }
+    if(layout == STRASSEN_COL_MAJOR) {
+        batch.a_base = b;
+        batch.b_base = a;
+        batch.stride_a = stride_b;
+        batch.stride_b = stride_a;
+        return gemm_batched(type, transb, transa, n, m, k, alpha, &batch, ldb, lda, beta, ldc,
+            batch_count);
+    }
+    return gemm_batched(type, transa, transb, m, n, k, alpha, &batch, lda, ldb, beta, ldc,
+        batch_count);
+}
+
+int strassen_sgemm(strassen_layout layout, strassen_transpose transa,
+    strassen_transpose transb, int m, int n, int k, float alpha, const float *a, int lda,
+    const float *b, int ldb, float beta, float *c, int ldc)
+{
+    return strassen_gemm(STRASSEN_FLOAT32, layout, transa, transb, m, n, k, &alpha, a, lda, b,
+        ldb, &beta, c, ldc);
+}
+
+int strassen_dgemm(strassen_layout layout, strassen_transpose transa,
+    strassen_transpose transb, int m, int n, int k, double alpha, const double *a, int lda,
+    const double *b, int ldb, double beta, double *c, int ldc)
+{
+    return strassen_gemm(STRASSEN_FLOAT64, layout, transa, transb, m, n, k, &alpha, a, lda, b,
+        ldb, &beta, c, ldc);
+}
@@ -0,0 +1,217 @@
+/* strassen.h
+   libstrassen: Strassen matrix multiplication of float, double, half and
+   integer matrices behind BLAS-style gemm entry points, computed by a
+   serial, OpenMP, threads or OpenCL backend picked at run time.
+
+   The backend, thread count, executor and cutoff are process-wide
+   settings. Change them only while no product is running. The first
+   product of each element type sets up its backend under a lock, so
+   first calls from several threads at once are safe. Products on the
+   serial and OpenMP backends can run concurrently from several threads,
+   and products on the threads backend can be called that way but take
+   turns. Products on the OpenCL backend share one device queue and must
+   not.
+*/
+#ifndef STRASSEN_H
+#define STRASSEN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32) && defined(STRASSEN_BUILDING)
+#define STRASSEN_API __declspec(dllexport)
+#elif defined(_WIN32) && defined(STRASSEN_SHARED)
+#define STRASSEN_API __declspec(dllimport)
+#elif defined(__GNUC__)
+#define STRASSEN_API __attribute__((visibility("default")))
+#else
+#define STRASSEN_API
+#endif
+
+/* Storage order of the matrices passed to strassen_sgemm(). The values
+ * are those of CBLAS, so CblasRowMajor etc. can be passed as they are.
+ */
+typedef enum {
+    STRASSEN_ROW_MAJOR = 101,
+    STRASSEN_COL_MAJOR = 102
+} strassen_layout;
+
+typedef enum {
+    STRASSEN_NO_TRANS = 111,
+    STRASSEN_TRANS = 112,
+    /* Same as STRASSEN_TRANS for real matrices. */
+    STRASSEN_CONJ_TRANS = 113
+} strassen_transpose;
+
+/* STRASSEN_BACKEND_AUTO is the STRASSEN_BACKEND environment variable
+ * (serial, openmp, opencl, threads or hybrid) if that is set, otherwise
+ * OpenMP when the library was built with it and serial when not.
+ * STRASSEN_BACKEND_THREADS runs the recursion of the OpenMP backend on a
+ * work-stealing scheduler of the library's own instead of the OpenMP
+ * runtime, on threads it starts or on an executor of the application.
+ * STRASSEN_BACKEND_HYBRID, built with OpenCL, splits the seven products
+ * of the top recursion level between the OpenCL device and the threads
+ * backend, by the throughput it measures on each; like OpenCL it only
+ * does STRASSEN_FLOAT32.
+ */
+typedef enum {
+    STRASSEN_BACKEND_AUTO,
+    STRASSEN_BACKEND_SERIAL,
+    STRASSEN_BACKEND_OPENMP,
+    STRASSEN_BACKEND_OPENCL,
+    STRASSEN_BACKEND_THREADS,
+    STRASSEN_BACKEND_HYBRID
+} strassen_backend;
+
+/* A thread pool of the application for the threads backend to run on
+ * instead of threads of its own. submit(data, run, argument) has to get
+ * run(argument) called once on a thread of the pool, and must not wait
+ * for that. A product submits a job for each of up to workers threads,
+ * which help with it until it is done; the thread calling the product
+ * works on it too. Jobs that only start after the product is done return
+ * at once, so a busy pool slows products down but can't deadlock them.
+ * The pool has to run jobs for as long as the library is used.
+ */
+typedef struct {
+    void *data;
+    void (*submit)(void *data, void (*run)(void *argument), void *argument);
+    int workers;
+} strassen_executor;
+
+/* Element types of strassen_gemm(). Each is computed in the type alpha
+ * and beta are given in:
+ *   STRASSEN_FLOAT32  float, computed in float
+ *   STRASSEN_FLOAT64  double, computed in double
+ *   STRASSEN_FLOAT16  IEEE binary16 in a uint16_t, computed in float:
+ *                     base case products accumulate in float and are
+ *                     rounded once, but the recursion's sums are stored
+ *                     as half
+ *   STRASSEN_INT32    int32_t, computed modulo 2^32, so exact unless the
+ *                     true product overflows
+ *   STRASSEN_INT64    int64_t, computed modulo 2^64
+ */
+typedef enum {
+    STRASSEN_FLOAT32,
+    STRASSEN_FLOAT64,
+    STRASSEN_FLOAT16,
+    STRASSEN_INT32,
+    STRASSEN_INT64
+} strassen_datatype;
+
+/* Return values. */
+#define STRASSEN_SUCCESS 0
+/* A dimension is negative, a leading dimension too small or an enum out
+ * of range. Nothing was written.
+ */
+#define STRASSEN_INVALID_ARGUMENT (-1)
+/* The backend was not built into the library, can't run here (no
+ * OpenCL device) or doesn't compute the element type (OpenCL and hybrid
+ * only do STRASSEN_FLOAT32).
+ */
+#define STRASSEN_UNAVAILABLE (-2)
+
+/* Selects the backend for the following products. The backend is set up
+ * here, so that its errors show at once. Returns STRASSEN_SUCCESS or
+ * STRASSEN_UNAVAILABLE, in which case the previous backend stays.
+ */
+STRASSEN_API int strassen_set_backend(strassen_backend backend);
+
+/* The backend products run on, never STRASSEN_BACKEND_AUTO. */
+STRASSEN_API strassen_backend strassen_get_backend(void);
+
+/* "serial", "openmp", "opencl", "threads", "hybrid" or "auto". */
+STRASSEN_API const char * strassen_backend_name(strassen_backend backend);
+
+/* Whether the backend was built into the library. Whether OpenCL finds a
+ * device is only known once strassen_set_backend() tries.
+ */
+STRASSEN_API int strassen_backend_built(strassen_backend backend);
+
+/* Threads of the OpenMP, threads and hybrid backends; 0 (the default)
+ * uses OMP_NUM_THREADS or all processors on the OpenMP backend, and on
+ * the threads and hybrid backends all processors, or the executor's
+ * workers and the calling thread.
+ */
+STRASSEN_API void strassen_set_threads(int threads);
+
+/* Runs the threads backend, and the host side of the hybrid one, on
+ * executor (which is copied), or on threads of their own again if
+ * executor is NULL.
+ */
+STRASSEN_API void strassen_set_executor(const strassen_executor *executor);
+
+/* How many of the seven top-level products the hybrid backend gives the
+ * device in its next product, from the throughput it has measured so far
+ * (STRASSEN_HYBRID_SPLIT fixes it); 0 without OpenCL.
+ */
+STRASSEN_API int strassen_hybrid_device_products(void);
+
+/* Recursion cutoff: blocks with a dimension this size or smaller are
+ * multiplied conventionally. 0 (the default) uses STRASSEN_CUTOFF or the
+ * result stored by the program's "tune" mode.
+ */
+STRASSEN_API void strassen_set_cutoff(int cutoff);
+
+/* C = alpha op(A) op(B) + beta C, where op(X) is X or its transpose, op(A)
+ * is m x k, op(B) is k x n and C is m x n, like cblas_sgemm(). The leading
+ * dimensions are the distance between rows (row-major) or columns
+ * (column-major). When beta is 0, C is not read, so it may hold NaNs.
+ * Returns STRASSEN_SUCCESS, STRASSEN_INVALID_ARGUMENT or
+ * STRASSEN_UNAVAILABLE.
+ */
+STRASSEN_API int strassen_sgemm(strassen_layout layout, strassen_transpose transa,
+    strassen_transpose transb, int m, int n, int k, float alpha, const float *a, int lda,
+    const float *b, int ldb, float beta, float *c, int ldc);
+
+/* strassen_sgemm() for any strassen_datatype: a, b and c point to
+ * elements of the type, alpha and beta to one value of the type it is
+ * computed in (float for STRASSEN_FLOAT16). Returns STRASSEN_SUCCESS,
+ * STRASSEN_INVALID_ARGUMENT or STRASSEN_UNAVAILABLE.
+ */
+STRASSEN_API int strassen_gemm(strassen_datatype type, strassen_layout layout,
+    strassen_transpose transa, strassen_transpose transb, int m, int n, int k,
+    const void *alpha, const void *a, int lda, const void *b, int ldb, const void *beta,
+    void *c, int ldc);
+
+/* strassen_gemm() for STRASSEN_FLOAT64. */
+STRASSEN_API int strassen_dgemm(strassen_layout layout, strassen_transpose transa,
+    strassen_transpose transb, int m, int n, int k, double alpha, const double *a, int lda,
+    const double *b, int ldb, double beta, double *c, int ldc);
+
+/* batch_count products c[i] = alpha op(a[i]) op(b[i]) + beta c[i] of one
+ * shape, type and layout, as strassen_gemm() computes them. The products
+ * are independent, and no c[i] may overlap another or an operand. On the
+ * OpenMP and threads backends a batch with at least as many products as
+ * threads is spread over the threads, each running whole products with
+ * buffers it reuses for the batch; smaller ones run a product at a time
+ * on all the threads. Products no larger than the cutoff go straight to
+ * the blocked base case. For many shapes, make one call per shape.
+ */
+STRASSEN_API int strassen_gemm_batched(strassen_datatype type, strassen_layout layout,
+    strassen_transpose transa, strassen_transpose transb, int m, int n, int k,
+    const void *alpha, const void *const *a, int lda, const void *const *b, int ldb,
+    const void *beta, void *const *c, int ldc, int batch_count);
+
+/* strassen_gemm_batched() for products stored at fixed distances: a[i]
+ * is a + i * stride_a elements, and so on. A stride_a or stride_b of 0
+ * uses the same operand for every product; stride_c may only be 0 for a
+ * single product, since the results can't share a matrix.
+ */
+STRASSEN_API int strassen_gemm_strided_batched(strassen_datatype type, strassen_layout layout,
+    strassen_transpose transa, strassen_transpose transb, int m, int n, int k,
+    const void *alpha, const void *a, int lda, long long stride_a, const void *b, int ldb,
+    long long stride_b, const void *beta, void *c, int ldc, long long stride_c,
+    int batch_count);
+
+/* Releases what the backends hold (the OpenCL device, buffers and
+ * queues, and the threads the threads backend started). A later call
+ * sets them up again.
+ */
+STRASSEN_API void strassen_finalize(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,655 @@
+/* strassen_test.c
+   Checks libstrassen through strassen.h on the backend named on the
+   command line: products and batches of every element type, layout,
+   transpose, alpha and beta and padded leading dimensions against a plain
+   double reference, the hybrid backend against the serial one, and the
+   arguments that have to be rejected. Exits with status 77, which CTest
+   takes as a skipped test, if the backend can't run here.
+*/
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "strassen.h"
+
+#define SKIPPED 77
+/* Small enough that the shapes below recurse a few levels. */
+#define TEST_CUTOFF 16
+/* More than the products of a level, so that they run in parallel. */
+#define TEST_THREADS 4
+/* Cutoff of the products the hybrid backend splits, which have to be at
+ * least 256 in every dimension; a smaller one only makes more leaves.
+ */
+#define HYBRID_TEST_CUTOFF 64
+/* What the padding of c holds; no product may write it. */
+#define SENTINEL 1000.0
+
+/* The largest error of an element allowed, relative to |alpha| k max|a|
+ * max|b| + |beta| max|c|, by strassen_datatype. Half rounds c and every
+ * sum of the recursion to 11 bits, and may be off by 8 units of 2^-11
+ * (the shapes below stay under one); the integers have to be exact.
+ */
+static const double tolerance[] = { 1e-5, 1e-12, 8.0 / 2048, 0, 0 };
+
+static const size_t element_sizes[] = { sizeof(float), sizeof(double), sizeof(uint16_t),
+    sizeof(int32_t), sizeof(int64_t) };
+
+/* alpha or beta, in the type the product is computed in. */
+typedef union {
+    float f;
+    double d;
+    int32_t i32;
+    int64_t i64;
+} scalar;
+
+static int checks, failures;
+
+static unsigned long long random_state = 88172645463325252ULL;
+
+static double random_unit(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return (double)(random_state >> 11) / (double)(1ULL << 53) * 2.0 - 1.0;
+}
+
+static int is_integer(strassen_datatype type)
+{
+    return type == STRASSEN_INT32 || type == STRASSEN_INT64;
+}
+
+/* The binary16 of value, which has to be zero, NaN or a normal half with
+ * no more than 11 significant bits, as all the values stored here are.
+ */
+static uint16_t half_from_double(double value)
+{
+    if(value != value) {
+        return 0x7e00;
+    }
+    uint16_t sign = value < 0 ? 0x8000 : 0;
+    if(value == 0) {
+        return sign;
+    }
+    int exponent;
+    double fraction = frexp(fabs(value), &exponent);
+    return (uint16_t) (sign | (exponent + 14) << 10 | ((int) (fraction * 2048) - 1024));
+}
+
+static double double_from_half(uint16_t half)
+{
+    int exponent = half >> 10 & 0x1f, mantissa = half & 0x3ff;
+    double magnitude = exponent == 0 ? ldexp(mantissa, -24)
+        : exponent == 31 ? (mantissa != 0 ? NAN : INFINITY)
+        : ldexp(mantissa | 0x400, exponent - 25);
+    return half & 0x8000 ? -magnitude : magnitude;
+}
+
+static void store(strassen_datatype type, void *x, size_t i, double value)
+{
+    switch(type) {
+    case STRASSEN_FLOAT32: ((float *) x)[i] = (float) value; break;
+    case STRASSEN_FLOAT64: ((double *) x)[i] = value; break;
+    case STRASSEN_FLOAT16: ((uint16_t *) x)[i] = half_from_double(value); break;
+    case STRASSEN_INT32: ((int32_t *) x)[i] = (int32_t) value; break;
+    case STRASSEN_INT64: ((int64_t *) x)[i] = (int64_t) value; break;
+    }
+}
+
+static double load(strassen_datatype type, const void *x, size_t i)
+{
+    switch(type) {
+    case STRASSEN_FLOAT32: return ((const float *) x)[i];
+    case STRASSEN_FLOAT64: return ((const double *) x)[i];
+    case STRASSEN_FLOAT16: return double_from_half(((const uint16_t *) x)[i]);
+    case STRASSEN_INT32: return ((const int32_t *) x)[i];
+    case STRASSEN_INT64: return (double) ((const int64_t *) x)[i];
+    }
+    return 0;
+}
+
+/* A value of the type, for operands and c: in [-1, 1] for the floating
+ * types, in 1024ths for half so that it is exact, and integers small
+ * enough that no product overflows and double holds the reference
+ * exactly.
+ */
+static double random_value(strassen_datatype type)
+{
+    switch(type) {
+    case STRASSEN_FLOAT16: return round(random_unit() * 1024) / 1024;
+    case STRASSEN_INT32: return round(random_unit() * 100);
+    case STRASSEN_INT64: return round(random_unit() * (1 << 20));
+    default: return random_unit();
+    }
+}
+
+static scalar make_scalar(strassen_datatype type, double value)
+{
+    scalar s;
+    switch(type) {
+    case STRASSEN_FLOAT64: s.d = value; break;
+    case STRASSEN_INT32: s.i32 = (int32_t) value; break;
+    case STRASSEN_INT64: s.i64 = (int64_t) value; break;
+    default: s.f = (float) value; break;
+    }
+    return s;
+}
+
+/* Index of element (i, j) of a rows x cols matrix stored in layout. */
+static size_t at(strassen_layout layout, int ld, int i, int j)
+{
+    return layout == STRASSEN_ROW_MAJOR ? (size_t) i * ld + j : (size_t) j * ld + i;
+}
+
+/* The least leading dimension of a rows x cols matrix in layout plus pad,
+ * and the elements the matrix then takes.
+ */
+static int leading_dimension(strassen_layout layout, int rows, int cols, int pad)
+{
+    int inner = layout == STRASSEN_ROW_MAJOR ? cols : rows;
+    return (inner > 1 ? inner : 1) + pad;
+}
+
+static size_t matrix_elements(strassen_layout layout, int rows, int cols, int ld)
+{
+    int outer = layout == STRASSEN_ROW_MAJOR ? rows : cols;
+    return (size_t) (outer > 1 ? outer : 1) * ld;
+}
+
+/* Fills a rows x cols matrix in layout with random elements and its
+ * padding with SENTINEL.
+ */
+static void fill_matrix(strassen_datatype type, strassen_layout layout, int rows, int cols,
+    int ld, void *x)
+{
+    size_t count = matrix_elements(layout, rows, cols, ld);
+    for(size_t i = 0; i < count; i++) {
+        store(type, x, i, SENTINEL);
+    }
+    for(int i = 0; i < rows; i++) {
+        for(int j = 0; j < cols; j++) {
+            store(type, x, at(layout, ld, i, j), random_value(type));
+        }
+    }
+}
+
+/* A filled rows x cols matrix with *ld set to the least leading dimension
+ * plus pad.
+ */
+static void *make_matrix(strassen_datatype type, strassen_layout layout, int rows, int cols,
+    int pad, int *ld)
+{
+    *ld = leading_dimension(layout, rows, cols, pad);
+    void *x = malloc(matrix_elements(layout, rows, cols, *ld) * element_sizes[type]);
+    fill_matrix(type, layout, rows, cols, *ld, x);
+    return x;
+}
+
+static void fail(const char *what, int m, int n, int k, strassen_datatype type,
+    strassen_layout layout, strassen_transpose transa, strassen_transpose transb)
+{
+    failures++;
+    fprintf(stderr, "FAILED %s: %dx%dx%d type %d layout %d trans %d %d\n", what, m, n, k,
+        (int) type, (int) layout, (int) transa, (int) transb);
+}
+
+/* Sets expected, m x n row-major, to alpha op(a) op(b) + beta c and
+ * returns the scale its error is measured in. With beta 0 c is filled
+ * with NaNs, or anything for the integers, since it must not be read.
+ */
+static double reference(strassen_datatype type, strassen_layout layout,
+    strassen_transpose transa, strassen_transpose transb, int m, int n, int k, double alpha,
+    const void *a, int lda, const void *b, int ldb, double beta, void *c, int ldc,
+    double *expected)
+{
+    double a_max = 0, b_max = 0, c_max = 0;
+    for(int i = 0; i < m; i++) {
+        for(int j = 0; j < n; j++) {
+            double sum = 0;
+            for(int p = 0; p < k; p++) {
+                double x = transa == STRASSEN_NO_TRANS ? load(type, a, at(layout, lda, i, p))
+                    : load(type, a, at(layout, lda, p, i));
+                double y = transb == STRASSEN_NO_TRANS ? load(type, b, at(layout, ldb, p, j))
+                    : load(type, b, at(layout, ldb, j, p));
+                sum += x * y;
+                a_max = fmax(a_max, fabs(x));
+                b_max = fmax(b_max, fabs(y));
+            }
+            size_t index = at(layout, ldc, i, j);
+            double old = load(type, c, index);
+            c_max = fmax(c_max, fabs(old));
+            expected[(size_t) i * n + j] = alpha * sum + (beta != 0 ? beta * old : 0);
+            if(beta == 0) {
+                store(type, c, index, is_integer(type) ? -SENTINEL : NAN);
+            }
+        }
+    }
+    return fabs(alpha) * k * a_max * b_max + fabs(beta) * c_max;
+}
+
+/* Compares c with the expected result of reference(), and its padding
+ * with SENTINEL.
+ */
+static void compare(strassen_datatype type, strassen_layout layout, strassen_transpose transa,
+    strassen_transpose transb, int m, int n, int k, const void *c, int ldc,
+    const double *expected, double scale)
+{
+    double worst = 0;
+    int padding_intact = 1;
+    int outer = layout == STRASSEN_ROW_MAJOR ? m : n;
+    int inner = layout == STRASSEN_ROW_MAJOR ? n : m;
+    for(int i = 0; i < m; i++) {
+        for(int j = 0; j < n; j++) {
+            double error = fabs(load(type, c, at(layout, ldc, i, j))
+                - expected[(size_t) i * n + j]);
+            // a NaN never compares greater
+            worst = error > worst || error != error ? error : worst;
+        }
+    }
+    for(int o = 0; o < outer; o++) {
+        for(int i = inner; i < ldc; i++) {
+            padding_intact &= load(type, c, (size_t) o * ldc + i) == SENTINEL;
+        }
+    }
+    if(!(worst <= tolerance[type] * (scale > 0 ? scale : 1))) {
+        fail("error", m, n, k, type, layout, transa, transb);
+        fprintf(stderr, "    error %g, allowed %g\n", worst, tolerance[type] * scale);
+    }
+    if(!padding_intact) {
+        fail("padding", m, n, k, type, layout, transa, transb);
+    }
+}
+
+/* c = alpha op(a) op(b) + beta c of random matrices with pad elements
+ * more than the least leading dimensions, through strassen_sgemm() or
+ * strassen_dgemm() if typed. The padding of c must stay as it was.
+ */
+static void check_product(strassen_datatype type, strassen_layout layout,
+    strassen_transpose transa, strassen_transpose transb, int m, int n, int k, double alpha,
+    double beta, int pad, int typed)
+{
+    int lda, ldb, ldc;
+    void *a = transa == STRASSEN_NO_TRANS ? make_matrix(type, layout, m, k, pad, &lda)
+        : make_matrix(type, layout, k, m, pad, &lda);
+    void *b = transb == STRASSEN_NO_TRANS ? make_matrix(type, layout, k, n, pad, &ldb)
+        : make_matrix(type, layout, n, k, pad, &ldb);
+    void *c = make_matrix(type, layout, m, n, pad, &ldc);
+    double *expected = malloc(((size_t) m * n + 1) * sizeof(double));
+    double scale = reference(type, layout, transa, transb, m, n, k, alpha, a, lda, b, ldb, beta,
+        c, ldc, expected);
+
+    scalar alpha_value = make_scalar(type, alpha), beta_value = make_scalar(type, beta);
+    int status;
+    if(typed && type == STRASSEN_FLOAT32) {
+        status = strassen_sgemm(layout, transa, transb, m, n, k, alpha_value.f, a, lda, b, ldb,
+            beta_value.f, c, ldc);
+    } else if(typed && type == STRASSEN_FLOAT64) {
+        status = strassen_dgemm(layout, transa, transb, m, n, k, alpha_value.d, a, lda, b, ldb,
+            beta_value.d, c, ldc);
+    } else {
+        status = strassen_gemm(type, layout, transa, transb, m, n, k, &alpha_value, a, lda, b,
+            ldb, &beta_value, c, ldc);
+    }
+
+    checks++;
+    if(status != STRASSEN_SUCCESS) {
+        fail("status", m, n, k, type, layout, transa, transb);
+    } else {
+        compare(type, layout, transa, transb, m, n, k, c, ldc, expected, scale);
+    }
+    free(a);
+    free(b);
+    free(c);
+    free(expected);
+}
+
+/* Every layout, transpose, alpha and beta and padding of a few shapes:
+ * single elements, empty products, square ones and odd rectangles.
+ */
+static void check_products(strassen_datatype type)
+{
+    static const int shapes[][3] = { { 1, 1, 1 }, { 0, 5, 3 }, { 4, 0, 2 }, { 3, 4, 0 },
+        { 64, 64, 64 }, { 67, 45, 83 }, { 33, 90, 17 } };
+    static const double scalars[][2] = { { 1, 0 }, { -2, 3 }, { 0, -1 } };
+    static const strassen_layout layouts[] = { STRASSEN_ROW_MAJOR, STRASSEN_COL_MAJOR };
+    static const strassen_transpose transposes[] = { STRASSEN_NO_TRANS, STRASSEN_TRANS,
+        STRASSEN_CONJ_TRANS };
+    for(size_t s = 0; s < sizeof shapes / sizeof shapes[0]; s++) {
+        for(int l = 0; l < 2; l++) {
+            for(int ta = 0; ta < 3; ta++) {
+                for(int tb = 0; tb < 3; tb++) {
+                    for(int v = 0; v < 3; v++) {
+                        check_product(type, layouts[l], transposes[ta], transposes[tb],
+                            shapes[s][0], shapes[s][1], shapes[s][2], scalars[v][0],
+                            scalars[v][1], (int) (s + v) % 2 * 3, (ta + tb + v) % 2);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* A batch of count products of one shape, each with an a, b and c of its
+ * own unless shared gives them all one b: strided through
+ * strassen_gemm_strided_batched() with a gap after every matrix, or
+ * through strassen_gemm_batched() with the pointers last to first.
+ */
+static void check_batch(strassen_datatype type, strassen_layout layout,
+    strassen_transpose transa, int m, int n, int k, double alpha, double beta, int count,
+    int shared, int strided)
+{
+    const strassen_transpose transb = STRASSEN_NO_TRANS;
+    int a_rows = transa == STRASSEN_NO_TRANS ? m : k;
+    int a_cols = transa == STRASSEN_NO_TRANS ? k : m;
+    int lda = leading_dimension(layout, a_rows, a_cols, 1);
+    int ldb = leading_dimension(layout, k, n, 2);
+    int ldc = leading_dimension(layout, m, n, 3);
+    long long stride_a = (long long) matrix_elements(layout, a_rows, a_cols, lda) + 5;
+    long long stride_b = shared ? 0 : (long long) matrix_elements(layout, k, n, ldb) + 5;
+    long long stride_c = (long long) matrix_elements(layout, m, n, ldc) + 5;
+    size_t size = element_sizes[type];
+    int products = count > 0 ? count : 1;
+    char *a = malloc((size_t) stride_a * products * size);
+    char *b = malloc((shared ? matrix_elements(layout, k, n, ldb) : (size_t) stride_b * products)
+        * size);
+    char *c = malloc((size_t) stride_c * products * size);
+    double *expected = malloc(((size_t) m * n * products + 1) * sizeof(double));
+    double *scales = malloc(products * sizeof(double));
+    const void **a_pointers = malloc(products * sizeof(void *));
+    const void **b_pointers = malloc(products * sizeof(void *));
+    void **c_pointers = malloc(products * sizeof(void *));
+    for(int i = 0; i < count; i++) {
+        char *a_i = a + (size_t) (i * stride_a) * size;
+        char *b_i = b + (size_t) (i * stride_b) * size;
+        char *c_i = c + (size_t) (i * stride_c) * size;
+        fill_matrix(type, layout, a_rows, a_cols, lda, a_i);
+        if(!shared || i == 0) {
+            fill_matrix(type, layout, k, n, ldb, b_i);
+        }
+        fill_matrix(type, layout, m, n, ldc, c_i);
+        scales[i] = reference(type, layout, transa, transb, m, n, k, alpha, a_i, lda, b_i, ldb,
+            beta, c_i, ldc, expected + (size_t) i * m * n);
+        a_pointers[count - 1 - i] = a_i;
+        b_pointers[count - 1 - i] = b_i;
+        c_pointers[count - 1 - i] = c_i;
+    }
+
+    scalar alpha_value = make_scalar(type, alpha), beta_value = make_scalar(type, beta);
+    int status = strided
+        ? strassen_gemm_strided_batched(type, layout, transa, transb, m, n, k, &alpha_value, a,
+            lda, stride_a, b, ldb, stride_b, &beta_value, c, ldc, stride_c, count)
+        : strassen_gemm_batched(type, layout, transa, transb, m, n, k, &alpha_value, a_pointers,
+            lda, b_pointers, ldb, &beta_value, c_pointers, ldc, count);
+    checks++;
+    if(status != STRASSEN_SUCCESS) {
+        fail(strided ? "strided batch status" : "batch status", m, n, k, type, layout, transa,
+            transb);
+    } else {
+        for(int i = 0; i < count; i++) {
+            compare(type, layout, transa, transb, m, n, k, c + (size_t) (i * stride_c) * size,
+                ldc, expected + (size_t) i * m * n, scales[i]);
+        }
+    }
+    free(a);
+    free(b);
+    free(c);
+    free(expected);
+    free(scales);
+    free(a_pointers);
+    free(b_pointers);
+    free(c_pointers);
+}
+
+/* Batches of both kinds: empty and single ones, ones with fewer products
+ * than threads, which run a product at a time on all of them, and ones
+ * with more, where every thread runs several products with the buffers it
+ * keeps for the batch. The small shape is below the cutoff and skips the
+ * recursion.
+ */
+static void check_batches(strassen_datatype type)
+{
+    static const int counts[] = { 0, 1, 3, 9 };
+    static const int shapes[][3] = { { 67, 45, 83 }, { 12, 16, 5 } };
+    static const strassen_layout layouts[] = { STRASSEN_ROW_MAJOR, STRASSEN_COL_MAJOR };
+    static const strassen_transpose transposes[] = { STRASSEN_NO_TRANS, STRASSEN_TRANS };
+    for(int i = 0; i < 4; i++) {
+        for(int s = 0; s < 2; s++) {
+            for(int l = 0; l < 2; l++) {
+                for(int t = 0; t < 2; t++) {
+                    for(int strided = 0; strided < 2; strided++) {
+                        int v = (i + s + t + strided) % 2;
+                        check_batch(type, layouts[l], transposes[t], shapes[s][0], shapes[s][1],
+                            shapes[s][2], v ? -2 : 1, v ? 3 : 0, counts[i], (i + l) % 2,
+                            strided);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* The hybrid backend against the serial one on the same operands, and
+ * both against the reference, with products large enough that the top
+ * level is split between device and host, and odd dimensions it peels.
+ * With STRASSEN_HYBRID_SPLIT set, the split has to stay where it says.
+ */
+static void check_hybrid(void)
+{
+    static const int shapes[][3] = { { 256, 256, 256 }, { 301, 257, 263 }, { 258, 300, 271 },
+        { 257, 511, 300 } };
+    const strassen_datatype type = STRASSEN_FLOAT32;
+    const strassen_layout layout = STRASSEN_ROW_MAJOR;
+    const strassen_transpose no = STRASSEN_NO_TRANS;
+    const char *split = getenv("STRASSEN_HYBRID_SPLIT");
+    strassen_set_cutoff(HYBRID_TEST_CUTOFF);
+    for(size_t s = 0; s < sizeof shapes / sizeof shapes[0]; s++) {
+        int m = shapes[s][0], n = shapes[s][1], k = shapes[s][2];
+        int lda, ldb, ldc;
+        float *a = make_matrix(type, layout, m, k, 1, &lda);
+        float *b = make_matrix(type, layout, k, n, 0, &ldb);
+        float *c = make_matrix(type, layout, m, n, 2, &ldc);
+        size_t c_bytes = matrix_elements(layout, m, n, ldc) * sizeof(float);
+        float *serial = malloc(c_bytes);
+        double *expected = malloc((size_t) m * n * sizeof(double));
+        double scale = reference(type, layout, no, no, m, n, k, -2, a, lda, b, ldb, 3, c, ldc,
+            expected);
+        memcpy(serial, c, c_bytes);
+
+        checks++;
+        if(strassen_sgemm(layout, no, no, m, n, k, -2, a, lda, b, ldb, 3, c, ldc)
+            != STRASSEN_SUCCESS
+            || strassen_set_backend(STRASSEN_BACKEND_SERIAL) != STRASSEN_SUCCESS
+            || strassen_sgemm(layout, no, no, m, n, k, -2, a, lda, b, ldb, 3, serial, ldc)
+            != STRASSEN_SUCCESS
+            || strassen_set_backend(STRASSEN_BACKEND_HYBRID) != STRASSEN_SUCCESS) {
+            fail("hybrid status", m, n, k, type, layout, no, no);
+        } else {
+            compare(type, layout, no, no, m, n, k, c, ldc, expected, scale);
+            for(int i = 0; i < m; i++) {
+                for(int j = 0; j < n; j++) {
+                    expected[(size_t) i * n + j] = serial[at(layout, ldc, i, j)];
+                }
+            }
+            compare(type, layout, no, no, m, n, k, c, ldc, expected, scale);
+        }
+        checks++;
+        if(split != NULL && strassen_hybrid_device_products() != atoi(split)) {
+            failures++;
+            fprintf(stderr, "FAILED hybrid split %d instead of %s\n",
+                strassen_hybrid_device_products(), split);
+        }
+        free(a);
+        free(b);
+        free(c);
+        free(serial);
+        free(expected);
+    }
+    strassen_set_cutoff(TEST_CUTOFF);
+}
+
+static void expect_status(const char *what, int returned, int status)
+{
+    checks++;
+    if(returned != status) {
+        failures++;
+        fprintf(stderr, "FAILED %s: returned %d instead of %d\n", what, returned, status);
+    }
+}
+
+/* Batches that have to be rejected, or are empty, must leave every c
+ * alone; a single product may have a stride_c of 0.
+ */
+static void check_rejected_batches(void)
+{
+    const strassen_datatype f = STRASSEN_FLOAT32;
+    const strassen_layout row = STRASSEN_ROW_MAJOR;
+    const strassen_transpose no = STRASSEN_NO_TRANS;
+    const int invalid = STRASSEN_INVALID_ARGUMENT;
+    float a[16], b[16], c[32];
+    float one = 1;
+    for(int i = 0; i < 32; i++) {
+        a[i % 16] = b[i % 16] = 1;
+        c[i] = (float) SENTINEL;
+    }
+    const void *a_pointers[2] = { a, a }, *b_pointers[2] = { b, b };
+    void *c_pointers[2] = { c, c + 16 };
+    expect_status("negative batch count", strassen_gemm_batched(f, row, no, no, 4, 4, 4, &one,
+        a_pointers, 4, b_pointers, 4, &one, c_pointers, 4, -1), invalid);
+    expect_status("batch without pointers", strassen_gemm_batched(f, row, no, no, 4, 4, 4,
+        &one, NULL, 4, b_pointers, 4, &one, c_pointers, 4, 2), invalid);
+    expect_status("batch lda < k", strassen_gemm_batched(f, row, no, no, 4, 4, 4, &one,
+        a_pointers, 3, b_pointers, 4, &one, c_pointers, 4, 2), invalid);
+    expect_status("batch layout", strassen_gemm_batched(f, (strassen_layout) 100, no, no, 4, 4,
+        4, &one, a_pointers, 4, b_pointers, 4, &one, c_pointers, 4, 2), invalid);
+    expect_status("empty batch", strassen_gemm_batched(f, row, no, no, 4, 4, 4, &one,
+        a_pointers, 4, b_pointers, 4, &one, c_pointers, 4, 0), STRASSEN_SUCCESS);
+    expect_status("negative stride", strassen_gemm_strided_batched(f, row, no, no, 4, 4, 4,
+        &one, a, 4, -16, b, 4, 0, &one, c, 4, 16, 2), invalid);
+    expect_status("results sharing c", strassen_gemm_strided_batched(f, row, no, no, 4, 4, 4,
+        &one, a, 4, 0, b, 4, 0, &one, c, 4, 0, 2), invalid);
+    expect_status("empty strided batch", strassen_gemm_strided_batched(f, row, no, no, 4, 4, 4,
+        &one, a, 4, 0, b, 4, 0, &one, c, 4, 0, 0), STRASSEN_SUCCESS);
+    int untouched = 1;
+    for(int i = 0; i < 32; i++) {
+        untouched &= c[i] == (float) SENTINEL;
+    }
+    checks++;
+    if(!untouched) {
+        failures++;
+        fprintf(stderr, "FAILED rejected batches wrote c\n");
+    }
+    expect_status("single product with stride_c 0", strassen_gemm_strided_batched(f, row, no,
+        no, 4, 4, 4, &one, a, 4, 0, b, 4, 0, &one, c, 4, 0, 1), STRASSEN_SUCCESS);
+    checks++;
+    if(c[0] != (float) SENTINEL + 4 || c[16] != (float) SENTINEL) {
+        failures++;
+        fprintf(stderr, "FAILED single product with stride_c 0: c %g, next %g\n", c[0], c[16]);
+    }
+}
+
+/* strassen_gemm() has to return status for these arguments and leave c
+ * alone.
+ */
+static void check_rejected(const char *what, int status, strassen_datatype type,
+    strassen_layout layout, strassen_transpose transa, strassen_transpose transb, int m, int n,
+    int k, int lda, int ldb, int ldc)
+{
+    float a[64], b[64], c[64];
+    float one = 1;
+    for(int i = 0; i < 64; i++) {
+        a[i] = b[i] = 1;
+        c[i] = (float) SENTINEL;
+    }
+    int returned = strassen_gemm(type, layout, transa, transb, m, n, k, &one, a, lda, b, ldb,
+        &one, c, ldc);
+    int untouched = 1;
+    for(int i = 0; i < 64; i++) {
+        untouched &= c[i] == (float) SENTINEL;
+    }
+    checks++;
+    if(returned != status || !untouched) {
+        failures++;
+        fprintf(stderr, "FAILED %s: returned %d, c %s\n", what, returned,
+            untouched ? "untouched" : "written");
+    }
+}
+
+static void check_invalid_arguments(void)
+{
+    const strassen_datatype f = STRASSEN_FLOAT32;
+    const strassen_layout row = STRASSEN_ROW_MAJOR, col = STRASSEN_COL_MAJOR;
+    const strassen_transpose no = STRASSEN_NO_TRANS, yes = STRASSEN_TRANS;
+    const int invalid = STRASSEN_INVALID_ARGUMENT;
+    check_rejected("negative m", invalid, f, row, no, no, -1, 4, 4, 4, 4, 4);
+    check_rejected("negative n", invalid, f, row, no, no, 4, -1, 4, 4, 4, 4);
+    check_rejected("negative k", invalid, f, col, no, no, 4, 4, -1, 4, 4, 4);
+    check_rejected("row-major lda < k", invalid, f, row, no, no, 4, 4, 5, 4, 4, 4);
+    check_rejected("row-major transposed lda < m", invalid, f, row, yes, no, 5, 4, 4, 4, 4, 5);
+    check_rejected("row-major ldb < n", invalid, f, row, no, no, 4, 5, 4, 4, 4, 5);
+    check_rejected("row-major ldc < n", invalid, f, row, no, no, 4, 5, 4, 4, 5, 4);
+    check_rejected("column-major lda < m", invalid, f, col, no, no, 5, 4, 4, 4, 4, 5);
+    check_rejected("column-major ldb < k", invalid, f, col, no, no, 4, 4, 5, 4, 4, 4);
+    check_rejected("column-major transposed ldb < n", invalid, f, col, no, yes, 4, 5, 4, 4, 4,
+        4);
+    check_rejected("column-major ldc < m", invalid, f, col, no, no, 5, 4, 4, 5, 4, 4);
+    check_rejected("zero ld", invalid, f, row, no, no, 0, 0, 0, 0, 1, 1);
+    check_rejected("layout", invalid, f, (strassen_layout) 100, no, no, 4, 4, 4, 4, 4, 4);
+    check_rejected("transa", invalid, f, row, (strassen_transpose) 110, no, 4, 4, 4, 4, 4, 4);
+    check_rejected("transb", invalid, f, row, no, (strassen_transpose) 114, 4, 4, 4, 4, 4, 4);
+    check_rejected("type", invalid, (strassen_datatype) 99, row, no, no, 4, 4, 4, 4, 4, 4);
+    check_rejected("empty product", STRASSEN_SUCCESS, f, row, no, no, 0, 0, 0, 1, 1, 1);
+    checks++;
+    if(strassen_set_backend((strassen_backend) 99) != invalid) {
+        failures++;
+        fprintf(stderr, "FAILED backend out of range\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    strassen_backend backend = STRASSEN_BACKEND_AUTO;
+    for(int b = STRASSEN_BACKEND_SERIAL; b <= STRASSEN_BACKEND_HYBRID; b++) {
+        if(argc > 1 && strcmp(argv[1], strassen_backend_name((strassen_backend) b)) == 0) {
+            backend = (strassen_backend) b;
+        }
+    }
+    if(backend == STRASSEN_BACKEND_AUTO) {
+        fprintf(stderr, "usage: strassen_test serial|openmp|opencl|threads|hybrid\n");
+        return 1;
+    }
+    strassen_set_threads(TEST_THREADS);
+    strassen_set_cutoff(TEST_CUTOFF);
+    if(strassen_set_backend(backend) != STRASSEN_SUCCESS) {
+        printf("%s backend unavailable, skipped\n", argv[1]);
+        return SKIPPED;
+    }
+    // the OpenCL and hybrid backends only do float
+    int float_only = backend == STRASSEN_BACKEND_OPENCL || backend == STRASSEN_BACKEND_HYBRID;
+
+    check_products(STRASSEN_FLOAT32);
+    check_batches(STRASSEN_FLOAT32);
+    for(int type = STRASSEN_FLOAT64; type <= STRASSEN_INT64; type++) {
+        if(!float_only) {
+            check_products((strassen_datatype) type);
+            check_batches((strassen_datatype) type);
+            continue;
+        }
+        int64_t one = 1, x[1] = { 0 };
+        checks++;
+        if(strassen_gemm((strassen_datatype) type, STRASSEN_ROW_MAJOR, STRASSEN_NO_TRANS,
+            STRASSEN_NO_TRANS, 1, 1, 1, &one, x, 1, x, 1, &one, x, 1) != STRASSEN_UNAVAILABLE) {
+            failures++;
+            fprintf(stderr, "FAILED type %d on a float only backend\n", type);
+        }
+    }
+    if(backend == STRASSEN_BACKEND_HYBRID) {
+        check_hybrid();
+    }
+    check_invalid_arguments();
+    check_rejected_batches();
+
+    strassen_finalize();
+    printf("%s: %d checks, %d failed\n", argv[1], checks, failures);
+    return failures != 0;
+}
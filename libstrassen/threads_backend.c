@@ -0,0 +1,10 @@
+/* threads_backend.c
+   parallel_strassens.c without its OpenMP schedules as the threads engine
+   of libstrassen: the work-stealing scheduler of common/stealing.h on
+   threads of its own or on the application's pool.
+*/
+#define STRASSEN_LIBRARY
+#define STRASSEN_WITHOUT_OPENMP
+#define BACKEND_PREFIX threads_
+#include "backend.h"
+#include "../OpenMP Strassens Matrix Multiplication/parallel_strassens.c"
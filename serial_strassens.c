@@ -5,240 +5,669 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
+#include <time.h>
+#include "common/matrix.h"
+#include "common/bench.h"
+#include "common/verify.h"
+#include "common/morton.h"
+#include "common/out_of_core.h"
+#include "common/profile.h"
 
-typedef float matrix_type;
-#define FORMAT "%f\t"
+/* Recursion cutoff used unless the command line, STRASSEN_CUTOFF or a
+ * stored tuning result says otherwise.
+ */
+#define DEFAULT_CUTOFF 64
+/* Where "tune" stores the measured cutoff; STRASSEN_TUNE_FILE overrides it.
+ */
+#define TUNE_FILE ".serial_strassens_cutoff"
+#define TUNE_REPEATS 3
 
-/*
-allocate_matrix() is a function to allocate the matrix onto heap storage
-the matrix is an array of pointers that each have an array of pointers
-*/
-matrix_type ** allocate_matrix(int size) 
+/* Which recursion strassens_multiplication() runs, picked with
+ * STRASSEN_VARIANT=strassen|winograd|morton. VARIANT_WINOGRAD is the
+ * Strassen-Winograd form (7 multiplies, 15 additions) scheduled to need
+ * only two temporaries per level; the products are built in the quadrants
+ * of the result. VARIANT_MORTON runs Strassen's formulas on copies of the
+ * operands in the recursive block layout of common/morton.h.
+ */
+enum { VARIANT_STRASSEN, VARIANT_WINOGRAD, VARIANT_MORTON };
+int strassen_variant = VARIANT_STRASSEN;
+
+/* Blocks with any dimension of this size or smaller are multiplied by
+ * blocked_matrix_multiplication() instead of being split further.
+ */
+int strassen_cutoff = DEFAULT_CUTOFF;
+
+/* Number of elements of workspace strassens_multiplication() needs for an
+ * m x k by k x n product. Each Strassen level takes m1..m7 (m/2 x n/2) and
+ * one temporary for sums of a blocks (m/2 x k/2) and one for sums of b
+ * blocks (k/2 x n/2). A Winograd level takes only the two temporaries,
+ * the first one large enough to also hold an m/2 x n/2 product. Blocks
+ * are rounded up to whole cache lines; odd sizes are peeled, so the
+ * halves round down. The Morton variant is sized by
+ * morton_workspace_size(). After the levels comes the scratch of
+ * blocked_matrix_multiplication(), which the leaves use below them all
+ * and the peels of a level once its products are combined.
+ */
+size_t morton_workspace_size(int m, int k, int n);
+
+size_t strassen_workspace_size(int m, int k, int n)
 {
-    matrix_type **matrix_rows = (matrix_type**) malloc(sizeof (matrix_type *) * size);
-    assert (matrix_rows != NULL); 
-    for (int i = 0; i < size; ++i)
-    {
-        matrix_rows[i] = (matrix_type *) malloc(sizeof(matrix_type) * size);
-        assert (matrix_rows[i] != NULL);
+    size_t total = blocked_scratch_size(m, k, n);
+    if(strassen_variant == VARIANT_MORTON) {
+        return total + morton_workspace_size(m, k, n);
     }
-	return matrix_rows;
+    while(m > strassen_cutoff && k > strassen_cutoff && n > strassen_cutoff) {
+        m /= 2;
+        k /= 2;
+        n /= 2;
+        if(strassen_variant == VARIANT_WINOGRAD) {
+            total += aligned_elements((size_t)m * (k > n ? k : n)) + aligned_elements((size_t)k * n);
+        } else {
+            total += 7 * aligned_elements((size_t)m * n) + aligned_elements((size_t)m * k)
+                + aligned_elements((size_t)k * n);
+        }
+    }
+    return total;
+}
+
+/* Peak workspace, in bytes, of an m x k by k x n product. This is all the
+ * memory the recursion uses besides a, b and result.
+ */
+size_t strassen_workspace_bytes(int m, int k, int n)
+{
+    return sizeof(matrix_type) * strassen_workspace_size(m, k, n);
 }
 
 /*
-deallocate_matrix() is a function which deallocates a matrix once it's use is over
+allocate_workspace() allocates the arena for an m x k by k x n product once, up front
 */
+matrix_type * allocate_workspace(int m, int k, int n)
+{
+    return (matrix_type *) allocate_aligned(strassen_workspace_bytes(m, k, n));
+}
 
-void deallocate_matrix(matrix_type ** m, int size)
+void strassens_multiplication(int m, int k, int n, matrix_view a, matrix_view b,
+    matrix_view result, matrix_type *workspace);
+
+/* One level of Strassen's algorithm on the even-sized leading 2m2 x 2k2
+ * and 2k2 x 2n2 parts of a and b: m1..m7 and one temporary for each
+ * operand shape are carved off the front of the workspace, the rest is
+ * handed on to the (sequential) recursive calls, which all reuse it.
+ */
+void strassen_step(int m2, int k2, int n2, matrix_view a, matrix_view b,
+    matrix_view result, matrix_type *workspace)
 {
-    // printf("in deall\n");
-    for (int i=0; i<size; ++i)
-    {
-        free(m[i]);
-    }
-    free (m);
+    matrix_view a11 = quadrant(a, m2, k2, 0, 0);
+    matrix_view a12 = quadrant(a, m2, k2, 0, 1);
+    matrix_view a21 = quadrant(a, m2, k2, 1, 0);
+    matrix_view a22 = quadrant(a, m2, k2, 1, 1);
+    matrix_view b11 = quadrant(b, k2, n2, 0, 0);
+    matrix_view b12 = quadrant(b, k2, n2, 0, 1);
+    matrix_view b21 = quadrant(b, k2, n2, 1, 0);
+    matrix_view b22 = quadrant(b, k2, n2, 1, 1);
+    matrix_view c11 = quadrant(result, m2, n2, 0, 0);
+    matrix_view c12 = quadrant(result, m2, n2, 0, 1);
+    matrix_view c21 = quadrant(result, m2, n2, 1, 0);
+    matrix_view c22 = quadrant(result, m2, n2, 1, 1);
+
+    matrix_view v1 = take_block(&workspace, m2, n2);
+    matrix_view v2 = take_block(&workspace, m2, n2);
+    matrix_view v3 = take_block(&workspace, m2, n2);
+    matrix_view v4 = take_block(&workspace, m2, n2);
+    matrix_view v5 = take_block(&workspace, m2, n2);
+    matrix_view v6 = take_block(&workspace, m2, n2);
+    matrix_view v7 = take_block(&workspace, m2, n2);
+    matrix_view sum_a = take_block(&workspace, m2, k2);
+    matrix_view sum_b = take_block(&workspace, k2, n2);
+
+    // m1
+    add_matrices(m2, k2, a11, a22, sum_a);
+    add_matrices(k2, n2, b11, b22, sum_b);
+    strassens_multiplication(m2, k2, n2, sum_a, sum_b, v1, workspace);
+    // m2   
+    add_matrices(m2, k2, a21, a22, sum_a);
+    strassens_multiplication(m2, k2, n2, sum_a, b11, v2, workspace);
+    // m3
+    subtract_matrices(k2, n2, b12, b22, sum_b);
+    strassens_multiplication(m2, k2, n2, a11, sum_b, v3, workspace);
+    // m4
+    subtract_matrices(k2, n2, b21, b11, sum_b);
+    strassens_multiplication(m2, k2, n2, a22, sum_b, v4, workspace);
+    // m5
+    add_matrices(m2, k2, a11, a12, sum_a);
+    strassens_multiplication(m2, k2, n2, sum_a, b22, v5, workspace);
+    // m6
+    subtract_matrices(m2, k2, a21, a11, sum_a);
+    add_matrices(k2, n2, b11, b12, sum_b);
+    strassens_multiplication(m2, k2, n2, sum_a, sum_b, v6, workspace);
+    // m7
+    subtract_matrices(m2, k2, a12, a22, sum_a);
+    add_matrices(k2, n2, b21, b22, sum_b);
+    strassens_multiplication(m2, k2, n2, sum_a, sum_b, v7, workspace);
+
+    // The C blocks are written straight into the quadrants of result
+    // c11
+    combine_matrices(m2, n2, v1, v4, v5, v7, c11);
+    // c12
+    add_matrices(m2, n2, v3, v5, c12);
+    // c21
+    add_matrices(m2, n2, v2, v4, c21);
+    // c22
+    combine_matrices(m2, n2, v1, v3, v2, v6, c22);
 }
 
-/* Takes a pointer to a 2-dimensional array matrix_type matrix of int size and
- * prints it to stdout, preceeded by a char label.
+/* One level of the Strassen-Winograd variant on the even-sized leading
+ * parts of a and b, in the two-temporary schedule of Boyer, Dumas, Pernet
+ * and Zhou. With
+ *
+ *   s1 = a21 + a22   s2 = s1 - a11   s3 = a11 - a21   s4 = a12 - s2
+ *   t1 = b12 - b11   t2 = b22 - t1   t3 = b22 - b12   t4 = t2 - b21
+ *   p1 = a11 b11   p2 = a12 b21   p3 = s4 b22   p4 = a22 t4
+ *   p5 = s1 t1     p6 = s2 t2     p7 = s3 t3
+ *
+ * the result is c11 = p1 + p2, c12 = u2 + p5 + p3, c21 = u3 - p4 and
+ * c22 = u3 + p5, where u2 = p1 + p6 and u3 = u2 + p7. Products go
+ * straight into the quadrants of result and are combined there in place;
+ * x holds the a operands and later p1, y the b operands.
  */
-void print_matrix(char *label, int size, matrix_type **matrix)
+void winograd_step(int m2, int k2, int n2, matrix_view a, matrix_view b,
+    matrix_view result, matrix_type *workspace)
 {
-    printf("\n\n%s\n", label);
-    printf("{\n");
-    for(int i = 0; i < size; i++) {
-        printf("\t[");
-        for(int j = 0; j < size; j++) {
-            printf(FORMAT, matrix[i][j]);
-        }
-        printf("]\n");
-    }
-    printf("}\n");
+    matrix_view a11 = quadrant(a, m2, k2, 0, 0);
+    matrix_view a12 = quadrant(a, m2, k2, 0, 1);
+    matrix_view a21 = quadrant(a, m2, k2, 1, 0);
+    matrix_view a22 = quadrant(a, m2, k2, 1, 1);
+    matrix_view b11 = quadrant(b, k2, n2, 0, 0);
+    matrix_view b12 = quadrant(b, k2, n2, 0, 1);
+    matrix_view b21 = quadrant(b, k2, n2, 1, 0);
+    matrix_view b22 = quadrant(b, k2, n2, 1, 1);
+    matrix_view c11 = quadrant(result, m2, n2, 0, 0);
+    matrix_view c12 = quadrant(result, m2, n2, 0, 1);
+    matrix_view c21 = quadrant(result, m2, n2, 1, 0);
+    matrix_view c22 = quadrant(result, m2, n2, 1, 1);
+
+    // x is sized for the larger of an m2 x k2 sum and the m2 x n2 p1
+    matrix_view x = take_block(&workspace, m2, k2 > n2 ? k2 : n2);
+    matrix_view p1 = { x.base, n2 };
+    x.ld = k2;
+    matrix_view y = take_block(&workspace, k2, n2);
+
+    // c21 = p7
+    subtract_matrices(m2, k2, a11, a21, x);
+    subtract_matrices(k2, n2, b22, b12, y);
+    strassens_multiplication(m2, k2, n2, x, y, c21, workspace);
+    // c22 = p5
+    add_matrices(m2, k2, a21, a22, x);
+    subtract_matrices(k2, n2, b12, b11, y);
+    strassens_multiplication(m2, k2, n2, x, y, c22, workspace);
+    // c12 = p6
+    subtract_matrices(m2, k2, x, a11, x);
+    subtract_matrices(k2, n2, b22, y, y);
+    strassens_multiplication(m2, k2, n2, x, y, c12, workspace);
+    // c11 = p3
+    subtract_matrices(m2, k2, a12, x, x);
+    strassens_multiplication(m2, k2, n2, x, b22, c11, workspace);
+    // p1, which replaces s4 in x
+    strassens_multiplication(m2, k2, n2, a11, b11, p1, workspace);
+
+    // c12 = u2, c21 = u3, c12 = u4, c22 = u7, c12 = u5
+    add_matrices(m2, n2, p1, c12, c12);
+    add_matrices(m2, n2, c12, c21, c21);
+    add_matrices(m2, n2, c12, c22, c12);
+    add_matrices(m2, n2, c21, c22, c22);
+    add_matrices(m2, n2, c12, c11, c12);
+    // c11 = p4, c21 = u6
+    subtract_matrices(k2, n2, y, b21, y);
+    strassens_multiplication(m2, k2, n2, a22, y, c11, workspace);
+    subtract_matrices(m2, n2, c21, c11, c21);
+    // c11 = p2, c11 = u1
+    strassens_multiplication(m2, k2, n2, a12, b21, c11, workspace);
+    add_matrices(m2, n2, p1, c11, c11);
 }
 
-/* Takes a pointer to a 2-dimensional array matrix_type matrix of int size and
- * fills it with random numbers.
+/* Recursion levels of the Morton variant for an m x k by k x n product:
+ * halvings, rounded up, until a dimension is no larger than the cutoff.
  */
-void fill_matrix(int size, matrix_type **matrix)
+int morton_levels(int m, int k, int n)
 {
-    for(int i = 0; i < size; i++) {
-        for(int j = 0; j < size; j++) {
-            matrix[i][j] = rand() % 100;
-        }
+    int levels = 0;
+    while(m > strassen_cutoff && k > strassen_cutoff && n > strassen_cutoff) {
+        m = (m + 1) / 2;
+        k = (k + 1) / 2;
+        n = (n + 1) / 2;
+        levels++;
     }
+    return levels;
 }
 
-/* Iterative matrix multiplication. The naive implementation.
+/* Workspace of the Morton variant: the copies of a, b and the result in
+ * the layout, padding included, and for each level m1..m7 and the two
+ * sum temporaries, like strassen_step() takes.
  */
-void naive_matrix_multiplication(int size,matrix_type **a , matrix_type **b , matrix_type **result)
+size_t morton_workspace_size(int m, int k, int n)
 {
-    for(int i = 0; i < size; i++) {
-        for(int j = 0; j < size; j++) {
-            result[i][j] = 0;
-            for(int k = 0; k < size; k++) {
-                result[i][j] += a[i][k] * b[k][j];
-            }
-        }
+    int levels = morton_levels(m, k, n);
+    if(levels == 0) {
+        return 0;
     }
+    morton_shape a = morton_shape_of(m, k, levels);
+    morton_shape b = morton_shape_of(k, n, levels);
+    morton_shape c = morton_shape_of(m, n, levels);
+    size_t total = aligned_elements(morton_elements(a)) + aligned_elements(morton_elements(b))
+        + aligned_elements(morton_elements(c));
+    for(int level = levels; level > 0; level--) {
+        a.levels = b.levels = c.levels = level - 1;
+        total += 7 * aligned_elements(morton_elements(c)) + aligned_elements(morton_elements(a))
+            + aligned_elements(morton_elements(b));
+    }
+    return total;
 }
 
-/* Subtract two matrices
+/* strassen_step() and the recursion below it on operands in the Morton
+ * layout, split levels more times down to leaf_m x leaf_k and leaf_k x
+ * leaf_n blocks. A quadrant is a quarter of its parent's run of
+ * elements, so no views are needed and every sum is a single pass over
+ * contiguous memory.
  */
-void subtract_matrices(int size, matrix_type **a , matrix_type **b , matrix_type **result)
+void morton_strassen(int levels, int leaf_m, int leaf_k, int leaf_n, const matrix_type *a,
+    const matrix_type *b, matrix_type *result, matrix_type *workspace)
 {
-    for(int i = 0; i < size; i++) {
-        for(int j = 0; j < size; j++) {
-            result[i][j] = a[i][j] - b[i][j];
-        }
+    PROFILE_ENTER(PROFILE_BELOW);
+    if(levels == 0) {
+        matrix_view va = { (matrix_type *) a, leaf_k };
+        matrix_view vb = { (matrix_type *) b, leaf_n };
+        matrix_view vc = { result, leaf_n };
+        blocked_matrix_multiplication(leaf_m, leaf_k, leaf_n, va, vb, vc, 0, workspace);
+        PROFILE_LEAVE();
+        return;
+    }
+    size_t qa = (size_t)leaf_m * leaf_k << 2 * (levels - 1);
+    size_t qb = (size_t)leaf_k * leaf_n << 2 * (levels - 1);
+    size_t qc = (size_t)leaf_m * leaf_n << 2 * (levels - 1);
+    const matrix_type *a11 = a, *a12 = a + qa, *a21 = a + 2 * qa, *a22 = a + 3 * qa;
+    const matrix_type *b11 = b, *b12 = b + qb, *b21 = b + 2 * qb, *b22 = b + 3 * qb;
+    matrix_type *c11 = result, *c12 = result + qc, *c21 = result + 2 * qc,
+        *c22 = result + 3 * qc;
+
+    matrix_type *v[7];
+    for(int i = 0; i < 7; i++) {
+        v[i] = workspace;
+        workspace += aligned_elements(qc);
     }
+    matrix_type *sum_a = workspace;
+    workspace += aligned_elements(qa);
+    matrix_type *sum_b = workspace;
+    workspace += aligned_elements(qb);
+    int below = levels - 1;
+
+    // m1
+    morton_add(qa, a11, a22, sum_a);
+    morton_add(qb, b11, b22, sum_b);
+    morton_strassen(below, leaf_m, leaf_k, leaf_n, sum_a, sum_b, v[0], workspace);
+    // m2
+    morton_add(qa, a21, a22, sum_a);
+    morton_strassen(below, leaf_m, leaf_k, leaf_n, sum_a, b11, v[1], workspace);
+    // m3
+    morton_subtract(qb, b12, b22, sum_b);
+    morton_strassen(below, leaf_m, leaf_k, leaf_n, a11, sum_b, v[2], workspace);
+    // m4
+    morton_subtract(qb, b21, b11, sum_b);
+    morton_strassen(below, leaf_m, leaf_k, leaf_n, a22, sum_b, v[3], workspace);
+    // m5
+    morton_add(qa, a11, a12, sum_a);
+    morton_strassen(below, leaf_m, leaf_k, leaf_n, sum_a, b22, v[4], workspace);
+    // m6
+    morton_subtract(qa, a21, a11, sum_a);
+    morton_add(qb, b11, b12, sum_b);
+    morton_strassen(below, leaf_m, leaf_k, leaf_n, sum_a, sum_b, v[5], workspace);
+    // m7
+    morton_subtract(qa, a12, a22, sum_a);
+    morton_add(qb, b21, b22, sum_b);
+    morton_strassen(below, leaf_m, leaf_k, leaf_n, sum_a, sum_b, v[6], workspace);
+
+    morton_combine(qc, v[0], v[3], v[4], v[6], c11);
+    morton_add(qc, v[2], v[4], c12);
+    morton_add(qc, v[1], v[3], c21);
+    morton_combine(qc, v[0], v[2], v[1], v[5], c22);
+    PROFILE_LEAVE();
 }
 
-/* Add two matrices
+/* The Morton variant of strassens_multiplication(): a and b are copied
+ * into the layout at the front of the workspace, multiplied there and the
+ * product copied out into result. The padding to whole leaf blocks takes
+ * the place of peeling.
  */
-void add_matrices(int size,matrix_type **a ,matrix_type **b , matrix_type **result)
+void morton_multiplication(int m, int k, int n, matrix_view a, matrix_view b,
+    matrix_view result, matrix_type *workspace)
 {
-    for(int i = 0; i < size; i++) {
-        for(int j = 0; j < size; j++) {
-            result[i][j] = a[i][j] + b[i][j];
-        }
-    }
+    int levels = morton_levels(m, k, n);
+    morton_shape sa = morton_shape_of(m, k, levels);
+    morton_shape sb = morton_shape_of(k, n, levels);
+    morton_shape sc = morton_shape_of(m, n, levels);
+    matrix_type *ma = workspace;
+    matrix_type *mb = ma + aligned_elements(morton_elements(sa));
+    matrix_type *mc = mb + aligned_elements(morton_elements(sb));
+    workspace = mc + aligned_elements(morton_elements(sc));
+
+    to_morton(m, k, a, sa, ma);
+    to_morton(k, n, b, sb, mb);
+    // morton_strassen() counts itself a level down like
+    // strassens_multiplication(), but its top level is this one
+    PROFILE_ENTER(profile_depth() - 1);
+    morton_strassen(levels, sa.leaf_rows, sa.leaf_cols, sb.leaf_cols, ma, mb, mc, workspace);
+    PROFILE_LEAVE();
+    from_morton(m, n, mc, sc, result);
 }
 
 /* Implementation of Strassen's recursive matrix multiplication
- * algorithm.
+ * algorithm for an m x k matrix a and a k x n matrix b. The quadrants of
+ * a, b and result are addressed in place; result must not overlap a or b.
+ * workspace must hold at least strassen_workspace_size(m, k, n) elements;
+ * no heap calls are made. Each level runs strassen_step() or
+ * winograd_step() as strassen_variant says, or the whole product runs in
+ * morton_multiplication().
+ *
+ * Odd dimensions are handled by dynamic peeling: Strassen runs on the
+ * even-sized leading part and the last row, column and inner index are
+ * fixed up with blocked_matrix_multiplication(), which costs O(mk + kn +
+ * mn) rather than padding to the next power of two.
  */
-void strassens_multiplication(int size,matrix_type **a , matrix_type **b , matrix_type **result)
+void strassens_multiplication(int m, int k, int n, matrix_view a, matrix_view b,
+    matrix_view result, matrix_type *workspace)
 {
-    if(size <= 2) 
+    PROFILE_ENTER(PROFILE_BELOW);
+    if(m <= strassen_cutoff || k <= strassen_cutoff || n <= strassen_cutoff) 
     {
-        naive_matrix_multiplication(size, a, b, result);
+        blocked_matrix_multiplication(m, k, n, a, b, result, 0, workspace);
     } 
+    else if(strassen_variant == VARIANT_MORTON)
+    {
+        morton_multiplication(m, k, n, a, b, result, workspace);
+    }
     else 
     {
-        int block_size = size / 2;
-
-        matrix_type ** m1=allocate_matrix(block_size);
-        matrix_type ** m2=allocate_matrix(block_size);
-        matrix_type ** m3=allocate_matrix(block_size);
-        matrix_type ** m4=allocate_matrix(block_size);
-        matrix_type ** m5=allocate_matrix(block_size);
-        matrix_type ** m6=allocate_matrix(block_size);
-        matrix_type ** m7=allocate_matrix(block_size);
-        matrix_type ** a11=allocate_matrix(block_size);
-        matrix_type ** a12=allocate_matrix(block_size);
-        matrix_type ** a21=allocate_matrix(block_size);
-        matrix_type ** a22=allocate_matrix(block_size);
-        matrix_type ** b11=allocate_matrix(block_size);
-        matrix_type ** b12=allocate_matrix(block_size);
-        matrix_type ** b21=allocate_matrix(block_size);
-        matrix_type ** b22=allocate_matrix(block_size);
-        matrix_type ** add_result1 = allocate_matrix(size);
-        matrix_type ** add_result2 = allocate_matrix(size);
-        matrix_type ** subtract_result = allocate_matrix(size);
-        
-        for(int i = 0; i < block_size; i++) {
-            for(int j = 0; j < block_size; j++) {
-                a11[i][j] = a[i][j];
-                a12[i][j] = a[i][j + block_size];
-                a21[i][j] = a[i + block_size][j];
-                a22[i][j] = a[i + block_size][j + block_size];
-                b11[i][j] = b[i][j];
-                b12[i][j] = b[i][j + block_size];
-                b21[i][j] = b[i + block_size][j];
-                b22[i][j] = b[i + block_size][j + block_size];
+        int m2 = m / 2;
+        int k2 = k / 2;
+        int n2 = n / 2;
+
+        if(strassen_variant == VARIANT_WINOGRAD) {
+            winograd_step(m2, k2, n2, a, b, result, workspace);
+        } else {
+            strassen_step(m2, k2, n2, a, b, result, workspace);
+        }
+
+        // Peel the odd edges: the last inner index is a rank-1 update of
+        // the even part, the last column and row are thin products
+        if(k % 2) {
+            blocked_matrix_multiplication(2 * m2, 1, 2 * n2, sub_view(a, 0, k - 1),
+                sub_view(b, k - 1, 0), result, 1, workspace);
+        }
+        if(n % 2) {
+            blocked_matrix_multiplication(m, k, 1, a, sub_view(b, 0, n - 1),
+                sub_view(result, 0, n - 1), 0, workspace);
+        }
+        if(m % 2) {
+            blocked_matrix_multiplication(1, k, 2 * n2, sub_view(a, m - 1, 0), b,
+                sub_view(result, m - 1, 0), 0, workspace);
+        }
+    }
+    PROFILE_LEAVE();
+}
+
+/* Sets strassen_variant from the STRASSEN_VARIANT environment variable.
+ */
+void configure_variant(void)
+{
+    const char *env = getenv("STRASSEN_VARIANT");
+    if(env != NULL && strcmp(env, "winograd") == 0) {
+        strassen_variant = VARIANT_WINOGRAD;
+    } else if(env != NULL && strcmp(env, "morton") == 0) {
+        strassen_variant = VARIANT_MORTON;
+    } else if(env != NULL && strcmp(env, "strassen") != 0) {
+        fprintf(stderr, "unknown STRASSEN_VARIANT %s, using strassen\n", env);
+    }
+}
+
+/* Path of the file the tuned cutoff is stored in.
+ */
+const char * tune_file(void)
+{
+    const char *path = getenv("STRASSEN_TUNE_FILE");
+    return path != NULL ? path : TUNE_FILE;
+}
+
+/* Sets strassen_cutoff from, in order of precedence, the command line
+ * argument (may be NULL), the STRASSEN_CUTOFF environment variable and
+ * the stored tuning result. Keeps DEFAULT_CUTOFF if none is given.
+ */
+void configure_cutoff(const char *arg)
+{
+    const char *env = getenv("STRASSEN_CUTOFF");
+    if(arg != NULL) {
+        strassen_cutoff = atoi(arg);
+    } else if(env != NULL) {
+        strassen_cutoff = atoi(env);
+    } else {
+        FILE *f = fopen(tune_file(), "r");
+        if(f != NULL) {
+            if(fscanf(f, "%d", &strassen_cutoff) != 1) {
+                strassen_cutoff = DEFAULT_CUTOFF;
             }
+            fclose(f);
         }
+    }
+    if(strassen_cutoff < 1) {
+        strassen_cutoff = 1;
+    }
+}
+
+/* Times m x k by k x n products for every power of two cutoff up to the
+ * smallest dimension (best of TUNE_REPEATS runs each), keeps the fastest
+ * in strassen_cutoff and stores it in the tuning file for later runs.
+ */
+void tune_cutoff(int m, int k, int n)
+{
+    matrix_type **matrix_a = allocate_matrix(m, k);
+    matrix_type **matrix_b = allocate_matrix(k, n);
+    matrix_type **matrix_result = allocate_matrix(m, n);
+    fill_matrix(m, k, matrix_a);
+    fill_matrix(k, n, matrix_b);
 
-        // m1
-        add_matrices(block_size, a11, a22, add_result1);
-        add_matrices(block_size, b11, b22, add_result2);
-        strassens_multiplication(block_size, add_result1, add_result2,m1);
-        // m2   
-        add_matrices(block_size, a21, a22, add_result1);
-        strassens_multiplication(block_size, add_result1, b11, m2);
-        // m3
-        subtract_matrices(block_size, b12, b22, subtract_result);
-        strassens_multiplication(block_size, a11, subtract_result, m3);
-        // m4
-        subtract_matrices(block_size, b21, b11, subtract_result);
-        strassens_multiplication(block_size, a22, subtract_result, m4);
-        // m5
-        add_matrices(block_size, a11, a12, add_result1);
-        strassens_multiplication(block_size, add_result1, b22, m5);
-        // m6
-        subtract_matrices(block_size, a21, a11, subtract_result);
-        add_matrices(block_size, b11, b12, add_result1);
-        strassens_multiplication(block_size, subtract_result,
-            add_result1, m6);
-        // m7
-        subtract_matrices(block_size, a12, a22, subtract_result);
-        add_matrices(block_size, b21, b22, add_result1);
-        strassens_multiplication(block_size, subtract_result,
-            add_result1, m7);
-
-        deallocate_matrix(a11, block_size);
-        deallocate_matrix(a12, block_size);
-        deallocate_matrix(a21, block_size);
-        deallocate_matrix(a22, block_size);
-        deallocate_matrix(b11, block_size);
-        deallocate_matrix(b12, block_size);
-        deallocate_matrix(b21, block_size);
-        deallocate_matrix(b22, block_size);
-        
-
-        matrix_type ** c11=allocate_matrix(block_size);
-        matrix_type ** c12=allocate_matrix(block_size);
-        matrix_type ** c21=allocate_matrix(block_size);
-        matrix_type ** c22=allocate_matrix(block_size);
-
-        // c11
-        add_matrices(block_size, m1, m4, add_result1);
-        add_matrices(block_size, add_result1, m7, add_result2);
-        subtract_matrices(block_size, add_result2, m5, c11);
-        // c12
-        add_matrices(block_size, m3, m5, c12);
-        // c21
-        add_matrices(block_size, m2, m4, c21);
-        // c22
-        add_matrices(block_size, m1, m3, add_result1);
-        add_matrices(block_size, add_result1, m6, add_result2);
-        subtract_matrices(block_size, add_result2, m2, c22);
-
-        for(int k = 0; k < block_size; k++) {
-            for(int j = 0; j < block_size; j++) {
-                result[k][j] = c11[k][j];
-                result[k][j + block_size] = c12[k][j];
-                result[k + block_size][j] = c21[k][j];
-                result[k + block_size][j + block_size] = c22[k][j];
+    int smallest = m < k ? (m < n ? m : n) : (k < n ? k : n);
+    int best_cutoff = strassen_cutoff;
+    double best_time = -1;
+    for(int candidate = 16; ; candidate *= 2) {
+        strassen_cutoff = candidate < smallest ? candidate : smallest;
+        matrix_type *workspace = allocate_workspace(m, k, n);
+        double time = -1;
+        for(int r = 0; r < TUNE_REPEATS; r++) {
+            clock_t begin = clock();
+            strassens_multiplication(m, k, n, view_of(k, matrix_a), view_of(n, matrix_b),
+                view_of(n, matrix_result), workspace);
+            double elapsed = (double)(clock() - begin) / CLOCKS_PER_SEC;
+            if(time < 0 || elapsed < time) {
+                time = elapsed;
             }
         }
-        deallocate_matrix(c11, block_size);
-        deallocate_matrix(c12, block_size);
-        deallocate_matrix(c21, block_size);
-        deallocate_matrix(c22, block_size);
-        deallocate_matrix(m1, block_size);
-        deallocate_matrix(m2, block_size);
-        deallocate_matrix(m3, block_size);
-        deallocate_matrix(m4, block_size);
-        deallocate_matrix(m5, block_size);
-        deallocate_matrix(m6, block_size);
-        deallocate_matrix(m7, block_size);
-        deallocate_matrix(add_result1, size);
-        deallocate_matrix(add_result2, size);
+        deallocate_aligned(workspace);
+        printf("cutoff %d: %f s\n", strassen_cutoff, time);
+        if(best_time < 0 || time < best_time) {
+            best_time = time;
+            best_cutoff = strassen_cutoff;
+        }
+        if(strassen_cutoff == smallest) {
+            break;
+        }
+    }
+    strassen_cutoff = best_cutoff;
+    printf("best cutoff for %dx%dx%d: %d\n", m, k, n, strassen_cutoff);
+
+    FILE *f = fopen(tune_file(), "w");
+    if(f != NULL) {
+        fprintf(f, "%d\n", strassen_cutoff);
+        fclose(f);
+    } else {
+        fprintf(stderr, "could not store cutoff in %s\n", tune_file());
+    }
+    deallocate_matrix(matrix_a, m);
+    deallocate_matrix(matrix_b, k);
+    deallocate_matrix(matrix_result, m);
+}
+
+/* Reads a problem shape: either a single size for a square product or
+ * MxKxN for an M x K by K x N product.
+ */
+void parse_shape(const char *arg, int *m, int *k, int *n)
+{
+    if(sscanf(arg, "%dx%dx%d", m, k, n) != 3) {
+        *m = *k = *n = atoi(arg);
+    }
+    assert (*m > 0 && *k > 0 && *n > 0);
+}
+
+/* Name of the selected variant, for reports.
+ */
+const char * variant_name(void)
+{
+    if(strassen_variant == VARIANT_MORTON) {
+        return "morton";
+    }
+    return strassen_variant == VARIANT_WINOGRAD ? "winograd" : "strassen";
+}
+
+/* strassens_multiplication() with the workspace passed as context, for
+ * bench_measure().
+ */
+void bench_strassen(int m, int k, int n, matrix_view a, matrix_view b, matrix_view result,
+    void *workspace)
+{
+    strassens_multiplication(m, k, n, a, b, result, (matrix_type *) workspace);
+}
+
+/* "bench" mode: for every shape of a comma separated list, times the naive
+ * baseline and this program and prints them in the format
+ * STRASSEN_BENCH_FORMAT asks for.
+ */
+void benchmark(const char *shapes)
+{
+    bench_options options;
+    bench_configure(&options);
+    bench_begin(&options);
+    int m, k, n;
+    while(next_shape(&shapes, &m, &k, &n)) {
+        matrix_type **matrix_a = allocate_matrix(m, k);
+        matrix_type **matrix_b = allocate_matrix(k, n);
+        matrix_type **matrix_result = allocate_matrix(m, n);
+        fill_matrix(m, k, matrix_a);
+        fill_matrix(k, n, matrix_b);
+
+        double baseline = bench_baseline(&options, m, k, n, view_of(k, matrix_a),
+            view_of(n, matrix_b), view_of(n, matrix_result));
+
+        matrix_type *workspace = allocate_workspace(m, k, n);
+        bench_record record = { "serial_strassens", variant_name() };
+        record.threads = 1;
+        record.cutoff = strassen_cutoff;
+        bench_measure(&options, bench_strassen, workspace, m, k, n, view_of(k, matrix_a),
+            view_of(n, matrix_b), view_of(n, matrix_result), &record);
+        record.speedup = baseline > 0 ? baseline / record.median : -1;
+        bench_print(&options, &record);
+        deallocate_aligned(workspace);
+
+        deallocate_matrix(matrix_a, m);
+        deallocate_matrix(matrix_b, k);
+        deallocate_matrix(matrix_result, m);
     }
+    bench_end(&options);
+}
+
+/* Library entry point: sets the variant from STRASSEN_VARIANT and the
+ * cutoff to cutoff, or as configure_cutoff() does if that is 0. There is
+ * only one thread. Returns 0.
+ */
+int strassen_configure(int threads, int cutoff)
+{
+    // the serial engine always runs on the calling thread
+    (void) threads;
+    configure_variant();
+    if(cutoff > 0) {
+        strassen_cutoff = cutoff;
+    } else {
+        configure_cutoff(NULL);
+    }
+    return 0;
 }
 
+/* Multiplies an m x k matrix a by a k x n matrix b into result, with a
+ * workspace of its own for the call.
+ */
+void strassen_product(int m, int k, int n, matrix_view a, matrix_view b, matrix_view result)
+{
+    matrix_type *workspace = allocate_workspace(m, k, n);
+    strassens_multiplication(m, k, n, a, b, result, workspace);
+    deallocate_aligned(workspace);
+}
+
+//the library takes the engine without the program around it
+#ifndef STRASSEN_LIBRARY
+/* strassen_product() as the in-memory product of the file mode. */
+void file_strassen(int m, int k, int n, matrix_view a, matrix_view b, matrix_view result,
+    void *context)
+{
+    (void) context;
+    strassen_product(m, k, n, a, b, result);
+}
+
+/* Usage: serial_strassens [--verify] [size | MxKxN] [cutoff | tune]
+ *        serial_strassens size[,size...] bench
+ * STRASSEN_VARIANT=winograd selects the Strassen-Winograd recursion,
+ * STRASSEN_VARIANT=morton Strassen's in the recursive block layout.
+ * --verify checks the product and fails if it is off by more than the
+ * error bound. --a=FILE --b=FILE [--generate] [--out=FILE] [--tile=N]
+ * [--memory=BYTES] multiply matrix files, out of core if they don't fit
+ * (see common/out_of_core.h).
+ */
 int main(int argc, char *argv[])
 {
-    int size = argc == 1 ? 128 : atoi(argv[1]);
+    int verify = take_flag(&argc, argv, "--verify");
+    file_options files;
+    int file_mode = take_file_options(&argc, argv, &files);
+    int m = 128, k = 128, n = 128;
+    if(argc > 1) {
+        parse_shape(argv[1], &m, &k, &n);
+    }
+    configure_variant();
     
-    matrix_type **matrix_a = allocate_matrix(size);
-    matrix_type **matrix_b = allocate_matrix(size);
-    matrix_type **matrix_result = allocate_matrix(size);
+    if(argc > 2 && strcmp(argv[2], "tune") == 0) {
+        tune_cutoff(m, k, n);
+    } else if(argc > 2 && strcmp(argv[2], "bench") == 0) {
+        configure_cutoff(NULL);
+        benchmark(argv[1]);
+        return 0;
+    } else {
+        configure_cutoff(argc > 2 ? argv[2] : NULL);
+    }
+    if(file_mode) {
+        out_of_core_options options = { file_strassen, NULL, strassen_workspace_bytes };
+        return file_product(&files, m, k, n, &options, verify, strassen_cutoff,
+            strassen_variant == VARIANT_WINOGRAD);
+    }
 
-    fill_matrix(size, matrix_a);
-    fill_matrix(size, matrix_b);
+    matrix_type **matrix_a = allocate_matrix(m, k);
+    matrix_type **matrix_b = allocate_matrix(k, n);
+    matrix_type **matrix_result = allocate_matrix(m, n);
 
-    strassens_multiplication(size, matrix_a, matrix_b, matrix_result);
+    fill_matrix(m, k, matrix_a);
+    fill_matrix(k, n, matrix_b);
+
+    strassen_product(m, k, n, view_of(k, matrix_a), view_of(n, matrix_b),
+        view_of(n, matrix_result));
+
+    if(verify && !verify_product(m, k, n, view_of(k, matrix_a), view_of(n, matrix_b),
+        view_of(n, matrix_result), strassen_cutoff, strassen_variant == VARIANT_WINOGRAD)) {
+        return 1;
+    }
     return 0;
 }
+#endif